@@ -0,0 +1,169 @@
+// adc_test.cpp
+// Unit tests for ADCDecimate.hpp: block means and their rounding,
+// channel mapping, split and unaligned DMA buffers, full output and the
+// calibration clamp.
+// 05/2023
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#include "ADCDecimate.hpp"
+#include "check.hpp"
+
+// Appends one type 1 conversion result as the DMA writes it.
+static void put(std::vector<uint8_t> &dma, uint8_t channel, uint16_t value) {
+    uint16_t w = (uint16_t)((channel << 12) | (value & 0x0fff));
+    dma.push_back((uint8_t)w);
+    dma.push_back((uint8_t)(w >> 8));
+}
+
+static const uint8_t CHANNELS[] = {0, 3, 4, 5};
+
+// Round robin over CHANNELS, `rounds` times, channel k at value(k, round).
+template <typename F>
+static std::vector<uint8_t> round_robin(int rounds, F value) {
+    std::vector<uint8_t> dma;
+    for (int r = 0; r < rounds; r++) {
+        for (int k = 0; k < 4; k++) {
+            put(dma, CHANNELS[k], value(k, r));
+        }
+    }
+    return dma;
+}
+
+static void test_constant() {
+    adc_decimator_t d;
+    adc_decimator_init(&d, CHANNELS, 4, 50);
+    auto dma = round_robin(200, [](int k, int) { return (uint16_t)(k * 1000 + 7); });
+    uint16_t out[8 * 4];
+    CHECK_EQ(adc_decimate(&d, dma.data(), dma.size(), out, 8), 4);
+    for (int b = 0; b < 4; b++) {
+        for (int k = 0; k < 4; k++) {
+            CHECK_EQ(out[b * 4 + k], (k * 1000 + 7) << ADC_MEAN_FRAC_BITS);
+        }
+    }
+    CHECK_EQ(d.dropped, 0);
+}
+
+// Means keep ADC_MEAN_FRAC_BITS of fraction, rounded to nearest.
+static void test_fraction() {
+    adc_decimator_t d;
+    adc_decimator_init(&d, CHANNELS, 4, 4);
+    // 100, 101, 100, 101 -> 100.5; 0, 0, 0, 1 -> 0.25; 1, 1, 1, 2 -> 1.25;
+    // 4095 throughout.
+    auto dma = round_robin(4, [](int k, int r) {
+        switch (k) {
+        case 0: return (uint16_t)(100 + r % 2);
+        case 1: return (uint16_t)(r == 3);
+        case 2: return (uint16_t)(1 + (r == 3));
+        default: return (uint16_t)4095;
+        }
+    });
+    uint16_t out[4];
+    CHECK_EQ(adc_decimate(&d, dma.data(), dma.size(), out, 1), 1);
+    CHECK_EQ(out[0], 1608);
+    CHECK_EQ(out[1], 4);
+    CHECK_EQ(out[2], 20);
+    CHECK_EQ(out[3], 4095 << ADC_MEAN_FRAC_BITS);
+}
+
+// Channels without a slot are skipped; slots follow the order given, not
+// the channel numbers.
+static void test_mapping() {
+    const uint8_t channels[] = {6, 1};
+    adc_decimator_t d;
+    adc_decimator_init(&d, channels, 2, 2);
+    std::vector<uint8_t> dma;
+    for (int r = 0; r < 2; r++) {
+        put(dma, 1, 111);
+        put(dma, 2, 4000); // no slot
+        put(dma, 6, 666);
+        put(dma, 7, 4000); // no slot
+    }
+    uint16_t out[2];
+    CHECK_EQ(adc_decimate(&d, dma.data(), dma.size(), out, 1), 1);
+    CHECK_EQ(out[0], 666 << ADC_MEAN_FRAC_BITS);
+    CHECK_EQ(out[1], 111 << ADC_MEAN_FRAC_BITS);
+}
+
+// A block can straddle DMA buffers, which needn't be aligned.
+static void test_split() {
+    auto value = [](int k, int r) { return (uint16_t)((k * 977 + r * 31) & 0x0fff); };
+    auto dma = round_robin(100, value);
+
+    adc_decimator_t whole;
+    adc_decimator_init(&whole, CHANNELS, 4, 25);
+    uint16_t expect[4 * 4];
+    CHECK_EQ(adc_decimate(&whole, dma.data(), dma.size(), expect, 4), 4);
+
+    for (size_t chunk : {2, 6, 34, 202}) {
+        adc_decimator_t d;
+        adc_decimator_init(&d, CHANNELS, 4, 25);
+        std::vector<uint8_t> buf(chunk + 1);
+        uint16_t out[4 * 4];
+        size_t blocks = 0;
+        for (size_t at = 0; at < dma.size(); at += chunk) {
+            size_t n = dma.size() - at < chunk ? dma.size() - at : chunk;
+            // One byte in, so every word is unaligned.
+            memcpy(buf.data() + 1, dma.data() + at, n);
+            blocks += adc_decimate(&d, buf.data() + 1, n, out + blocks * 4, 4 - blocks);
+        }
+        CHECK_EQ(blocks, 4);
+        CHECK(memcmp(out, expect, sizeof(out)) == 0);
+    }
+}
+
+// Blocks with no room are counted and their sums discarded.
+static void test_full() {
+    adc_decimator_t d;
+    adc_decimator_init(&d, CHANNELS, 4, 10);
+    auto dma = round_robin(50, [](int k, int r) { return (uint16_t)(r / 10 * 100 + k); });
+    uint16_t out[2 * 4];
+    CHECK_EQ(adc_decimate(&d, dma.data(), dma.size(), out, 2), 2);
+    CHECK_EQ(d.dropped, 3);
+    CHECK_EQ(out[4 + 2], (100 + 2) << ADC_MEAN_FRAC_BITS);
+
+    // The next block starts clean.
+    dma = round_robin(10, [](int k, int) { return (uint16_t)(3000 + k); });
+    CHECK_EQ(adc_decimate(&d, dma.data(), dma.size(), out, 2), 1);
+    CHECK_EQ(out[0], 3000 << ADC_MEAN_FRAC_BITS);
+}
+
+// The largest ratio at full scale must not overflow the sums.
+static void test_max_ratio() {
+    adc_decimator_t d;
+    adc_decimator_init(&d, CHANNELS, 1, 60000);
+    CHECK_EQ(d.ratio, ADC_MAX_RATIO);
+    std::vector<uint8_t> dma;
+    for (int i = 0; i < ADC_MAX_RATIO; i++) {
+        put(dma, 0, 4095);
+    }
+    uint16_t out[1];
+    CHECK_EQ(adc_decimate(&d, dma.data(), dma.size(), out, 1), 1);
+    CHECK_EQ(out[0], 4095 << ADC_MEAN_FRAC_BITS);
+}
+
+static void test_calibration() {
+    // 3100mV full scale over 4095 counts, 20mV offset.
+    adc_linear_t cal = {(3100 << 16) / 4095, 20};
+    CHECK_EQ(adc_to_mv(&cal, 0), 20);
+    CHECK_EQ(adc_to_mv(&cal, 4095 << ADC_MEAN_FRAC_BITS), 3100 - 1 + 20);
+    CHECK_EQ(adc_to_mv(&cal, 2048 << ADC_MEAN_FRAC_BITS), 1550 + 20);
+
+    adc_linear_t low = {(3100 << 16) / 4095, -500};
+    CHECK_EQ(adc_to_mv(&low, 100 << ADC_MEAN_FRAC_BITS), 0);
+    adc_linear_t high = {40 << 16, 0};
+    CHECK_EQ(adc_to_mv(&high, 4095 << ADC_MEAN_FRAC_BITS), 0xffff);
+}
+
+int main() {
+    test_constant();
+    test_fraction();
+    test_mapping();
+    test_split();
+    test_full();
+    test_max_ratio();
+    test_calibration();
+    return check_failures("adc_test");
+}
@@ -0,0 +1,176 @@
+// async_bench.cpp
+// Slot time with the sensor reads run one after another, as the
+// synchronous sensor_update does, against the same reads as coroutines
+// (Async.hpp) on bus workers, overlapping each other and the slot's
+// other work.
+//
+//   async_bench
+//
+// The bus workers are host threads standing in for AsyncBus's FreeRTOS
+// tasks: same queue-then-hand-back protocol, with each transaction a
+// sleep of its wire time. Also reports the scheduler's own cost per
+// transaction, with transactions that take no time. Exits non-zero if a
+// read never completes or the frame pool runs out.
+// 05/2023
+
+#include <stdint.h>
+#include <stdio.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <queue>
+#include <thread>
+
+#include "Async.hpp"
+
+#define BENCH_SLOTS 500
+#define BENCH_ROUND_TRIPS 20000
+// Wire time of each slot's reads at 400kHz (~25us a byte): acc0, acc1,
+// imu0, imu1.
+static const int READ_US[] = {200, 200, 600, 600};
+#define BENCH_READS (sizeof(READ_US) / sizeof(READ_US[0]))
+// Decoding each read, and the slot's ADC, flash and payload work.
+#define BENCH_DECODE_US 20
+#define BENCH_SERVICE_US 400
+
+typedef std::chrono::steady_clock bench_clock;
+
+static void spin_us(int us) {
+    bench_clock::time_point until = bench_clock::now() + std::chrono::microseconds(us);
+    while (bench_clock::now() < until) {
+        std::this_thread::yield();
+    }
+}
+
+// A blocking bus transaction.
+static int transfer(int us) {
+    if (us > 0) {
+        std::this_thread::sleep_for(std::chrono::microseconds(us));
+    }
+    return 0;
+}
+
+// AsyncBus on a host thread.
+class HostBus {
+public:
+    explicit HostBus(AsyncScheduler &sched) : sched(&sched), stop(false), worker([this] { work(); }) {}
+    ~HostBus() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stop = true;
+        }
+        wake.notify_one();
+        worker.join();
+    }
+
+    AsyncScheduler &scheduler() { return *sched; }
+    void submit(async_op_t *op) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            pending.push(op);
+        }
+        wake.notify_one();
+    }
+    template <typename F>
+    async_call_t<HostBus, F> call(F fn) {
+        return async_call_t<HostBus, F>(this, std::move(fn));
+    }
+
+private:
+    AsyncScheduler *sched;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::queue<async_op_t *> pending;
+    bool stop;
+    std::thread worker;
+
+    void work() {
+        for (;;) {
+            async_op_t *op;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                wake.wait(guard, [&] { return stop || !pending.empty(); });
+                if (pending.empty()) {
+                    return;
+                }
+                op = pending.front();
+                pending.pop();
+            }
+            op->result = op->call(op);
+            sched->ready(op->handle);
+        }
+    }
+};
+
+static int reads_done;
+
+// A driver's updateAsync: the read, then the decode.
+static AsyncTask<int> read_async(HostBus &bus, int us, int decode_us) {
+    int err = co_await bus.call([=] { return transfer(us); });
+    spin_us(decode_us);
+    co_return err;
+}
+
+// The result goes through a local: g++ 12 never runs a coroutine that
+// co_awaits another AsyncTask inside an if condition.
+static AsyncTask<> slot_read(HostBus &bus, int us, int decode_us) {
+    int err = co_await read_async(bus, us, decode_us);
+    if (err == 0) {
+        reads_done++;
+    }
+}
+
+static double us_since(bench_clock::time_point t) {
+    return std::chrono::duration<double, std::micro>(bench_clock::now() - t).count();
+}
+
+int main() {
+    AsyncScheduler sched;
+    bool ok = true;
+
+    printf("%-6s %16s %16s\n", "buses", "sequential us", "coroutines us");
+    for (int buses = 1; buses <= 2; buses++) {
+        HostBus i2c0(sched), i2c1(sched);
+        HostBus *bus[2] = {&i2c0, &i2c1};
+        double sequential = 0, overlapped = 0;
+        reads_done = 0;
+        for (int slot = 0; slot < BENCH_SLOTS; slot++) {
+            bench_clock::time_point start = bench_clock::now();
+            for (size_t i = 0; i < BENCH_READS; i++) {
+                transfer(READ_US[i]);
+                spin_us(BENCH_DECODE_US);
+            }
+            spin_us(BENCH_SERVICE_US);
+            sequential += us_since(start);
+
+            start = bench_clock::now();
+            for (size_t i = 0; i < BENCH_READS; i++) {
+                // imu1 on the second bus when there is one, as on board.
+                HostBus &on = *bus[buses == 2 && i == BENCH_READS - 1];
+                sched.spawn(slot_read(on, READ_US[i], BENCH_DECODE_US));
+            }
+            spin_us(BENCH_SERVICE_US);
+            sched.run();
+            overlapped += us_since(start);
+        }
+        printf("%-6d %16.0f %16.0f\n", buses, sequential / BENCH_SLOTS, overlapped / BENCH_SLOTS);
+        ok = ok && reads_done == BENCH_SLOTS * (int)BENCH_READS;
+    }
+
+    HostBus bus(sched);
+    bench_clock::time_point start = bench_clock::now();
+    for (int i = 0; i < BENCH_ROUND_TRIPS; i++) {
+        sched.spawn(slot_read(bus, 0, 0));
+        sched.run();
+    }
+    printf("scheduler round trip: %.2f us per transaction\n", us_since(start) / BENCH_ROUND_TRIPS);
+    printf("frame pool: high water %lu of %d, %lu failures\n",
+           (unsigned long)coro_pool.stats.high_water, CORO_POOL_FRAMES,
+           (unsigned long)coro_pool.stats.failures);
+
+    if (!ok || coro_pool.stats.failures > 0) {
+        printf("FAILED: a read didn't complete\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,242 @@
+// breaker_test.cpp
+// Injected bus faults against Device::transact's retries and deadline
+// checks, the circuit breaker and the HealthMonitor: NACK storms, a dead
+// bus that comes back, a hung bus held to the I2C hardware timeout, and
+// a slot with no room left for an attempt. Runs on the simulated
+// esp_timer clock, which only the fake bus moves.
+// 05/2023
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "Device.hpp"
+#include "Fleet.hpp"
+#include "HealthMonitor.hpp"
+#include "esp_timer.h"
+#include "check.hpp"
+
+// Full rate slot and the time kept free at its end, as in System.hpp.
+#define SLOT_US 1000
+#define GUARD_US 100
+// The I2C driver's own time per transaction, on top of the wire time.
+#define DRIVER_OVERHEAD_US 30
+#define SIM_FRAME 7
+
+// A bus that fails as told. Each attempt moves the clock by what it would
+// take on the wire; a hung attempt by the hardware timeout.
+typedef struct {
+    double nack_rate;
+    bool dead;
+    bool hung;
+    uint32_t calls;
+    uint32_t rng;
+} sim_bus_t;
+
+static sim_bus_t buses[2];
+
+static esp_err_t sim_transfer(sim_bus_t &bus, size_t bytes) {
+    bus.calls++;
+    if (bus.hung) {
+        host_clock_advance(I2C_HW_TIMEOUT_US);
+        return ESP_ERR_TIMEOUT;
+    }
+    host_clock_advance(i2c_wire_us(bytes) + DRIVER_OVERHEAD_US);
+    if (bus.dead) {
+        return ESP_FAIL;
+    }
+    // Deterministic noise, the same on any host.
+    bus.rng = bus.rng * 1103515245 + 12345;
+    return (bus.rng >> 8) % 10000 < bus.nack_rate * 10000 ? ESP_FAIL : ESP_OK;
+}
+
+// A driver reading status and three axes (7 bytes), as the H3LIS100DLTR
+// does, off the bus its desc's address names. A retry of that fits in a
+// full rate slot; one of the ICM20948's 22 bytes doesn't.
+class SimDevice : public Device<SimDevice> {
+public:
+    explicit SimDevice(const device_desc_t &desc) : bus(buses[desc.address]) {}
+    status checkOK() {
+        return transact(1, [&](TickType_t) { return sim_transfer(bus, 1); }) == ESP_OK ? STATUS_OK
+                                                                                        : STATUS_FAILED;
+    }
+    esp_err_t sample() {
+        return transact(SIM_FRAME, [&](TickType_t) { return sim_transfer(bus, SIM_FRAME); });
+    }
+
+private:
+    sim_bus_t &bus;
+};
+
+typedef Fleet<SimDevice, SimDevice> sim_fleet_t;
+
+static const device_desc_t TABLE[] = {
+    {"dev0", BUS_I2C0, 0, GPIO_NUM_NC},
+    {"dev1", BUS_I2C1, 1, GPIO_NUM_NC},
+};
+
+// The acquisition loop, as System::sensor_update runs it for dev0.
+typedef struct {
+    sim_fleet_t fleet;
+    HealthMonitor<sim_fleet_t> health;
+    uint32_t good, lost;
+    int64_t worst_us; // longest a slot's read and health check took
+} sim_loop_t;
+
+static void reset_bus(sim_bus_t &bus) {
+    bus = {};
+    bus.rng = 1;
+}
+
+static void run_slot(sim_loop_t &loop) {
+    int64_t start = esp_timer_get_time();
+    transaction_deadline_us = start + SLOT_US - GUARD_US;
+    if (loop.health.usable(0)) {
+        if (loop.fleet.get<0>().sample() == ESP_OK) {
+            loop.good++;
+        } else {
+            loop.lost++;
+        }
+    }
+    loop.health.poll(esp_timer_get_time(), start + SLOT_US - GUARD_US);
+    int64_t took = esp_timer_get_time() - start;
+    loop.worst_us = took > loop.worst_us ? took : loop.worst_us;
+    host_clock_set(start + SLOT_US > esp_timer_get_time() ? start + SLOT_US : esp_timer_get_time());
+}
+
+// 5% NACKs: retries hide them, the circuit stays closed and no slot runs
+// over.
+static void test_nack_storm() {
+    reset_bus(buses[0]);
+    buses[0].nack_rate = 0.05;
+    sim_loop_t loop = {sim_fleet_t(TABLE), HealthMonitor<sim_fleet_t>(loop.fleet, 1u << 0), 0, 0, 0};
+    for (int i = 0; i < 20000; i++) {
+        run_slot(loop);
+    }
+    device_stats_t s = loop.fleet.get<0>().ioStats().snapshot();
+    printf("5%% NACKs: %lu good, %lu lost, %lu retries, worst slot %lldus\n",
+           (unsigned long)loop.good, (unsigned long)loop.lost, (unsigned long)s.retries,
+           (long long)loop.worst_us);
+    CHECK(loop.lost <= 20);
+    CHECK(s.retries > 0);
+    CHECK(loop.health.usable(0));
+    CHECK_EQ(loop.fleet.get<0>().circuit(), BREAKER_CLOSED);
+    CHECK(loop.worst_us <= SLOT_US - GUARD_US);
+}
+
+// 60% NACKs: the breaker opens, and from then on the bus only sees the
+// HealthMonitor's re-probes and the odd run of reads after one passes.
+static void test_breaker_opens() {
+    reset_bus(buses[0]);
+    buses[0].nack_rate = 0.6;
+    sim_loop_t loop = {sim_fleet_t(TABLE), HealthMonitor<sim_fleet_t>(loop.fleet, 1u << 0), 0, 0, 0};
+    for (int i = 0; i < 2000; i++) {
+        run_slot(loop);
+    }
+    CHECK(!loop.health.usable(0));
+    uint32_t before = buses[0].calls;
+    for (int i = 0; i < 1000; i++) {
+        run_slot(loop);
+    }
+    uint32_t calls = buses[0].calls - before;
+    printf("60%% NACKs: quarantined, %lu bus calls in 1000 slots after\n", (unsigned long)calls);
+    // Against a call or more a slot while it was closed.
+    CHECK(calls < 100);
+}
+
+// A dead bus for 50 slots: quarantined within a few, then back and
+// closed again once the bus recovers.
+static void test_dead_bus_recovers() {
+    reset_bus(buses[0]);
+    sim_loop_t loop = {sim_fleet_t(TABLE), HealthMonitor<sim_fleet_t>(loop.fleet, 1u << 0), 0, 0, 0};
+    for (int i = 0; i < 100; i++) {
+        run_slot(loop);
+    }
+    buses[0].dead = true;
+    int quarantined = -1;
+    for (int i = 0; i < 50; i++) {
+        run_slot(loop);
+        if (quarantined < 0 && !loop.health.usable(0)) {
+            quarantined = i;
+        }
+    }
+    buses[0].dead = false;
+    int recovered = -1;
+    for (int i = 0; i < 5000 && recovered < 0; i++) {
+        run_slot(loop);
+        if (loop.health.usable(0)) {
+            recovered = i;
+        }
+    }
+    printf("dead bus: quarantined after %d slots, back %d slots after it recovered, "
+           "worst slot %lldus\n", quarantined, recovered, (long long)loop.worst_us);
+    CHECK(quarantined >= 0 && quarantined < 10);
+    CHECK(recovered >= 0);
+    CHECK_EQ(loop.fleet.get<0>().circuit(), BREAKER_CLOSED);
+    CHECK(loop.worst_us <= SLOT_US - GUARD_US);
+}
+
+// A hung bus: each attempt ends at the hardware timeout, and no retry
+// starts that wouldn't finish within the slot.
+static void test_hung_bus() {
+    reset_bus(buses[0]);
+    buses[0].hung = true;
+    sim_fleet_t fleet(TABLE);
+    host_clock_set(0);
+    transaction_deadline_us = SLOT_US - GUARD_US;
+    esp_err_t err = fleet.get<0>().sample();
+    printf("hung bus: %lu attempt(s), %lldus\n", (unsigned long)buses[0].calls,
+           (long long)esp_timer_get_time());
+    CHECK_EQ(err, ESP_ERR_TIMEOUT);
+    CHECK_EQ(buses[0].calls, 1);
+    CHECK(esp_timer_get_time() <= SLOT_US - GUARD_US);
+}
+
+// No room for the wire time: nothing goes out, and it doesn't count
+// against the device.
+static void test_no_room() {
+    reset_bus(buses[0]);
+    sim_fleet_t fleet(TABLE);
+    host_clock_set(0);
+    transaction_deadline_us = i2c_wire_us(SIM_FRAME) - 1;
+    CHECK_EQ(fleet.get<0>().sample(), ESP_ERR_TIMEOUT);
+    CHECK_EQ(buses[0].calls, 0);
+    CHECK_EQ(fleet.get<0>().ioStats().snapshot().transactions, 0);
+
+    transaction_deadline_us = i2c_wire_us(SIM_FRAME);
+    CHECK_EQ(fleet.get<0>().sample(), ESP_OK);
+    CHECK_EQ(buses[0].calls, 1);
+}
+
+// A monitor only checks and quarantines the devices it owns.
+static void test_ownership() {
+    reset_bus(buses[0]);
+    reset_bus(buses[1]);
+    buses[1].dead = true;
+    sim_fleet_t fleet(TABLE);
+    HealthMonitor<sim_fleet_t> mine(fleet, 1u << 0), theirs(fleet, 1u << 1);
+    host_clock_set(0);
+    transaction_deadline_us = INT64_MAX;
+    for (int i = 0; i < 3000; i++) {
+        mine.poll(esp_timer_get_time(), INT64_MAX);
+        host_clock_advance(SLOT_US);
+    }
+    CHECK_EQ(buses[1].calls, 0);
+    CHECK(mine.usable(1));
+    for (int i = 0; i < 3000; i++) {
+        theirs.poll(esp_timer_get_time(), INT64_MAX);
+        host_clock_advance(SLOT_US);
+    }
+    CHECK(buses[1].calls > 0);
+    CHECK(!theirs.usable(1));
+    CHECK(theirs.usable(0));
+}
+
+int main() {
+    test_nack_storm();
+    test_breaker_opens();
+    test_dead_bus_recovers();
+    test_hung_bus();
+    test_no_room();
+    test_ownership();
+    return check_failures("breaker");
+}
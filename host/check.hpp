@@ -0,0 +1,44 @@
+// check.hpp
+// Minimal assertions for the host tests: each failed CHECK prints where
+// and what, and the test's main() returns check_failures() so ctest sees
+// any failure.
+// 05/2023
+
+#ifndef HOST_CHECK_H
+#define HOST_CHECK_H
+
+#include <stdio.h>
+
+inline int check_failed = 0;
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            check_failed++;                                                 \
+        }                                                                   \
+    } while (0)
+
+#define CHECK_EQ(a, b)                                                           \
+    do {                                                                         \
+        long long check_a = (long long)(a), check_b = (long long)(b);            \
+        if (check_a != check_b) {                                                \
+            printf("%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", __FILE__, \
+                   __LINE__, #a, #b, check_a, check_b);                          \
+            check_failed++;                                                      \
+        }                                                                        \
+    } while (0)
+
+/**
+ * Prints a summary line and gives main()'s exit code.
+ */
+inline int check_failures(const char *name) {
+    if (check_failed) {
+        printf("%s: %d check(s) failed\n", name, check_failed);
+        return 1;
+    }
+    printf("%s: ok\n", name);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,128 @@
+// console_sim.cpp
+// How much test mode's console output delays the acquisition loop, with
+// output written straight to the UART (as before console_init) and
+// through Console.cpp's RAM ring and drain task.
+//
+//   console_sim
+//
+// stdout is swapped for a model of the console UART: 115200 baud, a 128
+// byte TX FIFO, and a writer that waits whenever the FIFO is full, as
+// esp-idf's blocking UART write does. A loop of 1ms slots writes test
+// mode's output and records how long the output calls took and how late
+// each slot starts. The numbers are real time on the host, so scheduler
+// noise shows up in the lateness of every row, output or not ("none");
+// the UART waits are far larger.
+// 05/2023
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "Console.hpp"
+
+#define SIM_SLOT_US 1000
+#define SIM_SLOTS 3000
+// Test mode's output, roughly: a health or retry message every 20 slots,
+// and a burst of status lines once a second.
+#define SIM_LINE_EVERY 20
+#define SIM_BURST_EVERY 1000
+#define SIM_BURST_LINES 8
+// 10 bits a byte at 115200 baud.
+#define UART_BYTE_US (10.0 * 1e6 / 115200)
+#define UART_FIFO 128
+
+typedef std::chrono::steady_clock sim_clock;
+
+// When the UART will have sent everything written so far.
+static sim_clock::time_point uart_idle;
+
+static ssize_t uart_write(void *cookie, const char *buf, size_t len) {
+    sim_clock::time_point now = sim_clock::now();
+    uart_idle = std::max(uart_idle, now);
+    uart_idle += std::chrono::microseconds((int64_t)(len * UART_BYTE_US));
+    // The writer returns once the rest fits in the FIFO.
+    std::this_thread::sleep_until(uart_idle - std::chrono::microseconds((int64_t)(UART_FIFO * UART_BYTE_US)));
+    return (ssize_t)len;
+}
+
+typedef struct {
+    double avg_us, p99_us, max_us;
+    uint32_t missed;     // slots that started a whole slot or more late
+    double write_max_us; // longest a slot spent in console calls
+} lateness_t;
+
+static lateness_t run_slots(bool output) {
+    std::vector<double> late(SIM_SLOTS);
+    double write_max_us = 0;
+    sim_clock::time_point origin = sim_clock::now() + std::chrono::milliseconds(10);
+    uint32_t lines = 0;
+    for (int slot = 0; slot < SIM_SLOTS; slot++) {
+        sim_clock::time_point due = origin + std::chrono::microseconds((int64_t)slot * SIM_SLOT_US);
+        std::this_thread::sleep_until(due);
+        late[slot] = std::chrono::duration<double, std::micro>(sim_clock::now() - due).count();
+
+        if (!output) {
+            continue;
+        }
+        sim_clock::time_point start = sim_clock::now();
+        if (slot % SIM_LINE_EVERY == 0) {
+            console_printf("System: imu0 transaction retried (timeout), %lu so far\n",
+                           (unsigned long)++lines);
+        }
+        if (slot % SIM_BURST_EVERY == SIM_BURST_EVERY - 1) {
+            for (int i = 0; i < SIM_BURST_LINES; i++) {
+                console_printf("System: stats %d: %lu transactions, %lu errors, %lu us max\n", i,
+                               (unsigned long)(slot * 7), (unsigned long)(slot % 3),
+                               (unsigned long)(400 + i));
+            }
+        }
+        double write_us = std::chrono::duration<double, std::micro>(sim_clock::now() - start).count();
+        write_max_us = std::max(write_max_us, write_us);
+    }
+
+    lateness_t result = {};
+    result.write_max_us = write_max_us;
+    for (double l : late) {
+        result.avg_us += l / SIM_SLOTS;
+        result.max_us = std::max(result.max_us, l);
+        result.missed += l >= SIM_SLOT_US;
+    }
+    std::sort(late.begin(), late.end());
+    result.p99_us = late[SIM_SLOTS * 99 / 100];
+    return result;
+}
+
+int main() {
+    // The report goes to the real stdout; the console's output to the
+    // UART model.
+    FILE *report = fdopen(dup(fileno(stdout)), "w");
+    cookie_io_functions_t uart = {nullptr, uart_write, nullptr, nullptr};
+    stdout = fopencookie(nullptr, "w", uart);
+    // esp-idf's console stdout is line buffered.
+    setvbuf(stdout, nullptr, _IOLBF, 128);
+
+    lateness_t quiet = run_slots(false);
+    lateness_t before = run_slots(true);
+    console_init();
+    lateness_t after = run_slots(true);
+    // Let the drain task finish before the process exits under it.
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+    fprintf(report, "%-8s %14s %12s %12s %12s %14s\n", "console", "write max us", "late avg us",
+            "late p99 us", "late max us", "slots missed");
+    const char *names[] = {"none", "direct", "ring"};
+    const lateness_t *rows[] = {&quiet, &before, &after};
+    for (int i = 0; i < 3; i++) {
+        const lateness_t &r = *rows[i];
+        fprintf(report, "%-8s %14.1f %12.1f %12.1f %12.1f %14lu\n", names[i], r.write_max_us,
+                r.avg_us, r.p99_us, r.max_us, (unsigned long)r.missed);
+    }
+    fprintf(report, "messages dropped by the ring: %lu\n", (unsigned long)console_dropped());
+    return 0;
+}
@@ -0,0 +1,228 @@
+// crc_bench.cpp
+// Cost of the flight log's CRC32s (Crc32.hpp) and of verifying a whole
+// 16MB image with log_verify_pages, on an image with known damage.
+//
+//   crc_bench [--image flash.bin]
+//
+// The image is 60000 written pages of accel, IMU and analog records, the
+// sizes the encoder writes, then three bit flips, a torn page (its second
+// half erased) and an erased hole. Reports the CRC throughput bytewise
+// (one table), slice-by-8 and, when built with zlib, zlib's; the cost
+// per record and per page; and the verify pass. Exits non-zero if the
+// CRCs disagree or the verify pass misses or invents damage. --image
+// writes the image out for tools/flashlog.py verify.
+// 05/2023
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "LogFormat.hpp"
+#include "check.hpp"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#define BENCH_PAGES 65536 // 16MB
+#define BENCH_WRITTEN 60000
+#define BENCH_BUFFER (16 << 20)
+#define BENCH_PASSES 4
+#define BENCH_RECORD_CRCS 2000000
+#define BENCH_PAGE_CRCS 1000000
+#define BENCH_VERIFIES 10
+// Payload sizes: an accel block, an IMU block, an analog reading.
+static const uint8_t RECORD_LEN[] = {97, 161, 8};
+// The damage, as (page, byte in the page). Flips avoid record lengths,
+// which would misframe the rest of the page rather than cost one record.
+static const uint32_t FLIPS[][2] = {{1000, 100}, {2000, 20}, {3000, 250}};
+#define TORN_PAGE 4000
+#define TORN_AT (LOG_PAGE_SIZE / 2)
+#define HOLE_PAGE 5000
+
+typedef std::chrono::steady_clock bench_clock;
+
+static double ns_since(bench_clock::time_point t) {
+    return std::chrono::duration<double, std::nano>(bench_clock::now() - t).count();
+}
+
+// The plain one-table CRC, for comparison.
+static uint32_t crc32_bytewise(uint32_t crc, const uint8_t *p, size_t len) {
+    const auto &t = crc32_detail::TABLES[0];
+    crc = ~crc;
+    while (len--) {
+        crc = t[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+// Where a record sits in the image, to tell which ones the damage hits.
+typedef struct {
+    uint32_t page;
+    uint16_t start, end; // page bytes, header included
+} placed_t;
+
+static void build_image(std::vector<log_page_t> &image, std::vector<placed_t> &placed) {
+    std::mt19937 rng(7);
+    memset(image.data(), 0xff, image.size() * sizeof(log_page_t));
+    log_page_t page;
+    memset(&page, 0xff, sizeof(page));
+    page.used = 0;
+    uint32_t index = 0, time_us = 0;
+    while (index < BENCH_WRITTEN) {
+        uint8_t type = rng() % sizeof(RECORD_LEN);
+        log_record_t rec = {type, RECORD_LEN[type], time_us += 500, 0};
+        if (page.used + sizeof(rec) + rec.len > LOG_PAGE_DATA) {
+            page.magic = LOG_PAGE_MAGIC;
+            page.index = index;
+            page.crc = log_page_crc(&page);
+            image[index++] = page;
+            memset(&page, 0xff, sizeof(page));
+            page.used = 0;
+            if (index == BENCH_WRITTEN) {
+                break;
+            }
+        }
+        uint8_t payload[LOG_RECORD_MAX];
+        for (size_t i = 0; i < rec.len; i++) {
+            payload[i] = rng();
+        }
+        rec.crc = log_record_crc(&rec, payload);
+        memcpy(&page.data[page.used], &rec, sizeof(rec));
+        memcpy(&page.data[page.used + sizeof(rec)], payload, rec.len);
+        uint16_t start = LOG_PAGE_HEADER + page.used;
+        page.used += sizeof(rec) + rec.len;
+        placed.push_back({index, start, (uint16_t)(LOG_PAGE_HEADER + page.used)});
+    }
+}
+
+// Damages the image, and returns how many records the damage should cost
+// (the hole's aren't counted: an erased page is a hole, not corruption).
+static uint32_t damage_image(std::vector<log_page_t> &image, const std::vector<placed_t> &placed,
+                             uint32_t *in_hole) {
+    uint32_t lost = 0;
+    *in_hole = 0;
+    for (const placed_t &r : placed) {
+        bool hit = r.page == TORN_PAGE && r.end > TORN_AT;
+        for (const auto &flip : FLIPS) {
+            hit = hit || (r.page == flip[0] && flip[1] >= r.start && flip[1] < r.end);
+            CHECK(!(r.page == flip[0] && flip[1] == r.start + offsetof(log_record_t, len)));
+        }
+        lost += hit;
+        *in_hole += r.page == HOLE_PAGE;
+    }
+    for (const auto &flip : FLIPS) {
+        ((uint8_t *)&image[flip[0]])[flip[1]] ^= 0x10;
+    }
+    memset((uint8_t *)&image[TORN_PAGE] + TORN_AT, 0xff, LOG_PAGE_SIZE - TORN_AT);
+    memset(&image[HOLE_PAGE], 0xff, LOG_PAGE_SIZE);
+    return lost;
+}
+
+template <typename F>
+static uint32_t throughput(const char *name, const std::vector<uint8_t> &buf, F crc) {
+    bench_clock::time_point start = bench_clock::now();
+    uint32_t result = 0;
+    for (int i = 0; i < BENCH_PASSES; i++) {
+        result = crc(result, buf.data(), buf.size());
+    }
+    double ns = ns_since(start);
+    printf("%-12s %7.0f MB/s\n", name, BENCH_PASSES * buf.size() / ns * 1e3);
+    return result;
+}
+
+int main(int argc, char **argv) {
+    const char *image_path = nullptr;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--image") == 0 && i + 1 < argc) {
+            image_path = argv[++i];
+        } else {
+            fprintf(stderr, "usage: crc_bench [--image flash.bin]\n");
+            return 2;
+        }
+    }
+
+    CHECK_EQ(crc32_update(0, "123456789", 9), 0xcbf43926u);
+
+    std::mt19937 rng(1);
+    std::vector<uint8_t> buf(BENCH_BUFFER);
+    for (uint8_t &b : buf) {
+        b = rng();
+    }
+    printf("CRC32 over %d MB:\n", BENCH_BUFFER >> 20);
+    uint32_t bytewise = throughput("bytewise", buf, crc32_bytewise);
+    uint32_t sliced = throughput("slice-by-8", buf, [](uint32_t crc, const uint8_t *p, size_t len) {
+        return crc32_update(crc, p, len);
+    });
+    CHECK_EQ(sliced, bytewise);
+#ifdef HAVE_ZLIB
+    uint32_t reference = throughput("zlib", buf, [](uint32_t crc, const uint8_t *p, size_t len) {
+        return (uint32_t)crc32(crc, p, len);
+    });
+    CHECK_EQ(sliced, reference);
+#endif
+
+    for (uint8_t len : RECORD_LEN) {
+        log_record_t rec = {0, len, 0, 0};
+        volatile uint32_t sink = 0;
+        bench_clock::time_point start = bench_clock::now();
+        for (int i = 0; i < BENCH_RECORD_CRCS; i++) {
+            rec.time_us = i;
+            sink = sink + log_record_crc(&rec, &buf[i & 1023]);
+        }
+        printf("record CRC, %3u byte payload: %6.1f ns\n", len, ns_since(start) / BENCH_RECORD_CRCS);
+    }
+
+    std::vector<log_page_t> image(BENCH_PAGES);
+    std::vector<placed_t> placed;
+    build_image(image, placed);
+    {
+        volatile uint32_t sink = 0;
+        bench_clock::time_point start = bench_clock::now();
+        for (int i = 0; i < BENCH_PAGE_CRCS; i++) {
+            sink = sink + log_page_crc(&image[i % BENCH_WRITTEN]);
+        }
+        printf("page CRC: %6.1f ns\n", ns_since(start) / BENCH_PAGE_CRCS);
+    }
+
+    uint32_t in_hole;
+    uint32_t lost = damage_image(image, placed, &in_hole);
+    log_verify_t result;
+    bench_clock::time_point start = bench_clock::now();
+    for (int i = 0; i < BENCH_VERIFIES; i++) {
+        result = {};
+        log_verify_pages(image.data(), 0, BENCH_PAGES, &result);
+    }
+    double ns = ns_since(start) / BENCH_VERIFIES;
+    printf("verify %d MB: %.1f ms, %.0f MB/s\n", (int)(sizeof(log_page_t) * BENCH_PAGES >> 20),
+           ns / 1e6, sizeof(log_page_t) * BENCH_PAGES / ns * 1e3);
+    printf("  pages: %lu ok, %lu corrupt, %lu erased, end %lu\n", (unsigned long)result.pages_ok,
+           (unsigned long)result.pages_corrupt, (unsigned long)result.pages_erased,
+           (unsigned long)result.end);
+    printf("  records: %lu ok, %lu corrupt, of %lu written (%lu in the hole, %lu damaged)\n",
+           (unsigned long)result.records_ok, (unsigned long)result.records_corrupt,
+           (unsigned long)placed.size(), (unsigned long)in_hole, (unsigned long)lost);
+
+    // Every damaged page is caught, and the hole and the unwritten end
+    // read as erased.
+    CHECK_EQ(result.pages_corrupt, sizeof(FLIPS) / sizeof(FLIPS[0]) + 1);
+    CHECK_EQ(result.pages_ok, BENCH_WRITTEN - result.pages_corrupt - 1);
+    CHECK_EQ(result.pages_erased, BENCH_PAGES - BENCH_WRITTEN + 1);
+    CHECK_EQ(result.end, BENCH_WRITTEN);
+    // Exactly the records the damage touched are lost, and each is seen.
+    CHECK_EQ(result.records_ok, placed.size() - in_hole - lost);
+    CHECK(result.records_corrupt > 0);
+
+    if (image_path != nullptr) {
+        FILE *f = fopen(image_path, "wb");
+        if (f == nullptr || fwrite(image.data(), sizeof(log_page_t), BENCH_PAGES, f) != BENCH_PAGES) {
+            fprintf(stderr, "crc_bench: can't write %s\n", image_path);
+            return 1;
+        }
+        fclose(f);
+    }
+    return check_failures("crc");
+}
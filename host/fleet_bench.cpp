@@ -0,0 +1,209 @@
+// fleet_bench.cpp
+// Compares the compile-time Fleet (Fleet.hpp, Device.hpp) with the
+// virtual Device base and shared_ptr members it replaced, on stand-in
+// drivers that do the same small amount of work per call.
+//
+//   fleet_bench
+//
+// Reports the time per sample slot (every device's update, then one
+// health check) and the RAM each design takes, heap included. Code size
+// comes from the symbols, which are kept apart by namespace:
+//
+//   nm -C -S --size-sort build-host/fleet_bench | grep fleet_static
+//   nm -C -S --size-sort build-host/fleet_bench | grep fleet_virtual
+//
+// Host numbers: the dispatch cost on an Xtensa core differs, but not
+// which way it goes.
+// 05/2023
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <memory>
+#include <new>
+
+#include "Fleet.hpp"
+
+#define BENCH_SLOTS (1 << 20)
+#define BENCH_REPEATS 10
+
+// Heap bytes allocated since start, to count what the virtual design's
+// shared_ptrs cost.
+static size_t heap_bytes;
+
+void *operator new(size_t size) {
+    heap_bytes += size;
+    void *p = malloc(size);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+// Register contents the stand-in drivers read, as a bus would return them.
+static volatile int16_t regs[64];
+
+// What every stand-in driver does with a sample: three axes into a small
+// running sum, as a driver's accept() into its ring would.
+struct sample_work_t {
+    int32_t sum[3];
+    uint8_t reg;
+
+    void update() {
+        for (int i = 0; i < 3; i++) {
+            sum[i] += regs[(reg + i) & 63];
+        }
+    }
+    status check() const { return regs[reg & 63] == 0x7fff ? STATUS_FAILED : STATUS_OK; }
+};
+
+namespace fleet_static {
+
+// Four driver types, as on the board: two of each.
+template <int Kind>
+class Sensor : public Device<Sensor<Kind>> {
+public:
+    explicit Sensor(const device_desc_t &desc) : work{{0, 0, 0}, (uint8_t)(desc.address + Kind)} {}
+    status checkOK() { return work.check(); }
+    void update() { work.update(); }
+    int32_t total() const { return work.sum[0] + work.sum[1] + work.sum[2]; }
+
+private:
+    sample_work_t work;
+};
+
+typedef Fleet<Sensor<0>, Sensor<0>, Sensor<1>, Sensor<1>,
+              Sensor<2>, Sensor<2>, Sensor<3>, Sensor<3>> fleet_t;
+
+// One sample slot: every device's update, then the next device's check.
+__attribute__((noinline)) status slot(fleet_t &fleet, int check) {
+    fleet.forEach([](auto &dev) { dev.update(); });
+    return fleet.visit(check, [](auto &dev) { return dev.checkOK(); });
+}
+
+int32_t total(fleet_t &fleet) {
+    int32_t t = 0;
+    fleet.forEach([&](auto &dev) { t += dev.total(); });
+    return t;
+}
+
+} // namespace fleet_static
+
+namespace fleet_virtual {
+
+// The old Device: pure virtual methods, and a bus handle and address
+// each held by shared_ptr.
+class Device {
+public:
+    virtual ~Device() = default;
+    virtual status checkOK() = 0;
+    virtual void update() = 0;
+    virtual int32_t total() const = 0;
+
+protected:
+    bool alive = true;
+    std::shared_ptr<int> i2c;
+    std::shared_ptr<uint8_t> addr;
+};
+
+template <int Kind>
+class Sensor : public Device {
+public:
+    Sensor(std::shared_ptr<int> bus, uint8_t address) : work{{0, 0, 0}, (uint8_t)(address + Kind)} {
+        i2c = std::move(bus);
+        addr = std::make_shared<uint8_t>(address);
+    }
+    status checkOK() override { return work.check(); }
+    void update() override { work.update(); }
+    int32_t total() const override { return work.sum[0] + work.sum[1] + work.sum[2]; }
+
+private:
+    sample_work_t work;
+};
+
+// System's eight members, reached through the base for the loop and the
+// health checks as the per-device watchdogs and HealthMonitor did.
+struct fleet_t {
+    Device *devices[8];
+};
+
+__attribute__((noinline)) status slot(fleet_t &fleet, int check) {
+    for (Device *dev : fleet.devices) {
+        dev->update();
+    }
+    return fleet.devices[check]->checkOK();
+}
+
+int32_t total(fleet_t &fleet) {
+    int32_t t = 0;
+    for (Device *dev : fleet.devices) {
+        t += dev->total();
+    }
+    return t;
+}
+
+} // namespace fleet_virtual
+
+static const device_desc_t TABLE[] = {
+    {"a0", BUS_I2C0, 0, GPIO_NUM_NC}, {"a1", BUS_I2C0, 1, GPIO_NUM_NC},
+    {"b0", BUS_I2C0, 2, GPIO_NUM_NC}, {"b1", BUS_I2C0, 3, GPIO_NUM_NC},
+    {"c0", BUS_I2C0, 4, GPIO_NUM_NC}, {"c1", BUS_I2C0, 5, GPIO_NUM_NC},
+    {"d0", BUS_I2C0, 6, GPIO_NUM_NC}, {"d1", BUS_I2C0, 7, GPIO_NUM_NC},
+};
+
+// Best of BENCH_REPEATS runs of BENCH_SLOTS slots, in ns per slot.
+template <typename F>
+static double time_slots(F &&slot) {
+    double best = 1e9;
+    for (int r = 0; r < BENCH_REPEATS; r++) {
+        auto t0 = std::chrono::steady_clock::now();
+        for (int i = 0; i < BENCH_SLOTS; i++) {
+            slot(i & 7);
+        }
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+        best = ns < best ? ns : best;
+    }
+    return best / BENCH_SLOTS;
+}
+
+int main() {
+    for (int i = 0; i < 64; i++) {
+        regs[i] = (int16_t)(i * 517 - 9000);
+    }
+
+    size_t before = heap_bytes;
+    static fleet_static::fleet_t fleet(TABLE);
+    size_t static_heap = heap_bytes - before;
+
+    before = heap_bytes;
+    std::shared_ptr<int> bus = std::make_shared<int>(0);
+    // As System held them: eight members, built in place.
+    static fleet_virtual::Sensor<0> v0(bus, 0), v1(bus, 1);
+    static fleet_virtual::Sensor<1> v2(bus, 2), v3(bus, 3);
+    static fleet_virtual::Sensor<2> v4(bus, 4), v5(bus, 5);
+    static fleet_virtual::Sensor<3> v6(bus, 6), v7(bus, 7);
+    size_t virtual_heap = heap_bytes - before;
+    fleet_virtual::fleet_t vfleet = {{&v0, &v1, &v2, &v3, &v4, &v5, &v6, &v7}};
+    size_t virtual_static = sizeof(v0) * 8;
+
+    double static_ns = time_slots([&](int check) { fleet_static::slot(fleet, check); });
+    double virtual_ns = time_slots([&](int check) { fleet_virtual::slot(vfleet, check); });
+    bool same = fleet_static::total(fleet) == fleet_virtual::total(vfleet);
+
+    // The Fleet's devices also carry the transaction counters and circuit
+    // breaker added since, which the old design had no equivalent of.
+    size_t extras = 8 * (sizeof(DeviceStats) + sizeof(CircuitBreaker));
+    printf("%-10s %10s %12s %10s\n", "design", "ns/slot", "static RAM", "heap");
+    printf("%-10s %10.2f %12zu %10zu  (%zu without counters and breakers)\n", "fleet", static_ns,
+           sizeof(fleet), static_heap, sizeof(fleet) - extras);
+    printf("%-10s %10.2f %12zu %10zu\n", "virtual", virtual_ns, virtual_static, virtual_heap);
+    if (!same) {
+        printf("MISMATCH: the two designs did different work\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,335 @@
+// h3lis_sim.cpp
+// Host simulation of acc0 and acc1 at the full 1kHz output rate, running
+// the real H3LIS100DLTR driver (its INT1 edge counting, burst read and
+// drop accounting) against a model of the chip on a 400kHz bus.
+//
+//   h3lis_sim           tables of drop rates over chip clock error and
+//                       jitter, read by the INT1 reader and, for
+//                       comparison, once a slot from the acquisition loop
+//   h3lis_sim --check   exit status only: under 1% dropped by the reader
+//                       at every clock error with 100us jitter, and every
+//                       drop counted by dropped()
+//
+// The model: each chip produces a sample every 1000us of its own clock
+// (off the CPU's by a given error) and raises INT1. The chip has no FIFO:
+// a sample not read before the next one is lost.
+//
+// With the reader, each edge wakes that chip's reader task (service())
+// after an interrupt and context switch latency plus up to the jitter,
+// and its STATUS..OUT_Z burst goes out as soon as the bus is free. The
+// acquisition task wakes each slot, up to the jitter late, and queues
+// imu0's and the barometers' reads on the same bus; the reader, above the
+// bus worker, goes ahead of any of those not yet started.
+//
+// Once a slot, the acquisition task wakes up to the jitter late and runs
+// both updateAsync()s back to back on I2C0, as sensor_update does without
+// the reader.
+//
+// Each sample carries its sequence number in OUT_X, so the samples that
+// come out of read() show exactly which were lost.
+// 05/2023
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "H3LIS100DLTR.hpp"
+#include "H3LIS100DLTRRegisters.hpp"
+
+#define SIM_SLOTS 200000
+#define SIM_PHASES 16
+#define SAMPLE_PERIOD_US 1000
+#define ODR_PERIOD_US 1000.0
+#define I2C_HZ 400000
+
+// --check: every clock error in the table, with each task waking up to
+// 100us late.
+#define CHECK_JITTER_US 100
+#define MAX_DROP_FRACTION 0.01
+// INT1 edge to the reader running: the GPIO interrupt, then a switch to
+// the highest priority task.
+#define READER_LATENCY_US 15
+#define NEVER INT64_MAX
+
+static const gpio_num_t INT1[2] = {34, 35};
+
+// Bus traffic the acquisition task queues on I2C0 each slot besides the
+// accelerometers: imu0's frame and both barometers' bursts.
+static const size_t ACQUIRE_READS[] = {22, 8, 8};
+#define ACQUIRE_COUNT (sizeof(ACQUIRE_READS) / sizeof(ACQUIRE_READS[0]))
+
+// One chip. `next_us` is when it next produces a sample.
+struct sim_chip_t {
+    uint8_t address;
+    gpio_num_t int1;
+    double period_us;
+    double next_us;
+    uint32_t seq;       // samples produced
+    uint8_t status;     // STATUS_REG
+    int8_t out[3];
+    int64_t edge_us;    // first INT1 edge not yet handed to the reader, or NEVER
+};
+
+static sim_chip_t chips[2];
+
+// Runs each chip up to `now`: every sample due overwrites the outputs,
+// sets ZYXDA (and ZYXOR if the last was never read) and raises INT1.
+static void chips_run(int64_t now) {
+    using namespace h3lis100dl;
+    for (sim_chip_t &chip : chips) {
+        while (chip.next_us <= now) {
+            if (chip.status & STATUS_REG::ZYXDA.mask) {
+                chip.status |= STATUS_REG::ZYXOR.mask;
+            }
+            chip.status |= STATUS_REG::ZYXDA.mask;
+            chip.out[0] = (int8_t)chip.seq;
+            chip.out[1] = (int8_t)(chip.seq >> 8);
+            chip.out[2] = 1;
+            chip.seq++;
+            if (chip.edge_us == NEVER) {
+                chip.edge_us = (int64_t)ceil(chip.next_us);
+            }
+            chip.next_us += chip.period_us;
+            host_gpio_edge(chip.int1);
+        }
+    }
+}
+
+// Start, address + register, repeated start, address, data, stop.
+static int64_t wire_us(size_t len) {
+    return ((2 + 1 + len) * 9 + 2) * 1000000ll / I2C_HZ;
+}
+
+esp_err_t reg_read(i2c_port_t, uint8_t address, uint8_t reg, uint8_t *data, size_t len,
+                   TickType_t) {
+    using namespace h3lis100dl;
+    // The chip latches the outputs as the burst starts.
+    chips_run(esp_timer_get_time());
+    for (sim_chip_t &chip : chips) {
+        if (chip.address != address) {
+            continue;
+        }
+        uint8_t regs[256] = {};
+        regs[WHO_AM_I::address] = WHO_AM_I_VALUE;
+        regs[STATUS_REG::address] = chip.status;
+        regs[OUT_X::address] = (uint8_t)chip.out[0];
+        regs[OUT_X::address + 2] = (uint8_t)chip.out[1];
+        regs[OUT_Z::address] = (uint8_t)chip.out[2];
+        reg &= (uint8_t)~MAP.increment;
+        memcpy(data, regs + reg, len);
+        if (reg <= OUT_Z::address && reg + len > OUT_Z::address) {
+            chip.status = 0;
+        }
+        host_clock_advance(wire_us(len));
+        return ESP_OK;
+    }
+    host_clock_advance(wire_us(0));
+    return ESP_FAIL;
+}
+
+// Configuration writes and read-back aren't modelled.
+esp_err_t reg_write(i2c_port_t, uint8_t, uint8_t, uint8_t, TickType_t) { return ESP_OK; }
+esp_err_t reg_write_block(i2c_port_t, uint8_t, const reg_block_view_t &) { return ESP_OK; }
+esp_err_t reg_verify_block(i2c_port_t, uint8_t, const reg_map_t &, const reg_block_view_t &) {
+    return ESP_OK;
+}
+
+static uint32_t rng = 0x12345678;
+
+static uint32_t xorshift(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+typedef struct {
+    uint64_t produced; // samples the chips made after the switch to full rate
+    uint64_t lost;     // gaps in the sequence numbers that came out
+    uint64_t counted;  // what dropped() reported
+} sim_result_t;
+
+// Takes what each driver has buffered, and counts the gaps in it.
+static void drain(H3LIS100DLTR (&acc)[2], uint32_t (&last)[2], uint64_t *lost) {
+    for (int i = 0; i < 2; i++) {
+        accel_reading_t out[H3LIS100DLTR_BUFFER];
+        size_t n = acc[i].read(out, H3LIS100DLTR_BUFFER);
+        for (size_t k = 0; k < n; k++) {
+            uint32_t seq = (uint8_t)out[k].acc_x | ((uint32_t)(uint8_t)out[k].acc_y << 8);
+            *lost += (uint16_t)(seq - last[i] - 1);
+            last[i] = seq;
+        }
+    }
+}
+
+static int64_t jitter(int jitter_us) {
+    return jitter_us ? xorshift() % (jitter_us + 1) : 0;
+}
+
+// SIM_SLOTS slots with the samples read by the reader tasks, as an event
+// simulation: chip samples, reader wakes, slot wakes and bus transfers,
+// earliest first.
+static void run_reader(H3LIS100DLTR (&acc)[2], int jitter_us, uint32_t (&last)[2],
+                       uint64_t *lost) {
+    int64_t bus_free = 0;
+    int64_t reader_due[2] = {NEVER, NEVER};
+    int64_t slot_due = SAMPLE_PERIOD_US + jitter(jitter_us);
+    int64_t slot = 1;
+    size_t queued = 0; // acquisition reads still to go out this slot
+
+    while (slot <= SIM_SLOTS) {
+        int64_t chip_due = (int64_t)ceil(chips[0].next_us < chips[1].next_us ? chips[0].next_us
+                                                                               : chips[1].next_us);
+        int reader = reader_due[0] <= reader_due[1] ? 0 : 1;
+        int64_t reader_start = reader_due[reader] == NEVER ? NEVER
+                             : reader_due[reader] > bus_free ? reader_due[reader] : bus_free;
+        int64_t acquire_start = queued == 0 ? NEVER : bus_free;
+
+        if (chip_due <= slot_due && chip_due <= reader_start && chip_due <= acquire_start) {
+            host_clock_set(chip_due);
+            chips_run(chip_due);
+        } else if (reader_start <= slot_due && reader_start <= acquire_start) {
+            host_clock_set(reader_start);
+            reader_due[reader] = NEVER;
+            acc[reader].service(false);
+            bus_free = esp_timer_get_time();
+        } else if (acquire_start <= slot_due) {
+            bus_free = acquire_start + wire_us(ACQUIRE_READS[ACQUIRE_COUNT - queued--]);
+        } else {
+            // The slot's block takes what the readers have buffered, and
+            // its reads are queued.
+            drain(acc, last, lost);
+            queued = ACQUIRE_COUNT;
+            bus_free = bus_free > slot_due ? bus_free : slot_due;
+            slot++;
+            slot_due = slot * SAMPLE_PERIOD_US + jitter(jitter_us);
+        }
+
+        // Each new edge wakes its chip's reader.
+        for (int i = 0; i < 2; i++) {
+            if (chips[i].edge_us != NEVER && reader_due[i] == NEVER) {
+                reader_due[i] = chips[i].edge_us + READER_LATENCY_US + jitter(jitter_us);
+            }
+            chips[i].edge_us = NEVER;
+        }
+    }
+    drain(acc, last, lost);
+}
+
+// SIM_SLOTS slots with both accelerometers read once a slot from the
+// acquisition loop.
+static void run_slots(H3LIS100DLTR (&acc)[2], AsyncScheduler &sched, AsyncBus &bus, int jitter_us,
+                      uint32_t (&last)[2], uint64_t *lost) {
+    for (int64_t slot = 1; slot <= SIM_SLOTS; slot++) {
+        int64_t wake = slot * SAMPLE_PERIOD_US + jitter(jitter_us);
+        host_clock_set(wake);
+        chips_run(wake);
+        for (H3LIS100DLTR &a : acc) {
+            sched.spawn(a.updateAsync(bus));
+        }
+        sched.run();
+        drain(acc, last, lost);
+    }
+}
+
+// One run of SIM_SLOTS slots, with the chips' first sample at `phase_us`
+// into the first slot.
+static sim_result_t run(bool reader, double clock_error, int jitter_us, double phase_us) {
+    static const device_desc_t desc[2] = {
+        {"acc0", BUS_I2C0, H3LIS100DLTR_I2C_ADDR, INT1[0]},
+        {"acc1", BUS_I2C0, H3LIS100DLTR_I2C_ADDR_ALT, INT1[1]},
+    };
+    H3LIS100DLTR acc[2] = {H3LIS100DLTR(desc[0]), H3LIS100DLTR(desc[1])};
+    AsyncScheduler sched;
+    AsyncBus bus("i2c");
+    bus.init(sched);
+
+    host_clock_set(0);
+    for (int i = 0; i < 2; i++) {
+        // Opposite errors, so the two chips also drift against each other.
+        double error = i == 0 ? clock_error : -clock_error / 2;
+        chips[i] = {desc[i].address, desc[i].irq, ODR_PERIOD_US * (1 - error),
+                    SAMPLE_PERIOD_US + phase_us, 0, 0, {}, NEVER};
+    }
+    for (H3LIS100DLTR &a : acc) {
+        a.init();
+        a.setRate(RATE_FULL);
+    }
+
+    // As if sample -1 had been read, so losing the first ones counts too.
+    uint32_t last[2] = {UINT32_MAX, UINT32_MAX};
+    uint64_t lost = 0;
+    if (reader) {
+        run_reader(acc, jitter_us, last, &lost);
+    } else {
+        run_slots(acc, sched, bus, jitter_us, last, &lost);
+    }
+    sim_result_t result = {0, lost, 0};
+    for (int i = 0; i < 2; i++) {
+        // A sample still on the chip when the run ends isn't lost yet.
+        bool unread = chips[i].status & h3lis100dl::STATUS_REG::ZYXDA.mask;
+        result.produced += chips[i].seq - unread;
+        result.counted += acc[i].dropped();
+    }
+    return result;
+}
+
+// Drop fraction over SIM_PHASES evenly spread starting phases: with no
+// clock error the phase never moves, and it decides everything.
+static double drop_fraction(bool reader, double clock_error, int jitter_us, bool *counted_all) {
+    uint64_t produced = 0, lost = 0;
+    *counted_all = true;
+    for (int p = 0; p < SIM_PHASES; p++) {
+        sim_result_t r = run(reader, clock_error, jitter_us,
+                             SAMPLE_PERIOD_US * p / (double)SIM_PHASES);
+        produced += r.produced;
+        lost += r.lost;
+        *counted_all = *counted_all && r.counted == r.lost;
+    }
+    return (double)lost / produced;
+}
+
+static const double ERRORS[] = {0, 0.001, 0.005, 0.01, 0.02};
+static const int JITTERS[] = {0, 20, 50, 100, 200};
+
+int main(int argc, char **argv) {
+    bool check = argc > 1 && strcmp(argv[1], "--check") == 0;
+    bool counted_all;
+
+    if (check) {
+        bool ok = true;
+        for (double error : ERRORS) {
+            double dropped = drop_fraction(true, error, CHECK_JITTER_US, &counted_all);
+            printf("h3lis_sim: %.3f%% dropped at %.1f%% clock error, %dus jitter\n",
+                   100 * dropped, 100 * error, CHECK_JITTER_US);
+            if (!counted_all) {
+                printf("h3lis_sim: dropped() disagrees with the samples lost\n");
+            }
+            ok = ok && dropped < MAX_DROP_FRACTION && counted_all;
+        }
+        return ok ? 0 : 1;
+    }
+
+    bool all = true;
+    for (int reader = 1; reader >= 0; reader--) {
+        printf("%% dropped (acc0 and acc1) read %s, %d slots x %d phases\n",
+               reader ? "on INT1 by the reader" : "once a slot", SIM_SLOTS, SIM_PHASES);
+        printf("%-14s", "clock error");
+        for (int jitter : JITTERS) {
+            printf(" %6dus", jitter);
+        }
+        printf("\n");
+        for (double error : ERRORS) {
+            printf("%12.1f%% ", 100 * error);
+            for (int jitter : JITTERS) {
+                printf(" %7.3f%%", 100 * drop_fraction(reader, error, jitter, &counted_all));
+                all = all && counted_all;
+            }
+            printf("\n");
+        }
+        printf("\n");
+    }
+    printf("dropped() %s the samples lost\n", all ? "matches" : "DOES NOT match");
+    return all ? 0 : 1;
+}
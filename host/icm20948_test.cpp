@@ -0,0 +1,124 @@
+// icm20948_test.cpp
+// Golden vectors for ICM20948Frame.hpp: big endian two's complement frames
+// with known decodes, through both icm20948_decode and the planar variant,
+// single bursts and strided FIFO runs, aligned and not.
+// 05/2023
+
+#include <stdint.h>
+#include <string.h>
+
+#include "ICM20948Frame.hpp"
+#include "check.hpp"
+
+#define FRAME_BYTES 22
+
+// Accel, gyro, temp, mag, then ST2/TMPS which the decode drops.
+static const uint8_t GOLDEN_FRAME[FRAME_BYTES] = {
+    0x80, 0x00, 0x7f, 0xff, 0xff, 0xfe, // acc: min, max, -2
+    0x12, 0x34, 0x00, 0x01, 0xff, 0xff, // gyr: 0x1234, 1, -1
+    0x0a, 0x0b,                         // temp
+    0xfc, 0x18, 0x00, 0x00, 0x01, 0x02, // mag: -1000, 0, 258
+    0x99, 0x99,                         // ST2/TMPS
+};
+
+static const int16_t GOLDEN_READING[ICM20948_FRAME_WORDS] = {
+    -32768, 32767, -2, 0x1234, 1, -1, 0x0a0b, -1000, 0, 258,
+};
+
+// Frame i of a run: the golden frame with every word offset by i, so
+// frames can't be mixed up. Offsets are small enough not to wrap here.
+static int16_t golden(size_t i, int c) {
+    return (int16_t)(GOLDEN_READING[c] + (GOLDEN_READING[c] > 32000 ? -(int)i : (int)i));
+}
+
+static void encode(uint8_t *frame, size_t i) {
+    memcpy(frame, GOLDEN_FRAME, FRAME_BYTES);
+    for (int c = 0; c < ICM20948_FRAME_WORDS; c++) {
+        uint16_t v = (uint16_t)golden(i, c);
+        frame[2 * c] = (uint8_t)(v >> 8);
+        frame[2 * c + 1] = (uint8_t)v;
+    }
+}
+
+static void check_reading(const imu_reading_t &r, size_t i) {
+    int16_t got[ICM20948_FRAME_WORDS];
+    memcpy(got, &r, sizeof(got));
+    for (int c = 0; c < ICM20948_FRAME_WORDS; c++) {
+        CHECK_EQ(got[c], golden(i, c));
+    }
+}
+
+static void test_swap() {
+    CHECK_EQ(swap16x2(0x11223344u), 0x22114433u);
+    CHECK_EQ(swap16x2(0x00ff00ffu), 0xff00ff00u);
+    CHECK_EQ(swap16x2(0), 0);
+}
+
+static void test_single_frame() {
+    imu_reading_t r;
+    icm20948_decode(GOLDEN_FRAME, 1, FRAME_BYTES, &r);
+    CHECK_EQ(r.acc_x, -32768);
+    CHECK_EQ(r.acc_y, 32767);
+    CHECK_EQ(r.acc_z, -2);
+    CHECK_EQ(r.gyr_x, 0x1234);
+    CHECK_EQ(r.gyr_y, 1);
+    CHECK_EQ(r.gyr_z, -1);
+    CHECK_EQ(r.temp, 0x0a0b);
+    CHECK_EQ(r.mag_x, -1000);
+    CHECK_EQ(r.mag_y, 0);
+    CHECK_EQ(r.mag_z, 258);
+    // Signed, so widening sign-extends.
+    CHECK_EQ((int32_t)r.acc_z, -2);
+}
+
+// FIFO runs: strides wider than a frame, starting at every alignment.
+static void test_strided_runs() {
+    const size_t count = 9;
+    for (size_t stride : {(size_t)FRAME_BYTES, (size_t)24, (size_t)31}) {
+        for (size_t offset = 0; offset < 4; offset++) {
+            uint8_t buf[4 + 9 * 31];
+            memset(buf, 0xa5, sizeof(buf));
+            for (size_t i = 0; i < count; i++) {
+                encode(buf + offset + i * stride, i);
+            }
+            imu_reading_t out[count + 1];
+            memset(out, 0x5a, sizeof(out));
+            icm20948_decode(buf + offset, count, stride, out);
+            for (size_t i = 0; i < count; i++) {
+                check_reading(out[i], i);
+            }
+            // Nothing written past the batch.
+            CHECK_EQ(out[count].acc_x, (int16_t)0x5a5a);
+        }
+    }
+}
+
+static void test_planar() {
+    const size_t count = 7, ch_stride = 8;
+    uint8_t buf[1 + 7 * FRAME_BYTES];
+    for (size_t i = 0; i < count; i++) {
+        encode(buf + 1 + i * FRAME_BYTES, i);
+    }
+    int16_t ch[IMU_CHANNELS * ch_stride];
+    memset(ch, 0x5a, sizeof(ch));
+    icm20948_decode_planar(buf + 1, count, FRAME_BYTES, ch, ch_stride);
+    for (int c = 0; c < IMU_CHANNELS; c++) {
+        for (size_t i = 0; i < count; i++) {
+            CHECK_EQ(ch[c * ch_stride + i], golden(i, c));
+        }
+        CHECK_EQ(ch[c * ch_stride + count], (int16_t)0x5a5a);
+    }
+    // Same answer as decoding to readings.
+    imu_reading_t r[count];
+    icm20948_decode(buf + 1, count, FRAME_BYTES, r);
+    CHECK_EQ(r[3].mag_x, ch[IMU_MAG_X * ch_stride + 3]);
+    CHECK_EQ(r[6].temp, ch[IMU_TEMP * ch_stride + 6]);
+}
+
+int main() {
+    test_swap();
+    test_single_frame();
+    test_strided_runs();
+    test_planar();
+    return check_failures("icm20948_test");
+}
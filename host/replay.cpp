@@ -0,0 +1,977 @@
+// replay.cpp
+// Runs a recorded or synthetic flight through the on-board Pipeline on a
+// host, as a regression test and a benchmark.
+//
+//   replay --synthetic 120              # a made up 120s flight
+//   replay --log flash.bin              # readings stored in a flight log
+//   replay --live capture.bin           # a diagnostic mode capture (full rate)
+//
+// Options:
+//   --realtime      feed readings at the rate they were taken, rather than
+//                   as fast as possible
+//   --phase N       flight_phase to start in (default PHASE_PAD)
+//   --expect CRC    exit 1 unless the digest of the pipeline's output matches
+//   --profile NAME  (synthetic only) flight to make up: 10k (default) or 30k
+//   --attitude      (synthetic only) compare IMU0's attitude estimate with a
+//                   double precision reference and the true orientation,
+//                   and exit 1 if the estimator strays from the reference
+//   --altitude      (synthetic only) compare IMU0's altitude and vertical
+//                   velocity estimates with the truth, and exit 1 if they
+//                   stray too far from it
+//   --reboot SECS   (synthetic only) reset the pipeline SECS into the flight,
+//                   restoring it from a checkpoint after a short gap
+//   --staged MS     (synthetic only) run the pipeline on a second thread fed
+//                   through a block channel in real time, as on board, with
+//                   the consumer stalling MS every second
+//   --detect        (synthetic only) run the on-board PhaseDetector over the
+//                   slots too, and exit 1 unless it finds every phase soon
+//                   enough after the profile enters it
+//
+// Prints what the pipeline logged, a CRC32 digest over every record it
+// produced (type, length, timestamp and payload, bar the estimates' cycle
+// counts) and how many seconds of flight it got through per second of
+// wall time. The synthetic flight is deterministic, so its digest only
+// changes when the pipeline does.
+//
+// A flight log only holds what was stored: phases logged decimated come
+// back at their stored rate, and are decimated again on the way through.
+// Diagnostic captures hold every reading but no phase changes.
+// 05/2023
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "types.hpp"
+#include "LogFormat.hpp"
+#include "Pipeline.hpp"
+#include "PhaseDetector.hpp"
+#include "Spsc.hpp"
+
+// Full rate slot length on board (SAMPLE_PERIOD_US in System.hpp). Low
+// rate slots are longer there, but the pipeline only goes by timestamps,
+// so every phase is replayed in these.
+#define REPLAY_SLOT_US 1000
+// Most IMU readings the synthetic flight produces in a slot.
+#define REPLAY_IMU_MAX PIPELINE_BLOCK_IMU
+// Blocks between the two threads with --staged (STORAGE_BLOCKS in
+// System.hpp), and how often, in flight time, the consumer stalls.
+#define REPLAY_BLOCKS 64
+#define REPLAY_STALL_EVERY_US (1000 * 1000)
+// --attitude fails if the on-board estimator and the double precision
+// reference ever disagree by more than this.
+#define ATTITUDE_TOLERANCE_DEG 0.01
+// --altitude fails if the altitude or vertical velocity estimate is ever
+// further than this from the truth.
+#define ALTITUDE_TOLERANCE_M 3.0
+#define VELOCITY_TOLERANCE_MS 3.0
+// --detect fails if a phase is found before the profile enters it, or
+// later than this after (s). Descent has to wait for drag to build, and
+// landing for the rocket to be still for PHASE_LANDED_HOLD_US.
+static const double DETECT_LATE_S[PHASE_COUNT] = {0, 0.5, 0.5, 0.5, 3.0, 6.0};
+// --reboot stops feeding the pipeline for this long, about what a reset
+// takes to get back to sampling on board (bootloader included).
+#define REPLAY_REBOOT_GAP_US (300 * 1000)
+
+// Mirrors live_header_t in LiveStream.hpp, which pulls in the UART driver.
+#define LIVE_SYNC 0x5aa5
+
+typedef struct __attribute__((packed)) {
+    uint16_t sync;
+    uint8_t channel;
+    uint8_t len;
+    uint32_t time_us;
+} live_header_t;
+
+// ### Output ###
+
+typedef struct {
+    uint32_t records[REC_ALTITUDE + 1];
+    uint64_t bytes;
+    uint32_t dropped; // records too long for the log
+    uint32_t digest;
+} replay_output_t;
+
+static bool replay_sink(void *ctx, log_record_type type, uint32_t time_us,
+                        const void *data, size_t len) {
+    replay_output_t *out = (replay_output_t *)ctx;
+    if (len > LOG_RECORD_MAX) {
+        out->dropped++;
+        return false;
+    }
+    log_record_t rec = {(uint8_t)type, (uint8_t)len, time_us, 0};
+    out->digest = crc32_update(out->digest, &rec, offsetof(log_record_t, crc));
+    if (type == REC_ATTITUDE && len == 1 + sizeof(attitude_sample_t)) {
+        // Leave out the cycle count, which is timing rather than output.
+        out->digest = crc32_update(out->digest, data, len - sizeof(int16_t));
+    } else if (type == REC_ALTITUDE && len == 1 + sizeof(altitude_sample_t)) {
+        out->digest = crc32_update(out->digest, data, len - sizeof(int32_t));
+    } else {
+        out->digest = crc32_update(out->digest, data, len);
+    }
+    out->records[type]++;
+    out->bytes += sizeof(rec) + len;
+    return true;
+}
+
+// ### Pacing ###
+
+// Turns 32 bit reading times into flight time, and in real time mode
+// holds each reading back until that much wall time has passed.
+class Clock {
+public:
+    explicit Clock(bool realtime) : realtime(realtime), started(false), base(0), last(0), first(0) {}
+
+    // Flight time of a reading taken at `time_us`, in microseconds since
+    // the first one.
+    int64_t at(uint32_t time_us) {
+        if (!started) {
+            started = true;
+            last = time_us;
+            first = time_us;
+            wall = std::chrono::steady_clock::now();
+        }
+        if (time_us < last && last - time_us > (1u << 31)) {
+            base += 1ll << 32;
+        }
+        last = time_us;
+        int64_t t = base + time_us - first;
+        if (realtime) {
+            std::this_thread::sleep_until(wall + std::chrono::microseconds(t));
+        }
+        end = t;
+        return t;
+    }
+
+    int64_t elapsed() const { return end; }
+
+private:
+    bool realtime;
+    bool started;
+    int64_t base;
+    uint32_t last, first;
+    int64_t end = 0;
+    std::chrono::steady_clock::time_point wall;
+};
+
+// ### Sources ###
+
+static bool read_file(const char *path, std::vector<uint8_t> *out) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        return false;
+    }
+    uint8_t buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        out->insert(out->end(), buf, buf + n);
+    }
+    fclose(f);
+    return true;
+}
+
+// Hands one device's run of readings to the pipeline. `source` is its
+// device_id; anything that isn't an accelerometer, IMU or barometer is
+// ignored.
+static void feed(Pipeline &pipeline, uint8_t source, uint32_t time_us,
+                 const uint8_t *payload, size_t len) {
+    if (source == DEV_ACC0 || source == DEV_ACC1) {
+        accel_reading_t r[LOG_RECORD_MAX / sizeof(accel_reading_t)];
+        size_t n = len / sizeof(r[0]);
+        memcpy(r, payload, n * sizeof(r[0]));
+        pipeline.accel(source - DEV_ACC0, time_us, r, n);
+    } else if (source == DEV_IMU0 || source == DEV_IMU1) {
+        imu_reading_t r[LOG_RECORD_MAX / sizeof(imu_reading_t)];
+        size_t n = len / sizeof(r[0]);
+        memcpy(r, payload, n * sizeof(r[0]));
+        pipeline.imu(source - DEV_IMU0, time_us, r, n);
+    } else if ((source == DEV_BARO0 || source == DEV_BARO1) && len >= sizeof(baro_reading_t)) {
+        baro_reading_t r;
+        memcpy(&r, payload, sizeof(r));
+        pipeline.baro(source - DEV_BARO0, time_us, r);
+    }
+}
+
+/**
+ * Replays the sensor and phase records of a raw flight log image, in
+ * log order. Records that fail their CRC are skipped.
+ */
+static bool replay_log(const char *path, Pipeline &pipeline, Clock &clock) {
+    std::vector<uint8_t> image;
+    if (!read_file(path, &image)) {
+        return false;
+    }
+    size_t pages = image.size() / LOG_PAGE_SIZE;
+    for (size_t i = 0; i < pages; i++) {
+        log_page_t page;
+        memcpy(&page, &image[i * LOG_PAGE_SIZE], sizeof(page));
+        log_page_records(&page, i, [&](const log_record_t &rec, const uint8_t *payload) {
+            if (rec.type == REC_PHASE && rec.len == 1 && payload[0] < PHASE_COUNT) {
+                clock.at(rec.time_us);
+                pipeline.setPhase((flight_phase)payload[0], rec.time_us);
+            } else if ((rec.type == REC_ACCEL || rec.type == REC_IMU || rec.type == REC_BARO) &&
+                       rec.len > 0) {
+                clock.at(rec.time_us);
+                feed(pipeline, payload[0], rec.time_us, payload + 1, rec.len - 1);
+            }
+        });
+    }
+    return true;
+}
+
+/**
+ * Replays a diagnostic mode capture (the raw bytes from the console UART,
+ * as saved by tools/live.py). Resyncs past console text and skips frames
+ * that fail their CRC, like the Python decoder.
+ */
+static bool replay_live(const char *path, Pipeline &pipeline, Clock &clock) {
+    std::vector<uint8_t> data;
+    if (!read_file(path, &data)) {
+        return false;
+    }
+    size_t pos = 0;
+    while (pos + sizeof(live_header_t) + sizeof(uint32_t) <= data.size()) {
+        live_header_t hdr;
+        memcpy(&hdr, &data[pos], sizeof(hdr));
+        size_t end = pos + sizeof(hdr) + hdr.len;
+        uint32_t crc;
+        if (hdr.sync != LIVE_SYNC || end + sizeof(crc) > data.size()) {
+            pos++;
+            continue;
+        }
+        memcpy(&crc, &data[end], sizeof(crc));
+        if (crc32_update(0, &data[pos], end - pos) != crc) {
+            pos++;
+            continue;
+        }
+        clock.at(hdr.time_us);
+        feed(pipeline, hdr.channel, hdr.time_us, &data[pos + sizeof(hdr)], hdr.len);
+        pos = end + sizeof(crc);
+    }
+    return true;
+}
+
+// ### Staging ###
+
+/**
+ * The hand-off between System's acquisition and storage tasks: slot
+ * blocks go across a BlockChannel to a second thread, which runs the
+ * pipeline. Every REPLAY_STALL_EVERY_US of flight the consumer stops for
+ * `stall_us`, as the storage task would if the flash held it up.
+ */
+class StagedPipeline {
+public:
+    StagedPipeline(Pipeline &pipeline, uint32_t stall_us)
+        : pipeline(pipeline), stall_us(stall_us), done(false) {
+        consumer = std::thread([this] { run(); });
+    }
+
+    // Producer side: hands over a copy of `block`, or drops it if every
+    // block is still waiting.
+    void submit(const pipeline_block_t &block) {
+        pipeline_block_t *b = channel.take();
+        if (b == NULL) {
+            dropped++;
+            return;
+        }
+        *b = block;
+        channel.commit(b);
+        submitted++;
+        size_t depth = channel.pending();
+        deepest = depth > deepest ? depth : deepest;
+    }
+
+    // Waits for the consumer to get through everything submitted.
+    void finish(void) {
+        done.store(true, std::memory_order_release);
+        consumer.join();
+    }
+
+    uint64_t submitted = 0;
+    uint64_t dropped = 0;
+    size_t deepest = 0;
+    double busy_s = 0; // consumer time spent in the pipeline
+
+private:
+    Pipeline &pipeline;
+    uint32_t stall_us;
+    std::atomic<bool> done;
+    std::thread consumer;
+    BlockChannel<pipeline_block_t, REPLAY_BLOCKS> channel;
+
+    void run(void) {
+        uint32_t stall_at = REPLAY_STALL_EVERY_US;
+        for (;;) {
+            pipeline_block_t *b = channel.next();
+            if (b == NULL) {
+                if (done.load(std::memory_order_acquire) && channel.pending() == 0) {
+                    return;
+                }
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+                continue;
+            }
+            auto start = std::chrono::steady_clock::now();
+            pipeline.process(*b);
+            uint32_t time_us = b->time_us;
+            channel.release(b);
+            busy_s += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (stall_us > 0 && time_us >= stall_at) {
+                stall_at += REPLAY_STALL_EVERY_US;
+                std::this_thread::sleep_for(std::chrono::microseconds(stall_us));
+            }
+        }
+    }
+};
+
+// ### Synthetic flight ###
+
+// Phase start times (seconds), the specific force along the rocket's axis
+// in each (g), and the body rates (rad/s). Coast is drag only; the
+// payload's microgravity window is around apogee, despun; descent is
+// under the drogue, tumbling. On the pad, under the drogue and landed the
+// specific force is straight up instead, and force_g is unused.
+typedef struct {
+    flight_phase phase;
+    double start_s;
+    double force_g;
+    double rate[3];
+} flight_step_t;
+
+// About 3km: apogee at 28s, down at 116s.
+static const flight_step_t FLIGHT_10K[] = {
+    {PHASE_PAD,          0.0,   1.0, {0, 0, 0}},
+    {PHASE_BOOST,        5.0,   9.0, {0, 0, 3.0}},
+    {PHASE_COAST,        8.0,  -0.3, {0.05, 0, 3.0}},
+    {PHASE_MICROGRAVITY, 20.0,  0.0, {0.02, -0.01, 0.2}},
+    {PHASE_DESCENT,      30.0,  1.0, {0.3, 0.2, 1.0}},
+    {PHASE_LANDED,       120.0, 1.0, {0, 0, 0}},
+};
+
+// About 9km, supersonic: apogee at 47s, down at 350s.
+static const flight_step_t FLIGHT_30K[] = {
+    {PHASE_PAD,          0.0,   1.0, {0, 0, 0}},
+    {PHASE_BOOST,        5.0,   8.5, {0, 0, 3.0}},
+    {PHASE_COAST,        11.0, -0.3, {0.05, 0, 3.0}},
+    {PHASE_MICROGRAVITY, 40.0,  0.0, {0.02, -0.01, 0.2}},
+    {PHASE_DESCENT,      50.0,  1.0, {0.3, 0.2, 1.0}},
+    {PHASE_LANDED,       360.0, 1.0, {0, 0, 0}},
+};
+
+typedef struct {
+    const char *name;
+    const flight_step_t *steps;
+    size_t count;
+} flight_profile_t;
+
+static const flight_profile_t PROFILES[] = {
+    {"10k", FLIGHT_10K, sizeof(FLIGHT_10K) / sizeof(FLIGHT_10K[0])},
+    {"30k", FLIGHT_30K, sizeof(FLIGHT_30K) / sizeof(FLIGHT_30K[0])},
+};
+
+#define STANDARD_G 9.80665
+#define DESCENT_RATE 30.0 // m/s, under the drogue
+#define DRAG_TAU_S 2.0    // how quickly drag settles on the descent rate
+#define LANDING_G 6.0     // deceleration at touchdown
+// Launch site elevation (Spaceport America), for the barometers.
+#define SITE_ALTITUDE_M 1400.0
+// Magnetic field at the launch site, world frame (x north, z up), in uT.
+static const double FIELD_UT[3] = {23.0, 0.0, -43.0};
+#define MAG_UT_PER_LSB 0.15
+
+// Deterministic noise, so the synthetic digest is the same on any host.
+static uint32_t noise_state = 1;
+static int16_t noise(int amplitude) {
+    noise_state ^= noise_state << 13;
+    noise_state ^= noise_state >> 17;
+    noise_state ^= noise_state << 5;
+    return (int16_t)((int)(noise_state % (2 * amplitude + 1)) - amplitude);
+}
+
+static int16_t clamp16(double v) {
+    return (int16_t)(v > 32767 ? 32767 : v < -32768 ? -32768 : lround(v));
+}
+
+// ### Reference attitude ###
+
+typedef struct {
+    double w, x, y, z;
+} dquat_t;
+
+static dquat_t dquat_mul(const dquat_t &a, const dquat_t &b) {
+    return {a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z,
+            a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+            a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+            a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w};
+}
+
+static dquat_t dquat_norm(const dquat_t &q) {
+    double n = sqrt(q.w * q.w + q.x * q.x + q.y * q.y + q.z * q.z);
+    return {q.w / n, q.x / n, q.y / n, q.z / n};
+}
+
+// Body to world (`inverse` false) or world to body.
+static void dquat_rotate(const dquat_t &q, const double v[3], double out[3], bool inverse) {
+    dquat_t c = inverse ? dquat_t{q.w, -q.x, -q.y, -q.z} : q;
+    dquat_t r = dquat_mul(dquat_mul(c, {0, v[0], v[1], v[2]}), {c.w, -c.x, -c.y, -c.z});
+    out[0] = r.x;
+    out[1] = r.y;
+    out[2] = r.z;
+}
+
+static void cross(const double a[3], const double b[3], double out[3]) {
+    out[0] = a[1] * b[2] - a[2] * b[1];
+    out[1] = a[2] * b[0] - a[0] * b[2];
+    out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+// Angle of the rotation between two orientations, conj(a) * b.
+static double angle_deg(const dquat_t &a, const quat_t &b) {
+    dquat_t d = dquat_mul({a.w, -a.x, -a.y, -a.z}, {b.w, b.x, b.y, b.z});
+    return 2 * atan2(sqrt(d.x * d.x + d.y * d.y + d.z * d.z), fabs(d.w)) * 180 / M_PI;
+}
+
+/**
+ * The same Mahony filter as AttitudeEstimator, in double precision and
+ * written from the vector form rather than the expanded one, as a check
+ * on the on-board kernel.
+ */
+class ReferenceAttitude {
+public:
+    dquat_t q = {1, 0, 0, 0};
+    double dt = 0;
+
+    void step(const imu_reading_t &r) {
+        const double gyro = M_PI / 180 / IMU_GYRO_LSB_PER_DPS;
+        double w[3] = {r.gyr_x * gyro, r.gyr_y * gyro, r.gyr_z * gyro};
+        double a[3] = {(double)r.acc_x, (double)r.acc_y, (double)r.acc_z};
+        double an = sqrt(a[0] * a[0] + a[1] * a[1] + a[2] * a[2]) / IMU_ACCEL_LSB_PER_G;
+
+        if (fabs(an - 1) <= ATTITUDE_ACCEL_GATE) {
+            double e[3], c[3];
+            for (double &x : a) {
+                x /= an * IMU_ACCEL_LSB_PER_G;
+            }
+            const double up[3] = {0, 0, 1};
+            double v[3];
+            dquat_rotate(q, up, v, true);
+            cross(a, v, e);
+
+            double m[3] = {(double)r.mag_x, -(double)r.mag_y, -(double)r.mag_z};
+            double mn = sqrt(m[0] * m[0] + m[1] * m[1] + m[2] * m[2]);
+            if (mn > 0) {
+                for (double &x : m) {
+                    x /= mn;
+                }
+                double h[3], b[3], f[3];
+                dquat_rotate(q, m, h, false);
+                b[0] = sqrt(h[0] * h[0] + h[1] * h[1]);
+                b[1] = 0;
+                b[2] = h[2];
+                dquat_rotate(q, b, f, true);
+                cross(m, f, c);
+                for (int i = 0; i < 3; i++) {
+                    e[i] += c[i];
+                }
+            }
+            for (int i = 0; i < 3; i++) {
+                w[i] += ATTITUDE_TWO_KP / 2 * e[i];
+            }
+        }
+
+        dquat_t dq = dquat_mul(q, {0, w[0], w[1], w[2]});
+        q = dquat_norm({q.w + dq.w * dt / 2, q.x + dq.x * dt / 2,
+                        q.y + dq.y * dt / 2, q.z + dq.z * dt / 2});
+    }
+};
+
+// Worst disagreement per phase, in degrees.
+typedef struct {
+    double vs_reference[PHASE_COUNT];
+    double vs_truth[PHASE_COUNT];
+    double reference_vs_truth[PHASE_COUNT];
+} attitude_check_t;
+
+// Worst and RMS altitude (m) and velocity (m/s) errors per phase, and
+// where each side puts apogee.
+typedef struct {
+    double altitude_max[PHASE_COUNT];
+    double velocity_max[PHASE_COUNT];
+    double altitude_sq[PHASE_COUNT];
+    double velocity_sq[PHASE_COUNT];
+    uint64_t samples[PHASE_COUNT];
+    double apogee_m, apogee_s;
+    double est_apogee_m, est_apogee_s;
+} altitude_check_t;
+
+// The detector --detect runs, and when it found each phase (s, -1 if it
+// didn't).
+typedef struct {
+    PhaseDetector detector;
+    double found_s[PHASE_COUNT];
+} phase_check_t;
+
+// Standard atmosphere, as baro_altitude() assumes.
+static double pressure_at(double altitude_m) {
+    return 101325.0 * pow(1 - 2.25577e-5 * altitude_m, 5.25588);
+}
+
+/**
+ * Makes up a flight `seconds` long and feeds it to the pipeline a slot at
+ * a time, with phase changes from `profile`: one accelerometer reading per
+ * slot, IMU readings at the ICM20948's output data rate for the phase, and
+ * barometer readings as often as the BME280s make them.
+ *
+ * The rocket's true orientation is integrated exactly from the profile's
+ * body rates. Its vertical motion comes from the same specific force the
+ * accelerometers read, so it tilts with the rocket, and pressure follows
+ * the standard atmosphere for the integrated altitude.
+ *
+ * If `attitude` is given, IMU0's attitude estimate is compared against the
+ * double precision reference and the truth after every block; if
+ * `altitude` is, its altitude and velocity estimates against the truth.
+ * If `detect` is, every block also goes through its PhaseDetector.
+ *
+ * If `reboot_s` is set the board is reset then: the pipeline is
+ * checkpointed and rebuilt, with nothing fed to it (or the reference) for
+ * REPLAY_REBOOT_GAP_US in between, as in a warm boot. The reference picks
+ * up from the restored attitude.
+ *
+ * Each slot's readings are collected into a pipeline_block_t, as on
+ * board, and processed there and then - or, given `staged`, handed to it
+ * to be processed on its own thread.
+ */
+static void replay_synthetic(double seconds, const flight_profile_t &profile, Pipeline &pipeline,
+                             replay_output_t *out, Clock &clock, double reboot_s,
+                             StagedPipeline *staged, attitude_check_t *attitude,
+                             altitude_check_t *altitude, phase_check_t *detect) {
+    const flight_step_t *flight = profile.steps;
+    size_t step = 0;
+    double height = 0, velocity = 0, imu_due = 0;
+    bool landed = false;
+    const double dt = REPLAY_SLOT_US / 1e6;
+    uint64_t slots = (uint64_t)(seconds * 1e6 / REPLAY_SLOT_US);
+    dquat_t truth = {1, 0, 0, 0};
+    ReferenceAttitude reference;
+    uint32_t imu_last = 0;
+    bool imu_timed = false;
+    // As System::baro_due
+    int64_t baro_due[PIPELINE_BAROS];
+    for (int i = 0; i < PIPELINE_BAROS; i++) {
+        baro_due[i] = i * BARO_INTERVAL_LOW_US / PIPELINE_BAROS;
+    }
+    uint64_t reboot_slot = reboot_s > 0 ? (uint64_t)(reboot_s * 1e6 / REPLAY_SLOT_US) : UINT64_MAX;
+    uint64_t resume_slot = reboot_s > 0 ? reboot_slot + REPLAY_REBOOT_GAP_US / REPLAY_SLOT_US
+                                        : UINT64_MAX;
+    pipeline_checkpoint_t saved;
+
+    for (uint64_t slot = 0; slot < slots; slot++) {
+        uint32_t now = (uint32_t)(slot * REPLAY_SLOT_US);
+        double t = slot * dt;
+        clock.at(now);
+        if (slot == reboot_slot) {
+            pipeline.checkpoint(&saved);
+            pipeline = Pipeline(replay_sink, out);
+        }
+        bool down = slot >= reboot_slot && slot < resume_slot;
+        while (step + 1 < profile.count && t >= flight[step + 1].start_s) {
+            step++;
+            if (PHASE_CONFIG[flight[step].phase].rate != PHASE_CONFIG[flight[step - 1].phase].rate) {
+                imu_timed = false;
+            }
+        }
+        if (slot == resume_slot) {
+            pipeline.restore(saved, REPLAY_REBOOT_GAP_US, now);
+            imu_timed = false;
+            // The reference restarts where the estimator does, so it still
+            // checks the arithmetic, and against the truth shows what the
+            // gap cost.
+            const quat_t &q = pipeline.attitude(0).attitude();
+            reference.q = {q.w, q.x, q.y, q.z};
+        }
+        const flight_step_t &f = flight[step];
+        // The phase change, if any, goes with it.
+        pipeline_block_t slot_block;
+        pipeline_block_clear(&slot_block, now, f.phase);
+        bool axial = f.phase == PHASE_BOOST || f.phase == PHASE_COAST ||
+                     f.phase == PHASE_MICROGRAVITY;
+
+        // Vertical specific force, in g.
+        double up_g = 1;
+        if (axial) {
+            const double body[3] = {0, 0, f.force_g};
+            double world[3];
+            dquat_rotate(truth, body, world, false);
+            up_g = world[2];
+        } else if (f.phase != PHASE_PAD && !landed) {
+            // Drag settles on the descent rate, until it's time to stop.
+            double stop = velocity * velocity / (2 * LANDING_G * STANDARD_G);
+            if (velocity < 0 && height <= stop) {
+                up_g = 1 + LANDING_G;
+            } else {
+                up_g = 1 + (-DESCENT_RATE - velocity) / (DRAG_TAU_S * STANDARD_G);
+                up_g = up_g < 0 ? 0 : up_g;
+            }
+        }
+        if (f.phase != PHASE_PAD && !landed) {
+            double v1 = velocity + (up_g - 1) * STANDARD_G * dt;
+            if (!axial && velocity < 0 && v1 >= 0) {
+                landed = true;
+                v1 = 0;
+                height = 0;
+            }
+            height += (velocity + v1) / 2 * dt;
+            velocity = v1;
+        }
+        if (height < 0) {
+            height = 0;
+        }
+
+        // Specific force in the body frame, in g.
+        const double up[3] = {0, 0, up_g};
+        double force[3] = {0, 0, f.force_g};
+        if (!axial) {
+            dquat_rotate(truth, up, force, true);
+        }
+
+        // H3LIS100DLTR: 780mg per count.
+        for (int i = 0; i < PIPELINE_ACCELS && !down; i++) {
+            accel_reading_t a = {clamp16(force[0] / 0.78 + noise(1)),
+                                 clamp16(force[1] / 0.78 + noise(1)),
+                                 clamp16(force[2] / 0.78 + noise(1))};
+            sample_block_append(&slot_block.accel[i], &a, 1, now, 0);
+        }
+
+        // IMU readings due this slot, with the orientation moving on
+        // between each.
+        double hz = PHASE_CONFIG[f.phase].rate == RATE_FULL ? IMU_RATE_FULL_HZ : IMU_RATE_LOW_HZ;
+        imu_due += hz * dt;
+        size_t n = (size_t)imu_due;
+        imu_due -= n;
+        n = n < REPLAY_IMU_MAX ? n : REPLAY_IMU_MAX;
+        double step_s = 1 / hz;
+        imu_reading_t imu[PIPELINE_IMUS][REPLAY_IMU_MAX];
+        for (size_t k = 0; k < n; k++) {
+            double half = step_s / 2;
+            double wn = sqrt(f.rate[0] * f.rate[0] + f.rate[1] * f.rate[1] + f.rate[2] * f.rate[2]);
+            if (wn > 0) {
+                double s = sin(wn * half) / wn;
+                truth = dquat_norm(dquat_mul(truth, {cos(wn * half), f.rate[0] * s,
+                                                      f.rate[1] * s, f.rate[2] * s}));
+            }
+            if (!axial) {
+                dquat_rotate(truth, up, force, true);
+            }
+            double field[3];
+            dquat_rotate(truth, FIELD_UT, field, true);
+            const double gyro = 180 / M_PI * IMU_GYRO_LSB_PER_DPS;
+            for (int i = 0; i < PIPELINE_IMUS; i++) {
+                imu[i][k] = {clamp16(force[0] * IMU_ACCEL_LSB_PER_G + noise(20)),
+                             clamp16(force[1] * IMU_ACCEL_LSB_PER_G + noise(20)),
+                             clamp16(force[2] * IMU_ACCEL_LSB_PER_G + noise(20)),
+                             clamp16(f.rate[0] * gyro + noise(3)),
+                             clamp16(f.rate[1] * gyro + noise(3)),
+                             clamp16(f.rate[2] * gyro + noise(3)),
+                             (int16_t)(2500 + noise(3)),
+                             clamp16(field[0] / MAG_UT_PER_LSB + noise(2)),
+                             clamp16(-field[1] / MAG_UT_PER_LSB + noise(2)),
+                             clamp16(-field[2] / MAG_UT_PER_LSB + noise(2))};
+            }
+        }
+        for (int i = 0; i < PIPELINE_IMUS && !down; i++) {
+            sample_block_append(&slot_block.imu[i], imu[i], n, now, (uint32_t)(step_s * 1e6));
+        }
+
+        for (int i = 0; i < PIPELINE_BAROS; i++) {
+            if ((int64_t)now < baro_due[i]) {
+                continue;
+            }
+            int64_t interval = baro_interval_us(PHASE_CONFIG[f.phase].rate);
+            baro_due[i] += interval;
+            if (baro_due[i] <= (int64_t)now) {
+                baro_due[i] = now + interval;
+            }
+            double pa = pressure_at(SITE_ALTITUDE_M + height);
+            // 40%RH, 25degC, and about 2Pa of noise.
+            baro_reading_t b = {40 << 10, 2500, (uint32_t)(lround(pa * 256) + noise(768))};
+            if (!down) {
+                sample_block_append(&slot_block.baro[i], &b, 1, now, 0);
+            }
+        }
+
+        if (detect != NULL && !down) {
+            flight_phase was = detect->detector.currentPhase();
+            flight_phase now_phase = detect->detector.update(slot_block);
+            for (int p = was + 1; p <= now_phase; p++) {
+                detect->found_s[p] = t;
+            }
+        }
+
+        if (!down) {
+            if (staged != NULL) {
+                staged->submit(slot_block);
+            } else {
+                pipeline.process(slot_block);
+            }
+        }
+
+        if (attitude != NULL && n > 0 && !down) {
+            // The reading spacing the pipeline works out (Pipeline::imu_interval).
+            uint32_t dt_us = imu_timed ? (now - imu_last) / n : (uint32_t)(1e6f / hz);
+            imu_last = now;
+            imu_timed = true;
+            reference.dt = dt_us / 1e6;
+            for (size_t k = 0; k < n; k++) {
+                reference.step(imu[0][k]);
+            }
+            const quat_t &q = pipeline.attitude(0).attitude();
+            quat_t rq = {(float)reference.q.w, (float)reference.q.x,
+                         (float)reference.q.y, (float)reference.q.z};
+            double e[3] = {angle_deg(reference.q, q), angle_deg(truth, q), angle_deg(truth, rq)};
+            double *worst[3] = {&attitude->vs_reference[f.phase], &attitude->vs_truth[f.phase],
+                                &attitude->reference_vs_truth[f.phase]};
+            for (int i = 0; i < 3; i++) {
+                if (e[i] > *worst[i]) {
+                    *worst[i] = e[i];
+                }
+            }
+        }
+
+
+        const AltitudeEstimator &est = pipeline.altitude(0);
+        if (altitude != NULL && est.ready()) {
+            double h = est.altitudeMm() / 1e3, v = est.velocityMmS() / 1e3;
+            double eh = fabs(h - height), ev = fabs(v - velocity);
+            altitude->altitude_max[f.phase] = fmax(altitude->altitude_max[f.phase], eh);
+            altitude->velocity_max[f.phase] = fmax(altitude->velocity_max[f.phase], ev);
+            altitude->altitude_sq[f.phase] += eh * eh;
+            altitude->velocity_sq[f.phase] += ev * ev;
+            altitude->samples[f.phase]++;
+            if (height > altitude->apogee_m) {
+                altitude->apogee_m = height;
+                altitude->apogee_s = t;
+            }
+            if (h > altitude->est_apogee_m) {
+                altitude->est_apogee_m = h;
+                altitude->est_apogee_s = t;
+            }
+        }
+    }
+    if (staged != NULL) {
+        staged->finish();
+    }
+    pipeline.flush((uint32_t)(slots * REPLAY_SLOT_US));
+}
+
+// ### Main ###
+
+[[noreturn]] static void usage(void) {
+    fprintf(stderr, "usage: replay (--synthetic SECONDS | --log IMAGE | --live CAPTURE)\n"
+                    "              [--realtime] [--phase N] [--expect CRC]\n"
+                    "              [--profile NAME] [--attitude] [--altitude]\n"
+                    "              [--reboot SECONDS] [--staged STALL_MS] [--detect]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    const char *log_path = NULL, *live_path = NULL;
+    double synthetic = 0, reboot = 0, stall_ms = -1;
+    bool realtime = false, check = false, attitude = false, altitude = false, detect = false;
+    const flight_profile_t *profile = &PROFILES[0];
+    int phase = PHASE_PAD;
+    uint32_t expect = 0;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(arg, "--realtime") == 0) {
+            realtime = true;
+            continue;
+        }
+        if (strcmp(arg, "--attitude") == 0) {
+            attitude = true;
+            continue;
+        }
+        if (strcmp(arg, "--altitude") == 0) {
+            altitude = true;
+            continue;
+        }
+        if (strcmp(arg, "--detect") == 0) {
+            detect = true;
+            continue;
+        }
+        if (value == NULL) {
+            usage();
+        }
+        i++;
+        if (strcmp(arg, "--log") == 0) {
+            log_path = value;
+        } else if (strcmp(arg, "--live") == 0) {
+            live_path = value;
+        } else if (strcmp(arg, "--synthetic") == 0) {
+            synthetic = atof(value);
+        } else if (strcmp(arg, "--reboot") == 0) {
+            reboot = atof(value);
+        } else if (strcmp(arg, "--staged") == 0) {
+            stall_ms = atof(value);
+        } else if (strcmp(arg, "--phase") == 0) {
+            phase = atoi(value);
+        } else if (strcmp(arg, "--expect") == 0) {
+            check = true;
+            expect = strtoul(value, NULL, 16);
+        } else if (strcmp(arg, "--profile") == 0) {
+            profile = NULL;
+            for (const flight_profile_t &p : PROFILES) {
+                if (strcmp(value, p.name) == 0) {
+                    profile = &p;
+                }
+            }
+            if (profile == NULL) {
+                usage();
+            }
+        } else {
+            usage();
+        }
+    }
+    if ((log_path != NULL) + (live_path != NULL) + (synthetic > 0) != 1 ||
+        phase < 0 || phase >= PHASE_COUNT ||
+        ((attitude || altitude || detect || reboot > 0 || stall_ms >= 0) && synthetic <= 0) ||
+        // Only the consumer thread may look at the pipeline.
+        (stall_ms >= 0 && (attitude || altitude || reboot > 0))) {
+        usage();
+    }
+    if (stall_ms >= 0) {
+        // A stall only means something against the producer's pace.
+        realtime = true;
+    }
+
+    replay_output_t out = {};
+    Pipeline pipeline(replay_sink, &out);
+    Clock clock(realtime);
+    if (phase != PHASE_PAD) {
+        pipeline.setPhase((flight_phase)phase, 0);
+    }
+
+    attitude_check_t errors = {};
+    altitude_check_t height = {};
+    phase_check_t found;
+    for (double &s : found.found_s) {
+        s = -1;
+    }
+    found.found_s[PHASE_PAD] = 0;
+    auto start = std::chrono::steady_clock::now();
+    bool ok = true;
+    if (log_path != NULL) {
+        ok = replay_log(log_path, pipeline, clock);
+    } else if (live_path != NULL) {
+        ok = replay_live(live_path, pipeline, clock);
+    } else if (stall_ms >= 0) {
+        StagedPipeline staged(pipeline, (uint32_t)(stall_ms * 1000));
+        replay_synthetic(synthetic, *profile, pipeline, &out, clock, 0, &staged, NULL, NULL,
+                         detect ? &found : NULL);
+        printf("staged: %llu blocks, %llu dropped, deepest queue %zu of %d, "
+               "consumer busy %.1f%% (%.0fms stall every %.0fs)\n",
+               (unsigned long long)staged.submitted, (unsigned long long)staged.dropped,
+               staged.deepest, REPLAY_BLOCKS, 100 * staged.busy_s / (synthetic > 0 ? synthetic : 1),
+               stall_ms, REPLAY_STALL_EVERY_US / 1e6);
+    } else {
+        replay_synthetic(synthetic, *profile, pipeline, &out, clock, reboot, NULL,
+                         attitude ? &errors : NULL, altitude ? &height : NULL,
+                         detect ? &found : NULL);
+    }
+    if (!ok) {
+        return 2;
+    }
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double flight = clock.elapsed() / 1e6;
+
+    static const char *names[] = {"accel", "imu", "baro", "rtc", "message", "analog",
+                                  "phase", "stats", "attitude", "altitude"};
+    printf("records:");
+    for (int t = 0; t <= REC_ALTITUDE; t++) {
+        if (out.records[t] > 0) {
+            printf(" %s %u", names[t], (unsigned)out.records[t]);
+        }
+    }
+    printf(" (%llu bytes, %u dropped)\n", (unsigned long long)out.bytes, (unsigned)out.dropped);
+    printf("digest: %08x\n", (unsigned)out.digest);
+    printf("%.1f flight s in %.3f wall s: %.0fx real time\n", flight, wall,
+           wall > 0 ? flight / wall : 0.0);
+
+    const cycle_stats_t &stats = pipeline.attitude(0).stats();
+    printf("attitude: %u updates, %u cycles avg, %u max\n", (unsigned)stats.updates,
+           (unsigned)stats.cycles_avg, (unsigned)stats.cycles_max);
+    const cycle_stats_t &astats = pipeline.altitude(0).stats();
+    printf("altitude: %u updates, %u cycles avg, %u max\n", (unsigned)astats.updates,
+           (unsigned)astats.cycles_avg, (unsigned)astats.cycles_max);
+
+    static const char *phases[] = {"pad", "boost", "coast", "microgravity", "descent",
+                                   "landed"};
+    int rc = 0;
+    if (attitude) {
+        printf("worst error (deg)  vs reference  vs truth  reference vs truth\n");
+        for (int p = 0; p < PHASE_COUNT; p++) {
+            printf("  %-14s  %12.4f  %8.3f  %18.3f\n", phases[p], errors.vs_reference[p],
+                   errors.vs_truth[p], errors.reference_vs_truth[p]);
+            if (errors.vs_reference[p] > ATTITUDE_TOLERANCE_DEG) {
+                rc = 1;
+            }
+        }
+        if (rc != 0) {
+            fprintf(stderr, "attitude estimator strays from the reference by over %.2f deg\n",
+                    ATTITUDE_TOLERANCE_DEG);
+        }
+    }
+    if (altitude) {
+        bool strayed = false;
+        printf("error vs truth     altitude (m)  rms   velocity (m/s)  rms\n");
+        for (int p = 0; p < PHASE_COUNT; p++) {
+            double n = height.samples[p] > 0 ? (double)height.samples[p] : 1;
+            printf("  %-14s  %12.3f  %5.3f  %14.3f  %5.3f\n", phases[p], height.altitude_max[p],
+                   sqrt(height.altitude_sq[p] / n), height.velocity_max[p],
+                   sqrt(height.velocity_sq[p] / n));
+            if (height.altitude_max[p] > ALTITUDE_TOLERANCE_M ||
+                height.velocity_max[p] > VELOCITY_TOLERANCE_MS) {
+                strayed = true;
+            }
+        }
+        printf("apogee: %.1fm at %.2fs, estimated %.1fm at %.2fs\n", height.apogee_m,
+               height.apogee_s, height.est_apogee_m, height.est_apogee_s);
+        if (strayed) {
+            fprintf(stderr, "altitude estimate strays from the truth by over %.1fm or %.1fm/s\n",
+                    ALTITUDE_TOLERANCE_M, VELOCITY_TOLERANCE_MS);
+            rc = 1;
+        }
+    }
+    if (detect) {
+        bool missed = false;
+        printf("phase detected      profile (s)  found (s)  late (s)\n");
+        for (size_t i = 1; i < profile->count; i++) {
+            const flight_step_t &f = profile->steps[i];
+            if (f.start_s >= synthetic) {
+                break;
+            }
+            double at = found.found_s[f.phase];
+            printf("  %-14s  %12.2f  %9.2f  %8.2f\n", phases[f.phase], f.start_s, at,
+                   at >= 0 ? at - f.start_s : 0.0);
+            if (at < f.start_s || at - f.start_s > DETECT_LATE_S[f.phase]) {
+                missed = true;
+            }
+        }
+        if (missed) {
+            fprintf(stderr, "phase detector missed a phase or found it too early or late\n");
+            rc = 1;
+        }
+    }
+    if (check && out.digest != expect) {
+        fprintf(stderr, "digest mismatch: expected %08x\n", (unsigned)expect);
+        rc = 1;
+    }
+    return rc;
+}
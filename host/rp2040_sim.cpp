@@ -0,0 +1,141 @@
+// rp2040_sim.cpp
+// Throughput and command round trip of the payload link, running the
+// real RP2040 driver against a loopback stand-in for the RP2040: every
+// frame comes straight back, as with PAYLOAD_LOOPBACK on target.
+//
+//   rp2040_sim
+//
+// The simulated SPI bus (host/stub/host_spi.cpp) runs at PAYLOAD_CLOCK_HZ
+// with a fixed driver overhead per transaction. poll() is called every
+// `poll_us` of simulated time; the firmware calls it once per sample slot.
+// Some runs flip a bit in one frame in a hundred ("1% bad"), to exercise
+// the CRC check and the command resends. Exits non-zero if a command is
+// never acknowledged, a telemetry frame goes missing without a CRC error,
+// or more frames are counted as sequence gaps than failed their CRC.
+// 05/2023
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "RP2040.hpp"
+#include "esp_timer.h"
+
+#define SIM_US (2 * 1000 * 1000)
+#define SIM_COMMANDS 2000
+// esp-idf's queue/ISR/DMA setup per transaction, assumed.
+#define SIM_SPI_OVERHEAD_US 10
+
+static const device_desc_t DESC = {"payload", BUS_SPI1, 15, GPIO_NUM_NC};
+
+static bool failed;
+
+// Drains what came back, counting telemetry payload bytes.
+static void drain(RP2040 &link, uint64_t *bytes) {
+    payload_lane lane;
+    uint8_t data[PAYLOAD_FRAME_DATA];
+    size_t len;
+    while ((len = link.receive(&lane, data, sizeof(data))) > 0) {
+        if (lane == LANE_TELEMETRY) {
+            *bytes += len;
+        }
+    }
+}
+
+// Telemetry lane kept full for SIM_US. Returns payload bytes per second
+// delivered back.
+static double throughput(int poll_us, int corrupt_every) {
+    RP2040 link(DESC);
+    host_clock_set(0);
+    host_spi_set_corrupt_every(corrupt_every);
+    link.init();
+
+    uint32_t sent = 0;
+    uint64_t bytes = 0;
+    uint8_t msg[PAYLOAD_FRAME_DATA] = {};
+    for (int64_t t = 0; t < SIM_US; t += poll_us) {
+        host_clock_set(t);
+        link.poll();
+        drain(link, &bytes);
+        while (link.send(LANE_TELEMETRY, msg, sizeof(msg))) {
+            sent++;
+        }
+    }
+    const payload_stats_t &s = link.stats();
+    // Each frame sent either came back or failed its CRC, apart from those
+    // still queued or in flight at the end.
+    uint32_t accounted = s.rx_frames + s.crc_errors + PAYLOAD_INFLIGHT + PAYLOAD_TELEMETRY_SLOTS;
+    if (s.rx_frames == 0 || accounted < sent || s.seq_gaps > s.crc_errors) {
+        printf("telemetry: sent %u, received %u, %u CRC errors, %u gaps\n", sent, s.rx_frames,
+               s.crc_errors, s.seq_gaps);
+        failed = true;
+    }
+    return bytes * 1e6 / SIM_US;
+}
+
+typedef struct {
+    double mean_us;
+    uint32_t max_us;
+    uint32_t resends;
+} rtt_t;
+
+// SIM_COMMANDS commands one after another, each sent as the previous one
+// is acknowledged, with or without the telemetry lane kept full.
+static rtt_t round_trip(int poll_us, bool loaded, int corrupt_every) {
+    RP2040 link(DESC);
+    host_clock_set(0);
+    host_spi_set_corrupt_every(corrupt_every);
+    link.init();
+
+    uint8_t cmd[8] = {'P'};
+    uint8_t msg[PAYLOAD_FRAME_DATA] = {};
+    uint64_t bytes = 0, total = 0;
+    int64_t t = 0;
+    for (int i = 0; i < SIM_COMMANDS; i++) {
+        link.send(LANE_COMMAND, cmd, sizeof(cmd));
+        int64_t limit = t + 1000 * 1000;
+        do {
+            t += poll_us;
+            host_clock_set(t);
+            link.poll();
+            drain(link, &bytes);
+            while (loaded && link.send(LANE_TELEMETRY, msg, sizeof(msg))) {
+            }
+        } while (!link.commandsIdle() && t < limit);
+        if (!link.commandsIdle()) {
+            printf("command %d never acknowledged\n", i);
+            failed = true;
+            break;
+        }
+        total += link.stats().rtt_last_us;
+    }
+    // Only a frame that failed its CRC can leave a gap; resends arriving
+    // behind newer frames mustn't look like one.
+    const payload_stats_t &s = link.stats();
+    if (s.seq_gaps > s.crc_errors) {
+        printf("commands: %u CRC errors, %u gaps\n", s.crc_errors, s.seq_gaps);
+        failed = true;
+    }
+    return {(double)total / SIM_COMMANDS, link.stats().rtt_max_us, link.stats().resends};
+}
+
+int main() {
+    host_spi_set_overhead(SIM_SPI_OVERHEAD_US);
+    double wire = PAYLOAD_FRAME_DATA * 1e6 /
+                  (PAYLOAD_FRAME_SIZE * 8 * 1e6 / PAYLOAD_CLOCK_HZ + SIM_SPI_OVERHEAD_US);
+    printf("SPI %d MHz, %d byte frames, %dus overhead: link limit %.0f KB/s\n\n",
+           PAYLOAD_CLOCK_HZ / 1000000, PAYLOAD_FRAME_SIZE, SIM_SPI_OVERHEAD_US, wire / 1000);
+
+    printf("command round trip loaded: telemetry lane kept full, 1%% of frames bad\n");
+    printf("%-8s %10s %10s %12s %10s %12s %10s %8s\n", "poll", "telemetry", "(1% bad)",
+           "rtt idle", "max", "rtt loaded", "max", "resends");
+    for (int poll_us : {50, 100, 250, 1000}) {
+        double kbs = throughput(poll_us, 0) / 1000;
+        double kbs_bad = throughput(poll_us, 100) / 1000;
+        rtt_t idle = round_trip(poll_us, false, 0);
+        rtt_t busy = round_trip(poll_us, true, 100);
+        printf("%6dus %7.0fKB/s %7.0fKB/s %10.0fus %8uus %10.0fus %8uus %8u\n", poll_us, kbs,
+               kbs_bad, idle.mean_us, idle.max_us, busy.mean_us, busy.max_us, busy.resends);
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,52 @@
+// gpio.h
+// Host stand-in for the GPIO types in device descriptions, and the
+// interrupt calls drivers make. Registered handlers are kept so a
+// simulation can raise an edge with host_gpio_edge (host_gpio.cpp).
+// 05/2023
+
+#ifndef HOST_GPIO_H
+#define HOST_GPIO_H
+
+#include <stdint.h>
+
+#include "esp_attr.h"
+#include "esp_err.h"
+
+typedef int gpio_num_t;
+
+#define GPIO_NUM_NC ((gpio_num_t)-1)
+#define GPIO_NUM_MAX 40
+
+typedef enum {
+    GPIO_INTR_DISABLE,
+    GPIO_INTR_POSEDGE,
+    GPIO_INTR_NEGEDGE,
+    GPIO_INTR_ANYEDGE,
+} gpio_int_type_t;
+
+typedef enum {
+    GPIO_MODE_DISABLE,
+    GPIO_MODE_INPUT,
+    GPIO_MODE_OUTPUT,
+} gpio_mode_t;
+
+typedef enum { GPIO_PULLUP_DISABLE, GPIO_PULLUP_ENABLE } gpio_pullup_t;
+typedef enum { GPIO_PULLDOWN_DISABLE, GPIO_PULLDOWN_ENABLE } gpio_pulldown_t;
+
+typedef struct {
+    uint64_t pin_bit_mask;
+    gpio_mode_t mode;
+    gpio_pullup_t pull_up_en;
+    gpio_pulldown_t pull_down_en;
+    gpio_int_type_t intr_type;
+} gpio_config_t;
+
+typedef void (*gpio_isr_t)(void *arg);
+
+esp_err_t gpio_config(const gpio_config_t *config);
+esp_err_t gpio_isr_handler_add(gpio_num_t pin, gpio_isr_t handler, void *arg);
+
+// Host only: run the handler registered on `pin`, as an edge would.
+void host_gpio_edge(gpio_num_t pin);
+
+#endif
@@ -0,0 +1,16 @@
+// i2c.h
+// Host stand-in for the I2C port numbers. The register access functions
+// (Registers.hpp) are left for each simulation to define against its
+// model of the chips.
+// 05/2023
+
+#ifndef HOST_I2C_H
+#define HOST_I2C_H
+
+typedef enum {
+    I2C_NUM_0,
+    I2C_NUM_1,
+    I2C_NUM_MAX,
+} i2c_port_t;
+
+#endif
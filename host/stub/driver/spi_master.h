@@ -0,0 +1,66 @@
+// spi_master.h
+// Host stand-in for the esp-idf SPI master driver, enough for the queued
+// DMA transactions of the RP2040 link (host_spi.cpp). The bus is a
+// loopback: every transaction receives what it sent, as PAYLOAD_LOOPBACK
+// wires it on target. Transactions take their wire time on the simulated
+// esp_timer clock, plus a fixed driver overhead each.
+// 05/2023
+
+#ifndef HOST_SPI_MASTER_H
+#define HOST_SPI_MASTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+typedef enum {
+    SPI1_HOST,
+    SPI2_HOST,
+    SPI3_HOST,
+} spi_host_device_t;
+
+#define SPI_DMA_CH_AUTO 3
+
+typedef struct {
+    int mosi_io_num;
+    int miso_io_num;
+    int sclk_io_num;
+    int quadwp_io_num;
+    int quadhd_io_num;
+    int max_transfer_sz;
+} spi_bus_config_t;
+
+typedef struct {
+    uint8_t mode;
+    int clock_speed_hz;
+    int spics_io_num;
+    int queue_size;
+} spi_device_interface_config_t;
+
+typedef struct {
+    uint32_t flags;
+    size_t length; // bits
+    size_t rxlength;
+    void *user;
+    const void *tx_buffer;
+    void *rx_buffer;
+} spi_transaction_t;
+
+typedef struct spi_device_t *spi_device_handle_t;
+
+esp_err_t spi_bus_initialize(spi_host_device_t host, const spi_bus_config_t *config, int dma);
+esp_err_t spi_bus_add_device(spi_host_device_t host, const spi_device_interface_config_t *config,
+                             spi_device_handle_t *handle);
+esp_err_t spi_device_queue_trans(spi_device_handle_t handle, spi_transaction_t *trans,
+                                 TickType_t timeout);
+esp_err_t spi_device_get_trans_result(spi_device_handle_t handle, spi_transaction_t **trans,
+                                      TickType_t timeout);
+
+// Host only: driver and ISR time per transaction, on top of the wire time.
+void host_spi_set_overhead(int64_t us);
+// Host only: flip a bit in every `n`th frame received, 0 for none.
+void host_spi_set_corrupt_every(int n);
+
+#endif
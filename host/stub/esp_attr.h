@@ -0,0 +1,12 @@
+// esp_attr.h
+// Host stand-in: placement attributes mean nothing off target.
+// 05/2023
+
+#ifndef HOST_ESP_ATTR_H
+#define HOST_ESP_ATTR_H
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define RTC_NOINIT_ATTR
+
+#endif
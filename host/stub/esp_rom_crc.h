@@ -0,0 +1,13 @@
+// esp_rom_crc.h
+// Host stand-in for the ROM CRC32, computed by Crc32.hpp's host path
+// (host_crc.cpp). Same polynomial and conventions as the ROM routine.
+// 05/2023
+
+#ifndef HOST_ESP_ROM_CRC_H
+#define HOST_ESP_ROM_CRC_H
+
+#include <stdint.h>
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len);
+
+#endif
@@ -0,0 +1,19 @@
+// esp_timer.h
+// Host stand-in for esp_timer. Time is simulated: it only moves when a
+// test or simulation moves it (host_clock.cpp), so timing-dependent logic
+// runs the same on every machine. Benchmarks time themselves with
+// std::chrono instead.
+// 05/2023
+
+#ifndef HOST_ESP_TIMER_H
+#define HOST_ESP_TIMER_H
+
+#include <stdint.h>
+
+int64_t esp_timer_get_time(void);
+
+// Host only.
+void host_clock_set(int64_t now_us);
+void host_clock_advance(int64_t us);
+
+#endif
@@ -0,0 +1,22 @@
+// FreeRTOS.h
+// Host stand-in for the FreeRTOS types the drivers' headers use. Ticks
+// are CONFIG_FREERTOS_HZ=100 ones, as in sdkconfig.
+// 05/2023
+
+#ifndef HOST_FREERTOS_H
+#define HOST_FREERTOS_H
+
+#include <stdint.h>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+
+#define portTICK_PERIOD_MS 10
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms) / portTICK_PERIOD_MS)
+#define portMAX_DELAY 0xffffffffu
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+
+#endif
@@ -0,0 +1,15 @@
+// queue.h
+// Host stand-in for the FreeRTOS queue handle types in AsyncBus.hpp.
+// 05/2023
+
+#ifndef HOST_FREERTOS_QUEUE_H
+#define HOST_FREERTOS_QUEUE_H
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct QueueDefinition *QueueHandle_t;
+typedef struct {
+    void *dummy[20];
+} StaticQueue_t;
+
+#endif
@@ -0,0 +1,28 @@
+// ringbuf.h
+// Host stand-in for the FreeRTOS no-split ring buffer Console.cpp uses,
+// on a mutex and condition variable (host_ringbuf.cpp).
+// 05/2023
+
+#ifndef HOST_FREERTOS_RINGBUF_H
+#define HOST_FREERTOS_RINGBUF_H
+
+#include <stddef.h>
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct host_ringbuf *RingbufHandle_t;
+
+typedef enum {
+    RINGBUF_TYPE_NOSPLIT = 0,
+} RingbufferType_t;
+
+RingbufHandle_t xRingbufferCreate(size_t size, RingbufferType_t type);
+void vRingbufferDelete(RingbufHandle_t ring);
+// Only a wait of 0 is supported: the item goes in whole or not at all.
+BaseType_t xRingbufferSend(RingbufHandle_t ring, const void *data, size_t len, TickType_t wait);
+// Only one item is out at a time, as with Console.cpp's single reader.
+void *xRingbufferReceive(RingbufHandle_t ring, size_t *len, TickType_t wait);
+void vRingbufferReturnItem(RingbufHandle_t ring, void *item);
+size_t xRingbufferGetCurFreeSize(RingbufHandle_t ring);
+
+#endif
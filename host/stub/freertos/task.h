@@ -0,0 +1,27 @@
+// task.h
+// Host stand-in for the FreeRTOS task calls the firmware makes.
+// 05/2023
+
+#ifndef HOST_FREERTOS_TASK_H
+#define HOST_FREERTOS_TASK_H
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct tskTaskControlBlock *TaskHandle_t;
+
+#define portYIELD_FROM_ISR(woken) ((void)(woken))
+
+// Detached threads, with no handle (host_task.cpp). The core is ignored.
+BaseType_t xTaskCreate(void (*task)(void *), const char *name, uint32_t stack, void *param,
+                       UBaseType_t priority, TaskHandle_t *handle);
+BaseType_t xTaskCreatePinnedToCore(void (*task)(void *), const char *name, uint32_t stack,
+                                   void *param, UBaseType_t priority, TaskHandle_t *handle,
+                                   BaseType_t core);
+
+// Notifications go nowhere, as no host task has a handle to send them
+// to: a take waits out its timeout and returns 0.
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t wait);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken);
+
+#endif
@@ -0,0 +1,21 @@
+// host_clock.cpp
+// Simulated esp_timer clock for host builds (see esp_timer.h).
+// 05/2023
+
+#include "esp_timer.h"
+
+#include <atomic>
+
+static std::atomic<int64_t> now_us;
+
+int64_t esp_timer_get_time(void) {
+    return now_us.load(std::memory_order_relaxed);
+}
+
+void host_clock_set(int64_t us) {
+    now_us.store(us, std::memory_order_relaxed);
+}
+
+void host_clock_advance(int64_t us) {
+    now_us.fetch_add(us, std::memory_order_relaxed);
+}
@@ -0,0 +1,28 @@
+// host_gpio.cpp
+// Simulated GPIO interrupts for host builds (see driver/gpio.h).
+// 05/2023
+
+#include "driver/gpio.h"
+
+static struct {
+    gpio_isr_t handler;
+    void *arg;
+} handlers[GPIO_NUM_MAX];
+
+esp_err_t gpio_config(const gpio_config_t *config) {
+    return config->pin_bit_mask >> GPIO_NUM_MAX ? ESP_ERR_INVALID_ARG : ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_add(gpio_num_t pin, gpio_isr_t handler, void *arg) {
+    if (pin < 0 || pin >= GPIO_NUM_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    handlers[pin] = {handler, arg};
+    return ESP_OK;
+}
+
+void host_gpio_edge(gpio_num_t pin) {
+    if (pin >= 0 && pin < GPIO_NUM_MAX && handlers[pin].handler) {
+        handlers[pin].handler(handlers[pin].arg);
+    }
+}
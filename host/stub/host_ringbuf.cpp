@@ -0,0 +1,67 @@
+// host_ringbuf.cpp
+// No-split ring buffer for host builds (see freertos/ringbuf.h). Items
+// take the space they would in esp-idf's: an 8 byte header and the data
+// rounded up to 4 bytes.
+// 05/2023
+
+#include "freertos/ringbuf.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#define HOST_RINGBUF_HEADER 8
+
+struct host_ringbuf {
+    std::mutex lock;
+    std::condition_variable ready;
+    std::deque<std::vector<char>> items;
+    size_t size;
+    size_t used;
+};
+
+static size_t item_cost(size_t len) {
+    return HOST_RINGBUF_HEADER + ((len + 3) & ~(size_t)3);
+}
+
+RingbufHandle_t xRingbufferCreate(size_t size, RingbufferType_t type) {
+    RingbufHandle_t ring = new host_ringbuf;
+    ring->size = size;
+    ring->used = 0;
+    return ring;
+}
+
+void vRingbufferDelete(RingbufHandle_t ring) {
+    delete ring;
+}
+
+BaseType_t xRingbufferSend(RingbufHandle_t ring, const void *data, size_t len, TickType_t wait) {
+    std::lock_guard<std::mutex> guard(ring->lock);
+    if (ring->used + item_cost(len) > ring->size) {
+        return pdFALSE;
+    }
+    ring->used += item_cost(len);
+    ring->items.emplace_back((const char *)data, (const char *)data + len);
+    ring->ready.notify_one();
+    return pdTRUE;
+}
+
+void *xRingbufferReceive(RingbufHandle_t ring, size_t *len, TickType_t wait) {
+    std::unique_lock<std::mutex> guard(ring->lock);
+    ring->ready.wait(guard, [&] { return !ring->items.empty(); });
+    *len = ring->items.front().size();
+    return ring->items.front().data();
+}
+
+void vRingbufferReturnItem(RingbufHandle_t ring, void *item) {
+    std::lock_guard<std::mutex> guard(ring->lock);
+    ring->used -= item_cost(ring->items.front().size());
+    ring->items.pop_front();
+}
+
+size_t xRingbufferGetCurFreeSize(RingbufHandle_t ring) {
+    std::lock_guard<std::mutex> guard(ring->lock);
+    size_t free = ring->size - ring->used;
+    return free > HOST_RINGBUF_HEADER ? free - HOST_RINGBUF_HEADER : 0;
+}
@@ -0,0 +1,82 @@
+// host_spi.cpp
+// Simulated SPI master for host builds (see driver/spi_master.h). One
+// loopback device; transactions run back to back in queue order, and
+// only come back from spi_device_get_trans_result once the simulated
+// clock has passed their end.
+// 05/2023
+
+#include "driver/spi_master.h"
+
+#include <string.h>
+
+#include "esp_timer.h"
+
+#define HOST_SPI_QUEUE 8
+
+struct spi_device_t {
+    int clock_hz;
+    int queue_size;
+    spi_transaction_t *queue[HOST_SPI_QUEUE];
+    int64_t done_us[HOST_SPI_QUEUE];
+    int head, count;
+    int64_t bus_free_us;
+};
+
+static spi_device_t device;
+static int64_t overhead_us = 10;
+static int corrupt_every, received;
+
+void host_spi_set_overhead(int64_t us) {
+    overhead_us = us;
+}
+
+void host_spi_set_corrupt_every(int n) {
+    corrupt_every = n;
+    received = 0;
+}
+
+esp_err_t spi_bus_initialize(spi_host_device_t, const spi_bus_config_t *, int) {
+    return ESP_OK;
+}
+
+esp_err_t spi_bus_add_device(spi_host_device_t, const spi_device_interface_config_t *config,
+                             spi_device_handle_t *handle) {
+    if (config->queue_size > HOST_SPI_QUEUE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    device = {};
+    device.clock_hz = config->clock_speed_hz;
+    device.queue_size = config->queue_size;
+    *handle = &device;
+    return ESP_OK;
+}
+
+esp_err_t spi_device_queue_trans(spi_device_handle_t dev, spi_transaction_t *trans, TickType_t) {
+    if (dev->count == dev->queue_size) {
+        return ESP_ERR_TIMEOUT;
+    }
+    int64_t now = esp_timer_get_time();
+    int64_t start = dev->bus_free_us > now ? dev->bus_free_us : now;
+    dev->bus_free_us = start + overhead_us + (int64_t)trans->length * 1000000 / dev->clock_hz;
+    int i = (dev->head + dev->count++) % HOST_SPI_QUEUE;
+    dev->queue[i] = trans;
+    dev->done_us[i] = dev->bus_free_us;
+    return ESP_OK;
+}
+
+esp_err_t spi_device_get_trans_result(spi_device_handle_t dev, spi_transaction_t **trans,
+                                      TickType_t) {
+    if (dev->count == 0 || dev->done_us[dev->head] > esp_timer_get_time()) {
+        return ESP_ERR_TIMEOUT;
+    }
+    spi_transaction_t *t = dev->queue[dev->head];
+    // Loopback: MISO is MOSI. DMA captures the frame as it finishes.
+    memcpy(t->rx_buffer, t->tx_buffer, t->length / 8);
+    if (corrupt_every > 0 && ++received % corrupt_every == 0) {
+        ((uint8_t *)t->rx_buffer)[t->length / 16] ^= 0x10;
+    }
+    dev->head = (dev->head + 1) % HOST_SPI_QUEUE;
+    dev->count--;
+    *trans = t;
+    return ESP_OK;
+}
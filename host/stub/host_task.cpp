@@ -0,0 +1,41 @@
+// host_task.cpp
+// FreeRTOS tasks for host builds (see freertos/task.h): detached threads,
+// with priorities and cores up to the host scheduler.
+// 05/2023
+
+#include "freertos/task.h"
+
+#include <chrono>
+#include <thread>
+
+BaseType_t xTaskCreate(void (*task)(void *), const char *name, uint32_t stack, void *param,
+                       UBaseType_t priority, TaskHandle_t *handle) {
+    std::thread(task, param).detach();
+    if (handle != nullptr) {
+        *handle = nullptr;
+    }
+    return pdPASS;
+}
+
+BaseType_t xTaskCreatePinnedToCore(void (*task)(void *), const char *name, uint32_t stack,
+                                   void *param, UBaseType_t priority, TaskHandle_t *handle,
+                                   BaseType_t core) {
+    return xTaskCreate(task, name, stack, param, priority, handle);
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t wait) {
+    if (wait != portMAX_DELAY) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(wait * portTICK_PERIOD_MS));
+    }
+    return 0;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken) {
+    if (woken != nullptr) {
+        *woken = pdFALSE;
+    }
+}
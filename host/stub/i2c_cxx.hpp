@@ -0,0 +1,24 @@
+// i2c_cxx.hpp
+// Host stand-in for esp-idf's C++ I2C classes: the address type drivers
+// keep.
+// 05/2023
+
+#ifndef HOST_I2C_CXX_H
+#define HOST_I2C_CXX_H
+
+#include <stdint.h>
+
+namespace idf {
+
+class I2CAddress {
+public:
+    explicit I2CAddress(uint8_t address) : address(address) {}
+    uint8_t get_value() const { return address; }
+
+private:
+    uint8_t address;
+};
+
+} // namespace idf
+
+#endif
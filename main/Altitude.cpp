@@ -0,0 +1,254 @@
+// Altitude.cpp
+// Barometer and accelerometer altitude filter. See Altitude.hpp.
+// 05/2023
+
+#include "Altitude.hpp"
+
+#include <math.h>
+
+#define STANDARD_G 9.80665
+
+// ### Compile time helpers ###
+
+// <cmath> isn't constexpr, so the table and gains below use these. Only
+// good near the arguments they're used with.
+static constexpr double cx_ln(double x) {
+    // 2 atanh((x - 1) / (x + 1)), for x in about [0.1, 10]
+    double z = (x - 1) / (x + 1), z2 = z * z, term = z, sum = 0;
+    for (int i = 1; i < 200; i += 2) {
+        sum += term / i;
+        term *= z2;
+    }
+    return 2 * sum;
+}
+
+static constexpr double cx_exp(double x) {
+    double term = 1, sum = 1;
+    for (int i = 1; i < 40; i++) {
+        term *= x / i;
+        sum += term;
+    }
+    return sum;
+}
+
+static constexpr int64_t cx_round(double x) {
+    return (int64_t)(x >= 0 ? x + 0.5 : x - 0.5);
+}
+
+// ### Pressure to altitude ###
+
+// Table of standard atmosphere altitudes every 256Pa, interpolated.
+// Interpolation error is under 0.2m at 20kPa and a few cm at the pad.
+#define BARO_TABLE_MIN (80u << 16) // 20.48kPa, Pa Q24.8
+#define BARO_TABLE_STEP_LOG2 16    // 256Pa
+#define BARO_TABLE_SIZE 353        // to 110.59kPa
+
+struct baro_table_t {
+    int32_t h[BARO_TABLE_SIZE];
+};
+
+static constexpr baro_table_t make_baro_table() {
+    baro_table_t t = {};
+    for (int i = 0; i < BARO_TABLE_SIZE; i++) {
+        double pa = (double)((BARO_TABLE_MIN >> 8) + (i << (BARO_TABLE_STEP_LOG2 - 8)));
+        double h = 44330.77 * (1 - cx_exp(0.190263 * cx_ln(pa / 101325)));
+        t.h[i] = (int32_t)cx_round(h * 65536);
+    }
+    return t;
+}
+
+static constexpr baro_table_t BARO_TABLE = make_baro_table();
+
+int32_t baro_altitude(uint32_t pressure) {
+    const uint32_t max = BARO_TABLE_MIN + ((BARO_TABLE_SIZE - 1) << BARO_TABLE_STEP_LOG2);
+    if (pressure <= BARO_TABLE_MIN) {
+        return BARO_TABLE.h[0];
+    }
+    if (pressure >= max) {
+        return BARO_TABLE.h[BARO_TABLE_SIZE - 1];
+    }
+    uint32_t offset = pressure - BARO_TABLE_MIN;
+    uint32_t i = offset >> BARO_TABLE_STEP_LOG2;
+    int64_t frac = offset & ((1u << BARO_TABLE_STEP_LOG2) - 1);
+    int32_t h0 = BARO_TABLE.h[i];
+    return h0 + (int32_t)(((int64_t)(BARO_TABLE.h[i + 1] - h0) * frac) >> BARO_TABLE_STEP_LOG2);
+}
+
+// ### Gains ###
+
+/**
+ * Steady state gains for a barometer update every `t` seconds, from
+ * iterating the Kalman filter's covariance until it settles. Inputs are
+ * the vertical acceleration between updates; the state transition is
+ *
+ *   h += v t - b t^2 / 2,  v -= b t,  b unchanged
+ *
+ * on top of what the measured acceleration adds. The covariance is
+ * symmetric, so only its six distinct terms are kept: the bias settles
+ * slowly, and a general 3x3 version runs out of constexpr budget.
+ */
+static constexpr altitude_gains_t solve_gains(double t) {
+    const double qa = ALTITUDE_ACCEL_NOISE * ALTITUDE_ACCEL_NOISE;
+    const double qb = ALTITUDE_BIAS_NOISE * ALTITUDE_BIAS_NOISE;
+    const double r = ALTITUDE_BARO_NOISE * ALTITUDE_BARO_NOISE;
+    const double u = t * t / 2;
+    // [[a b c] [b d e] [c e f]], for altitude, velocity and bias
+    double a = 100, b = 0, c = 0, d = 100, e = 0, f = 1;
+    double k0 = 0, k1 = 0, k2 = 0;
+
+    for (int iter = 0; iter < 200000; iter++) {
+        // P = F P F' + Q
+        double r00 = a + t * b - u * c, r01 = b + t * d - u * e, r02 = c + t * e - u * f;
+        double r11 = d - t * e, r12 = e - t * f;
+        a = r00 + t * r01 - u * r02 + qa * t * t * t / 3;
+        b = r01 - t * r02 + qa * u;
+        c = r02;
+        d = r11 - t * r12 + qa * t;
+        e = r12;
+        f += qb * t;
+
+        // Altitude is measured directly.
+        double s = a + r;
+        double n0 = a / s, n1 = b / s, n2 = c / s;
+        d -= n1 * b;
+        e -= n1 * c;
+        f -= n2 * c;
+        b -= n0 * b;
+        c -= n0 * c;
+        a -= n0 * a;
+
+        double change = (n0 > k0 ? n0 - k0 : k0 - n0) + (n1 > k1 ? n1 - k1 : k1 - n1) +
+                        (n2 > k2 ? n2 - k2 : k2 - n2);
+        k0 = n0;
+        k1 = n1;
+        k2 = n2;
+        if (iter > 0 && change < 1e-13) {
+            break;
+        }
+    }
+    return {{(int32_t)cx_round(k0 * (1 << 24)), (int32_t)cx_round(k1 * (1 << 24)),
+             (int32_t)cx_round(k2 * (1 << 24))}};
+}
+
+// Both barometers update every filter, each at its own interval, so
+// updates arrive twice as often as either one reads.
+static constexpr altitude_gains_t GAINS_FULL = solve_gains(BARO_INTERVAL_FULL_US / 2e6);
+static constexpr altitude_gains_t GAINS_LOW = solve_gains(BARO_INTERVAL_LOW_US / 2e6);
+
+// ### Filter ###
+
+// Raw accel counts (Q14, as rotated below) to m/s^2 Q16, as a Q32 factor.
+static constexpr int64_t ACCEL_SCALE = cx_round(STANDARD_G / IMU_ACCEL_LSB_PER_G / (1 << 14) *
+                                                65536.0 * 4294967296.0);
+static constexpr int32_t G_Q16 = (int32_t)cx_round(STANDARD_G * 65536);
+
+static int32_t q14(float v) {
+    return (int32_t)lroundf(v * (1 << 14));
+}
+
+AltitudeEstimator::AltitudeEstimator() {
+    reset();
+    setRate(RATE_LOW);
+}
+
+void AltitudeEstimator::reset() {
+    h = v = b = 0;
+    ground = 0;
+    accel = 0;
+    initialised = false;
+    tracking = true;
+    cycles.reset();
+}
+
+void AltitudeEstimator::setRate(sample_rate rate) {
+    gains = rate == RATE_FULL ? &GAINS_FULL : &GAINS_LOW;
+}
+
+/**
+ * Each reading's specific force is rotated into the vertical (the third
+ * row of q's rotation matrix, Q14), gravity and the bias are taken off,
+ * and what's left is integrated: velocity by the rectangle rule, altitude
+ * by the trapezoid rule, which is exact for constant acceleration.
+ */
+void AltitudeEstimator::update(const imu_reading_t *readings, size_t n, uint32_t dt_us,
+                               const quat_t &q) {
+    if (n == 0 || !initialised) {
+        return;
+    }
+    uint32_t start = cpu_cycles();
+
+    int32_t r0 = q14(2 * (q.x * q.z - q.w * q.y));
+    int32_t r1 = q14(2 * (q.y * q.z + q.w * q.x));
+    int32_t r2 = q14(q.w * q.w - q.x * q.x - q.y * q.y + q.z * q.z);
+    // Seconds, Q32.
+    int64_t dt = (int64_t)(((uint64_t)dt_us * 281474977u) >> 16);
+    int32_t bias = (int32_t)(b >> 16);
+
+    for (size_t i = 0; i < n; i++) {
+        const imu_reading_t &r = readings[i];
+        int32_t up = r0 * r.acc_x + r1 * r.acc_y + r2 * r.acc_z;
+        int32_t a = (int32_t)(((int64_t)up * ACCEL_SCALE) >> 32) - G_Q16 - bias;
+        int64_t v1 = v + (((int64_t)a * dt) >> 16);
+        int32_t mean = (int32_t)((v + v1) >> 17);
+        h += ((int64_t)mean * dt) >> 16;
+        v = v1;
+        accel = a;
+    }
+    cycles.add(start, n);
+}
+
+void AltitudeEstimator::baro(uint32_t pressure) {
+    int32_t z = baro_altitude(pressure);
+    if (!initialised) {
+        h = (int64_t)z << 16;
+        v = b = 0;
+        ground = h;
+        initialised = true;
+        return;
+    }
+
+    int32_t e = z - (int32_t)(h >> 16);
+    h += ((int64_t)e * gains->k[0]) >> 8;
+    v += ((int64_t)e * gains->k[1]) >> 8;
+    b += ((int64_t)e * gains->k[2]) >> 8;
+    if (tracking) {
+        ground = h;
+    }
+}
+
+void AltitudeEstimator::save(altitude_state_t *state) const {
+    *state = {};
+    state->h = (int32_t)(h >> 16);
+    state->v = (int32_t)(v >> 16);
+    state->b = (int32_t)(b >> 16);
+    state->ground = (int32_t)(ground >> 16);
+    state->accel = accel;
+    state->initialised = initialised;
+}
+
+void AltitudeEstimator::restore(const altitude_state_t &state, uint32_t elapsed_us) {
+    h = (int64_t)state.h << 16;
+    v = (int64_t)state.v << 16;
+    b = (int64_t)state.b << 16;
+    ground = (int64_t)state.ground << 16;
+    accel = state.accel;
+    initialised = state.initialised;
+
+    // h += v t + a t^2 / 2, v += a t
+    int64_t t = (int64_t)(((uint64_t)elapsed_us * 281474977u) >> 16);
+    int64_t dv = ((int64_t)accel * t) >> 16;
+    h += (((v + dv / 2) >> 16) * t) >> 16;
+    v += dv;
+}
+
+int32_t AltitudeEstimator::altitudeMm() const {
+    return (int32_t)(((h - ground) * 1000) >> 32);
+}
+
+int32_t AltitudeEstimator::velocityMmS() const {
+    return (int32_t)((v * 1000) >> 32);
+}
+
+int32_t AltitudeEstimator::biasMmS2() const {
+    return (int32_t)((b * 1000) >> 32);
+}
@@ -0,0 +1,189 @@
+// Attitude.cpp
+// Mahony orientation filter on raw ICM20948 readings. See Attitude.hpp.
+// 05/2023
+
+#include "Attitude.hpp"
+
+#include <string.h>
+#include <math.h>
+
+static constexpr float GYRO_RAD_PER_LSB = (float)(M_PI / 180.0) / IMU_GYRO_LSB_PER_DPS;
+// Accel gate bounds on |a|^2, in raw counts squared.
+static constexpr float ACCEL_MIN2 = (1 - ATTITUDE_ACCEL_GATE) * (1 - ATTITUDE_ACCEL_GATE) *
+                                    IMU_ACCEL_LSB_PER_G * IMU_ACCEL_LSB_PER_G;
+static constexpr float ACCEL_MAX2 = (1 + ATTITUDE_ACCEL_GATE) * (1 + ATTITUDE_ACCEL_GATE) *
+                                    IMU_ACCEL_LSB_PER_G * IMU_ACCEL_LSB_PER_G;
+
+/**
+ * 1 / sqrt(x) from a bit-level first guess and two Newton steps, good to
+ * about 5e-6. Square roots and divides aren't single instructions on the
+ * ESP32's FPU, so this is several times cheaper than 1 / sqrtf(x).
+ */
+static inline float inv_sqrt(float x) {
+    uint32_t i;
+    float y;
+    memcpy(&i, &x, sizeof(i));
+    i = 0x5f375a86 - (i >> 1);
+    memcpy(&y, &i, sizeof(y));
+    y = y * (1.5f - 0.5f * x * y * y);
+    y = y * (1.5f - 0.5f * x * y * y);
+    return y;
+}
+
+AttitudeEstimator::AttitudeEstimator() {
+    reset();
+}
+
+void AttitudeEstimator::reset() {
+    q = {1, 0, 0, 0};
+    half_dt = 0;
+    ix = iy = iz = 0;
+    rate[0] = rate[1] = rate[2] = 0;
+    cycles.reset();
+}
+
+/**
+ * One filter step.
+ *
+ * The error between the measured and estimated directions of gravity and
+ * the magnetic field (their cross product) is fed back into the gyro rate
+ * before it's integrated. The field's reference direction is taken from
+ * the measurement itself, so only its inclination matters and the local
+ * declination doesn't. A reading without a magnetometer sample (all
+ * zero) corrects tilt only.
+ */
+void AttitudeEstimator::step(const imu_reading_t &r) {
+    float gx = r.gyr_x * GYRO_RAD_PER_LSB;
+    float gy = r.gyr_y * GYRO_RAD_PER_LSB;
+    float gz = r.gyr_z * GYRO_RAD_PER_LSB;
+    float qw = q.w, qx = q.x, qy = q.y, qz = q.z;
+    rate[0] = gx;
+    rate[1] = gy;
+    rate[2] = gz;
+
+    float ax = r.acc_x, ay = r.acc_y, az = r.acc_z;
+    float a2 = ax * ax + ay * ay + az * az;
+    if (a2 >= ACCEL_MIN2 && a2 <= ACCEL_MAX2) {
+        float n = inv_sqrt(a2);
+        ax *= n;
+        ay *= n;
+        az *= n;
+
+        // Estimated gravity direction, halved.
+        float vx = qx * qz - qw * qy;
+        float vy = qw * qx + qy * qz;
+        float vz = qw * qw - 0.5f + qz * qz;
+        float ex = ay * vz - az * vy;
+        float ey = az * vx - ax * vz;
+        float ez = ax * vy - ay * vx;
+
+        // The AK09916's y and z point the other way to the accel/gyro axes.
+        float mx = r.mag_x, my = -(float)r.mag_y, mz = -(float)r.mag_z;
+        float m2 = mx * mx + my * my + mz * mz;
+        if (m2 > 0) {
+            n = inv_sqrt(m2);
+            mx *= n;
+            my *= n;
+            mz *= n;
+
+            // Field in the world frame, and its reference (bx, 0, bz).
+            float hx = 2 * (mx * (0.5f - qy * qy - qz * qz) + my * (qx * qy - qw * qz) +
+                            mz * (qx * qz + qw * qy));
+            float hy = 2 * (mx * (qx * qy + qw * qz) + my * (0.5f - qx * qx - qz * qz) +
+                            mz * (qy * qz - qw * qx));
+            float h2 = hx * hx + hy * hy;
+            float bx = h2 > 0 ? h2 * inv_sqrt(h2) : 0;
+            float bz = 2 * (mx * (qx * qz - qw * qy) + my * (qy * qz + qw * qx) +
+                            mz * (0.5f - qx * qx - qy * qy));
+
+            // Estimated field direction, halved.
+            float wx = bx * (0.5f - qy * qy - qz * qz) + bz * (qx * qz - qw * qy);
+            float wy = bx * (qx * qy - qw * qz) + bz * (qw * qx + qy * qz);
+            float wz = bx * (qw * qy + qx * qz) + bz * (0.5f - qx * qx - qy * qy);
+            ex += my * wz - mz * wy;
+            ey += mz * wx - mx * wz;
+            ez += mx * wy - my * wx;
+        }
+
+        if (ATTITUDE_TWO_KI > 0) {
+            ix += ATTITUDE_TWO_KI * ex * 2 * half_dt;
+            iy += ATTITUDE_TWO_KI * ey * 2 * half_dt;
+            iz += ATTITUDE_TWO_KI * ez * 2 * half_dt;
+            gx += ix;
+            gy += iy;
+            gz += iz;
+        }
+        gx += ATTITUDE_TWO_KP * ex;
+        gy += ATTITUDE_TWO_KP * ey;
+        gz += ATTITUDE_TWO_KP * ez;
+    }
+
+    // q += q * (0, g) * dt / 2
+    gx *= half_dt;
+    gy *= half_dt;
+    gz *= half_dt;
+    qw += -q.x * gx - q.y * gy - q.z * gz;
+    qx += q.w * gx + q.y * gz - q.z * gy;
+    qy += q.w * gy - q.x * gz + q.z * gx;
+    qz += q.w * gz + q.x * gy - q.y * gx;
+
+    // One more Newton step here: an error of 5e-6 in the norm alone reads
+    // as a third of a degree.
+    float n2 = qw * qw + qx * qx + qy * qy + qz * qz;
+    float n = inv_sqrt(n2);
+    n = n * (1.5f - 0.5f * n2 * n * n);
+    q = {qw * n, qx * n, qy * n, qz * n};
+}
+
+void AttitudeEstimator::save(attitude_state_t *state) const {
+    state->q = q;
+    state->rate[0] = rate[0];
+    state->rate[1] = rate[1];
+    state->rate[2] = rate[2];
+}
+
+/**
+ * The turn is applied exactly, as the rotation by |rate| t about the rate
+ * vector, so a steady roll comes out right however long the gap.
+ */
+void AttitudeEstimator::restore(const attitude_state_t &state, uint32_t elapsed_us) {
+    q = state.q;
+    ix = iy = iz = 0;
+    rate[0] = state.rate[0];
+    rate[1] = state.rate[1];
+    rate[2] = state.rate[2];
+
+    float wn = sqrtf(rate[0] * rate[0] + rate[1] * rate[1] + rate[2] * rate[2]);
+    if (wn > 0) {
+        float half = 0.5e-6f * elapsed_us * wn;
+        float c = cosf(half), s = sinf(half) / wn;
+        float rx = rate[0] * s, ry = rate[1] * s, rz = rate[2] * s;
+        // q = q * (c, r)
+        q = {q.w * c - q.x * rx - q.y * ry - q.z * rz, q.w * rx + q.x * c + q.y * rz - q.z * ry,
+             q.w * ry - q.x * rz + q.y * c + q.z * rx, q.w * rz + q.x * ry - q.y * rx + q.z * c};
+    }
+}
+
+void AttitudeEstimator::update(const imu_reading_t *readings, size_t n, uint32_t dt_us) {
+    if (n == 0) {
+        return;
+    }
+    uint32_t start = cpu_cycles();
+    half_dt = 0.5e-6f * dt_us;
+    for (size_t i = 0; i < n; i++) {
+        step(readings[i]);
+    }
+    cycles.add(start, n);
+}
+
+/**
+ * From the rotation between them, conj(a) * b, as 2 atan2(|vector|, |scalar|)
+ * rather than 2 acos(scalar), which loses small angles to rounding.
+ */
+float quat_angle(const quat_t &a, const quat_t &b) {
+    float w = a.w * b.w + a.x * b.x + a.y * b.y + a.z * b.z;
+    float x = a.w * b.x - a.x * b.w - a.y * b.z + a.z * b.y;
+    float y = a.w * b.y + a.x * b.z - a.y * b.w - a.z * b.x;
+    float z = a.w * b.z - a.x * b.y + a.y * b.x - a.z * b.w;
+    return 2 * atan2f(sqrtf(x * x + y * y + z * z), fabsf(w));
+}
@@ -0,0 +1,59 @@
+// Checkpoint.cpp
+// Flight state in RTC memory. See Checkpoint.hpp.
+// 05/2023
+
+#include "Checkpoint.hpp"
+
+#include <stddef.h>
+#include <string.h>
+
+#include "esp_attr.h"
+#include "Crc32.hpp"
+
+// Left alone by the startup code, so whatever was there before the reset
+// still is. Garbage after power on, which the CRC catches.
+static RTC_NOINIT_ATTR checkpoint_t saved[2];
+
+static uint32_t checkpoint_crc(const checkpoint_t *cp) {
+    return crc32_update(0, cp, offsetof(checkpoint_t, crc));
+}
+
+static bool checkpoint_valid(const checkpoint_t *cp) {
+    return cp->magic == CHECKPOINT_MAGIC && cp->version == CHECKPOINT_VERSION &&
+           cp->crc == checkpoint_crc(cp);
+}
+
+Checkpoint::Checkpoint() {
+    if (!load(&current)) {
+        clear();
+    }
+}
+
+bool Checkpoint::load(checkpoint_t *out) const {
+    bool a = checkpoint_valid(&saved[0]), b = checkpoint_valid(&saved[1]);
+    if (!a && !b) {
+        return false;
+    }
+    // Sequence numbers only ever differ by one, so wrapping is fine.
+    bool newer = a && b ? (int32_t)(saved[1].sequence - saved[0].sequence) > 0 : b;
+    memcpy(out, &saved[newer], sizeof(*out));
+    return true;
+}
+
+void Checkpoint::clear() {
+    memset(saved, 0, sizeof(saved));
+    memset(&current, 0, sizeof(current));
+    current.magic = CHECKPOINT_MAGIC;
+    current.version = CHECKPOINT_VERSION;
+}
+
+/**
+ * Each save goes to the copy not holding the newest one. The CRC is
+ * worked out in RAM first, so the copy in RTC memory only takes the one
+ * memcpy to go from stale to current.
+ */
+void Checkpoint::save() {
+    current.sequence++;
+    current.crc = checkpoint_crc(&current);
+    memcpy(&saved[current.sequence & 1], &current, sizeof(current));
+}
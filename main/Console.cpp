@@ -0,0 +1,80 @@
+// Console.cpp
+// Non-blocking console output through a RAM ring and a drain task.
+// 05/2023
+
+#include "Console.hpp"
+
+#include <atomic>
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/ringbuf.h"
+
+static RingbufHandle_t ring = nullptr;
+static std::atomic<uint32_t> dropped(0);
+
+/**
+ * Moves messages from the ring to stdout. The blocking UART write happens
+ * here, in the lowest priority task, instead of in whoever logged.
+ */
+static void console_task(void *param) {
+    for (;;) {
+        size_t len;
+        char *msg = (char *)xRingbufferReceive(ring, &len, portMAX_DELAY);
+        if (msg == nullptr) {
+            continue;
+        }
+        fwrite(msg, 1, len, stdout);
+        vRingbufferReturnItem(ring, msg);
+        // Only push stdio's buffer out once there is nothing else to write.
+        if (xRingbufferGetCurFreeSize(ring) >= CONSOLE_BUFFER / 2) {
+            fflush(stdout);
+        }
+    }
+}
+
+bool console_init() {
+    if (ring != nullptr) {
+        return true;
+    }
+    RingbufHandle_t rb = xRingbufferCreate(CONSOLE_BUFFER, RINGBUF_TYPE_NOSPLIT);
+    if (rb == nullptr) {
+        return false;
+    }
+    ring = rb;
+    if (xTaskCreate(console_task, "console", CONSOLE_TASK_STACK, nullptr,
+                    CONSOLE_TASK_PRIORITY, nullptr) != pdPASS) {
+        ring = nullptr;
+        vRingbufferDelete(rb);
+        return false;
+    }
+    return true;
+}
+
+void console_write(const char *msg, size_t len) {
+    if (ring == nullptr) {
+        fwrite(msg, 1, len, stdout);
+        return;
+    }
+    if (xRingbufferSend(ring, msg, len, 0) != pdTRUE) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void console_printf(const char *fmt, ...) {
+    char line[CONSOLE_LINE_MAX];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    if (len < 0) {
+        return;
+    }
+    console_write(line, (size_t)len < sizeof(line) ? (size_t)len : sizeof(line) - 1);
+}
+
+uint32_t console_dropped() {
+    return dropped.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,440 @@
+// FlashLog.cpp
+// Page-structured flight log with write-behind staging.
+// 05/2023
+
+#include "FlashLog.hpp"
+
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+static uint32_t page_address(uint32_t index) {
+    return index * W25Q128_PAGE_SIZE;
+}
+
+FlashLog::FlashLog(W25Q128 &primary, W25Q128 *staging)
+    : primary(primary), staging(staging) {
+    buf_head = 0;
+    buf_count = 0;
+    head = 0;
+    memset(erased, 0, sizeof(erased));
+    staging_tail = 0;
+    staging_head = 0;
+    staging_erased = 0;
+    erasing = UINT32_MAX;
+    staging_erasing = false;
+    moved = 0;
+    counters = {};
+    memset(bufs[0].data, 0xff, LOG_PAGE_DATA);
+    bufs[0].used = 0;
+}
+
+void FlashLog::waitIdle(W25Q128 &chip) {
+    while (chip.busy() && chip.isAlive()) {
+        vTaskDelay(1);
+    }
+}
+
+bool FlashLog::stagingUsable() {
+    return staging != nullptr && staging->isAlive();
+}
+
+/**
+ * Copies any staged pages whose holes in the primary are still erased
+ * back into place, then wipes the staging ring so stale copies can never
+ * be migrated into a later log.
+*/
+void FlashLog::recoverStaging() {
+    bool dirty = false;
+    log_page_t header;
+
+    for (uint32_t slot = 0; slot < LOG_STAGING_PAGES; slot++) {
+        if (staging->read(page_address(slot), &header, LOG_PAGE_HEADER) != STATUS_OK) {
+            return;
+        }
+        if (header.magic == LOG_PAGE_ERASED) {
+            continue;
+        }
+        dirty = true;
+        if (header.magic != LOG_PAGE_MAGIC || header.index >= W25Q128_PAGES) {
+            continue;
+        }
+
+        uint16_t magic;
+        if (primary.read(page_address(header.index), &magic, sizeof(magic)) != STATUS_OK ||
+            magic != LOG_PAGE_ERASED) {
+            continue;
+        }
+        if (staging->read(page_address(slot), &migrate_buf, W25Q128_PAGE_SIZE) == STATUS_OK &&
+            primary.program(page_address(header.index), &migrate_buf, W25Q128_PAGE_SIZE) == STATUS_OK) {
+            counters.pages_migrated++;
+            waitIdle(primary);
+        }
+    }
+
+    if (dirty) {
+        for (uint32_t a = 0; a < LOG_STAGING_PAGES * W25Q128_PAGE_SIZE; a += W25Q128_BLOCK_SIZE) {
+            staging->eraseBlock(a);
+            waitIdle(*staging);
+        }
+    }
+}
+
+/**
+ * Find the end of the log.
+ * 
+ * Pages are written in index order (holes left by staging are filled in
+ * by `recoverStaging` first), so the first erased page can be found with
+ * a binary search over page headers.
+ * 
+ * @return status: STATUS_OK, or STATUS_FAILED if the primary can't be read.
+*/
+status FlashLog::mount() {
+    if (stagingUsable()) {
+        recoverStaging();
+        staging_tail = staging_head = 0;
+        staging_erased = LOG_STAGING_PAGES;
+    } else {
+        staging_tail = staging_head = staging_erased = 0;
+    }
+
+    uint32_t lo = 0, hi = W25Q128_PAGES;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        uint16_t magic;
+        if (primary.read(page_address(mid), &magic, sizeof(magic)) != STATUS_OK) {
+            return STATUS_FAILED;
+        }
+        if (magic != LOG_PAGE_ERASED) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    head = lo;
+    moved++;
+    // The rest of the block holding the head is still erased. Anything
+    // beyond it is erased again before use, in case it holds an older log.
+    memset(erased, 0, sizeof(erased));
+    if (head % W25Q128_PAGES_PER_BLOCK != 0) {
+        uint32_t block = head / W25Q128_PAGES_PER_BLOCK;
+        erased[block / 8] |= 1 << (block % 8);
+    }
+    return STATUS_OK;
+}
+
+/**
+ * Pick up the log where `pos` left it, as long as the chips agree.
+ *
+ * The chips aren't reset with the ESP32, so anything they were doing
+ * finishes first. Staged pages are found again from their headers. At
+ * most one page can have been handed out after `pos` was saved, since it
+ * is saved every slot and a slot writes at most one: it is picked up if
+ * its header is there. Pages still in RAM at the reset are lost.
+ *
+ * @return STATUS_OK, or STATUS_FAILED if `pos` doesn't fit the chips.
+*/
+status FlashLog::resume(const log_position_t &pos) {
+    if (pos.head > W25Q128_PAGES || pos.staging_tail > pos.staging_head ||
+        pos.staging_head > pos.staging_erased ||
+        pos.staging_erased > pos.staging_tail + LOG_STAGING_PAGES ||
+        (pos.staging_erased > 0 && !stagingUsable())) {
+        return STATUS_FAILED;
+    }
+    waitIdle(primary);
+    if (stagingUsable()) {
+        waitIdle(*staging);
+    }
+
+    head = pos.head;
+    memcpy(erased, pos.erased, sizeof(erased));
+    staging_tail = pos.staging_tail;
+    staging_head = pos.staging_head;
+    staging_erased = pos.staging_erased;
+    erasing = UINT32_MAX;
+    staging_erasing = false;
+
+    log_page_t header;
+    for (uint32_t p = staging_tail; p < staging_head; p++) {
+        uint32_t slot = p % LOG_STAGING_PAGES;
+        if (staging->read(page_address(slot), &header, LOG_PAGE_HEADER) != STATUS_OK ||
+            header.magic != LOG_PAGE_MAGIC || header.index >= head) {
+            return STATUS_FAILED;
+        }
+        targets[slot] = header.index;
+    }
+
+    if (head < W25Q128_PAGES && blockErased(head)) {
+        if (primary.read(page_address(head), &header, LOG_PAGE_HEADER) != STATUS_OK) {
+            return STATUS_FAILED;
+        }
+        if (header.magic != LOG_PAGE_ERASED) {
+            // Written, or cut short by the reset - either way taken.
+            head++;
+        }
+    }
+    if (staging_head < staging_erased) {
+        uint32_t slot = staging_head % LOG_STAGING_PAGES;
+        if (staging->read(page_address(slot), &header, LOG_PAGE_HEADER) != STATUS_OK) {
+            return STATUS_FAILED;
+        }
+        if (header.magic != LOG_PAGE_ERASED) {
+            if (header.magic != LOG_PAGE_MAGIC || header.index != head) {
+                return STATUS_FAILED;
+            }
+            targets[slot] = head;
+            staging_head++;
+            head++;
+        }
+    }
+    moved++;
+    return STATUS_OK;
+}
+
+void FlashLog::position(log_position_t *pos) const {
+    pos->head = head;
+    pos->staging_tail = staging_tail;
+    pos->staging_head = staging_head;
+    pos->staging_erased = staging_erased;
+    if (staging_erasing) {
+        pos->staging_erased -= W25Q128_PAGES_PER_BLOCK;
+    }
+    memcpy(pos->erased, erased, sizeof(erased));
+    if (erasing != UINT32_MAX) {
+        uint32_t block = erasing / W25Q128_PAGES_PER_BLOCK;
+        pos->erased[block / 8] &= ~(1 << (block % 8));
+    }
+}
+
+bool FlashLog::blockErased(uint32_t index) {
+    uint32_t block = index / W25Q128_PAGES_PER_BLOCK;
+    return erased[block / 8] & (1 << (block % 8));
+}
+
+/**
+ * Start erasing the primary block holding page `index`.
+ * 
+ * Only called for blocks whose bit is clear, which can't hold any
+ * programmed page of this log: the primary never programs an unerased
+ * block, so at most they hold holes.
+ * 
+ * @return true if the erase was started.
+*/
+bool FlashLog::eraseFor(uint32_t index) {
+    if (primary.eraseBlock(page_address(index)) != STATUS_OK) {
+        return false;
+    }
+    uint32_t block = index / W25Q128_PAGES_PER_BLOCK;
+    erased[block / 8] |= 1 << (block % 8);
+    erasing = index;
+    moved++;
+    return true;
+}
+
+/**
+ * The page currently being filled, or nullptr if every buffer is waiting
+ * to be written out.
+*/
+log_page_t *FlashLog::openPage() {
+    if (buf_count == LOG_PAGE_BUFFERS) {
+        return nullptr;
+    }
+    return &bufs[(buf_head + buf_count) % LOG_PAGE_BUFFERS];
+}
+
+/**
+ * Encode a record into the open page, closing it first if it won't fit.
+ * 
+ * @return false if the record was dropped.
+*/
+bool FlashLog::append(uint8_t type, uint32_t time_us, const void *data, size_t len) {
+    if (len > LOG_RECORD_MAX) {
+        counters.records_dropped++;
+        return false;
+    }
+
+    log_page_t *page = openPage();
+    if (page != nullptr && page->used + sizeof(log_record_t) + len > LOG_PAGE_DATA) {
+        flush();
+        page = openPage();
+    }
+    if (page == nullptr) {
+        counters.records_dropped++;
+        return false;
+    }
+
+    log_record_t rec = {type, (uint8_t)len, time_us, 0};
+    rec.crc = log_record_crc(&rec, data);
+    memcpy(&page->data[page->used], &rec, sizeof(rec));
+    memcpy(&page->data[page->used + sizeof(rec)], data, len);
+    page->used += sizeof(rec) + len;
+    return true;
+}
+
+void FlashLog::flush() {
+    log_page_t *page = openPage();
+    if (page == nullptr || page->used == 0) {
+        return;
+    }
+    page->magic = LOG_PAGE_MAGIC;
+    buf_count++;
+
+    page = openPage();
+    if (page != nullptr) {
+        memset(page->data, 0xff, LOG_PAGE_DATA);
+        page->used = 0;
+    }
+}
+
+/**
+ * Write out, stage, migrate and erase - whatever the chips are free for.
+ * 
+ * At most one operation is started per chip, so this costs a couple of
+ * status reads and at most one page transfer each way.
+*/
+void FlashLog::poll() {
+    bool primary_free = !primary.busy();
+    bool staging_free = stagingUsable() && !staging->busy();
+    if (primary_free && erasing != UINT32_MAX) {
+        erasing = UINT32_MAX;
+        moved++;
+    }
+    if (staging_free && staging_erasing) {
+        staging_erasing = false;
+        moved++;
+    }
+
+    // A page that was waiting for a buffer can be opened now.
+    bool was_full = buf_count == LOG_PAGE_BUFFERS;
+
+    if (buf_count > 0 && head < W25Q128_PAGES) {
+        log_page_t &page = bufs[buf_head];
+        page.index = head;
+        page.crc = log_page_crc(&page);
+
+        if (primary_free && blockErased(head)) {
+            if (primary.program(page_address(head), &page, W25Q128_PAGE_SIZE) == STATUS_OK) {
+                counters.pages_written++;
+                head++;
+                moved++;
+                buf_head = (buf_head + 1) % LOG_PAGE_BUFFERS;
+                buf_count--;
+            }
+            primary_free = false;
+        } else if (staging_free && staging_head < staging_erased) {
+            uint32_t slot = staging_head % LOG_STAGING_PAGES;
+            if (staging->program(page_address(slot), &page, W25Q128_PAGE_SIZE) == STATUS_OK) {
+                counters.pages_staged++;
+                targets[slot] = head;
+                staging_head++;
+                head++;
+                moved++;
+                buf_head = (buf_head + 1) % LOG_PAGE_BUFFERS;
+                buf_count--;
+            }
+            staging_free = false;
+        }
+    }
+
+    if (was_full && buf_count < LOG_PAGE_BUFFERS) {
+        log_page_t *page = openPage();
+        memset(page->data, 0xff, LOG_PAGE_DATA);
+        page->used = 0;
+    }
+
+    // The primary's own head comes first. Anything else waits until no
+    // pages are queued: erasing one block ahead, then migrating staged
+    // pages (erasing the blocks holding their holes first).
+    if (primary_free && head < W25Q128_PAGES) {
+        uint32_t next = (head / W25Q128_PAGES_PER_BLOCK + 1) * W25Q128_PAGES_PER_BLOCK;
+        if (!blockErased(head)) {
+            eraseFor(head);
+        } else if (buf_count > 0) {
+            // leave the primary for the next page
+        } else if (next < W25Q128_PAGES && !blockErased(next)) {
+            eraseFor(next);
+        } else if (staging_free && staging_tail < staging_head) {
+            uint32_t slot = staging_tail % LOG_STAGING_PAGES;
+            if (!blockErased(targets[slot])) {
+                eraseFor(targets[slot]);
+            } else if (staging->read(page_address(slot), &migrate_buf, W25Q128_PAGE_SIZE) == STATUS_OK &&
+                       migrate_buf.magic == LOG_PAGE_MAGIC && migrate_buf.index == targets[slot] &&
+                       primary.program(page_address(targets[slot]), &migrate_buf,
+                                       W25Q128_PAGE_SIZE) == STATUS_OK) {
+                counters.pages_migrated++;
+                staging_tail++;
+                moved++;
+            }
+        }
+    }
+
+    // Erase the next staging block once nothing in it is waiting to be
+    // migrated.
+    if (staging_free && staging_erased - staging_head < W25Q128_PAGES_PER_BLOCK &&
+        staging_erased + W25Q128_PAGES_PER_BLOCK <= staging_tail + LOG_STAGING_PAGES) {
+        uint32_t slot = staging_erased % LOG_STAGING_PAGES;
+        if (staging->eraseBlock(page_address(slot)) == STATUS_OK) {
+            staging_erased += W25Q128_PAGES_PER_BLOCK;
+            staging_erasing = true;
+            moved++;
+        }
+    }
+}
+
+/**
+ * Read one page of the log through the merged view.
+ * 
+ * @return STATUS_OK, STATUS_MISBEHAVING if a chip is busy (try again), or
+ *         STATUS_FAILED if the page doesn't exist or was lost.
+*/
+status FlashLog::readPage(uint32_t index, log_page_t *page) {
+    if (index >= head) {
+        return STATUS_FAILED;
+    }
+
+    status s = primary.read(page_address(index), page, W25Q128_PAGE_SIZE);
+    if (s != STATUS_OK || (page->magic == LOG_PAGE_MAGIC && page->index == index)) {
+        return s;
+    }
+
+    for (uint32_t pos = staging_tail; pos < staging_head; pos++) {
+        uint32_t slot = pos % LOG_STAGING_PAGES;
+        if (targets[slot] == index) {
+            s = staging->read(page_address(slot), page, W25Q128_PAGE_SIZE);
+            if (s != STATUS_OK || page->magic == LOG_PAGE_MAGIC) {
+                return s;
+            }
+            break;
+        }
+    }
+    return STATUS_FAILED;
+}
+
+/**
+ * Checks every page of the log (see log_verify_page), through the merged
+ * view. Blocks; meant for offload, with logging stopped.
+ * 
+ * @return STATUS_OK, or STATUS_FAILED if a page couldn't be read at all.
+*/
+status FlashLog::verify(log_verify_t *result) {
+    *result = {};
+    log_page_t page;
+
+    for (uint32_t index = 0; index < head; index++) {
+        status s;
+        while ((s = readPage(index, &page)) == STATUS_MISBEHAVING) {
+            vTaskDelay(1);
+        }
+        if (s != STATUS_OK) {
+            // Neither chip has a copy with the right header. Judge
+            // whatever the primary holds (a hole, or a damaged page).
+            waitIdle(primary);
+            if (primary.read(page_address(index), &page, sizeof(page)) != STATUS_OK) {
+                return STATUS_FAILED;
+            }
+        }
+        log_verify_page(&page, index, result);
+    }
+    return STATUS_OK;
+}
@@ -0,0 +1,98 @@
+// LiveStream.cpp
+// Framed binary stream of live sensor readings for diagnostic mode.
+// 05/2023
+
+#include "LiveStream.hpp"
+
+#include <string.h>
+
+#include "esp_rom_crc.h"
+
+LiveStream::LiveStream(uint32_t mask) : mask(mask) {
+    dropped_count = 0;
+    ready = false;
+    pm_lock = nullptr;
+    cmd_len = 0;
+}
+
+/**
+ * Installs the UART driver on the console port and raises the baud rate.
+ * 
+ * The driver's TX ring buffer is refilled into the hardware FIFO from the
+ * UART interrupt, so `send` only ever copies into RAM.
+ * 
+ * @return true if the UART is ready.
+*/
+bool LiveStream::init() {
+    uart_config_t config = {};
+    config.baud_rate = LIVE_BAUD;
+    config.data_bits = UART_DATA_8_BITS;
+    config.parity = UART_PARITY_DISABLE;
+    config.stop_bits = UART_STOP_BITS_1;
+    config.flow_ctrl = UART_HW_FLOWCTRL_DISABLE;
+    config.source_clk = UART_SCLK_DEFAULT;
+
+    if (uart_driver_install(LIVE_UART, LIVE_RX_BUFFER, LIVE_TX_BUFFER, 0, NULL, 0) != ESP_OK ||
+        uart_param_config(LIVE_UART, &config) != ESP_OK) {
+        return false;
+    }
+    // LIVE_BAUD is too fast for the REF_TICK clock that would survive
+    // frequency scaling. Fails harmlessly without CONFIG_PM_ENABLE.
+    if (esp_pm_lock_create(ESP_PM_APB_FREQ_MAX, 0, "live", &pm_lock) == ESP_OK) {
+        esp_pm_lock_acquire(pm_lock);
+    }
+    ready = true;
+    return true;
+}
+
+/**
+ * Frames and queues a run of readings.
+ * 
+ * @return false if the stream isn't up, the payload is too long, or the
+ *         TX buffer was too full (counted in `dropped`).
+*/
+bool LiveStream::send(uint8_t channel, uint32_t time_us, const void *data, size_t len) {
+    if (!ready || len > LIVE_MAX_PAYLOAD) {
+        return false;
+    }
+
+    uint8_t frame[sizeof(live_header_t) + LIVE_MAX_PAYLOAD + sizeof(uint32_t)];
+    live_header_t header = {LIVE_SYNC, channel, (uint8_t)len, time_us};
+    memcpy(frame, &header, sizeof(header));
+    memcpy(frame + sizeof(header), data, len);
+    size_t n = sizeof(header) + len;
+    uint32_t crc = esp_rom_crc32_le(0, frame, n);
+    memcpy(frame + n, &crc, sizeof(crc));
+    n += sizeof(crc);
+
+    size_t space;
+    if (uart_get_tx_buffer_free_size(LIVE_UART, &space) != ESP_OK || space < n) {
+        dropped_count++;
+        return false;
+    }
+    uart_write_bytes(LIVE_UART, frame, n);
+    return true;
+}
+
+/**
+ * Reads any pending command bytes without waiting. A complete
+ * LIVE_CMD_MASK command replaces the channel mask; anything else is
+ * ignored.
+*/
+void LiveStream::poll() {
+    if (!ready) {
+        return;
+    }
+
+    uint8_t c;
+    while (uart_read_bytes(LIVE_UART, &c, 1, 0) == 1) {
+        if (cmd_len == 0 && c != LIVE_CMD_MASK) {
+            continue;
+        }
+        cmd[cmd_len++] = c;
+        if (cmd_len == sizeof(cmd)) {
+            memcpy(&mask, &cmd[1], sizeof(mask));
+            cmd_len = 0;
+        }
+    }
+}
@@ -0,0 +1,68 @@
+// LogFormat.cpp
+// Integrity checks on flight log pages.
+// 05/2023
+
+#include "LogFormat.hpp"
+
+#include <string.h>
+
+/**
+ * Walks the records packed in a page, checking each one's CRC if the
+ * page's own CRC didn't already cover them.
+ *
+ * Stops at the first record that runs past `used`, since nothing after
+ * it can be framed.
+ */
+static void verify_records(const log_page_t *page, bool check, log_verify_t *result) {
+    size_t used = page->used < LOG_PAGE_DATA ? page->used : LOG_PAGE_DATA;
+    size_t pos = 0;
+
+    while (pos + sizeof(log_record_t) <= used) {
+        log_record_t rec;
+        memcpy(&rec, &page->data[pos], sizeof(rec));
+        if (pos + sizeof(rec) + rec.len > used) {
+            result->records_corrupt++;
+            return;
+        }
+        if (!check || log_record_crc(&rec, &page->data[pos + sizeof(rec)]) == rec.crc) {
+            result->records_ok++;
+        } else {
+            result->records_corrupt++;
+        }
+        pos += sizeof(rec) + rec.len;
+    }
+}
+
+/**
+ * Checks one page.
+ *
+ * An erased page only counts as such. Anything else must have the magic,
+ * the expected index, a sane length and a matching CRC to be good. The
+ * records of a page that isn't are still checked one by one, so the
+ * result says how much of it can be recovered.
+ */
+void log_verify_page(const log_page_t *page, uint32_t index, log_verify_t *result) {
+    if (page->magic == LOG_PAGE_ERASED) {
+        result->pages_erased++;
+        return;
+    }
+    result->end = index + 1;
+
+    bool good = page->magic == LOG_PAGE_MAGIC && page->index == index &&
+                page->used <= LOG_PAGE_DATA && log_page_crc(page) == page->crc;
+    if (good) {
+        result->pages_ok++;
+    } else {
+        result->pages_corrupt++;
+    }
+    if (page->magic == LOG_PAGE_MAGIC) {
+        verify_records(page, !good, result);
+    }
+}
+
+void log_verify_pages(const log_page_t *pages, uint32_t first, uint32_t count,
+                      log_verify_t *result) {
+    for (uint32_t i = 0; i < count; i++) {
+        log_verify_page(&pages[i], first + i, result);
+    }
+}
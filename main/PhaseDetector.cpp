@@ -0,0 +1,130 @@
+// PhaseDetector.cpp
+// Flight phase from the accelerometers. See PhaseDetector.hpp.
+// 05/2023
+
+#include "PhaseDetector.hpp"
+
+#include "Attitude.hpp"
+
+// Counts at which the ICM20948's +-16g accelerometer is clipping.
+#define PHASE_IMU_CLIP 32000
+
+PhaseDetector::PhaseDetector() {
+    reset(PHASE_PAD);
+}
+
+void PhaseDetector::reset(flight_phase next) {
+    phase = next;
+    holding = false;
+    since_us = 0;
+    axis[0] = axis[1] = axis[2] = 0;
+    imu_seen = false;
+    imu_us = 0;
+}
+
+flight_phase PhaseDetector::update(const pipeline_block_t &block) {
+    const imu_block_t *imu = block.imu[0].n > 0 ? &block.imu[0] : &block.imu[1];
+    bool clipping = false;
+    for (uint32_t i = 0; i < imu->n; i++) {
+        for (int c = IMU_ACC_X; c <= IMU_ACC_Z; c++) {
+            int32_t v = imu->ch[c][i];
+            clipping = clipping || v > PHASE_IMU_CLIP || v < -PHASE_IMU_CLIP;
+        }
+    }
+
+    if (imu->n > 0 && !clipping) {
+        for (uint32_t i = 0; i < imu->n; i++) {
+            int32_t mg[3], dps = 0;
+            for (int c = 0; c < 3; c++) {
+                mg[c] = (int32_t)(imu->ch[IMU_ACC_X + c][i] * 1000 / (int32_t)IMU_ACCEL_LSB_PER_G);
+                int32_t g = imu->ch[IMU_GYR_X + c][i];
+                g = g < 0 ? -g : g;
+                dps = g > dps ? g : dps;
+            }
+            reading(imu->time_us[i], mg, (int32_t)(dps / IMU_GYRO_LSB_PER_DPS));
+        }
+        imu_seen = true;
+        imu_us = imu->time_us[imu->n - 1];
+        return phase;
+    }
+    if (!clipping && imu_seen && block.time_us - imu_us < PHASE_IMU_STALE_US) {
+        return phase;
+    }
+
+    const accel_block_t *acc = block.accel[0].n > 0 ? &block.accel[0] : &block.accel[1];
+    for (uint32_t i = 0; i < acc->n; i++) {
+        int32_t mg[3];
+        for (int c = 0; c < 3; c++) {
+            mg[c] = acc->ch[ACC_X + c][i] * PHASE_ACCEL_MG_PER_LSB;
+        }
+        reading(acc->time_us[i], mg, -1);
+    }
+    return phase;
+}
+
+/**
+ * True once `condition` has held on every reading for `hold_us`.
+ */
+bool PhaseDetector::hold(bool condition, uint32_t time_us, uint32_t hold_us) {
+    if (!condition) {
+        holding = false;
+        return false;
+    }
+    if (!holding) {
+        holding = true;
+        since_us = time_us;
+    }
+    return time_us - since_us >= hold_us;
+}
+
+void PhaseDetector::reading(uint32_t time_us, const int32_t mg[3], int32_t dps) {
+    int64_t mag2 = (int64_t)mg[0] * mg[0] + (int64_t)mg[1] * mg[1] + (int64_t)mg[2] * mg[2];
+    bool done = false;
+
+    switch (phase) {
+    case PHASE_PAD: {
+        bool thrust = mag2 > (int64_t)PHASE_LAUNCH_MG * PHASE_LAUNCH_MG;
+        if (!thrust || !holding) {
+            axis[0] = axis[1] = axis[2] = 0;
+        }
+        done = hold(thrust, time_us, PHASE_LAUNCH_HOLD_US);
+        for (int c = 0; c < 3; c++) {
+            axis[c] += mg[c];
+        }
+        break;
+    }
+    case PHASE_BOOST: {
+        // After a warm boot into boost the axis is lost: go on the thrust
+        // dropping away instead.
+        bool burnout;
+        if (axis[0] == 0 && axis[1] == 0 && axis[2] == 0) {
+            burnout = mag2 < (int64_t)PHASE_LAUNCH_MG * PHASE_LAUNCH_MG;
+        } else {
+            burnout = axis[0] * mg[0] + axis[1] * mg[1] + axis[2] * mg[2] < 0;
+        }
+        done = hold(burnout, time_us, PHASE_BURNOUT_HOLD_US);
+        break;
+    }
+    case PHASE_COAST:
+        done = hold(mag2 < (int64_t)PHASE_ZERO_G_MG * PHASE_ZERO_G_MG, time_us,
+                    PHASE_ZERO_G_HOLD_US);
+        break;
+    case PHASE_MICROGRAVITY:
+        done = hold(mag2 > (int64_t)PHASE_DESCENT_MG * PHASE_DESCENT_MG, time_us,
+                    PHASE_DESCENT_HOLD_US);
+        break;
+    case PHASE_DESCENT: {
+        const int64_t lo = 1000 - PHASE_STILL_MG, hi = 1000 + PHASE_STILL_MG;
+        bool still = mag2 > lo * lo && mag2 < hi * hi && dps >= 0 && dps < PHASE_STILL_DPS;
+        done = hold(still, time_us, PHASE_LANDED_HOLD_US);
+        break;
+    }
+    default:
+        break;
+    }
+
+    if (done) {
+        phase = (flight_phase)(phase + 1);
+        holding = false;
+    }
+}
@@ -0,0 +1,276 @@
+// Pipeline.cpp
+// On-board processing of sensor readings. See Pipeline.hpp.
+// 05/2023
+
+#include "Pipeline.hpp"
+
+#include <string.h>
+#include <math.h>
+
+static const uint8_t ACCEL_SOURCE[PIPELINE_ACCELS] = {DEV_ACC0, DEV_ACC1};
+static const uint8_t IMU_SOURCE[PIPELINE_IMUS] = {DEV_IMU0, DEV_IMU1};
+static const uint8_t BARO_SOURCE[PIPELINE_BAROS] = {DEV_BARO0, DEV_BARO1};
+
+Pipeline::Pipeline(pipeline_sink_t sink, void *ctx) : sink(sink), ctx(ctx) {
+    phase = PHASE_PAD;
+    for (int i = 0; i < PIPELINE_IMUS; i++) {
+        altitude_est[i].setRate(PHASE_CONFIG[phase].rate);
+        altitude_est[i].trackGround(true);
+        attitude_logged_us[i] = 0;
+        altitude_logged_us[i] = 0;
+        imu_timed[i] = false;
+    }
+}
+
+static int16_t q14(float v) {
+    int32_t x = (int32_t)lroundf(v * (1 << 14));
+    return (int16_t)(x > INT16_MAX ? INT16_MAX : x < INT16_MIN ? INT16_MIN : x);
+}
+
+attitude_sample_t attitude_sample(const AttitudeEstimator &est) {
+    const quat_t &q = est.attitude();
+    uint32_t cycles = est.stats().cycles_avg;
+    return {{q14(q.w), q14(q.x), q14(q.y), q14(q.z)},
+            (int16_t)(cycles > INT16_MAX ? INT16_MAX : cycles)};
+}
+
+altitude_sample_t altitude_sample(const AltitudeEstimator &est) {
+    return {est.altitudeMm(), est.velocityMmS(), est.biasMmS2(),
+            (int32_t)est.stats().cycles_avg};
+}
+
+/**
+ * Logs one block of readings from a device: its index in FLEET, then the
+ * readings. Timestamped when the block completes.
+ */
+void Pipeline::record_block(log_record_type type, uint8_t source, uint32_t time_us,
+                            const void *readings, size_t len) {
+    uint8_t buf[LOG_RECORD_MAX];
+    buf[0] = source;
+    memcpy(&buf[1], readings, len);
+    sink(ctx, type, time_us, buf, 1 + len);
+}
+
+/**
+ * Feeds one accelerometer's readings through its decimation stream into
+ * the flight log.
+ */
+void Pipeline::accel(int index, uint32_t time_us, const accel_reading_t *readings, size_t n) {
+    acc_streams[index].push(readings, n, [&](const accel_reading_t *block, size_t len) {
+        record_block(REC_ACCEL, ACCEL_SOURCE[index], time_us, block, len * sizeof(*block));
+    });
+}
+
+/**
+ * Time between one IMU's readings, from how far apart its blocks arrive.
+ * On board the ICM20948 is read once a slot rather than at its output
+ * data rate, and a flight log holds decimated readings, so the nominal
+ * rate is only used when there's nothing better.
+ */
+uint32_t Pipeline::imu_interval(int index, uint32_t time_us, size_t n) {
+    uint32_t span = time_us - imu_time_us[index];
+    bool timed = imu_timed[index];
+    imu_time_us[index] = time_us;
+    imu_timed[index] = true;
+    if (!timed || span == 0 || span > n * IMU_INTERVAL_MAX_US) {
+        float hz = PHASE_CONFIG[phase].rate == RATE_FULL ? IMU_RATE_FULL_HZ : IMU_RATE_LOW_HZ;
+        return (uint32_t)(1e6f / hz);
+    }
+    return span / n;
+}
+
+/**
+ * Runs one IMU's readings through its attitude and altitude estimators,
+ * and logs the estimates every ATTITUDE_LOG_US and ALTITUDE_LOG_US.
+ */
+void Pipeline::imu_estimate(int index, uint32_t time_us, const imu_reading_t *readings, size_t n) {
+    uint32_t dt_us = imu_interval(index, time_us, n);
+    attitude_est[index].update(readings, n, dt_us);
+    altitude_est[index].update(readings, n, dt_us, attitude_est[index].attitude());
+
+    if (time_us - attitude_logged_us[index] >= ATTITUDE_LOG_US) {
+        attitude_logged_us[index] = time_us;
+        attitude_sample_t s = attitude_sample(attitude_est[index]);
+        record_block(REC_ATTITUDE, IMU_SOURCE[index], time_us, &s, sizeof(s));
+    }
+    if (altitude_est[index].ready() && time_us - altitude_logged_us[index] >= ALTITUDE_LOG_US) {
+        altitude_logged_us[index] = time_us;
+        altitude_sample_t s = altitude_sample(altitude_est[index]);
+        record_block(REC_ALTITUDE, IMU_SOURCE[index], time_us, &s, sizeof(s));
+    }
+}
+
+/**
+ * Runs one IMU's readings through its estimators, then its decimation
+ * stream into the flight log.
+ */
+void Pipeline::imu(int index, uint32_t time_us, const imu_reading_t *readings, size_t n) {
+    if (n > 0) {
+        imu_estimate(index, time_us, readings, n);
+    }
+    imu_streams[index].push(readings, n, [&](const imu_reading_t *block, size_t len) {
+        record_block(REC_IMU, IMU_SOURCE[index], time_us, block, len * sizeof(*block));
+    });
+}
+
+/**
+ * Decimation reads the block's channels in place. Getting readings back
+ * out first costs more than the interleaved CIC would save.
+ */
+void Pipeline::accel(int index, const accel_block_t &block) {
+    if (block.n == 0) {
+        return;
+    }
+    uint32_t time_us = block.time_us[block.n - 1];
+    acc_streams[index].pushPlanar(block.ch[0], PIPELINE_BLOCK_ACCEL, block.n,
+                                  [&](const accel_reading_t *out, size_t len) {
+        record_block(REC_ACCEL, ACCEL_SOURCE[index], time_us, out, len * sizeof(*out));
+    });
+}
+
+/**
+ * The estimators step through a whole reading at a time, so get the block
+ * back as readings. Decimation takes those readings too: with them already
+ * in hand, the interleaved CIC is the faster one (host/soa_bench.cpp).
+ */
+void Pipeline::imu(int index, const imu_block_t &block) {
+    if (block.n == 0) {
+        return;
+    }
+    uint32_t time_us = block.time_us[block.n - 1];
+    imu_reading_t readings[PIPELINE_BLOCK_IMU];
+    for (size_t i = 0; i < block.n; i++) {
+        sample_block_get(block, i, &readings[i]);
+    }
+    imu_estimate(index, time_us, readings, block.n);
+    imu_streams[index].push(readings, block.n, [&](const imu_reading_t *out, size_t len) {
+        record_block(REC_IMU, IMU_SOURCE[index], time_us, out, len * sizeof(*out));
+    });
+}
+
+void Pipeline::baro(int index, const baro_block_t &block) {
+    for (size_t i = 0; i < block.n; i++) {
+        baro_reading_t reading;
+        sample_block_get(block, i, &reading);
+        baro(index, block.time_us[i], reading);
+    }
+}
+
+/**
+ * Logs a barometer reading, and corrects every IMU's altitude estimate
+ * with it. These are slow enough to store every one.
+ */
+void Pipeline::baro(int index, uint32_t time_us, const baro_reading_t &reading) {
+    record_block(REC_BARO, BARO_SOURCE[index], time_us, &reading, sizeof(reading));
+    if (reading.pressure == 0) {
+        return;
+    }
+    for (int i = 0; i < PIPELINE_IMUS; i++) {
+        altitude_est[i].baro(reading.pressure);
+    }
+}
+
+void pipeline_block_clear(pipeline_block_t *block, uint32_t time_us, flight_phase phase) {
+    block->time_us = time_us;
+    block->phase = phase;
+    for (int i = 0; i < PIPELINE_ACCELS; i++) {
+        sample_block_clear(&block->accel[i]);
+    }
+    for (int i = 0; i < PIPELINE_IMUS; i++) {
+        sample_block_clear(&block->imu[i]);
+    }
+    for (int i = 0; i < PIPELINE_BAROS; i++) {
+        sample_block_clear(&block->baro[i]);
+    }
+    block->records_len = 0;
+}
+
+bool pipeline_block_record(pipeline_block_t *block, log_record_type type, uint32_t time_us,
+                           const void *data, size_t len) {
+    log_record_t rec = {type, (uint8_t)len, time_us, 0};
+    if (len > LOG_RECORD_MAX || block->records_len + sizeof(rec) + len > PIPELINE_BLOCK_RECORDS) {
+        return false;
+    }
+    memcpy(&block->records[block->records_len], &rec, sizeof(rec));
+    memcpy(&block->records[block->records_len + sizeof(rec)], data, len);
+    block->records_len += sizeof(rec) + len;
+    return true;
+}
+
+/**
+ * The same calls System made straight from the drivers before the
+ * pipeline had a task of its own, in the same order, so a flight comes
+ * out the same either way.
+ */
+void Pipeline::process(const pipeline_block_t &block) {
+    if (block.phase != phase && block.phase < PHASE_COUNT) {
+        setPhase((flight_phase)block.phase, block.time_us);
+    }
+    for (size_t at = 0; at < block.records_len;) {
+        log_record_t rec;
+        memcpy(&rec, &block.records[at], sizeof(rec));
+        sink(ctx, (log_record_type)rec.type, rec.time_us, &block.records[at + sizeof(rec)], rec.len);
+        at += sizeof(rec) + rec.len;
+    }
+    for (int i = 0; i < PIPELINE_ACCELS; i++) {
+        accel(i, block.accel[i]);
+    }
+    for (int i = 0; i < PIPELINE_IMUS; i++) {
+        imu(i, block.imu[i]);
+    }
+    for (int i = 0; i < PIPELINE_BAROS; i++) {
+        baro(i, block.baro[i]);
+    }
+}
+
+void Pipeline::flush(uint32_t time_us) {
+    for (int i = 0; i < PIPELINE_ACCELS; i++) {
+        acc_streams[i].flush([&](const accel_reading_t *block, size_t len) {
+            record_block(REC_ACCEL, ACCEL_SOURCE[i], time_us, block, len * sizeof(*block));
+        });
+    }
+    for (int i = 0; i < PIPELINE_IMUS; i++) {
+        imu_streams[i].flush([&](const imu_reading_t *block, size_t len) {
+            record_block(REC_IMU, IMU_SOURCE[i], time_us, block, len * sizeof(*block));
+        });
+    }
+}
+
+void Pipeline::checkpoint(pipeline_checkpoint_t *cp) const {
+    *cp = {};
+    cp->phase = phase;
+    for (int i = 0; i < PIPELINE_IMUS; i++) {
+        attitude_est[i].save(&cp->attitude[i]);
+        altitude_est[i].save(&cp->altitude[i]);
+    }
+}
+
+void Pipeline::restore(const pipeline_checkpoint_t &cp, uint32_t elapsed_us, uint32_t time_us) {
+    for (int i = 0; i < PIPELINE_IMUS; i++) {
+        attitude_est[i].restore(cp.attitude[i], elapsed_us);
+        altitude_est[i].restore(cp.altitude[i], elapsed_us);
+    }
+    setPhase(cp.phase < PHASE_COUNT ? (flight_phase)cp.phase : PHASE_PAD, time_us);
+}
+
+void Pipeline::setPhase(flight_phase next, uint32_t time_us) {
+    const phase_config_t &config = PHASE_CONFIG[next];
+
+    flush(time_us);
+    for (int i = 0; i < PIPELINE_ACCELS; i++) {
+        acc_streams[i].setRatio(config.accel_log2);
+    }
+    for (int i = 0; i < PIPELINE_IMUS; i++) {
+        imu_streams[i].setRatio(config.imu_log2);
+        altitude_est[i].setRate(config.rate);
+        altitude_est[i].trackGround(next == PHASE_PAD);
+        if (config.rate != PHASE_CONFIG[phase].rate) {
+            // The next gap spans the old rate; don't take it as the new one.
+            imu_timed[i] = false;
+        }
+    }
+
+    uint8_t p = next;
+    sink(ctx, REC_PHASE, time_us, &p, sizeof(p));
+    phase = next;
+}
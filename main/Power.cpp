@@ -0,0 +1,148 @@
+// Power.cpp
+// CPU frequency scaling and light sleep between sample slots. See Power.hpp.
+// 05/2023
+
+#include "Power.hpp"
+
+#include "esp_timer.h"
+
+PowerManager::PowerManager() {
+    cpu_lock = nullptr;
+    awake_lock = nullptr;
+    store_lock = nullptr;
+    sleep_allowed = false;
+    period_us = 0;
+    depth = 0;
+    held_since = 0;
+    busy_us = 0;
+    interval_start = 0;
+    slots = 0;
+    wake_sum_us = 0;
+    wake_max_us = 0;
+}
+
+/**
+ * Configures dynamic frequency scaling with light sleep enabled, and
+ * takes the no-sleep lock straight away so nothing sleeps before the
+ * sample clock is running.
+ *
+ * @return false if power management isn't available (CONFIG_PM_ENABLE
+ *         and CONFIG_FREERTOS_USE_TICKLESS_IDLE) - the CPU then stays at
+ *         its default frequency.
+ */
+bool PowerManager::init() {
+    interval_start = esp_timer_get_time();
+
+    esp_pm_config_t config = {};
+    config.max_freq_mhz = POWER_CPU_MAX_MHZ;
+    config.min_freq_mhz = POWER_CPU_MIN_MHZ;
+    config.light_sleep_enable = true;
+    if (esp_pm_configure(&config) != ESP_OK) {
+        return false;
+    }
+    if (esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "slot", &cpu_lock) != ESP_OK) {
+        cpu_lock = nullptr;
+        return false;
+    }
+    if (esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "awake", &awake_lock) != ESP_OK) {
+        awake_lock = nullptr;
+        return false;
+    }
+    if (esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "store", &store_lock) != ESP_OK) {
+        store_lock = nullptr;
+        return false;
+    }
+    esp_pm_lock_acquire(awake_lock);
+    return true;
+}
+
+void PowerManager::setSlot(uint32_t period, bool sleep) {
+    period_us = period;
+    if (sleep == sleep_allowed) {
+        return;
+    }
+    sleep_allowed = sleep;
+    if (awake_lock != nullptr) {
+        if (sleep) {
+            esp_pm_lock_release(awake_lock);
+        } else {
+            esp_pm_lock_acquire(awake_lock);
+        }
+    }
+}
+
+void PowerManager::hold() {
+    if (depth++ > 0) {
+        return;
+    }
+    held_since = esp_timer_get_time();
+    if (cpu_lock != nullptr) {
+        // Switches the clock before returning.
+        esp_pm_lock_acquire(cpu_lock);
+    }
+}
+
+void PowerManager::release() {
+    if (depth == 0 || --depth > 0) {
+        return;
+    }
+    if (cpu_lock != nullptr) {
+        esp_pm_lock_release(cpu_lock);
+    }
+    busy_us += esp_timer_get_time() - held_since;
+}
+
+void PowerManager::storeBegin() {
+    if (store_lock != nullptr) {
+        esp_pm_lock_acquire(store_lock);
+    }
+}
+
+void PowerManager::storeEnd() {
+    if (store_lock != nullptr) {
+        esp_pm_lock_release(store_lock);
+    }
+}
+
+/**
+ * The latency is taken once the clock is back up, so it covers waking
+ * from light sleep, the esp_timer task, the switch to this task and the
+ * frequency switch - everything between the alarm and full speed work.
+ */
+void PowerManager::slotBegin(int64_t due_us) {
+    hold();
+    int64_t late = esp_timer_get_time() - due_us;
+    if (late < 0) {
+        late = 0;
+    }
+    slots++;
+    wake_sum_us += late;
+    if (late > wake_max_us) {
+        wake_max_us = (uint32_t)late;
+    }
+}
+
+power_stats_t PowerManager::snapshot(int64_t now) {
+    int64_t busy = busy_us;
+    if (depth > 0) {
+        // Count the running hold up to now, and the rest in the next one.
+        busy += now - held_since;
+        held_since = now;
+    }
+    int64_t elapsed = now - interval_start;
+
+    power_stats_t s;
+    s.slots = slots;
+    s.period_us = period_us;
+    s.duty_permille = elapsed > 0 ? (uint32_t)(busy * 1000 / elapsed) : 0;
+    s.sleep = sleep_allowed;
+    s.wake_avg_us = slots > 0 ? (uint32_t)(wake_sum_us / slots) : 0;
+    s.wake_max_us = wake_max_us;
+
+    interval_start = now;
+    busy_us = 0;
+    slots = 0;
+    wake_sum_us = 0;
+    wake_max_us = 0;
+    return s;
+}
@@ -7,12 +7,85 @@
 
 #include "System.hpp"
 
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+#include "esp_private/esp_clk.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#if CONFIG_HEAP_USE_HOOKS
+// Every heap allocation and free, from any task, for the REC_HEAP record.
+// Called from inside the allocator, so kept in IRAM and to one add.
+static std::atomic<uint32_t> heap_allocs, heap_frees;
+
+extern "C" void IRAM_ATTR esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps) {
+    heap_allocs.fetch_add(1, std::memory_order_relaxed);
+}
+
+extern "C" void IRAM_ATTR esp_heap_trace_free_hook(void *ptr) {
+    heap_frees.fetch_add(1, std::memory_order_relaxed);
+}
+#endif
+
 /**
  * Default constructor for the system class.
- * Encaspualtes all initialisation logic. This technically should be
- * a singleton class but I think nobody is going to go crazy with this.
+ * Only sets up members: `dm` is a global, so this runs during static
+ * initialisation, before the scheduler. Bring-up is in core_init. This
+ * technically should be a singleton class but I think nobody is going to
+ * go crazy with this.
  */
-System::System() {
+System::System() : devices(FLEET), pipeline(pipeline_sink, this), health(devices, ~STORAGE_DEVICES),
+                   storage_health(devices, STORAGE_DEVICES), i2c_bus("i2c0"), i2c1_bus("i2c1") {
+    phase = PHASE_PAD;
+    open_block = nullptr;
+    storage_task = nullptr;
+    acquire_task = nullptr;
+    acquire_busy_us = 0;
+    blocks_dropped = 0;
+    readings_dropped = 0;
+    records_dropped = 0;
+    queue_max = 0;
+    slots_missed = 0;
+    flush_requested = false;
+    flush_done = false;
+    encode_us = 0;
+    flash_us = 0;
+    blocks_done = 0;
+    stages_logged_us = 0;
+    flushing = false;
+    sample_timer = nullptr;
+    slot_us = SAMPLE_PERIOD_LOW_US;
+    slot_origin_us = 0;
+    last_slot_us = 0;
+    slot_late_max_us = 0;
+    last_stats_us = 0;
+    pool_fallbacks = 0;
+    time_offset_us = 0;
+    checkpoint_moves = 0;
+    attitude_sent_us = 0;
+    baro_due_us[0] = 0;
+    baro_due_us[1] = BARO_INTERVAL_LOW_US / 2;
+    warm = false;
+    flashmode = FLASH_INTERNAL;
+    mode = MODE_DIAGNOSTIC;
+}
+
+/**
+ * Brings up everything below the sensors: clock scaling, the mode
+ * jumpers, the flight checkpoint, flash and the logger.
+ * Must be called first, from a task, since the flash drivers wait on the
+ * chips with vTaskDelay.
+ */
+void System::core_init() {
+    // Before anything else starts drivers, so they come up with the
+    // clock scaling they'll run under.
+    power.init();
+
     // Initialise GPIO pins for system control
     gpio_config_t io_conf;
     io_conf.intr_type = GPIO_INTR_DISABLE;
@@ -27,10 +100,34 @@ System::System() {
     // how C++ handles enum types
     mode = (system_mode)(gpio_get_level(PIN_OFFLOAD) | (gpio_get_level(PIN_TESTMODE) << 1));
 
-    // Check if external flash is OK
-    if (flash.checkOK()) {
-        flashmode = FLASH_EXTERNAL;
-        // flash.init(); 
+    // Before anything is logged, since carrying on a flight moves the
+    // log's clock on.
+    warm = resume_checkpoint();
+
+    // Check if external flash is OK. With the buffer chip as well, full
+    // rate writes can be staged on it while the primary is busy.
+    // Diagnostic mode leaves the flash alone.
+    if (mode != MODE_DIAGNOSTIC && flash().init() == STATUS_OK) {
+        if (flashbuf().init() == STATUS_OK) {
+            flashmode = FLASH_TIERED;
+            flashlog.emplace(flash(), &flashbuf());
+        } else {
+            flashmode = FLASH_EXTERNAL;
+            flashlog.emplace(flash(), nullptr);
+        }
+        status s = STATUS_FAILED;
+        if (warm && checkpoint.state().logging) {
+            // Straight from the saved position, instead of searching the
+            // chip and migrating whatever is staged.
+            s = flashlog->resume(checkpoint.state().log);
+        }
+        if (s != STATUS_OK) {
+            s = flashlog->mount();
+        }
+        if (s != STATUS_OK) {
+            flashlog.reset();
+            flashmode = FLASH_INTERNAL;
+        }
     } else {
         // Switch to internal flash
         flashmode = FLASH_INTERNAL;
@@ -40,89 +137,836 @@ System::System() {
     
     // TODO: mount filesystem
 
+    log_internal("Core initialisation complete.\n", LOG_INFO);
+}
+
+/**
+ * Initialises both I2C buses for devices to use. imu1 is on its own on
+ * the second.
+ */
+void System::i2c_init() {
+    i2c.emplace(
+        idf::I2CNumber::I2C0(),
+        PIN_SCL, // the scl gpio pin
+        PIN_SDA, // the sda gpio pin
+        idf::Frequency::KHz(I2C_CLOCK_HZ / 1000)
+    );
+    i2c1.emplace(idf::I2CNumber::I2C1(), PIN_SCL1, PIN_SDA1, idf::Frequency::KHz(I2C_CLOCK_HZ / 1000));
+
+    // A stuck or stretching slave ends the transaction after
+    // I2C_HW_TIMEOUT_US instead of the driver's tick timeout.
+    int cycles = esp_clk_apb_freq() / 1000000 * I2C_HW_TIMEOUT_US;
+    i2c_set_timeout(I2C_NUM_0, cycles);
+    i2c_set_timeout(I2C_NUM_1, cycles);
+}
+
+/**
+ * Attempts to initialise all connected sensors.
+ * Must be called before attempting to read sensors.
+ * 
+ * @note System::i2c_init must succeed before calling this.
+ */
+void System::sensor_init() {
     // Check if RTC is connected
     // Timezone is hardcoded to UTC because we don't really care about it.
     struct timeval tv;
-    if (rtc.checkOK()) {
+    if (rtc().init() == STATUS_OK) {
         // If OK, set system time to RTC time
-        tv = rtc.getTime();
+        tv = rtc().getTime();
         settimeofday(&tv, NULL);
-        log_internal(std::string("RTC found. Setting system time to RTC time.\n"), LOG_INFO);
+        log_internal("RTC found. Setting system time to RTC time.\n", LOG_INFO);
     } else {
         // Otherwise, leave system time as is.
         tv.tv_sec = 0;
         tv.tv_usec = 0;
         settimeofday(&tv, NULL);
-        log_internal(std::string("RTC not found. Falling back to relative time.\n"), LOG_WARNING);
+        log_internal("RTC not found. Falling back to relative time.\n", LOG_WARNING);
     }
     // NOTE: We settimeofday inside of both branches of the if statement so
     //       our logging system can use the system time.
 
-    log_internal(std::string("Core initialisation complete.\n"), LOG_INFO);
+    // Data ready interrupts
+    gpio_install_isr_service(0);
+
+    acc0().init();
+    acc1().init();
+    baro0().init();
+    baro1().init();
+    imu0().init();
+    imu1().init();
+    // Each accelerometer sample is read out as INT1 flags it, rather than
+    // waiting for the next slot: the chip has no FIFO.
+    bool readers = acc0().startReader();
+    readers = acc1().startReader() && readers;
+    if (!readers) {
+        log_internal("Couldn't start the accelerometer readers, reading them each slot.\n", LOG_WARNING);
+    }
+
+#if SENSOR_ASYNC
+    if (!i2c_bus.init(sched)) {
+        log_internal("Couldn't start I2C worker, reading sensors synchronously.\n", LOG_WARNING);
+    } else if (!i2c1_bus.init(sched)) {
+        log_internal("Couldn't start I2C1 worker, reading imu1 on I2C0's.\n", LOG_WARNING);
+    }
+#endif
+
+    analog().init();
+    if (warm) {
+        // Mid-flight: logging comes first. The battery and payload were
+        // checked before launch, and waiting on them now would lose data.
+        payload().init();
+    } else {
+        if (!check_power()) {
+            log_internal("Battery low or not measurable.\n", LOG_WARNING);
+        }
+
+        if (!check_payload()) {
+            log_internal("Payload not responding.\n", LOG_WARNING);
+        }
+    }
+
+    // Sample clock: releases sensor_update once per slot, on this task.
+    acquire_task = xTaskGetCurrentTaskHandle();
+    esp_timer_create_args_t timer_args = {};
+    timer_args.callback = interrupt_handler;
+    timer_args.arg = this;
+    timer_args.name = "sample";
+    esp_timer_create(&timer_args, &sample_timer);
+
+    if (warm) {
+        // Back to the phase the reset interrupted, with the estimators
+        // carried forward over the time they missed.
+        checkpoint_t &cp = checkpoint.state();
+        sample_rate rate = PHASE_CONFIG[cp.pipeline.phase].rate;
+        if (rate != PHASE_CONFIG[phase].rate) {
+            set_rates(rate);
+        }
+        int64_t now = log_time();
+        pipeline.restore(cp.pipeline, (uint32_t)(now - cp.log_us), (uint32_t)now);
+        phase = pipeline.currentPhase();
+        detector.reset(phase);
+        cp.boots++;
+
+        char msg[112];
+        int len = snprintf(msg, sizeof(msg),
+                           "Warm boot %lu: logging again %lld us after the last checkpoint, "
+                           "%lld us after app start.\n",
+                           (unsigned long)cp.boots, (long long)(now - cp.saved_us),
+                           (long long)esp_timer_get_time());
+        record(REC_MESSAGE, msg, len < (int)sizeof(msg) ? len : sizeof(msg) - 1);
+        log_internal(msg, LOG_WARNING);
+    }
+    set_slot(PHASE_CONFIG[phase].rate);
+
+    // From here on the pipeline and the flight log are the storage task's.
+    if (xTaskCreatePinnedToCore(storage_run, "storage", STORAGE_TASK_STACK, this,
+                                STORAGE_TASK_PRIORITY, &storage_task, STORAGE_TASK_CORE) != pdPASS) {
+        storage_task = nullptr;
+        log_internal("Couldn't start storage task, storing between slots.\n", LOG_WARNING);
+    }
 }
 
 /**
- * Initialises the I2c bus for devices to use.
+ * Whether the last reset interrupted a flight, going by the checkpoint.
+ * If so the log clock picks up where it was: the RTC timer counted on
+ * through the reset, so the log time now is the saved one plus how far
+ * the RTC has moved since.
+ *
+ * Only a reset that keeps RTC memory can resume, and only mid-flight in
+ * a mode that logs. On the pad a reset is as good as a power cycle, and
+ * the startup checks are worth doing again. Anything else starts over.
  */
-void System::i2c_init() {
-    // Placeholder
+bool System::resume_checkpoint() {
+    const checkpoint_t &cp = checkpoint.state();
+    int64_t rtc = (int64_t)esp_clk_rtc_time();
+    bool resume = esp_reset_reason() != ESP_RST_POWERON && cp.sequence != 0 &&
+                  (mode == MODE_NORMAL || mode == MODE_TEST) && cp.mode == mode &&
+                  cp.pipeline.phase != PHASE_PAD && cp.pipeline.phase < PHASE_COUNT &&
+                  rtc >= cp.rtc_us;
+    if (!resume) {
+        checkpoint.clear();
+        return false;
+    }
+    time_offset_us = cp.log_us + (rtc - cp.rtc_us) - esp_timer_get_time();
+    return true;
+}
 
-    i2c = std::make_shared<idf::I2CMaster>(
-        idf::I2CNumber::I2C0(), // I2C1() for second bus
-        PIN_SCL, // the scl gpio pin
-        PIN_SDA, // the sda gpio pin
-        idf::Frequency::KHz(40)
-    );
+/**
+ * Keeps the checkpoint up to date: the log position whenever it moved,
+ * and the pipeline's state every CHECKPOINT_INTERVAL_US. Nothing is
+ * written if neither is due. Called by storage after every poll of the
+ * flight log.
+ */
+void System::save_checkpoint() {
+    if (mode != MODE_NORMAL && mode != MODE_TEST) {
+        return;
+    }
+    uint32_t start = cpu_cycles();
+    checkpoint_t &cp = checkpoint.state();
+    int64_t now = log_time();
+    bool due = now - cp.log_us >= CHECKPOINT_INTERVAL_US;
+    bool moved = flashlog && flashlog->moves() != checkpoint_moves;
+    if (!due && !moved) {
+        return;
+    }
+
+    if (due) {
+        cp.rtc_us = (int64_t)esp_clk_rtc_time();
+        cp.log_us = log_time();
+        pipeline.checkpoint(&cp.pipeline);
+    }
+    if (flashlog) {
+        checkpoint_moves = flashlog->moves();
+        flashlog->position(&cp.log);
+    }
+    cp.mode = mode;
+    cp.logging = flashlog.has_value();
+    cp.saved_us = now;
+    checkpoint.save();
+    checkpoint_cycles.add(start, 1);
 }
 
 /**
- * Attempts to initialise all connected sensors.
- * Must be called before attempting to read sensors.
- * 
- * @note System::i2c_init must succeed before calling this.
+ * (Re)starts the sample clock at the slot length for `rate`.
+ *
+ * Full rate slots are too short to sleep through, so light sleep is only
+ * allowed between low rate ones.
  */
-void System::sensor_init() {
-    // Placeholder
-    imu0.init(this->i2c, false);
-    imu1.init(this->i2c, true);
+void System::set_slot(sample_rate rate) {
+    if (sample_timer == nullptr) {
+        return;
+    }
+    slot_us = slot_period_us(rate);
+    // The timer takes its start time a moment after this, so wake-up
+    // latencies read a few microseconds long rather than short.
+    slot_origin_us = esp_timer_get_time() + slot_us;
+    if (esp_timer_restart(sample_timer, slot_us) != ESP_OK) {
+        esp_timer_start_periodic(sample_timer, slot_us);
+    }
+    last_slot_us = 0;
+    power.setSlot(slot_us, rate == RATE_LOW);
 }
 
+/**
+ * Takes one sample slot's worth of readings from every device in service.
+ *
+ * Quarantined devices are skipped. Whatever bus time is left in the slot
+ * once the reads are done is handed to the health monitor, which will only
+ * use it if a check fits before the next slot starts.
+ *
+ * The CPU runs at full speed from the sample clock firing to the end of
+ * the slot's work, and scales down (or light sleeps, in low rate phases)
+ * while this is blocked waiting for the next one. What the slot produced
+ * goes to the storage task as one block at the end.
+ */
 void System::sensor_update() {
-    System::data_ready.acquire(); // block until data is ready
+    // Block until the sample clock fires. More than one tick means the
+    // last slot ran past the next one's start, and those are gone.
+    uint32_t ticks = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    if (ticks > 1) {
+        slots_missed.fetch_add(ticks - 1, std::memory_order_relaxed);
+    }
+    // The periodic timer keeps its cadence, so this slot fell due at the
+    // last multiple of slot_us since it started. A slot that overran
+    // shows up in slots_missed and slot_late_max_us instead.
+    int64_t woke = esp_timer_get_time();
+    power.slotBegin(woke - (woke - slot_origin_us) % slot_us);
+    int64_t slot_start = esp_timer_get_time();
+
+    // How late this slot started against the sample clock. Anything that
+    // blocks the loop (a slow bus, console output) shows up here.
+    if (last_slot_us != 0) {
+        int64_t late = slot_start - last_slot_us - slot_us;
+        if (late > slot_late_max_us) {
+            slot_late_max_us = late;
+        }
+    }
+    last_slot_us = slot_start;
+    // Bus retries must finish before the next slot is due.
+    transaction_deadline_us = slot_start + slot_us - SLOT_GUARD_US;
+
+    if (slot_start - last_stats_us >= STATS_INTERVAL_US) {
+        snapshot_stats(slot_start);
+    }
+
+#if SENSOR_ASYNC
+    if (i2c_bus.started()) {
+        // Every read is queued on the I2C worker up front, and the ADC,
+        // flash and payload work runs while they're on the wire.
+        if (health.usable(DEV_ACC0)) {
+            sched.spawn(acc0().updateAsync(i2c_bus));
+        }
+        if (health.usable(DEV_ACC1)) {
+            sched.spawn(acc1().updateAsync(i2c_bus));
+        }
+        if (health.usable(DEV_IMU0)) {
+            sched.spawn(imu0().updateAsync(i2c_bus));
+        }
+        if (health.usable(DEV_IMU1)) {
+            sched.spawn(imu1().updateAsync(i2c1_bus.started() ? i2c1_bus : i2c_bus));
+        }
+        if (baro_due(0, slot_start)) {
+            sched.spawn(baro0().updateAsync(i2c_bus));
+        }
+        if (baro_due(1, slot_start)) {
+            sched.spawn(baro1().updateAsync(i2c_bus));
+        }
+        service_io();
+        sched.run();
+
+        // The health checks and rate changes are synchronous, so they
+        // must only happen once the worker is idle again.
+        health.poll(esp_timer_get_time(), slot_start + slot_us - SLOT_GUARD_US);
+        log_samples();
+        if (live) {
+            live->poll();
+        }
+        commit_block();
+        acquire_busy_us.fetch_add((uint32_t)(esp_timer_get_time() - slot_start), std::memory_order_relaxed);
+        power.slotEnd();
+        return;
+    }
+#endif
+
+    if (health.usable(DEV_ACC0)) {
+        acc0().update();
+    }
+    if (health.usable(DEV_ACC1)) {
+        acc1().update();
+    }
+    if (health.usable(DEV_IMU0)) {
+        imu0().update();
+    }
+    if (health.usable(DEV_IMU1)) {
+        imu1().update();
+    }
+    if (baro_due(0, slot_start)) {
+        baro0().update();
+    }
+    if (baro_due(1, slot_start)) {
+        baro1().update();
+    }
+
+    health.poll(esp_timer_get_time(), slot_start + slot_us - SLOT_GUARD_US);
 
-    imu0.update();
-    imu1.update();
+    log_samples();
+    service_io();
+
+    if (live) {
+        live->poll();
+    }
+    commit_block();
+    acquire_busy_us.fetch_add((uint32_t)(esp_timer_get_time() - slot_start), std::memory_order_relaxed);
+    power.slotEnd();
+}
+
+/**
+ * Whether a barometer in service has a new measurement by `now`, moving
+ * its due time on if so. The BME280s run free, so reading them any
+ * faster would only repeat measurements.
+ */
+bool System::baro_due(int index, int64_t now) {
+    if (!health.usable(DEV_BARO0 + index) || now < baro_due_us[index]) {
+        return false;
+    }
+    int64_t interval = baro_interval_us(PHASE_CONFIG[phase].rate);
+    baro_due_us[index] += interval;
+    if (baro_due_us[index] <= now) {
+        // Fell behind (a rate change, or back from quarantine)
+        baro_due_us[index] = now + interval;
+    }
+    return true;
 }
 
 /**
- * Attempts to take a reading from each working accelerometer. 
+ * Logs every device's counters, and streams them in diagnostic mode.
+ * The power stats (duty cycle and wake-up latency) and the heap and pool
+ * stats are logged with them; storage logs its own (snapshot_stages).
+ */
+void System::snapshot_stats(int64_t now) {
+    last_stats_us = now;
+    bool streaming = live && live->enabled(LIVE_CHANNEL_STATS);
+
+    power_stats_t power_stats = power.snapshot(now);
+    record(REC_POWER, &power_stats, sizeof(power_stats));
+
+    multi_heap_info_t info;
+    heap_caps_get_info(&info, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    heap_stats_t heap = {};
+    heap.free_bytes = info.total_free_bytes;
+    heap.min_free_bytes = info.minimum_free_bytes;
+    heap.largest_block = info.largest_free_block;
+    if (info.total_free_bytes > 0) {
+        heap.fragmentation_permille =
+            1000 - (uint32_t)((uint64_t)info.largest_free_block * 1000 / info.total_free_bytes);
+    }
+#if CONFIG_HEAP_USE_HOOKS
+    heap.allocs = heap_allocs.exchange(0, std::memory_order_relaxed);
+    heap.frees = heap_frees.exchange(0, std::memory_order_relaxed);
+#endif
+    heap.samples = sample_pool.stats();
+    heap.coro = coro_pool.stats;
+    record(REC_HEAP, &heap, sizeof(heap));
+    if (heap.samples.fallbacks != pool_fallbacks) {
+        char msg[96];
+        int len = snprintf(msg, sizeof(msg),
+                           "Sample pool full: %lu batch(es) allocated from the heap, %lu so far.\n",
+                           (unsigned long)(heap.samples.fallbacks - pool_fallbacks),
+                           (unsigned long)heap.samples.fallbacks);
+        record(REC_MESSAGE, msg, len < (int)sizeof(msg) ? len : sizeof(msg) - 1);
+        log_internal(msg, LOG_WARNING);
+        pool_fallbacks = heap.samples.fallbacks;
+    }
+
+    uint8_t index = 0;
+    devices.forEach([&](auto &dev) {
+        uint8_t buf[1 + sizeof(device_stats_t)];
+        device_stats_t s = dev.ioStats().snapshot();
+        buf[0] = index++;
+        memcpy(&buf[1], &s, sizeof(s));
+        record(REC_STATS, buf, sizeof(buf));
+        if (streaming) {
+            live->send(LIVE_CHANNEL_STATS, (uint32_t)now, buf, sizeof(buf));
+        }
+    });
+}
+
+/**
+ * Per-slot work that doesn't touch the I2C bus: collects analog blocks
+ * and keeps the payload SPI transfers moving. The flash is storage's.
+ */
+void System::service_io() {
+    // The ADC runs off its own DMA; this only decimates what's arrived
+    // and hands the blocks to the log.
+    if (health.usable(DEV_ANALOG)) {
+        analog().update();
+        analog_reading_t block;
+        while (analog().read(&block, 1) == 1) {
+            analog_latest = block;
+            record(REC_ANALOG, &block, sizeof(block));
+            if (live && live->enabled(DEV_ANALOG)) {
+                live->send(DEV_ANALOG, (uint32_t)esp_timer_get_time(), &block, sizeof(block));
+            }
+        }
+    }
+
+    // The payload has its own SPI bus and DMA, so this only swaps buffers
+    // and requeues - it never waits on the RP2040.
+    payload().poll();
+}
+
+/**
+ * Starts streaming raw readings for diagnostic mode. Takes over the
+ * console UART.
  * 
- * @return std::vector<accel_reading_t> containing readings for each accelerometer
+ * @param mask Bit N set streams device_id N.
  */
-std::vector<accel_reading_t> System::accelread(void) {
-    // Placeholder
-    return std::vector<accel_reading_t>({0});
+void System::live_init(uint32_t mask) {
+    live.emplace(mask);
+    if (!live->init()) {
+        live.reset();
+        log_internal("Couldn't start live stream.\n", LOG_ERROR);
+    }
+}
+
+/**
+ * Sends a run of readings to the live stream, split into frames on whole
+ * readings.
+ */
+void System::stream(uint8_t channel, uint32_t time_us, const void *readings, size_t len, size_t size) {
+    const uint8_t *p = (const uint8_t *)readings;
+    size_t chunk = LIVE_MAX_PAYLOAD / size * size;
+    while (len > 0) {
+        size_t n = len < chunk ? len : chunk;
+        live->send(channel, time_us, p, n);
+        p += n;
+        len -= n;
+    }
+}
+
+/**
+ * Pipeline output goes straight to the flight log. On the storage task,
+ * like everything else that touches it.
+ */
+bool System::pipeline_sink(void *ctx, log_record_type type, uint32_t time_us,
+                           const void *data, size_t len) {
+    System *self = (System *)ctx;
+    if (!self->flashlog) {
+        return false;
+    }
+    return self->flashlog->append(type, time_us, data, len);
 }
+
 /**
- * Attempts to take a reading for each working IMU.
+ * Moves what the accelerometers, IMUs and barometers buffered this slot
+ * into the slot's block (and the live stream), passes the attitude
+ * estimate storage sent back on to the payload during microgravity, and
+ * moves on to the next flight phase once the readings show it.
  *
- * @return std::vector<imu_reading_t> containing readings for each imu
+ * If storage holds every block, the slot's readings are dropped and
+ * counted - apart from the accelerometers', which stay buffered in the
+ * drivers until there's room.
  */
-std::vector<imu_reading_t> System::imuread(void) {
-    // Placeholder
+void System::log_samples() {
+    uint32_t now = (uint32_t)log_time();
+
+    attitude_msg_t latest;
+    bool attitude = false;
+    while (attitude_out.pop(&latest)) {
+        attitude = true;
+    }
+    if (attitude) {
+        uint8_t msg[1 + sizeof(attitude_sample_t)];
+        msg[0] = PAYLOAD_MSG_ATTITUDE;
+        memcpy(&msg[1], &latest.imu[health.usable(DEV_IMU0) ? 0 : 1], sizeof(attitude_sample_t));
+        payload().send(LANE_TELEMETRY, msg, sizeof(msg));
+    }
+
+    ICM20948 *imus[] = {&imu0(), &imu1()};
+    BME280 *baros[] = {&baro0(), &baro1()};
+    pipeline_block_t *block = begin_block();
+    if (block == nullptr) {
+        uint32_t lost = 0;
+        for (int i = 0; i < 2; i++) {
+            lost += imus[i]->read().size() + baros[i]->read().size();
+        }
+        blocks_dropped.fetch_add(1, std::memory_order_relaxed);
+        readings_dropped.fetch_add(lost, std::memory_order_relaxed);
+        return;
+    }
+    block->time_us = now;
+
+    for (int i = 0; i < 2; i++) {
+        size_t from = block->accel[i].n;
+        if (accelread(i, &block->accel[i]) > 0 && live && live->enabled(DEV_ACC0 + i)) {
+            stream_block<accel_reading_t>(DEV_ACC0 + i, block->accel[i], from);
+        }
+    }
+    for (int i = 0; i < 2; i++) {
+        size_t from = block->imu[i].n;
+        if (imuread(i, &block->imu[i]) > 0 && live && live->enabled(DEV_IMU0 + i)) {
+            stream_block<imu_reading_t>(DEV_IMU0 + i, block->imu[i], from);
+        }
+    }
+    for (int i = 0; i < 2; i++) {
+        size_t from = block->baro[i].n;
+        if (baroread(i, &block->baro[i]) > 0 && live && live->enabled(DEV_BARO0 + i)) {
+            stream_block<baro_reading_t>(DEV_BARO0 + i, block->baro[i], from);
+        }
+    }
+
+    // Flights only: a bench test shouldn't switch rates on a bump.
+    if (mode == MODE_NORMAL || mode == MODE_TEST) {
+        flight_phase next = detector.update(*block);
+        if (next != phase) {
+            set_phase(next);
+        }
+    }
+}
 
-    return std::vector<imu_reading_t>({0});
+/**
+ * Streams a block's readings from `from` on, back as the drivers' structs,
+ * which is what the live stream carries.
+ */
+template <typename T, typename B>
+void System::stream_block(uint8_t channel, const B &block, size_t from) {
+    T readings[B::capacity];
+    size_t n = block.n - from;
+    for (size_t i = 0; i < n; i++) {
+        sample_block_get(block, from + i, &readings[i]);
+    }
+    stream(channel, block.time_us[block.n - 1], readings, n * sizeof(T), sizeof(T));
 }
 
 /**
- * Attempts to take a reading for each working IMU.
+ * The block this slot's readings and records go in, taking a free one if
+ * none is open yet. nullptr if storage has every block.
+ */
+pipeline_block_t *System::begin_block() {
+    if (open_block == nullptr) {
+        open_block = blocks.take();
+        if (open_block != nullptr) {
+            pipeline_block_clear(open_block, (uint32_t)log_time(), phase);
+        }
+    }
+    return open_block;
+}
+
+/**
+ * Hands the open block to storage and wakes it. Without a storage task
+ * (before sensor_init has started one, or if it couldn't), does storage's
+ * work here instead.
+ */
+void System::commit_block() {
+    if (open_block != nullptr) {
+        blocks.commit(open_block);
+        open_block = nullptr;
+        uint32_t depth = blocks.pending();
+        if (depth > queue_max.load(std::memory_order_relaxed)) {
+            queue_max.store(depth, std::memory_order_relaxed);
+        }
+    }
+    if (storage_task != nullptr) {
+        xTaskNotifyGive(storage_task);
+    } else {
+        storage_poll();
+    }
+}
+
+void System::storage_run(void *param) {
+    System *self = (System *)param;
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        self->storage_poll();
+    }
+}
+
+/**
+ * Storage's work, woken by each committed block: every block waiting
+ * goes through the pipeline, which encodes its output into log pages,
+ * then the flight log gets a poll and the checkpoint catches up, as the
+ * acquisition task used to do once a slot. FlashLog::poll never waits on
+ * a chip, so an erase holds nothing up here either. The flash chips'
+ * health checks run here too, between flash operations rather than
+ * racing them from acquisition.
  *
- * @return std::vector<baro_reading_t> containing readings for each barometer
+ * Time in the pipeline counts as encoding, the rest as flash I/O.
  */
-std::vector<baro_reading_t> System::baroread(void) {
-    // Placeholder
+void System::storage_poll() {
+    power.storeBegin();
+    pipeline_block_t *block;
+    do {
+        int64_t start = esp_timer_get_time();
+        block = blocks.next();
+        if (block != nullptr) {
+            pipeline.process(*block);
+            uint32_t time_us = block->time_us;
+            blocks.release(block);
+            blocks_done++;
+
+            if (pipeline.currentPhase() == PHASE_MICROGRAVITY &&
+                time_us - attitude_sent_us >= ATTITUDE_PAYLOAD_US) {
+                attitude_sent_us = time_us;
+                attitude_msg_t msg;
+                for (int i = 0; i < PIPELINE_IMUS; i++) {
+                    msg.imu[i] = attitude_sample(pipeline.attitude(i));
+                }
+                // Skipped if acquisition hasn't taken the last few.
+                attitude_out.push(msg);
+            }
+        }
+        int64_t encoded = esp_timer_get_time();
+        // Storage's own, apart from acquisition's slot deadline.
+        transaction_deadline_us = encoded + STORAGE_IO_DEADLINE_US;
+
+        if (flashlog) {
+            if (flush_requested.exchange(false)) {
+                flashlog->flush();
+                flushing = true;
+            }
+            flashlog->poll();
+            if (flushing && flashlog->drained()) {
+                flushing = false;
+                flush_done = true;
+            }
+        }
+        save_checkpoint();
+        storage_health.poll(esp_timer_get_time(), transaction_deadline_us);
+
+        int64_t end = esp_timer_get_time();
+        encode_us += encoded - start;
+        flash_us += end - encoded;
+        if (end - stages_logged_us >= STATS_INTERVAL_US) {
+            snapshot_stages(end);
+        }
+    } while (block != nullptr);
+    power.storeEnd();
+}
+
+static uint32_t permille(int64_t part, int64_t whole) {
+    return whole > 0 ? (uint32_t)(part * 1000 / whole) : 0;
+}
+
+/**
+ * Logs how busy each stage was since the last call, what was dropped
+ * between them, and what saving the checkpoint costs. Storage's side of
+ * snapshot_stats.
+ */
+void System::snapshot_stages(int64_t now) {
+    int64_t elapsed = now - stages_logged_us;
+    stages_logged_us = now;
+
+    stage_stats_t s;
+    s.blocks = blocks_done;
+    s.blocks_dropped = blocks_dropped.exchange(0, std::memory_order_relaxed);
+    s.readings_dropped = readings_dropped.exchange(0, std::memory_order_relaxed);
+    s.records_dropped = records_dropped.exchange(0, std::memory_order_relaxed);
+    s.queue_max = queue_max.exchange(0, std::memory_order_relaxed);
+    s.slots_missed = slots_missed.exchange(0, std::memory_order_relaxed);
+    s.acquire_permille = permille(acquire_busy_us.exchange(0, std::memory_order_relaxed), elapsed);
+    s.encode_permille = permille(encode_us, elapsed);
+    s.flash_permille = permille(flash_us, elapsed);
+    blocks_done = 0;
+    encode_us = 0;
+    flash_us = 0;
+
+    uint32_t time_us = (uint32_t)log_time();
+    pipeline_sink(this, REC_STAGES, time_us, &s, sizeof(s));
+    pipeline_sink(this, REC_CHECKPOINT, time_us, &checkpoint_cycles.stats(), sizeof(cycle_stats_t));
+}
+
+/**
+ * Switches stored rates (and sensor output rates) for a new flight phase.
+ * 
+ * The next slot's block carries the new phase to the pipeline, which
+ * writes out blocks already collected at the old rate first, and logs the
+ * phase change itself so the decoder knows the new rates.
+ */
+void System::set_phase(flight_phase next) {
+    const phase_config_t &config = PHASE_CONFIG[next];
+
+    if (config.rate != PHASE_CONFIG[phase].rate) {
+        set_rates(config.rate);
+        set_slot(config.rate);
+    }
+    phase = next;
+}
+
+/**
+ * Sensor output rates, and the analog front end's.
+ */
+void System::set_rates(sample_rate rate) {
+    acc0().setRate(rate);
+    acc1().setRate(rate);
+    imu0().setRate(rate);
+    imu1().setRate(rate);
+    baro0().setRate(rate);
+    baro1().setRate(rate);
+    analog().setRate(rate);
+}
+
+/**
+ * Moves an accelerometer's buffered readings straight into `block`'s
+ * channels.
+ */
+size_t System::accelread(int index, accel_block_t *block) {
+    H3LIS100DLTR &acc = index == 0 ? acc0() : acc1();
+    uint32_t n = block->n;
+    size_t added = acc.read(&block->ch[0][n], PIPELINE_BLOCK_ACCEL, PIPELINE_BLOCK_ACCEL - n);
+    sample_block_commit(block, added, (uint32_t)log_time(), slot_us);
+    return added;
+}
+
+size_t System::imuread(int index, imu_block_t *block) {
+    const sample_batch<imu_reading_t> &batch = (index == 0 ? imu0() : imu1()).read();
+    size_t added = sample_block_append(block, batch.data(), batch.size(), (uint32_t)log_time(), slot_us);
+    if (added < batch.size()) {
+        readings_dropped.fetch_add(batch.size() - added, std::memory_order_relaxed);
+    }
+    return added;
+}
+
+size_t System::baroread(int index, baro_block_t *block) {
+    const sample_batch<baro_reading_t> &batch = (index == 0 ? baro0() : baro1()).read();
+    size_t added = sample_block_append(block, batch.data(), batch.size(), (uint32_t)log_time(), slot_us);
+    if (added < batch.size()) {
+        readings_dropped.fetch_add(batch.size() - added, std::memory_order_relaxed);
+    }
+    return added;
+}
+
+/**
+ * Appends a record to the flight log, timestamped now, by way of the
+ * slot's block. A full block is sent on and another started.
+ * 
+ * @return false if there is no external flash or the record was dropped.
+*/
+bool System::record(log_record_type type, const void *data, size_t len) {
+    if (!flashlog) {
+        return false;
+    }
+    uint32_t now = (uint32_t)log_time();
+    pipeline_block_t *block = begin_block();
+    if (block != nullptr && pipeline_block_record(block, type, now, data, len)) {
+        return true;
+    }
+    if (block != nullptr) {
+        commit_block();
+        block = begin_block();
+        if (block != nullptr && pipeline_block_record(block, type, now, data, len)) {
+            return true;
+        }
+    }
+    records_dropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
 
-    return std::vector<baro_reading_t>({0});
+/**
+ * Writes out every buffered page of the flight log. Pages may still be
+ * on the buffer chip afterwards, but they are on flash. With the storage
+ * task running, it does the writing, woken every tick until it's done.
+ * 
+ * @return 0 on success, -1 if there is no external flash or it timed out.
+*/
+int System::flash_flush(void) {
+    if (!flashlog) {
+        return -1;
+    }
+    power.hold();
+    int64_t deadline = esp_timer_get_time() + FLASH_FLUSH_TIMEOUT_US;
+    bool done;
+    if (storage_task == nullptr) {
+        flashlog->flush();
+        while (!flashlog->drained() && esp_timer_get_time() < deadline) {
+            flashlog->poll();
+            vTaskDelay(1);
+        }
+        done = flashlog->drained();
+    } else {
+        flush_done = false;
+        flush_requested = true;
+        while (!flush_done && esp_timer_get_time() < deadline) {
+            xTaskNotifyGive(storage_task);
+            vTaskDelay(1);
+        }
+        done = flush_done;
+    }
+    power.release();
+    return done ? 0 : -1;
+}
+
+/**
+ * Checks every page and record of the flight log against its CRC and
+ * reports the result on the console.
+ * 
+ * @return true if nothing is damaged.
+*/
+bool System::verify_log(void) {
+    if (!flashlog) {
+        return false;
+    }
+    log_verify_t result;
+    int64_t start = esp_timer_get_time();
+    if (flashlog->verify(&result) != STATUS_OK) {
+        log_internal("Flight log couldn't be read.\n", LOG_ERROR);
+        return false;
+    }
+    int64_t took = esp_timer_get_time() - start;
+    console_printf("Log verify: %lu pages ok, %lu corrupt, %lu erased; "
+                   "%lu records ok, %lu corrupt (%lld ms)\n",
+                   (unsigned long)result.pages_ok, (unsigned long)result.pages_corrupt,
+                   (unsigned long)result.pages_erased, (unsigned long)result.records_ok,
+                   (unsigned long)result.records_corrupt, (long long)(took / 1000));
+    return result.pages_corrupt == 0 && result.records_corrupt == 0;
+}
+
+/**
+ * Latest decimated analog block.
+ * 
+ * @return analog_reading_t in millivolts at each pin
+ */
+analog_reading_t System::analogread(void) {
+    return analog_latest;
 }
 
 /**
@@ -134,9 +978,9 @@ std::vector<baro_reading_t> System::baroread(void) {
  * 
  * @param msg The message to log.
 */
-void System::log_msg(std::string msg, log_type type) {
+void System::log_msg(const char *msg, log_type type) {
     // Placeholder
-    std::cout << msg;
+    console_write(msg, strlen(msg));
 }
 
 /**
@@ -149,9 +993,9 @@ void System::log_msg(std::string msg, log_type type) {
  * 
  * @param msg The message to log.
 */
-void System::log_internal(std::string msg, log_type type) {
+void System::log_internal(const char *msg, log_type type) {
     // Placeholder
-    std::cout << "System: " << msg;
+    console_printf("System: %s", msg);
 }
 
 /**
@@ -161,10 +1005,64 @@ void System::log_internal(std::string msg, log_type type) {
  * device.
 */
 void System::log_init() {
+    // Console output goes through a RAM ring from here on, so logging
+    // never blocks on the UART.
+    console_init();
+
     // Placeholder
-    std::cout << "Initialising logger...\n";
+    console_printf("Initialising logger...\n");
 }
 
+/**
+ * Checks the battery is above POWER_MIN_MV, from the first analog block.
+ * 
+ * @return true if the battery voltage could be measured and is high enough
+*/
+bool System::check_power(void) {
+    analog_reading_t block;
+    int64_t deadline = esp_timer_get_time() + POWER_CHECK_TIMEOUT_US;
+    size_t n = 0;
+    while (n == 0 && esp_timer_get_time() < deadline) {
+        vTaskDelay(1);
+        analog().update();
+        n = analog().read(&block, 1);
+    }
+    if (n == 0) {
+        return false;
+    }
+    analog_latest = block;
+    return (uint32_t)block.mv[AN_VBAT] * ANALOG_VBAT_DIVIDER >= POWER_MIN_MV;
+}
+
+/**
+ * Brings up the link to the payload and checks the RP2040 acknowledges
+ * a ping command.
+ * 
+ * @return true if the ping was acknowledged within PAYLOAD_PING_TIMEOUT_US
+*/
+bool System::check_payload(void) {
+    static const uint8_t ping[] = {'P', 'I', 'N', 'G'};
+
+    if (payload().init() != STATUS_OK) {
+        return false;
+    }
+    payload().send(LANE_COMMAND, ping, sizeof(ping));
+
+    int64_t deadline = esp_timer_get_time() + PAYLOAD_PING_TIMEOUT_US;
+    while (!payload().commandsIdle() && esp_timer_get_time() < deadline) {
+        vTaskDelay(1);
+        payload().poll();
+    }
+    return payload().commandsIdle();
+}
+
+/**
+ * Sample clock callback. Runs on the esp_timer task, so a plain task
+ * notification will do.
+ */
 void System::interrupt_handler(void *param) {
-    System::data_ready.release();
+    System *self = (System *)param;
+    if (self->acquire_task != nullptr) {
+        xTaskNotifyGive(self->acquire_task);
+    }
 }
@@ -0,0 +1,238 @@
+// Analog.cpp
+// Implementation of the continuous ADC analog inputs.
+// 05/2023
+
+#include "Analog.hpp"
+
+#include <string.h>
+
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "esp_adc/adc_cali.h"
+#include "esp_adc/adc_cali_scheme.h"
+
+#define ANALOG_ATTEN ADC_ATTEN_DB_12 // ~150-2450mV usable
+
+// Nominal transfer function if the chip has no eFuse calibration:
+// ~3100mV full scale at 12dB.
+#define ANALOG_NOMINAL_FULL_SCALE_MV 3100
+
+// ADC channel for each analog_channel, in order.
+static const uint8_t CHANNELS[AN_CHANNELS] = {
+    ANALOG_CH_TC0,
+    ANALOG_CH_TC1,
+    ANALOG_CH_VBAT,
+    ANALOG_CH_RESIN,
+};
+
+Analog::Analog(const device_desc_t &desc) : overruns(0) {
+    handle = nullptr;
+    adc_decimator_init(&decimator, CHANNELS, AN_CHANNELS, ANALOG_DECIMATION);
+    cal.gain_q16 = (ANALOG_NOMINAL_FULL_SCALE_MV << 16) / 4095;
+    cal.offset_mv = 0;
+    head = 0;
+    count = 0;
+    dropped_count = 0;
+    last_block_us = 0;
+    rate = RATE_LOW;
+    running = false;
+    burst_us = 0;
+}
+
+/**
+ * Driver pool overflow. Runs in the ADC ISR, so only counts.
+*/
+bool IRAM_ATTR Analog::pool_ovf(adc_continuous_handle_t handle,
+                                const adc_continuous_evt_data_t *edata, void *param) {
+    Analog *self = (Analog *)param;
+    self->overruns.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+/**
+ * Fits a straight line to the eFuse calibration, so blocks can be
+ * converted in fixed point from their fractional means rather than
+ * rounding them back to raw counts first. The ESP32 line fitting scheme
+ * is linear, so two points through its middle capture it exactly.
+*/
+void Analog::calibrate() {
+    adc_cali_line_fitting_config_t config = {};
+    config.unit_id = ADC_UNIT_1;
+    config.atten = ANALOG_ATTEN;
+    config.bitwidth = ADC_BITWIDTH_12;
+    adc_cali_handle_t cali;
+    if (adc_cali_create_scheme_line_fitting(&config, &cali) != ESP_OK) {
+        return; // keep the nominal line
+    }
+
+    int lo, hi;
+    if (adc_cali_raw_to_voltage(cali, 1000, &lo) == ESP_OK &&
+        adc_cali_raw_to_voltage(cali, 3000, &hi) == ESP_OK) {
+        cal.gain_q16 = ((hi - lo) << 16) / 2000;
+        cal.offset_mv = lo - ((1000 * cal.gain_q16) >> 16);
+    }
+    adc_cali_delete_scheme_line_fitting(cali);
+}
+
+/**
+ * Check if the device is working correctly.
+ * 
+ * Doesn't touch the ADC - just checks blocks are still arriving.
+ * 
+ * @return status: device status
+*/
+status Analog::checkOK() {
+    if (handle == nullptr || esp_timer_get_time() - last_block_us > ANALOG_TIMEOUT_US) {
+        return STATUS_FAILED;
+    }
+    return STATUS_OK;
+}
+
+/**
+ * Initialise the device.
+ * 
+ * Starts every channel converting round robin into the DMA pool. From
+ * here on the ADC runs by itself at the full rate; `update` only collects.
+ * It starts at the low rate, like the sensors.
+ * 
+ * @return status: STATUS_OK if the ADC started.
+*/
+status Analog::init() {
+    calibrate();
+
+    adc_continuous_handle_cfg_t handle_config = {};
+    handle_config.max_store_buf_size = ANALOG_POOL_BYTES;
+    handle_config.conv_frame_size = ANALOG_FRAME_BYTES;
+    if (adc_continuous_new_handle(&handle_config, &handle) != ESP_OK) {
+        handle = nullptr;
+        return STATUS_FAILED;
+    }
+
+    adc_digi_pattern_config_t pattern[AN_CHANNELS];
+    for (int i = 0; i < AN_CHANNELS; i++) {
+        pattern[i].atten = ANALOG_ATTEN;
+        pattern[i].channel = CHANNELS[i];
+        pattern[i].unit = ADC_UNIT_1;
+        pattern[i].bit_width = ADC_BITWIDTH_12;
+    }
+    adc_continuous_config_t config = {};
+    config.pattern_num = AN_CHANNELS;
+    config.adc_pattern = pattern;
+    config.sample_freq_hz = ANALOG_SAMPLE_HZ;
+    config.conv_mode = ADC_CONV_SINGLE_UNIT_1;
+    config.format = ADC_DIGI_OUTPUT_FORMAT_TYPE1;
+
+    adc_continuous_evt_cbs_t callbacks = {};
+    callbacks.on_pool_ovf = pool_ovf;
+
+    if (adc_continuous_config(handle, &config) != ESP_OK ||
+        adc_continuous_register_event_callbacks(handle, &callbacks, this) != ESP_OK ||
+        adc_continuous_start(handle) != ESP_OK) {
+        adc_continuous_deinit(handle);
+        handle = nullptr;
+        return STATUS_FAILED;
+    }
+    running = true;
+    rate = RATE_LOW;
+    last_block_us = burst_us = esp_timer_get_time();
+    return STATUS_OK;
+}
+
+/**
+ * Switch between converting continuously (RATE_FULL) and one block every
+ * ANALOG_LOW_INTERVAL_US (RATE_LOW), e.g. on a change of flight phase.
+ *
+ * @return status: STATUS_FAILED if the ADC isn't set up or won't restart.
+*/
+status Analog::setRate(sample_rate next) {
+    if (handle == nullptr) {
+        return STATUS_FAILED;
+    }
+    rate = next;
+    burst_us = esp_timer_get_time();
+    if (rate == RATE_FULL && !running) {
+        if (adc_continuous_start(handle) != ESP_OK) {
+            return STATUS_FAILED;
+        }
+        running = true;
+    }
+    return STATUS_OK;
+}
+
+/**
+ * Stops the ADC between low rate blocks. Whatever it converted past the
+ * end of the block is thrown away, along with the decimator's partial
+ * sums, so the next block starts clean.
+*/
+void Analog::stop() {
+    adc_continuous_stop(handle);
+    running = false;
+    uint32_t len;
+    while (adc_continuous_read(handle, raw, sizeof(raw), &len, 0) == ESP_OK) {
+    }
+    adc_decimator_init(&decimator, CHANNELS, AN_CHANNELS, ANALOG_DECIMATION);
+}
+
+/**
+ * Collect and decimate everything in the DMA pool.
+ * 
+ * Reads with a zero timeout, so this returns as soon as the pool is
+ * empty. Each finished block is calibrated and buffered for `read`.
+*/
+void Analog::update() {
+    if (handle == nullptr) {
+        return;
+    }
+    if (!running) {
+        int64_t now = esp_timer_get_time();
+        if (now - burst_us < ANALOG_LOW_INTERVAL_US || adc_continuous_start(handle) != ESP_OK) {
+            return;
+        }
+        running = true;
+        burst_us = now;
+    }
+
+    uint32_t len;
+    while (adc_continuous_read(handle, raw, sizeof(raw), &len, 0) == ESP_OK) {
+        // A frame holds 128 conversions, so at most 32 per channel -
+        // never more than one block.
+        uint16_t means[AN_CHANNELS];
+        if (adc_decimate(&decimator, raw, len, means, 1) == 0) {
+            continue;
+        }
+        last_block_us = esp_timer_get_time();
+
+        if (count == ANALOG_BUFFER) {
+            dropped_count++;
+            io_stats.lost(1);
+        } else {
+            analog_reading_t &block = blocks[head];
+            for (int i = 0; i < AN_CHANNELS; i++) {
+                block.mv[i] = adc_to_mv(&cal, means[i]);
+            }
+            head = (head + 1) % ANALOG_BUFFER;
+            count++;
+            io_stats.produced(1);
+        }
+
+        if (rate == RATE_LOW) {
+            stop();
+            break;
+        }
+    }
+}
+
+/**
+ * Move buffered blocks out, oldest first.
+ * 
+ * @return Number of blocks written to `out`.
+*/
+size_t Analog::read(analog_reading_t *out, size_t max) {
+    size_t n = count < max ? count : max;
+    size_t tail = (head + ANALOG_BUFFER - count) % ANALOG_BUFFER;
+    for (size_t i = 0; i < n; i++) {
+        out[i] = blocks[(tail + i) % ANALOG_BUFFER];
+    }
+    count -= n;
+    return n;
+}
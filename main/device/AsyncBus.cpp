@@ -0,0 +1,55 @@
+// AsyncBus.cpp
+// Worker task per bus for coroutine drivers.
+// 05/2023
+
+#include "AsyncBus.hpp"
+
+AsyncBus::AsyncBus(const char *name) : name(name) {
+    sched = nullptr;
+    worker = nullptr;
+    queue = xQueueCreateStatic(CORO_POOL_FRAMES, sizeof(async_op_t *), queue_storage, &queue_buf);
+}
+
+/**
+ * Starts the worker task.
+ *
+ * @return false if the task couldn't be created.
+ */
+bool AsyncBus::init(AsyncScheduler &sched) {
+    if (worker != nullptr) {
+        return true;
+    }
+    this->sched = &sched;
+    if (xTaskCreatePinnedToCore(run, name, ASYNC_BUS_TASK_STACK, this, ASYNC_BUS_TASK_PRIORITY,
+                                &worker, ASYNC_BUS_TASK_CORE) != pdPASS) {
+        worker = nullptr;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Queues a transaction for the worker. Called from the scheduler's task
+ * as a coroutine suspends on it.
+ *
+ * Never blocks in practice: only a suspended coroutine can have a
+ * transaction queued, and each of those holds a pool frame.
+ */
+void AsyncBus::submit(async_op_t *op) {
+    xQueueSend(queue, &op, portMAX_DELAY);
+}
+
+/**
+ * Worker loop: run each transaction, then hand its coroutine back.
+ */
+void AsyncBus::run(void *param) {
+    AsyncBus *bus = (AsyncBus *)param;
+    for (;;) {
+        async_op_t *op;
+        if (xQueueReceive(bus->queue, &op, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        op->result = op->call(op);
+        bus->sched->ready(op->handle);
+    }
+}
@@ -4,15 +4,21 @@
 // 05/2023
 
 #include "BME280.hpp"
+#include "BME280Registers.hpp"
+#include "Console.hpp"
 #include "i2c_cxx.hpp"
-// #include 
-#include <sys/_stdint.h>
 #include <sys/_stdint.h>
+#include <stdlib.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 
 
-BME280::BME280() {
+BME280::BME280(const device_desc_t &desc) : addr(desc.address) {
+    port = i2c_port(desc.bus);
+    measurements.reserve(SAMPLE_BATCH_MAX);
+    taken.reserve(SAMPLE_BATCH_MAX);
     // start at 0;
-    _i2c_address = 0;
     _t_fine = 0;
     _temperature = 0;
     _pressure = 0;
@@ -47,75 +53,28 @@ void BME280::clearCalibrationData(void)
     _dig_H6 = 0;
 }
 
-/* begin takes in i2c address */
-uint8_t BME280::begin(uint8_t i2cAddress) {
-    _i2c_address = i2cAddress;
-    if (readId()== BME280_ID) {
-        clearCalibrationData();
-        // will need to read data 
-        // 
-        return 0;
-    }
-    return (uint8_t)-1;
-}
-
-/*
-    busWrite determines which interface to write to and chooses between I2C communication or spi
-    communication.
-    This function takes in 3 arguments which include p_data which is a pointer to the data array, 
-    data size which is the size of the array and a flag repeated_start which indicates whether a 
-    repeated start condition is used. *NOTE* A 'repeated start' is basically a continuing conversation
-    to get multiple readings :)
-*/
-void BME280::busWrite(uint8_t *p_data, uint8_t data_size, uint8_t repeated_start) 
-{
-    if (_i2c_address == BME280_I2C_ADDRESS1 || _i2c_address == BME280_I2C_ADDRESS2) {
-        // yay! i2c worked :) 
-        i2cWrite(_i2c_address, p_data, data_size, repeated_start); 
-    } else {
-        // most likely wont use as we focus on SPI
-        //This operation clears the most significant bit (MSB) of the first element
-        p_data[0] &= 0x7f;
-        spiWrite(p_data, data_size); 
-    }
-}
-/*
-    Similar to busWrite however it reads to the chosen communication.
-    :)
-*/
-void BME280::busRead(uint8_t *p_data, uint8_t data_size) 
-{
-    if (_i2c_address == BME280_I2C_ADDRESS1 || _i2c_address == BME280_I2C_ADDRESS2) {
-        // yay! i2c worked :) 
-        i2cRead(_i2c_address, p_data, data_size);
-    } else {
-        // most likely wont use as we focus on SPI
-        //This operation clears the most significant bit (MSB) of the first element
-        p_data[0] &= 0x80;
-        spiRead(p_data, data_size); 
-    }
-}
-
-// uint8_t
-
 /* read ID returns the Register */
 uint8_t BME280::readId(void)
 {
-    return readUint8(BME280_ID_REGISTER);
+    return readUint8(bme280::ID::address);
 }
 
 // reading unsign ints helpers -------------------
 /*
     These functions are for convenience  and helps in
-    reading specific registers :)
+    reading specific registers :) They return 0 if the
+    bus transaction fails.
 */
 /*  This function takes in register address.
 */
 uint8_t BME280::readUint8(uint8_t reg)
 {
-  uint8_t data;
-  busWrite(&reg,1,1); // Use repeated start.
-  busRead(&data,1); // Read one byte.
+  uint8_t data = 0;
+  if (transact(1, [&](TickType_t timeout) {
+        return reg_read(port, addr.get_value(), reg, &data, 1, timeout);
+      }) != ESP_OK) {
+    return 0;
+  }
   return data;
 }
 
@@ -124,53 +83,185 @@ uint16_t BME280::readUint16(uint8_t reg)
 {
   uint8_t data[2];
   uint16_t value;
-  busWrite(&reg,1,1); // Use repeated start.
-  busRead(data,2); // Read two bytes.
+  if (transact(2, [&](TickType_t timeout) {
+        return reg_read(port, addr.get_value(), reg, data, 2, timeout);
+      }) != ESP_OK) {
+    return 0;
+  }
   // Process as little endian, which is the case for calibration data.
   value = data[1];
   value = (value<<8) | data[0];
   return value;
 }
 
+/*
+    Reads both calibration blocks in one burst each, instead of
+    one transaction per coefficient.
+*/
+status BME280::readCalibrationData(void)
+{
+  uint8_t c[bme280::CALIB00_SIZE];
+  uint8_t h[bme280::CALIB26_SIZE];
+  if (reg_read(port, addr.get_value(), bme280::CALIB00::address, c, sizeof(c)) != ESP_OK ||
+      reg_read(port, addr.get_value(), bme280::CALIB26::address, h, sizeof(h)) != ESP_OK) {
+    return STATUS_FAILED;
+  }
+
+  // all little endian, see table 16 of the datasheet
+  _dig_T1 = (uint16_t)(c[1] << 8 | c[0]);
+  _dig_T2 = (int16_t)(c[3] << 8 | c[2]);
+  _dig_T3 = (int16_t)(c[5] << 8 | c[4]);
+  _dig_P1 = (uint16_t)(c[7] << 8 | c[6]);
+  _dig_P2 = (int16_t)(c[9] << 8 | c[8]);
+  _dig_P3 = (int16_t)(c[11] << 8 | c[10]);
+  _dig_P4 = (int16_t)(c[13] << 8 | c[12]);
+  _dig_P5 = (int16_t)(c[15] << 8 | c[14]);
+  _dig_P6 = (int16_t)(c[17] << 8 | c[16]);
+  _dig_P7 = (int16_t)(c[19] << 8 | c[18]);
+  _dig_P8 = (int16_t)(c[21] << 8 | c[20]);
+  _dig_P9 = (int16_t)(c[23] << 8 | c[22]);
+  _dig_H1 = c[25];
+  _dig_H2 = (int16_t)(h[1] << 8 | h[0]);
+  _dig_H3 = h[2];
+  // H4 and H5 are 12 bits, sharing 0xe5
+  _dig_H4 = (int16_t)((int8_t)h[3] * 16 | (h[4] & 0x0f));
+  _dig_H5 = (int16_t)((int8_t)h[5] * 16 | (h[4] >> 4));
+  _dig_H6 = (int8_t)h[6];
+  return STATUS_OK;
+}
+
 // -----------------------------------------------
 
 /**
 * Prints everything out from the readings
 * For debugging purposes
 */
-void printReadings(const std::vector<baro_reading_t>& readings) {
+void printReadings(const sample_batch<baro_reading_t>& readings) {
    for (const auto& reading : readings) {
-       printf("Temperature: %d °C\n", reading.temp);
-       printf("Pressure: %d \n", reading.pressure);
-       printf("Humidity: %d \n", reading.humidity);  
+       console_printf("Temperature: %ld.%02ld °C\n", (long)(reading.temp / 100), (long)abs(reading.temp % 100));
+       console_printf("Pressure: %lu Pa\n", (unsigned long)(reading.pressure >> 8));
+       console_printf("Humidity: %lu %%RH\n", (unsigned long)(reading.humidity >> 10));
    }
 }
 
 
 /**
- * Take a reading from this device.
- * @return A vector of readings from this device of type [TYPE]
+ * Take the readings queued by `update`.
+ * @return The queued readings, valid until the next call
+*/
+const sample_batch<baro_reading_t> &BME280::read() {
+    // the two blocks trade places, so nothing is allocated
+    taken.clear();
+    taken.swap(measurements);
+    return taken;
+}
+
+/**
+ * Read the latest measurement (pressure, temperature and humidity in one
+ * burst) and queue it for `read`.
+*/
+void BME280::update() {
+    uint8_t raw[bme280::MEASUREMENT_SIZE];
+    if (transact(sizeof(raw), [&](TickType_t timeout) {
+            return reg_read(port, addr.get_value(), bme280::PRESS_MSB::address, raw, sizeof(raw), timeout);
+        }) != ESP_OK) {
+        return;
+    }
+    accept(raw);
+}
+
+/**
+ * As `update`, as a coroutine: the measurement burst goes out on `bus`'s
+ * worker.
 */
-std::vector<baro_reading_t> BME280::read() {
-    // Placeholder
-    // std::vector<baro_reading_t> readings = std::vector<baro_reading_t>({0});
-    // return readings;
-
-    // making the vector
-    std::vector<baro_reading_t> readings;
-    // reading type
+AsyncTask<> BME280::updateAsync(AsyncBus &bus) {
+    uint8_t raw[bme280::MEASUREMENT_SIZE];
+    if (co_await bus.read(*this, port, addr.get_value(), bme280::PRESS_MSB::address, raw, sizeof(raw)) != ESP_OK) {
+        co_return;
+    }
+    accept(raw);
+}
+
+void BME280::accept(const uint8_t *raw) {
+    baro_reading_t reading = decode(raw);
+    io_stats.produced(1);
+    if (measurements.size() == SAMPLE_BATCH_MAX) {
+        io_stats.lost(1);
+        return;
+    }
+    measurements.push_back(reading);
+}
+
+/*
+    Unpacks a PRESS_MSB..HUM_LSB burst and compensates it with the chip's
+    calibration data. Temperature goes first: the others need t_fine.
+*/
+baro_reading_t BME280::decode(const uint8_t *raw)
+{
+    // pressure and temperature are 20 bits, humidity 16
+    int32_t adc_P = (int32_t)raw[0] << 12 | (int32_t)raw[1] << 4 | raw[2] >> 4;
+    int32_t adc_T = (int32_t)raw[3] << 12 | (int32_t)raw[4] << 4 | raw[5] >> 4;
+    int32_t adc_H = (int32_t)raw[6] << 8 | raw[7];
+
     baro_reading_t reading;
-    // want to loop to grab the data of readings
-    for (;;) {
-        // populating the reading vector
-        reading.temp = BME280_TEMPERATURE;
-        reading.humidity = BME280_HUMIDITY;
-        reading.pressure = BME280_PRESSURE;
-        // shoving stuff into vector :)
-        readings.push_back(reading);
+    reading.temp = _temperature = compensateTemperature(adc_T);
+    reading.pressure = _pressure = compensatePressure(adc_P);
+    reading.humidity = _humidity = compensateHumidity(adc_H);
+    return reading;
+}
+
+// Compensation formulas. These are the 32 bit temperature and humidity
+// and 64 bit pressure versions from section 4.2.3 of the datasheet.
+
+/*
+    Temperature in 0.01 degC. Sets _t_fine.
+*/
+temp_t BME280::compensateTemperature(int32_t adc_T)
+{
+    int32_t var1 = ((((adc_T >> 3) - ((int32_t)_dig_T1 << 1))) * ((int32_t)_dig_T2)) >> 11;
+    int32_t var2 = (((((adc_T >> 4) - ((int32_t)_dig_T1)) * ((adc_T >> 4) - ((int32_t)_dig_T1))) >> 12) *
+                    ((int32_t)_dig_T3)) >> 14;
+    _t_fine = var1 + var2;
+    return (_t_fine * 5 + 128) >> 8;
+}
+
+/*
+    Pressure in Pa, Q24.8. 0 if there's no calibration data to divide by.
+*/
+press_t BME280::compensatePressure(int32_t adc_P)
+{
+    int64_t var1 = ((int64_t)_t_fine) - 128000;
+    int64_t var2 = var1 * var1 * (int64_t)_dig_P6;
+    var2 = var2 + ((var1 * (int64_t)_dig_P5) << 17);
+    var2 = var2 + (((int64_t)_dig_P4) << 35);
+    var1 = ((var1 * var1 * (int64_t)_dig_P3) >> 8) + ((var1 * (int64_t)_dig_P2) << 12);
+    var1 = (((((int64_t)1) << 47) + var1)) * ((int64_t)_dig_P1) >> 33;
+    if (var1 == 0) {
+        return 0;
     }
-    return readings;
+    int64_t p = 1048576 - adc_P;
+    p = (((p << 31) - var2) * 3125) / var1;
+    var1 = (((int64_t)_dig_P9) * (p >> 13) * (p >> 13)) >> 25;
+    var2 = (((int64_t)_dig_P8) * p) >> 19;
+    p = ((p + var1 + var2) >> 8) + (((int64_t)_dig_P7) << 4);
+    return (uint32_t)p;
+}
 
+/*
+    Relative humidity in %RH, Q22.10.
+*/
+humid_t BME280::compensateHumidity(int32_t adc_H)
+{
+    int32_t v = _t_fine - ((int32_t)76800);
+    v = (((((adc_H << 14) - (((int32_t)_dig_H4) << 20) - (((int32_t)_dig_H5) * v)) +
+           ((int32_t)16384)) >> 15) *
+         (((((((v * ((int32_t)_dig_H6)) >> 10) * (((v * ((int32_t)_dig_H3)) >> 11) +
+                                                  ((int32_t)32768))) >> 10) +
+            ((int32_t)2097152)) * ((int32_t)_dig_H2) + 8192) >> 14));
+    v = (v - (((((v >> 15) * (v >> 15)) >> 7) * ((int32_t)_dig_H1)) >> 4));
+    v = (v < 0 ? 0 : v);
+    v = (v > 419430400 ? 419430400 : v);
+    return (uint32_t)(v >> 12);
 }
 
 /**
@@ -182,35 +273,19 @@ std::vector<baro_reading_t> BME280::read() {
  * @return status: device status
 */
 status BME280::checkOK() {
-    // creating a chip ID
-    uint16_t chip_ID = 0;
-    //FIXME: temporary value assigned to CHIP_ID
-    // chip_ID = 1;
-
     // want to check if the BME280 chip is present
-    // i2cRead(BME280_I2C_ADDRESS1, BME280_ID, &chip_ID, 1);
-    // 
-    // use esp_err_t i2c_master_write_read_device(i2c_port_t i2c_num, uint8_t device_address, const uint8_t *write_buffer, size_t write_size, uint8_t *read_buffer, size_t read_size, TickType_t ticks_to_wait) 
-    auto buf = std::vector<uint8_t>();
-    idf::I2CCommandLink cmd;
-    cmd.start();
-    cmd.write_byte(BME280_ID_REGISTER);
-    cmd.read(buf);
-    cmd.execute_transfer(idf::I2CNumber::I2C0(), std::chrono::milliseconds::max() );
-
-   
-    /**
-     * uint8_t wbuf[1] = BME_ID_REGISTER;
-     * uint8_t result[1] = {0};
-     * i2c_master_write_read_device([i2c_struct]), 0, BME280_I2C_ADDRESS1, wbuf, 1, result, 1, 300);
-     * 
-     * 
-    */
-    // if chip is not present
-    if (chip_ID != BME280_ID ) {
+    uint8_t chip_ID = 0;
+    if (transact(1, [&](TickType_t timeout) {
+            return reg_read(port, addr.get_value(), bme280::ID::address, &chip_ID, 1, timeout);
+        }) != ESP_OK) {
         // not found the bme280 chip :(
         return STATUS_FAILED;
     }
+    // something answered, but it isn't a bme280
+    if (chip_ID != bme280::CHIP_ID) {
+        io_stats.error(DEV_ERR_BAD_DATA);
+        return STATUS_MISBEHAVING;
+    }
 
     return STATUS_OK;    
 }
@@ -218,32 +293,44 @@ status BME280::checkOK() {
 /**
  * Initialise the device.
  * 
- * Performs any setup required inc. calculating
- * magic numbers etc. - returns a STATUS the same way as checkOK. You can probably
- * just call checkOK at the end of this, but obviously there if you fail the setup steps
- * that's worth thinking about too.
+ * Soft resets the chip, loads its calibration data and then writes and
+ * verifies the low rate configuration block (see BME280Registers.hpp).
  * 
  * @return status: device status
 */
-status BME280::init(idf::I2CMaster i2c) {
-    // Placeholder
-    
-    return STATUS_OK;
-}
-
+status BME280::init() {
 
+    if (reg_write(port, addr.get_value(), bme280::RESET::address, bme280::RESET_VALUE) != ESP_OK) {
+        return STATUS_FAILED;
+    }
+    vTaskDelay(pdMS_TO_TICKS(bme280::STARTUP_MS) + 1);
 
-void BME280::stop()
-{
-
+    status result = checkOK();
+    if (result != STATUS_OK) {
+        return result;
+    }
+    clearCalibrationData();
+    if (readCalibrationData() != STATUS_OK) {
+        return STATUS_FAILED;
+    }
+    return setRate(RATE_LOW);
 }
 
-void BME280::watchdog_task(void *parameters)
-{
+/**
+ * Switch oversampling, filtering and standby time, e.g. on a change of
+ * flight phase. The whole change is a single bus transaction.
+ * 
+ * @return status: device status
+*/
+status BME280::setRate(sample_rate rate) {
+    const reg_block_view_t block = rate == RATE_FULL ? reg_block_view_t(bme280::RATE_FULL_CFG)
+                                                     : reg_block_view_t(bme280::RATE_LOW_CFG);
 
+    if (reg_write_block(port, addr.get_value(), block) != ESP_OK) {
+        return STATUS_FAILED;
+    }
+    if (reg_verify_block(port, addr.get_value(), bme280::MAP, block) != ESP_OK) {
+        return STATUS_MISBEHAVING;
+    }
+    return STATUS_OK;
 }
-
-void BME280::watchdog_callback(TimerHandle_t xtimer)
-{
-
-}
\ No newline at end of file
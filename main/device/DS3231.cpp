@@ -5,16 +5,77 @@
 
 #include "DS3231.hpp"
 
+static int bcd(uint8_t value) {
+    return (value >> 4) * 10 + (value & 0x0f);
+}
+
+/**
+ * Converts the seven timekeeping registers to seconds since the epoch.
+ * The clock is kept in UTC and 24 hour mode, but 12 hour mode is handled
+ * in case something else set it.
+*/
+time_t DS3231::decode(const uint8_t *regs) {
+    int sec = bcd(regs[0] & 0x7f);
+    int min = bcd(regs[1] & 0x7f);
+    int hour;
+    if (regs[2] & 0x40) {
+        hour = bcd(regs[2] & 0x1f) % 12 + (regs[2] & 0x20 ? 12 : 0);
+    } else {
+        hour = bcd(regs[2] & 0x3f);
+    }
+    int day = bcd(regs[4] & 0x3f);
+    int month = bcd(regs[5] & 0x1f);
+    int year = 2000 + bcd(regs[6]) + (regs[5] & 0x80 ? 100 : 0);
+
+    // Days since 1970-01-01 for a proleptic Gregorian date, without
+    // going through the C library's timezone handling.
+    int y = month <= 2 ? year - 1 : year;
+    int era = y / 400;
+    int yoe = y - era * 400;
+    int doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    int64_t days = (int64_t)era * 146097 + doe - 719468;
+
+    return (time_t)(days * 86400 + hour * 3600 + min * 60 + sec);
+}
+
+/**
+ * Read the current time.
+ * 
+ * @return The RTC's time, or zero if it couldn't be read.
+*/
 struct timeval DS3231::getTime() {
-    // Placeholder
     struct timeval tv;
     tv.tv_sec = 0;
     tv.tv_usec = 0;
+
+    uint8_t regs[DS3231_TIME_SIZE];
+    if (transact(sizeof(regs), [&](TickType_t timeout) {
+            return reg_read(port, addr.get_value(), DS3231_REG_TIME, regs, sizeof(regs), timeout);
+        }) != ESP_OK) {
+        return tv;
+    }
+    tv.tv_sec = decode(regs);
     return tv;
 }
 
-DS3231::DS3231() {
-    // Placeholder
+/**
+ * As `getTime`, as a coroutine: the read goes out on `bus`'s worker.
+ * 
+ * @return STATUS_OK, or STATUS_FAILED if the bus transaction failed.
+*/
+AsyncTask<status> DS3231::getTimeAsync(AsyncBus &bus, struct timeval *tv) {
+    uint8_t regs[DS3231_TIME_SIZE];
+    if (co_await bus.read(*this, port, addr.get_value(), DS3231_REG_TIME, regs, sizeof(regs)) != ESP_OK) {
+        co_return STATUS_FAILED;
+    }
+    tv->tv_sec = decode(regs);
+    tv->tv_usec = 0;
+    co_return STATUS_OK;
+}
+
+DS3231::DS3231(const device_desc_t &desc) : addr(desc.address) {
+    port = i2c_port(desc.bus);
 }
 
 /**
@@ -23,10 +84,22 @@ DS3231::DS3231() {
  * Returns either STATUS_OK if normal, STATUS_MISBEHAVING if
  * accessible but readings out of range, or STATUS_FAILED otherwise.
  * 
+ * A clock whose oscillator has stopped (e.g. the backup cell ran flat)
+ * answers but has lost the time, so counts as misbehaving.
+ * 
  * @return status: device status
 */
 status DS3231::checkOK() {
-    // Placeholder
+    uint8_t reg;
+    if (transact(1, [&](TickType_t timeout) {
+            return reg_read(port, addr.get_value(), DS3231_REG_STATUS, &reg, 1, timeout);
+        }) != ESP_OK) {
+        return STATUS_FAILED;
+    }
+    if (reg & DS3231_STATUS_OSF) {
+        io_stats.error(DEV_ERR_BAD_DATA);
+        return STATUS_MISBEHAVING;
+    }
     return STATUS_OK;
 }
 
@@ -40,24 +113,6 @@ status DS3231::checkOK() {
  * 
  * @return status: device status
 */
-status DS3231::init(idf::I2CMaster i2c) {
-    // Placeholder
-    return STATUS_OK;
-}
-
-
-
-void DS3231::stop()
-{
-
+status DS3231::init() {
+    return checkOK();
 }
-
-void DS3231::watchdog_task(void *parameters)
-{
-
-}
-
-void DS3231::watchdog_callback(TimerHandle_t xtimer)
-{
-
-}
\ No newline at end of file
@@ -4,25 +4,196 @@
 // 05/2023
 
 #include "H3LIS100DLTR.hpp"
+#include "H3LIS100DLTRRegisters.hpp"
 
-H3LIS100DLTR::H3LIS100DLTR() {
-    // Placeholder
+H3LIS100DLTR::H3LIS100DLTR(const device_desc_t &desc)
+    : name(desc.name), addr(desc.address), pending(0), polled(false), reader(nullptr), head(0),
+      tail(0), dropped_count(0) {
+    port = i2c_port(desc.bus);
+    irq = desc.irq;
 }
 
 /**
- * Take a reading from this device.
- * @return A vector of readings from this device of type [TYPE]
+ * INT1 data ready handler. Counts the edge and wakes the reader, if it
+ * runs, to read the sample out.
 */
-std::vector<accel_reading_t> H3LIS100DLTR::read() {
-    // Placeholder
-    std::vector<accel_reading_t> readings = std::vector<accel_reading_t>({0});
-    return readings;
+void IRAM_ATTR H3LIS100DLTR::drdy_isr(void *param) {
+    H3LIS100DLTR *self = (H3LIS100DLTR *)param;
+    self->pending.fetch_add(1, std::memory_order_relaxed);
+    if (self->reader != nullptr) {
+        BaseType_t woken = pdFALSE;
+        vTaskNotifyGiveFromISR(self->reader, &woken);
+        portYIELD_FROM_ISR(woken);
+    }
 }
 
 /**
- * @brief 
- * 
+ * Starts the reader task.
  *
+ * @return false without an INT1 line, or if the task couldn't be created.
+ */
+bool H3LIS100DLTR::startReader() {
+    if (reader != nullptr) {
+        return true;
+    }
+    if (irq == GPIO_NUM_NC) {
+        return false;
+    }
+    if (xTaskCreatePinnedToCore(reader_run, name, H3LIS100DLTR_TASK_STACK, this,
+                                H3LIS100DLTR_TASK_PRIORITY, &reader, H3LIS100DLTR_TASK_CORE) != pdPASS) {
+        reader = nullptr;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Reader loop: wait for INT1 (or the poll timeout), then read the sample
+ * out.
+ */
+void H3LIS100DLTR::reader_run(void *param) {
+    H3LIS100DLTR *self = (H3LIS100DLTR *)param;
+    for (;;) {
+        bool woken = ulTaskNotifyTake(pdTRUE, H3LIS100DLTR_POLL_TICKS) > 0;
+        transaction_deadline_us = esp_timer_get_time() + H3LIS100DLTR_READ_DEADLINE_US;
+        self->service(!woken || self->polled.load(std::memory_order_relaxed));
+    }
+}
+
+/**
+ * Fetch the latest sample if one is ready.
+ * 
+ * STATUS_REG and all three axes come back in one auto-increment burst.
+ * If the chip reports an overrun, the samples in between were overwritten
+ * on the chip and are counted as dropped: one per extra data ready edge
+ * since the last call, and at least one.
+*/
+void H3LIS100DLTR::service(bool poll) {
+    using namespace h3lis100dl;
+
+    uint32_t edges = pending.exchange(0, std::memory_order_relaxed);
+    if (!poll && edges == 0) {
+        return;
+    }
+
+    uint8_t frame[FRAME_SIZE];
+    esp_err_t err;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        err = transact(sizeof(frame), [&](TickType_t timeout) {
+            return reg_read(port, addr.get_value(), STATUS_REG::address | MAP.increment,
+                            frame, sizeof(frame), timeout);
+        });
+    }
+    if (err == ESP_OK) {
+        accept(frame, edges);
+    }
+}
+
+/**
+ * As `service`, from the acquisition loop. Without an interrupt line, or
+ * at the low rate, polls STATUS_REG every call.
+*/
+void H3LIS100DLTR::update() {
+    if (reader != nullptr) {
+        return;
+    }
+    service(irq == GPIO_NUM_NC || polled.load(std::memory_order_relaxed));
+}
+
+/**
+ * As `update`, as a coroutine: the burst read goes out on `bus`'s worker.
+*/
+AsyncTask<> H3LIS100DLTR::updateAsync(AsyncBus &bus) {
+    using namespace h3lis100dl;
+
+    if (reader != nullptr) {
+        co_return;
+    }
+    uint32_t edges = pending.exchange(0, std::memory_order_relaxed);
+    if (irq != GPIO_NUM_NC && !polled.load(std::memory_order_relaxed) && edges == 0) {
+        co_return;
+    }
+
+    uint8_t frame[FRAME_SIZE];
+    if (co_await bus.read(*this, port, addr.get_value(), STATUS_REG::address | MAP.increment,
+                          frame, sizeof(frame)) != ESP_OK) {
+        co_return;
+    }
+    accept(frame, edges);
+}
+
+/**
+ * Buffers the sample in a STATUS_REG..OUT_Z frame, if it holds a new one.
+ * `edges` is the number of data ready interrupts since the last frame.
+*/
+void H3LIS100DLTR::accept(const uint8_t *frame, uint32_t edges) {
+    using namespace h3lis100dl;
+
+    if (!(frame[0] & STATUS_REG::ZYXDA.mask)) {
+        return;
+    }
+
+    // Only an overrun on the chip means samples were lost. An edge landing
+    // between taking `pending` and the burst is counted with the next
+    // frame, so the edge count alone overstates the loss; it just says how
+    // many went once the chip confirms some did.
+    uint32_t lost = 0;
+    if (frame[0] & STATUS_REG::ZYXOR.mask) {
+        lost = edges > 1 ? edges - 1 : 1;
+    }
+    dropped_count.fetch_add(lost, std::memory_order_relaxed);
+    io_stats.lost(lost);
+
+    uint32_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) == H3LIS100DLTR_BUFFER) {
+        // Nobody is draining us. Keep the older data, it's contiguous.
+        dropped_count.fetch_add(1, std::memory_order_relaxed);
+        io_stats.lost(1);
+        return;
+    }
+    accel_reading_t &sample = samples[h % H3LIS100DLTR_BUFFER];
+    sample.acc_x = (int8_t)frame[OUT_X::address - STATUS_REG::address];
+    sample.acc_y = (int8_t)frame[OUT_X::address - STATUS_REG::address + 2];
+    sample.acc_z = (int8_t)frame[OUT_Z::address - STATUS_REG::address];
+    head.store(h + 1, std::memory_order_release);
+    io_stats.produced(1);
+}
+
+/**
+ * Take readings from this device.
+ * 
+ * @param out Caller's buffer.
+ * @param max Capacity of `out`.
+ * @return number of readings copied, oldest first.
+*/
+size_t H3LIS100DLTR::read(accel_reading_t *out, size_t max) {
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    uint32_t count = head.load(std::memory_order_acquire) - t;
+    size_t n = count < max ? count : max;
+    for (size_t i = 0; i < n; i++) {
+        out[i] = samples[(t + i) % H3LIS100DLTR_BUFFER];
+    }
+    tail.store(t + n, std::memory_order_release);
+    return n;
+}
+
+size_t H3LIS100DLTR::read(int16_t *ch, size_t stride, size_t max) {
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    uint32_t count = head.load(std::memory_order_acquire) - t;
+    size_t n = count < max ? count : max;
+    for (size_t i = 0; i < n; i++) {
+        const accel_reading_t &sample = samples[(t + i) % H3LIS100DLTR_BUFFER];
+        ch[i] = sample.acc_x;
+        ch[stride + i] = sample.acc_y;
+        ch[2 * stride + i] = sample.acc_z;
+    }
+    tail.store(t + n, std::memory_order_release);
+    return n;
+}
+
+/**
+ * @brief Checks WHO_AM_I.
  * 
  * Returns either STATUS_OK if normal, STATUS_MISBEHAVING if
  * accessible but readings out of range, or STATUS_FAILED otherwise.
@@ -30,37 +201,93 @@ std::vector<accel_reading_t> H3LIS100DLTR::read() {
  * @return status: device status
 **/
 status H3LIS100DLTR::checkOK() {
-    // Placeholder
+    uint8_t id;
+    esp_err_t err;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        err = transact(1, [&](TickType_t timeout) {
+            return reg_read(port, addr.get_value(), h3lis100dl::WHO_AM_I::address, &id, 1, timeout);
+        });
+    }
+    if (err != ESP_OK) {
+        return STATUS_FAILED;
+    }
+    if (id != h3lis100dl::WHO_AM_I_VALUE) {
+        io_stats.error(DEV_ERR_BAD_DATA);
+        return STATUS_MISBEHAVING;
+    }
     return STATUS_OK;
 }
 
 /**
  * Initialise the device.
  * 
- * Performs any setup required inc. calculating
- * magic numbers etc. - returns a STATUS the same way as checkOK. You can probably
- * just call checkOK at the end of this, but obviously there if you fail the setup steps
- * that's worth thinking about too.
+ * Writes and verifies the INIT block, hooks up the INT1 data ready line
+ * and starts sampling at the low rate.
+ * 
+ * @note The GPIO ISR service must already be installed.
  * 
  * @return status: device status
 */
-status H3LIS100DLTR::init(idf::I2CMaster i2c) {
-    // Placeholder
-    return STATUS_OK;
-}
-
-
-void H3LIS100DLTR::stop()
-{
+status H3LIS100DLTR::init() {
+    using namespace h3lis100dl;
 
-}
+    status result = checkOK();
+    if (result != STATUS_OK) {
+        return result;
+    }
+    if (reg_write_block(port, addr.get_value(), INIT) != ESP_OK) {
+        return STATUS_FAILED;
+    }
+    if (reg_verify_block(port, addr.get_value(), MAP, INIT) != ESP_OK) {
+        return STATUS_MISBEHAVING;
+    }
 
-void H3LIS100DLTR::watchdog_task(void *parameters)
-{
+    if (irq != GPIO_NUM_NC) {
+        gpio_config_t io_conf = {};
+        io_conf.intr_type = GPIO_INTR_POSEDGE;
+        io_conf.mode = GPIO_MODE_INPUT;
+        io_conf.pin_bit_mask = 1ULL << irq;
+        io_conf.pull_down_en = GPIO_PULLDOWN_DISABLE;
+        io_conf.pull_up_en = GPIO_PULLUP_DISABLE;
+        if (gpio_config(&io_conf) != ESP_OK ||
+            gpio_isr_handler_add(irq, drdy_isr, this) != ESP_OK) {
+            // Still usable by polling STATUS_REG
+            irq = GPIO_NUM_NC;
+        }
+    }
 
+    return setRate(RATE_LOW);
 }
 
-void H3LIS100DLTR::watchdog_callback(TimerHandle_t xtimer)
-{
+/**
+ * Switch output data rate, e.g. on a change of flight phase.
+ * 
+ * @return status: device status
+*/
+status H3LIS100DLTR::setRate(sample_rate rate) {
+    using namespace h3lis100dl;
+    const reg_block_view_t block = rate == RATE_FULL ? reg_block_view_t(RATE_FULL_CFG)
+                                                     : reg_block_view_t(RATE_LOW_CFG);
 
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (reg_write_block(port, addr.get_value(), block) != ESP_OK) {
+            return STATUS_FAILED;
+        }
+        if (reg_verify_block(port, addr.get_value(), MAP, block) != ESP_OK) {
+            return STATUS_MISBEHAVING;
+        }
+    }
+    // Reading the outputs clears data ready, so a stale sample left over from
+    // before the switch can't hold INT1 high and stop new edges.
+    pending.store(1, std::memory_order_relaxed);
+    // The CPU may be in light sleep between low rate slots, and edges
+    // aren't latched through it: one missed edge would leave INT1 high for
+    // good. Slots are short enough to poll at this rate instead.
+    polled.store(rate == RATE_LOW, std::memory_order_relaxed);
+    if (reader != nullptr) {
+        xTaskNotifyGive(reader);
+    }
+    return STATUS_OK;
 }
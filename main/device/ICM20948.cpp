@@ -4,30 +4,30 @@
 // 05/2023
 
 #include "ICM20948.hpp"
+#include "ICM20948Registers.hpp"
+#include "ICM20948Frame.hpp"
 #include "i2c_cxx.hpp"
 #include "types.hpp"
-#include <memory>
 #include <sys/_stdint.h>
 
-ICM20948::ICM20948() {
-    // Placeholder
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+ICM20948::ICM20948(const device_desc_t &desc) : addr(desc.address) {
+    port = i2c_port(desc.bus);
+    measurements.reserve(SAMPLE_BATCH_MAX);
+    taken.reserve(SAMPLE_BATCH_MAX);
 }
 
 /**
- * Take a reading from this device.
- * @return A vector of readings from this device of type [TYPE]
+ * Take the readings queued by `update`.
+ * @return The queued readings, valid until the next call
 */
-std::vector<imu_reading_t> ICM20948::read() {
-    // Placeholder
-
-    // imu_reading_t placeholder[] = {0};
-    // std::vector<imu_reading_t> readings = std::vector<imu_reading_t>(placeholder, placeholder + sizeof(imu_reading_t) / sizeof(placeholder[0]));
-
-    // the swap is so that the internal measuremnets are earased, and are handed to the caller
-    auto readings = std::vector<imu_reading_t>{};
-    measurements.swap(readings);
-
-    return readings;
+const sample_batch<imu_reading_t> &ICM20948::read() {
+    // the two blocks trade places, so nothing is allocated
+    taken.clear();
+    taken.swap(measurements);
+    return taken;
 }
 
 /**
@@ -39,99 +39,212 @@ std::vector<imu_reading_t> ICM20948::read() {
  * @return status: device status
 */
 status ICM20948::checkOK() {
-    // Placeholder
+    uint8_t id;
+    if (transact(1, [&](TickType_t timeout) {
+            return reg_read(port, addr.get_value(), icm20948::WHO_AM_I::address, &id, 1, timeout);
+        }) != ESP_OK) {
+        return STATUS_FAILED;
+    }
+    if (id != icm20948::WHO_AM_I_VALUE) {
+        io_stats.error(DEV_ERR_BAD_DATA);
+        return STATUS_MISBEHAVING;
+    }
     return STATUS_OK;
 }
 
-#define USER_CTRL 0x03
-#define INT_ENABLE 0x10
-
 /**
  * Initialise the device.
  * 
- * Performs any setup required inc. calculating
- * magic numbers etc. - returns a STATUS the same way as checkOK. You can probably
- * just call checkOK at the end of this, but obviously there if you fail the setup steps
- * that's worth thinking about too.
+ * Resets the chip, then writes and verifies the compiled INIT block
+ * (see ICM20948Registers.hpp) and starts sampling at the low rate.
  * 
  * @return status: device status
 */
-status ICM20948::init(std::shared_ptr<idf::I2CMaster> i2c, bool alt_address) {
-    this->addr = std::make_unique<idf::I2CAddress>(BASE_ADDRESS & alt_address);
-    this->i2c = i2c;
+status ICM20948::init() {
+    using namespace icm20948;
 
-    // check if device is available
-    try {
-      this->i2c->sync_read(*this->addr, 0); // send nothing
-                                            // should still recieve ACK
-    } catch (idf::I2CException& e) {
-      // something went wrong with the i2c communication
-      return STATUS_FAILED;
+    // Do a full reset. The chip can't be reached until it's back up.
+    if (reg_write(port, addr.get_value(), PWR_MGMT_1::address, PWR_MGMT_1::DEVICE_RESET(1)) != ESP_OK) {
+        return STATUS_FAILED;
     }
+    vTaskDelay(pdMS_TO_TICKS(ICM20948_RESET_MS));
 
-    // Setup user settings.
-    try {
-      // Do a full reset.
-      const std::vector<uint8_t> data {USER_CTRL, 0x00};
-      this->i2c->sync_write(*this->addr, data);
-    } catch (idf::I2CException& e) {
-      return STATUS_FAILED;
+    if (checkOK() != STATUS_OK) {
+        return STATUS_FAILED;
     }
-
-    // Setup interrupts.
-    try {
-      // enable the raw data ready interrupt
-      const std::vector<uint8_t> data {INT_ENABLE + 3, 0x01};
-      this->i2c->sync_write(*this->addr, data);
-    } catch (idf::I2CException& e) {
-      return STATUS_FAILED;
+    if (reg_write_block(port, addr.get_value(), INIT) != ESP_OK) {
+        return STATUS_FAILED;
+    }
+    if (reg_verify_block(port, addr.get_value(), MAP, INIT) != ESP_OK) {
+        return STATUS_MISBEHAVING;
     }
 
-    return STATUS_OK;
+    // Without the magnetometer we still have 6 axes, so carry on.
+    status mag = magInit();
+    status rate = setRate(RATE_LOW);
+    return rate == STATUS_OK ? mag : rate;
 }
 
-#define SENS_START 0x2D // ACCEL_XOUT_H on datasheet
-#define SENS_LEN   14   // number of sensor registers
+/**
+ * Set up the AK09916 behind the auxiliary I2C master.
+ * 
+ * Resets it and puts it in continuous 100Hz mode through slave 4, then
+ * points slave 0 at its data registers so every sample is copied into
+ * EXT_SLV_SENS_DATA - right after the temperature registers, where the
+ * main burst in `update` picks it up.
+ * 
+ * @return status: STATUS_MISBEHAVING if the magnetometer is missing
+*/
+status ICM20948::magInit() {
+    using namespace icm20948;
+    uint8_t wia2 = 0;
 
-void ICM20948::update() {
-    try {
-      const std::vector<uint8_t> data {SENS_START};
-      auto data_vec = this->i2c->sync_transfer(*this->addr, data, SENS_LEN);
+    if (magTransfer(false, ak09916::CNTL3::address, ak09916::CNTL3::SRST(1), nullptr) != ESP_OK) {
+        return STATUS_MISBEHAVING;
+    }
+    vTaskDelay(pdMS_TO_TICKS(ak09916::RESET_MS) + 1);
 
-      typedef union {
-        imu_reading_t r;
-        uint8_t d[sizeof(imu_reading_t)];
-      } imu_reading_ser_t;
+    if (magTransfer(true, ak09916::WIA2::address, 0, &wia2) != ESP_OK ||
+        wia2 != ak09916::WIA2_VALUE) {
+        return STATUS_MISBEHAVING;
+    }
+    if (magTransfer(false, ak09916::CNTL2::address,
+                    ak09916::CNTL2::MODE(ak09916::Mode::CONT_100HZ), nullptr) != ESP_OK) {
+        return STATUS_MISBEHAVING;
+    }
 
-      // convert byte stream to actual value
-      imu_reading_ser_t reading;
-      *reading.d = *data_vec.data(); 
-      measurements.push_back(reading.r);
-      
-      // i'm not sure how correct the above is. If the endian-ness matches and
-      // if the struct is packed correctly
-      // could easily change to the more direct assignment approach.
+    if (reg_write_block(port, addr.get_value(), MAG_READOUT) != ESP_OK ||
+        reg_verify_block(port, addr.get_value(), MAP, MAG_READOUT) != ESP_OK) {
+        return STATUS_MISBEHAVING;
+    }
+    return STATUS_OK;
+}
 
-    } catch (idf::I2CException& e) {
-      this->alive = false;
-      return;
+/**
+ * Single register access to the AK09916 using auxiliary slave 4.
+ * 
+ * Slave 4 runs one transaction each time it is enabled and flags
+ * I2C_SLV4_DONE when finished. Only used during setup.
+ * 
+ * @param read true to read `reg` into `in`, false to write `out` to it.
+ * @return ESP_OK, ESP_ERR_TIMEOUT if slave 4 never finished, or
+ *         ESP_ERR_INVALID_RESPONSE if the magnetometer NACKed.
+*/
+esp_err_t ICM20948::magTransfer(bool read, uint8_t reg, uint8_t out, uint8_t *in) {
+    using namespace icm20948;
+    const uint8_t address = addr.get_value();
+    esp_err_t err;
+
+    // DO must be in place before the transaction is kicked off by SLV4_CTRL,
+    // then ADDR/REG/CTRL are contiguous and go out in one burst.
+    const uint8_t bank3[] = {MAP.bank_reg, 3 << MAP.bank_shift};
+    const uint8_t data_out[] = {I2C_SLV4_DO::address, out};
+    const uint8_t start[] = {
+        I2C_SLV4_ADDR::address,
+        (uint8_t)(I2C_SLV4_ADDR::I2C_SLV_RNW(read) | I2C_SLV4_ADDR::I2C_ID(ak09916::I2C_ADDR)),
+        reg,
+        I2C_SLV4_CTRL::I2C_SLV_EN(1),
+    };
+    TickType_t timeout = pdMS_TO_TICKS(REG_TIMEOUT_MS);
+    err = i2c_master_write_to_device(port, address, bank3, sizeof(bank3), timeout);
+    if (err == ESP_OK) {
+        err = i2c_master_write_to_device(port, address, data_out, sizeof(data_out), timeout);
+    }
+    if (err == ESP_OK) {
+        err = i2c_master_write_to_device(port, address, start, sizeof(start), timeout);
+    }
+    esp_err_t restore = reg_write(port, address, MAP.bank_reg, 0);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (restore != ESP_OK) {
+        return restore;
     }
 
-}
+    uint8_t mst_status = 0;
+    for (int tries = 0; tries < ICM20948_SLV4_TRIES; tries++) {
+        err = reg_read(port, address, I2C_MST_STATUS::address, &mst_status, 1);
+        if (err != ESP_OK) {
+            return err;
+        }
+        if (mst_status & I2C_MST_STATUS::I2C_SLV4_NACK.mask) {
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        if (mst_status & I2C_MST_STATUS::I2C_SLV4_DONE.mask) {
+            break;
+        }
+        vTaskDelay(1);
+    }
+    if (!(mst_status & I2C_MST_STATUS::I2C_SLV4_DONE.mask)) {
+        return ESP_ERR_TIMEOUT;
+    }
 
-// watchdog stuff
+    if (read) {
+        err = reg_write(port, address, MAP.bank_reg, 3 << MAP.bank_shift);
+        if (err == ESP_OK) {
+            err = reg_read(port, address, I2C_SLV4_DI::address, in, 1);
+        }
+        restore = reg_write(port, address, MAP.bank_reg, 0);
+        if (err == ESP_OK) {
+            err = restore;
+        }
+    }
+    return err;
+}
 
-void ICM20948::stop()
-{
+/**
+ * Switch output data rate, e.g. on a change of flight phase.
+ * 
+ * @return status: device status
+*/
+status ICM20948::setRate(sample_rate rate) {
+    using namespace icm20948;
+    const reg_block_view_t block = rate == RATE_FULL ? reg_block_view_t(RATE_FULL_CFG)
+                                                     : reg_block_view_t(RATE_LOW_CFG);
 
+    if (reg_write_block(port, addr.get_value(), block) != ESP_OK) {
+        return STATUS_FAILED;
+    }
+    if (reg_verify_block(port, addr.get_value(), MAP, block) != ESP_OK) {
+        return STATUS_MISBEHAVING;
+    }
+    return STATUS_OK;
 }
 
-void ICM20948::watchdog_task(void *parameters)
-{
+#define SENS_START icm20948::ACCEL_XOUT_H::address
+#define SENS_LEN   icm20948::FRAME_SIZE // accel, gyro, temp and magnetometer
 
+/**
+ * Read one frame (all nine axes and temperature) and queue it for `read`.
+*/
+void ICM20948::update() {
+    uint8_t frame[SENS_LEN];
+    if (transact(sizeof(frame), [&](TickType_t timeout) {
+            return reg_read(port, addr.get_value(), SENS_START, frame, sizeof(frame), timeout);
+        }) != ESP_OK) {
+        return;
+    }
+    accept(frame);
 }
 
-void ICM20948::watchdog_callback(TimerHandle_t xtimer)
-{
+/**
+ * As `update`, as a coroutine: the frame read goes out on `bus`'s worker.
+*/
+AsyncTask<> ICM20948::updateAsync(AsyncBus &bus) {
+    uint8_t frame[SENS_LEN];
+    if (co_await bus.read(*this, port, addr.get_value(), SENS_START, frame, sizeof(frame)) != ESP_OK) {
+        co_return;
+    }
+    accept(frame);
+}
 
+void ICM20948::accept(const uint8_t *frame) {
+    imu_reading_t reading;
+    icm20948_decode(frame, 1, SENS_LEN, &reading);
+    io_stats.produced(1);
+    if (measurements.size() == SAMPLE_BATCH_MAX) {
+        io_stats.lost(1);
+        return;
+    }
+    measurements.push_back(reading);
 }
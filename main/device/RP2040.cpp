@@ -0,0 +1,298 @@
+// RP2040.cpp
+// Framed, DMA driven SPI link to the payload's RP2040.
+// 05/2023
+
+#include "RP2040.hpp"
+
+#include <string.h>
+#include <stddef.h>
+
+#include "esp_timer.h"
+#include "esp_rom_crc.h"
+
+RP2040::RP2040(const device_desc_t &desc) {
+    host = spi_host(desc.bus);
+    cs = (gpio_num_t)desc.address;
+    spi = nullptr;
+    inflight = 0;
+    next_slot = 0;
+    cmd_head = cmd_count = 0;
+    tel_head = tel_count = 0;
+    rx_head = rx_count = 0;
+    tx_seq = 0;
+    cmd_seq = 0;
+    cmd_sent = false;
+    cmd_wait = 0;
+    rx_seq = 0;
+    rx_cmd_seq = 0;
+    rx_cmd_seen = false;
+    rx_seen = false;
+    last_rx_us = 0;
+    counters = {};
+    // Nothing has been heard from the RP2040 yet.
+    alive = false;
+}
+
+static uint32_t frame_crc(const payload_frame_t *frame) {
+    return esp_rom_crc32_le(0, (const uint8_t *)frame, offsetof(payload_frame_t, crc));
+}
+
+/**
+ * Check if the link is working.
+ * 
+ * Doesn't touch the bus - just looks at when a valid frame last arrived.
+ * 
+ * @return status: STATUS_OK if a frame arrived within PAYLOAD_TIMEOUT_US,
+ *         STATUS_FAILED otherwise.
+*/
+status RP2040::checkOK() {
+    if (spi == nullptr || !rx_seen || esp_timer_get_time() - last_rx_us > PAYLOAD_TIMEOUT_US) {
+        return STATUS_FAILED;
+    }
+    return STATUS_OK;
+}
+
+/**
+ * Initialise the link.
+ * 
+ * Sets up the SPI bus with DMA and queues the first frames.
+ * 
+ * @return status: device status
+*/
+status RP2040::init() {
+    spi_bus_config_t bus = {};
+    bus.mosi_io_num = PIN_PAYLOAD_MOSI;
+    bus.miso_io_num = PAYLOAD_LOOPBACK ? PIN_PAYLOAD_MOSI : PIN_PAYLOAD_MISO;
+    bus.sclk_io_num = PIN_PAYLOAD_SCLK;
+    bus.quadwp_io_num = -1;
+    bus.quadhd_io_num = -1;
+    bus.max_transfer_sz = PAYLOAD_FRAME_SIZE;
+    if (spi_bus_initialize(host, &bus, SPI_DMA_CH_AUTO) != ESP_OK) {
+        return STATUS_FAILED;
+    }
+
+    spi_device_interface_config_t dev = {};
+    dev.mode = 0;
+    dev.clock_speed_hz = PAYLOAD_CLOCK_HZ;
+    dev.spics_io_num = cs;
+    dev.queue_size = PAYLOAD_INFLIGHT;
+    if (spi_bus_add_device(host, &dev, &spi) != ESP_OK) {
+        spi = nullptr;
+        return STATUS_FAILED;
+    }
+
+    for (int i = 0; i < PAYLOAD_INFLIGHT; i++) {
+        memset(&trans[i], 0, sizeof(trans[i]));
+        trans[i].length = PAYLOAD_FRAME_SIZE * 8;
+        trans[i].tx_buffer = &tx_frames[i];
+        trans[i].rx_buffer = &rx_frames[i];
+        trans[i].user = (void *)(intptr_t)i;
+    }
+    poll();
+    return STATUS_OK;
+}
+
+/**
+ * Run the link.
+ * 
+ * Hands every finished transaction's received frame to `accept`, then
+ * refills and requeues free slots so PAYLOAD_INFLIGHT transactions are
+ * always with the driver. Nothing here waits on the bus.
+*/
+void RP2040::poll() {
+    if (spi == nullptr) {
+        return;
+    }
+
+    spi_transaction_t *done;
+    while (inflight > 0 && spi_device_get_trans_result(spi, &done, 0) == ESP_OK) {
+        int slot = (intptr_t)done->user;
+        int64_t now = esp_timer_get_time();
+        io_stats.transaction(ESP_OK, PAYLOAD_FRAME_SIZE, (uint32_t)(now - queued_at[slot]), now);
+        accept(&rx_frames[slot]);
+        inflight--;
+    }
+
+    while (inflight < PAYLOAD_INFLIGHT) {
+        int slot = next_slot;
+        fill(&tx_frames[slot]);
+        queued_at[slot] = esp_timer_get_time();
+        if (spi_device_queue_trans(spi, &trans[slot], 0) != ESP_OK) {
+            break;
+        }
+        next_slot = (next_slot + 1) % PAYLOAD_INFLIGHT;
+        inflight++;
+    }
+}
+
+/**
+ * Queue a message for the RP2040.
+ * 
+ * @param lane LANE_COMMAND for reliable delivery, LANE_TELEMETRY for bulk.
+ * @return false if the lane is full or `len` exceeds PAYLOAD_FRAME_DATA.
+*/
+bool RP2040::send(payload_lane lane, const uint8_t *data, size_t len) {
+    if (len > PAYLOAD_FRAME_DATA) {
+        return false;
+    }
+
+    message_t *msg;
+    if (lane == LANE_COMMAND) {
+        if (cmd_count == PAYLOAD_COMMAND_SLOTS) {
+            return false;
+        }
+        msg = &cmd_queue[(cmd_head + cmd_count++) % PAYLOAD_COMMAND_SLOTS];
+    } else if (lane == LANE_TELEMETRY) {
+        if (tel_count == PAYLOAD_TELEMETRY_SLOTS) {
+            return false;
+        }
+        msg = &tel_queue[(tel_head + tel_count++) % PAYLOAD_TELEMETRY_SLOTS];
+    } else {
+        return false;
+    }
+
+    msg->queued_us = esp_timer_get_time();
+    msg->lane = lane;
+    msg->len = (uint16_t)len;
+    memcpy(msg->data, data, len);
+    return true;
+}
+
+/**
+ * Take the oldest message received from the RP2040.
+ * 
+ * @param lane Set to the lane it arrived on.
+ * @return its length (truncated to `max`), or 0 if nothing is waiting.
+*/
+size_t RP2040::receive(payload_lane *lane, uint8_t *data, size_t max) {
+    if (rx_count == 0) {
+        return 0;
+    }
+    const message_t &msg = rx_queue[rx_head];
+    size_t len = msg.len < max ? msg.len : max;
+    memcpy(data, msg.data, len);
+    *lane = (payload_lane)msg.lane;
+    rx_head = (rx_head + 1) % PAYLOAD_TELEMETRY_SLOTS;
+    rx_count--;
+    return len;
+}
+
+/**
+ * Build the next outgoing frame.
+ * 
+ * An unacknowledged command is (re)sent first, once every
+ * PAYLOAD_RESEND_EXCHANGES exchanges, keeping its sequence number so
+ * the RP2040 can discard duplicates. Telemetry fills the exchanges in
+ * between, and idle frames keep the clock running for the RP2040.
+*/
+void RP2040::fill(payload_frame_t *frame) {
+    const message_t *msg = nullptr;
+
+    if (cmd_count > 0 && (!cmd_sent || cmd_wait >= PAYLOAD_RESEND_EXCHANGES)) {
+        if (cmd_sent) {
+            counters.resends++;
+            io_stats.retry();
+        } else {
+            cmd_seq = ++tx_seq;
+            cmd_sent = true;
+        }
+        cmd_wait = 0;
+        msg = &cmd_queue[cmd_head];
+        frame->seq = cmd_seq;
+    } else {
+        if (cmd_sent) {
+            cmd_wait++;
+        }
+        if (tel_count > 0) {
+            msg = &tel_queue[tel_head];
+            tel_head = (tel_head + 1) % PAYLOAD_TELEMETRY_SLOTS;
+            tel_count--;
+            frame->seq = ++tx_seq;
+        } else {
+            frame->seq = tx_seq;
+        }
+    }
+
+    frame->magic = PAYLOAD_MAGIC;
+    frame->ack = rx_cmd_seq;
+    if (msg != nullptr) {
+        frame->lane = msg->lane;
+        frame->len = msg->len;
+        memcpy(frame->data, msg->data, msg->len);
+        counters.tx_frames++;
+    } else {
+        frame->lane = LANE_IDLE;
+        frame->len = 0;
+    }
+    frame->crc = frame_crc(frame);
+}
+
+/**
+ * Process a frame received from the RP2040.
+ * 
+ * Frames that fail the CRC are counted and ignored. The `ack` of any
+ * valid frame can retire our outstanding command. Repeats of a command
+ * (its sequence number, or any before it) are acknowledged again but not
+ * delivered twice.
+*/
+void RP2040::accept(const payload_frame_t *frame) {
+    if (frame->magic != PAYLOAD_MAGIC) {
+        // Nobody there, or out of sync. Not worth counting.
+        return;
+    }
+    if (frame->crc != frame_crc(frame) || frame->len > PAYLOAD_FRAME_DATA) {
+        counters.crc_errors++;
+        io_stats.error(DEV_ERR_BAD_DATA);
+        return;
+    }
+    int64_t now = esp_timer_get_time();
+    last_rx_us = now;
+
+    if (cmd_sent && (int16_t)(frame->ack - cmd_seq) >= 0) {
+        uint32_t rtt = (uint32_t)(now - cmd_queue[cmd_head].queued_us);
+        counters.rtt_last_us = rtt;
+        if (rtt > counters.rtt_max_us) {
+            counters.rtt_max_us = rtt;
+        }
+        cmd_head = (cmd_head + 1) % PAYLOAD_COMMAND_SLOTS;
+        cmd_count--;
+        cmd_sent = false;
+    }
+
+    if (frame->lane == LANE_IDLE) {
+        rx_seen = true;
+        return;
+    }
+
+    if (frame->lane == LANE_COMMAND) {
+        if (rx_cmd_seen && (int16_t)(frame->seq - rx_cmd_seq) <= 0) {
+            return; // resent command we already have
+        }
+        rx_cmd_seen = true;
+        rx_cmd_seq = frame->seq;
+    }
+    // A resend keeps its first seq, so it can arrive behind newer frames:
+    // only a newer frame moves rx_seq on.
+    uint16_t gap = (uint16_t)(frame->seq - rx_seq);
+    if (!rx_seen) {
+        rx_seq = frame->seq;
+    } else if (gap != 0 && gap < 0x8000) {
+        counters.seq_gaps += gap - 1;
+        io_stats.lost(gap - 1);
+        rx_seq = frame->seq;
+    }
+    rx_seen = true;
+    counters.rx_frames++;
+    io_stats.produced(1);
+
+    if (rx_count == PAYLOAD_TELEMETRY_SLOTS) {
+        counters.dropped++;
+        io_stats.lost(1);
+        return;
+    }
+    message_t &msg = rx_queue[(rx_head + rx_count++) % PAYLOAD_TELEMETRY_SLOTS];
+    msg.queued_us = now;
+    msg.lane = frame->lane;
+    msg.len = frame->len;
+    memcpy(msg.data, frame->data, frame->len);
+}
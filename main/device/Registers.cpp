@@ -0,0 +1,105 @@
+// Registers.cpp
+// Bus access for compiled register configuration blocks.
+// 05/2023
+
+#include "Registers.hpp"
+
+#include <freertos/FreeRTOS.h>
+
+// Longest contiguous run read back in one go while verifying.
+#define REG_VERIFY_MAX_RUN 32
+
+/**
+ * Reads `len` consecutive registers starting at `reg` in one transaction.
+ *
+ * @return ESP_OK, or the error from the I2C driver.
+ */
+esp_err_t reg_read(i2c_port_t port, uint8_t address, uint8_t reg,
+                   uint8_t *data, size_t len, TickType_t timeout) {
+    return i2c_master_write_read_device(port, address, &reg, 1, data, len, timeout);
+}
+
+/**
+ * Writes a single register.
+ *
+ * @return ESP_OK, or the error from the I2C driver.
+ */
+esp_err_t reg_write(i2c_port_t port, uint8_t address, uint8_t reg, uint8_t value,
+                    TickType_t timeout) {
+    const uint8_t buf[2] = {reg, value};
+    return i2c_master_write_to_device(port, address, buf, sizeof(buf), timeout);
+}
+
+/**
+ * Writes a compiled configuration block straight out of flash, one bus
+ * transaction per burst.
+ *
+ * @return ESP_OK, or the first error from the I2C driver.
+ */
+esp_err_t reg_write_block(i2c_port_t port, uint8_t address, const reg_block_view_t &block) {
+    const uint8_t *bytes = block.bytes;
+    for (size_t i = 0; i < block.count; i++) {
+        esp_err_t err = i2c_master_write_to_device(port, address, bytes, block.lengths[i],
+                                                   pdMS_TO_TICKS(REG_TIMEOUT_MS));
+        if (err != ESP_OK) {
+            return err;
+        }
+        bytes += block.lengths[i];
+    }
+    return ESP_OK;
+}
+
+/**
+ * Reads back the registers written by a configuration block and checks
+ * them against what was written.
+ *
+ * Contiguous registers in the same bank are read in a single burst. Only
+ * the bits in each write's verify_mask are compared, so self-clearing and
+ * write-only bits can be excluded. Banked chips are left in bank 0.
+ *
+ * @return ESP_OK if everything matches, ESP_ERR_INVALID_RESPONSE on a
+ *         mismatch, or the error from the I2C driver.
+ */
+esp_err_t reg_verify_block(i2c_port_t port, uint8_t address, const reg_map_t &map,
+                           const reg_block_view_t &block) {
+    const reg_write_t *writes = block.writes;
+    esp_err_t err = ESP_OK;
+    int bank = -1;
+    size_t i = 0;
+
+    while (i < block.nwrites && err == ESP_OK) {
+        if (map.banked && writes[i].bank != bank) {
+            bank = writes[i].bank;
+            err = reg_write(port, address, map.bank_reg, (uint8_t)(bank << map.bank_shift));
+            if (err != ESP_OK) {
+                break;
+            }
+        }
+
+        size_t j = i + 1;
+        while (j < block.nwrites && j - i < REG_VERIFY_MAX_RUN &&
+               writes[j].bank == writes[i].bank &&
+               writes[j].reg == writes[j - 1].reg + 1) {
+            j++;
+        }
+
+        uint8_t readback[REG_VERIFY_MAX_RUN];
+        uint8_t start = writes[i].reg | (j - i > 1 ? map.increment : 0);
+        err = reg_read(port, address, start, readback, j - i);
+        for (size_t k = i; k < j && err == ESP_OK; k++) {
+            uint8_t mask = writes[k].verify_mask;
+            if ((readback[k - i] & mask) != (writes[k].value & mask)) {
+                err = ESP_ERR_INVALID_RESPONSE;
+            }
+        }
+        i = j;
+    }
+
+    if (map.banked && bank > 0) {
+        esp_err_t restore = reg_write(port, address, map.bank_reg, 0);
+        if (err == ESP_OK) {
+            err = restore;
+        }
+    }
+    return err;
+}
@@ -5,49 +5,195 @@
 
 #include "W25Q128.hpp"
 
-W25Q128::W25Q128() {
-    // Placeholder
+#include <string.h>
+
+// Instructions, from the W25Q128JV datasheet section 8.1.
+#define CMD_WRITE_ENABLE   0x06
+#define CMD_READ_STATUS1   0x05
+#define CMD_PAGE_PROGRAM   0x02
+#define CMD_SECTOR_ERASE   0x20
+#define CMD_BLOCK_ERASE    0xd8
+#define CMD_READ_DATA      0x03
+#define CMD_JEDEC_ID       0x9f
+
+#define STATUS1_BUSY 0x01
+
+W25Q128::W25Q128(const device_desc_t &desc) {
+    host = spi_host(desc.bus);
+    cs = (gpio_num_t)desc.address;
+    spi = nullptr;
+    in_progress = false;
+}
+
+/**
+ * One polling transaction: an instruction byte, optionally a 24 bit
+ * address, then `len` bytes each way.
+*/
+esp_err_t W25Q128::command(uint8_t cmd, int addr_bits, uint32_t address,
+                           const void *tx, void *rx, size_t len) {
+    spi_transaction_ext_t t = {};
+    t.base.flags = SPI_TRANS_VARIABLE_ADDR;
+    t.base.cmd = cmd;
+    t.base.addr = address;
+    t.base.length = len * 8;
+    t.base.tx_buffer = tx;
+    t.base.rx_buffer = rx;
+    t.address_bits = addr_bits;
+
+    // Polling transactions have no timeout of their own.
+    return transact(1 + addr_bits / 8 + len, [&](TickType_t) {
+        return spi_device_polling_transmit(spi, &t.base);
+    });
 }
 
 /**
  * Check if the device is working correctly.
  * 
- * Returns either STATUS_OK if normal, STATUS_MISBEHAVING if
- * accessible but readings out of range, or STATUS_FAILED otherwise.
+ * Reads the JEDEC ID, or just the status register if the chip is busy
+ * (it ignores everything else until it's done).
  * 
  * @return status: device status
 */
 status W25Q128::checkOK() {
-    // Placeholder
-    return STATUS_OK;
+    if (spi == nullptr) {
+        return STATUS_FAILED;
+    }
+    if (busy()) {
+        return this->alive ? STATUS_OK : STATUS_FAILED;
+    }
+
+    uint8_t id[3];
+    if (command(CMD_JEDEC_ID, 0, 0, nullptr, id, sizeof(id)) != ESP_OK) {
+        return STATUS_FAILED;
+    }
+    uint32_t jedec = ((uint32_t)id[0] << 16) | ((uint32_t)id[1] << 8) | id[2];
+    return jedec == W25Q128_JEDEC_ID ? STATUS_OK : STATUS_FAILED;
 }
 
 /**
  * Initialise the device.
  * 
- * Performs any setup required inc. calculating
- * magic numbers etc. - returns a STATUS the same way as checkOK. You can probably
- * just call checkOK at the end of this, but obviously there if you fail the setup steps
- * that's worth thinking about too.
+ * Brings up the shared flash bus (whichever chip gets there first) and
+ * adds this chip to it.
  * 
  * @return status: device status
 */
 status W25Q128::init() {
-    // Placeholder
-    return STATUS_OK;
+    spi_bus_config_t bus = {};
+    bus.mosi_io_num = PIN_FLASH_MOSI;
+    bus.miso_io_num = PIN_FLASH_MISO;
+    bus.sclk_io_num = PIN_FLASH_SCLK;
+    bus.quadwp_io_num = -1;
+    bus.quadhd_io_num = -1;
+    bus.max_transfer_sz = W25Q128_PAGE_SIZE + 4;
+    esp_err_t err = spi_bus_initialize(host, &bus, SPI_DMA_CH_AUTO);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+        return STATUS_FAILED;
+    }
+
+    spi_device_interface_config_t dev = {};
+    dev.command_bits = 8;
+    dev.address_bits = 24;
+    dev.mode = 0;
+    dev.clock_speed_hz = W25Q128_CLOCK_HZ;
+    dev.spics_io_num = cs;
+    dev.queue_size = 1;
+    if (spi_bus_add_device(host, &dev, &spi) != ESP_OK) {
+        spi = nullptr;
+        return STATUS_FAILED;
+    }
+
+    // A program or erase may have been cut off by a reset.
+    in_progress = true;
+    return checkOK();
 }
 
-void W25Q128::stop()
-{
+/**
+ * Whether the last program or erase is still running.
+ * 
+ * Reads status register 1 only if an operation was started and hasn't
+ * been seen to finish, so this is free when the chip is idle. A failed
+ * read counts as busy.
+*/
+bool W25Q128::busy() {
+    if (!in_progress) {
+        return false;
+    }
+    uint8_t status1;
+    if (command(CMD_READ_STATUS1, 0, 0, nullptr, &status1, 1) != ESP_OK) {
+        return true;
+    }
+    in_progress = status1 & STATUS1_BUSY;
+    return in_progress;
+}
 
+/**
+ * Read from the array.
+ * 
+ * @return STATUS_OK, STATUS_MISBEHAVING if the chip is busy, or
+ *         STATUS_FAILED on a bus error.
+*/
+status W25Q128::read(uint32_t address, void *data, size_t len) {
+    if (busy()) {
+        return STATUS_MISBEHAVING;
+    }
+    uint8_t *out = (uint8_t *)data;
+    while (len > 0) {
+        size_t chunk = len < W25Q128_PAGE_SIZE ? len : W25Q128_PAGE_SIZE;
+        if (command(CMD_READ_DATA, 24, address, nullptr, out, chunk) != ESP_OK) {
+            return STATUS_FAILED;
+        }
+        address += chunk;
+        out += chunk;
+        len -= chunk;
+    }
+    return STATUS_OK;
 }
 
-void W25Q128::watchdog_task(void *parameters)
-{
+/**
+ * Write enable followed by a program or erase instruction. Returns as
+ * soon as the chip has latched it.
+*/
+status W25Q128::start(uint8_t cmd, uint32_t address, const void *data, size_t len) {
+    if (busy()) {
+        return STATUS_MISBEHAVING;
+    }
+    if (command(CMD_WRITE_ENABLE, 0, 0, nullptr, nullptr, 0) != ESP_OK ||
+        command(cmd, 24, address, data, nullptr, len) != ESP_OK) {
+        return STATUS_FAILED;
+    }
+    in_progress = true;
+    return STATUS_OK;
+}
 
+/**
+ * Start programming part of one page. Bits can only be cleared, so the
+ * target must have been erased.
+ * 
+ * @return STATUS_OK if started, STATUS_MISBEHAVING if the chip is busy,
+ *         or STATUS_FAILED on a bus error or bad arguments.
+*/
+status W25Q128::program(uint32_t address, const void *data, size_t len) {
+    if (len == 0 || (address % W25Q128_PAGE_SIZE) + len > W25Q128_PAGE_SIZE) {
+        return STATUS_FAILED;
+    }
+    return start(CMD_PAGE_PROGRAM, address, data, len);
 }
 
-void W25Q128::watchdog_callback(TimerHandle_t xtimer)
-{
+/**
+ * Start erasing a 4KB sector. 45ms typical, 400ms worst case.
+ * 
+ * @return as for `program`.
+*/
+status W25Q128::eraseSector(uint32_t address) {
+    return start(CMD_SECTOR_ERASE, address, nullptr, 0);
+}
 
-}
\ No newline at end of file
+/**
+ * Start erasing a 64KB block. 150ms typical, 2s worst case.
+ * 
+ * @return as for `program`.
+*/
+status W25Q128::eraseBlock(uint32_t address) {
+    return start(CMD_BLOCK_ERASE, address, nullptr, 0);
+}
@@ -0,0 +1,129 @@
+// ADCDecimate.hpp
+// Oversampling, decimation and calibration of raw ESP32 continuous ADC
+// output. Kept free of any esp-idf dependencies so it builds anywhere.
+// 05/2023
+
+#ifndef ADCDECIMATE_H
+#define ADCDECIMATE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+              "DMA word decoding assumes a little endian CPU");
+
+// Channels on one ADC unit.
+#define ADC_MAX_CHANNELS 8
+#define ADC_SLOT_NONE 0xff
+// Means are kept with this many fractional bits: oversampling by N buys
+// roughly log4(N) bits of resolution, which a 12 bit integer would throw
+// away.
+#define ADC_MEAN_FRAC_BITS 4
+// Largest decimation ratio before the sums could overflow.
+#define ADC_MAX_RATIO 4096
+
+typedef struct {
+    uint8_t slot[ADC_MAX_CHANNELS]; // output slot of each ADC channel
+    uint8_t slots;
+    uint16_t ratio;                 // samples per slot per output block
+    uint32_t sum[ADC_MAX_CHANNELS]; // indexed by slot
+    uint16_t count[ADC_MAX_CHANNELS];
+    uint32_t dropped;               // blocks with no room in `out`
+} adc_decimator_t;
+
+// mv = raw * gain_q16 / 65536 + offset_mv
+typedef struct {
+    int32_t gain_q16;
+    int32_t offset_mv;
+} adc_linear_t;
+
+/**
+ * Sets up a decimator.
+ *
+ * @param channels ADC channel for each output slot, in slot order.
+ * @param ratio Samples averaged into each output, at most ADC_MAX_RATIO.
+ */
+static inline void adc_decimator_init(adc_decimator_t *d, const uint8_t *channels,
+                                      size_t n, uint16_t ratio) {
+    memset(d, 0, sizeof(*d));
+    memset(d->slot, ADC_SLOT_NONE, sizeof(d->slot));
+    for (size_t i = 0; i < n && i < ADC_MAX_CHANNELS; i++) {
+        d->slot[channels[i] % ADC_MAX_CHANNELS] = (uint8_t)i;
+    }
+    d->slots = (uint8_t)n;
+    d->ratio = ratio > ADC_MAX_RATIO ? ADC_MAX_RATIO : ratio;
+}
+
+/**
+ * Accumulates a run of DMA conversion results and emits block means.
+ *
+ * Input is the ESP32's "type 1" format: one little endian 16 bit word per
+ * conversion, channel in the top 4 bits and the 12 bit result below.
+ * Results for channels without a slot are skipped. Once every slot has
+ * `ratio` samples, one block of `slots` means (12.ADC_MEAN_FRAC_BITS
+ * fixed point) is written to `out` and the sums restart.
+ *
+ * @param src Raw DMA bytes. No alignment needed.
+ * @param out Room for `max_blocks` blocks of `slots` values.
+ * @return Number of blocks written.
+ */
+static inline size_t adc_decimate(adc_decimator_t *d, const uint8_t *src, size_t bytes,
+                                  uint16_t *out, size_t max_blocks) {
+    size_t blocks = 0;
+
+    for (size_t i = 0; i + 1 < bytes; i += 2) {
+        uint16_t w;
+        memcpy(&w, src + i, sizeof(w));
+        uint8_t s = d->slot[(w >> 12) % ADC_MAX_CHANNELS];
+        if (s == ADC_SLOT_NONE) {
+            continue;
+        }
+        d->sum[s] += w & 0x0fff;
+        if (++d->count[s] != d->ratio) {
+            continue;
+        }
+
+        // Channels convert round robin, so every slot fills at about the
+        // same time. Only look at the others once this one is full.
+        bool ready = true;
+        for (uint8_t k = 0; k < d->slots; k++) {
+            if (d->count[k] < d->ratio) {
+                ready = false;
+                break;
+            }
+        }
+        if (!ready) {
+            continue;
+        }
+
+        if (blocks < max_blocks) {
+            uint16_t *block = out + blocks * d->slots;
+            for (uint8_t k = 0; k < d->slots; k++) {
+                block[k] = (uint16_t)(((d->sum[k] << ADC_MEAN_FRAC_BITS) + d->count[k] / 2) /
+                                      d->count[k]);
+            }
+            blocks++;
+        } else {
+            d->dropped++;
+        }
+        memset(d->sum, 0, sizeof(d->sum));
+        memset(d->count, 0, sizeof(d->count));
+    }
+    return blocks;
+}
+
+/**
+ * Applies a linear calibration to a block mean.
+ *
+ * @return Millivolts at the pin, clamped to 0..65535.
+ */
+static inline uint16_t adc_to_mv(const adc_linear_t *cal, uint16_t mean) {
+    int64_t mv = (((int64_t)mean * cal->gain_q16) >> (16 + ADC_MEAN_FRAC_BITS)) + cal->offset_mv;
+    if (mv < 0) {
+        return 0;
+    }
+    return mv > 0xffff ? 0xffff : (uint16_t)mv;
+}
+
+#endif
@@ -0,0 +1,89 @@
+// Analog.hpp
+// Header file for the analog inputs (thermocouples, battery, resin
+// pressure) sampled by the ESP32's ADC in continuous mode.
+// 05/2023
+
+#ifndef ANALOG_H
+#define ANALOG_H
+
+#include <atomic>
+
+#include "esp_adc/adc_continuous.h"
+
+#include "Device.hpp"
+#include "ADCDecimate.hpp"
+
+// Continuous mode only runs on ADC1 (GPIO 32-39). Channels 6 and 7 share
+// pins with the accelerometer interrupts, so these are what's left.
+// TODO: check these
+#define ANALOG_CH_TC0   ADC_CHANNEL_0 // GPIO36
+#define ANALOG_CH_TC1   ADC_CHANNEL_3 // GPIO39
+#define ANALOG_CH_VBAT  ADC_CHANNEL_4 // GPIO32
+#define ANALOG_CH_RESIN ADC_CHANNEL_5 // GPIO33
+
+// Battery divider ratio. TODO: check against the board
+#define ANALOG_VBAT_DIVIDER 4
+
+// Conversions per second across all channels. 20kHz is the slowest the
+// ESP32's DMA mode runs, so every channel gets 5kHz.
+#define ANALOG_SAMPLE_HZ 20000
+// Conversions averaged into each output, per channel: 5kHz -> 100Hz.
+#define ANALOG_DECIMATION 50
+// Bytes per DMA frame. The driver takes one interrupt per frame (128
+// conversions), never per sample, and nothing of ours runs then.
+#define ANALOG_FRAME_BYTES 256
+// Driver ring between the DMA and `update`: ~50ms at 20kHz.
+#define ANALOG_POOL_BYTES 2048
+// Decimated blocks held between `update` and `read`.
+#define ANALOG_BUFFER 16
+// No new block for this long means the ADC has stopped.
+#define ANALOG_TIMEOUT_US (100 * 1000)
+// At the low rate the ADC converts one block and stops until the next is
+// due, 20 a second. The driver keeps the APB clock up (and the CPU out of
+// light sleep) for as long as it's converting.
+#define ANALOG_LOW_INTERVAL_US (50 * 1000)
+
+class Analog : public Device<Analog> {
+public:
+    explicit Analog(const device_desc_t &desc);
+
+    // Device methods
+    status checkOK();
+    status init(void);
+    status setRate(sample_rate rate);
+
+    // Decimate whatever the DMA has delivered since the last call, and
+    // start or stop the ADC at the low rate. Never waits for the ADC.
+    void update(void);
+    // Move up to `max` decimated blocks into `out`, oldest first.
+    size_t read(analog_reading_t *out, size_t max);
+
+    // Losses since init: DMA frames overrun in the driver's pool, plus
+    // blocks that didn't fit in the buffer.
+    uint32_t dropped() const { return dropped_count + overruns.load(std::memory_order_relaxed); }
+
+private:
+    adc_continuous_handle_t handle;
+    adc_decimator_t decimator;
+    adc_linear_t cal;
+
+    uint8_t raw[ANALOG_FRAME_BYTES] __attribute__((aligned(4)));
+
+    analog_reading_t blocks[ANALOG_BUFFER];
+    size_t head; // next slot to write
+    size_t count;
+    uint32_t dropped_count;
+    int64_t last_block_us;
+    sample_rate rate;
+    bool running;
+    int64_t burst_us; // when the ADC last started, at the low rate
+
+    std::atomic<uint32_t> overruns;
+
+    void calibrate(void);
+    void stop(void);
+    static bool pool_ovf(adc_continuous_handle_t handle,
+                         const adc_continuous_evt_data_t *edata, void *param);
+};
+
+#endif
@@ -0,0 +1,322 @@
+// Async.hpp
+// Coroutine tasks for overlapping bus transactions.
+//
+// A driver read written as an `AsyncTask` looks like straight-line code,
+// but every `co_await` on a bus transaction hands the transaction to that
+// bus's worker and suspends, so the acquisition task can start the next
+// device's read (or get on with its own work) in the meantime. The bus
+// workers post finished transactions back to the `AsyncScheduler`, which
+// resumes the waiting coroutine on the acquisition task - drivers never
+// run on a worker, so they need no locking.
+//
+// Coroutine frames come from a fixed pool, never the heap. Everything here
+// is independent of esp-idf apart from the scheduler's ready queue, so it
+// can be built and benchmarked on a host.
+// 05/2023
+
+#ifndef ASYNC_H
+#define ASYNC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <coroutine>
+#include <exception>
+#include <utility>
+#include <type_traits>
+
+#ifdef ESP_PLATFORM
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#else
+#include <mutex>
+#include <condition_variable>
+#endif
+
+// Frames in the pool and the size of each. A frame holds a coroutine's
+// locals across suspension points, including its read buffers.
+#define CORO_POOL_FRAMES 16
+#define CORO_FRAME_BYTES 256
+// Top level tasks one AsyncScheduler::run can wait on.
+#define CORO_MAX_ROOTS 8
+
+// ### Frame pool ###
+//
+// Only ever touched from the task running the scheduler.
+
+typedef struct {
+    uint32_t in_use;     // frames allocated right now
+    uint32_t high_water;
+    uint32_t failures;   // allocations refused (pool full or frame too big)
+} coro_pool_stats_t;
+
+struct coro_pool_t {
+    alignas(max_align_t) uint8_t frames[CORO_POOL_FRAMES][CORO_FRAME_BYTES];
+    uint32_t used; // bit N set if frames[N] is allocated
+    coro_pool_stats_t stats;
+};
+
+static_assert(CORO_POOL_FRAMES <= 32, "coroutine pool bitmap is 32 bits");
+
+inline coro_pool_t coro_pool;
+
+inline void *coro_frame_alloc(size_t size) noexcept {
+    if (size > CORO_FRAME_BYTES || coro_pool.used == (uint32_t)((1ull << CORO_POOL_FRAMES) - 1)) {
+        coro_pool.stats.failures++;
+        return nullptr;
+    }
+    int i = __builtin_ctz(~coro_pool.used);
+    coro_pool.used |= 1u << i;
+    if (++coro_pool.stats.in_use > coro_pool.stats.high_water) {
+        coro_pool.stats.high_water = coro_pool.stats.in_use;
+    }
+    return coro_pool.frames[i];
+}
+
+inline void coro_frame_free(void *frame) noexcept {
+    size_t i = ((uint8_t *)frame - &coro_pool.frames[0][0]) / CORO_FRAME_BYTES;
+    coro_pool.used &= ~(1u << i);
+    coro_pool.stats.in_use--;
+}
+
+// ### Tasks ###
+
+template <typename T>
+struct async_result {
+    T value{};
+    void return_value(T v) { value = std::move(v); }
+    T take() { return std::move(value); }
+};
+
+template <>
+struct async_result<void> {
+    void return_void() {}
+    void take() {}
+};
+
+// A lazily started coroutine returning T. Awaiting it runs it to
+// completion; when it finishes it resumes whoever awaited it directly
+// (symmetric transfer), so nested driver calls cost no scheduler trips.
+//
+// If the frame pool is exhausted the task comes back empty (`valid()` is
+// false) and awaiting it yields a default T straight away.
+template <typename T = void>
+class AsyncTask {
+public:
+    struct promise_type;
+    typedef std::coroutine_handle<promise_type> handle_t;
+
+    struct promise_type : async_result<T> {
+        std::coroutine_handle<> continuation;
+
+        static void *operator new(size_t size) noexcept { return coro_frame_alloc(size); }
+        static void operator delete(void *frame) noexcept { coro_frame_free(frame); }
+        static AsyncTask get_return_object_on_allocation_failure() noexcept { return AsyncTask(); }
+
+        AsyncTask get_return_object() noexcept { return AsyncTask(handle_t::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        struct final_awaiter {
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(handle_t h) noexcept {
+                std::coroutine_handle<> next = h.promise().continuation;
+                return next ? next : std::noop_coroutine();
+            }
+            void await_resume() noexcept {}
+        };
+        final_awaiter final_suspend() noexcept { return {}; }
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+
+    AsyncTask() : handle(nullptr) {}
+    explicit AsyncTask(handle_t h) : handle(h) {}
+    AsyncTask(AsyncTask &&other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+    AsyncTask &operator=(AsyncTask &&other) noexcept {
+        if (this != &other) {
+            reset();
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+    AsyncTask(const AsyncTask &) = delete;
+    AsyncTask &operator=(const AsyncTask &) = delete;
+    ~AsyncTask() { reset(); }
+
+    bool valid() const { return (bool)handle; }
+    bool done() const { return !handle || handle.done(); }
+
+    // Run until the first suspension point. Used for top level tasks;
+    // everything else is started by being awaited.
+    void start() {
+        if (handle && !handle.done()) {
+            handle.resume();
+        }
+    }
+
+    void reset() {
+        if (handle) {
+            handle.destroy();
+            handle = nullptr;
+        }
+    }
+
+    auto operator co_await() && noexcept {
+        struct awaiter {
+            handle_t h;
+            bool await_ready() noexcept { return !h || h.done(); }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> waiting) noexcept {
+                h.promise().continuation = waiting;
+                return h;
+            }
+            T await_resume() {
+                if constexpr (std::is_void_v<T>) {
+                    return;
+                } else {
+                    return h ? h.promise().take() : T{};
+                }
+            }
+        };
+        return awaiter{handle};
+    }
+
+private:
+    handle_t handle;
+};
+
+// ### Scheduler ###
+
+class AsyncScheduler {
+public:
+    AsyncScheduler();
+
+    // Start a top level task. It runs up to its first transaction before
+    // this returns. Returns false if it couldn't be started (empty task or
+    // too many roots), in which case it is dropped.
+    bool spawn(AsyncTask<> &&task);
+
+    // Resume tasks as their transactions complete, until every task
+    // spawned since the last call has finished. Blocks the calling task.
+    void run(void);
+
+    // Whether any spawned task is still waiting on a transaction.
+    bool busy(void) const { return outstanding > 0; }
+
+    // A transaction is about to be handed to a bus worker. Scheduler task only.
+    void submitted(void) { outstanding++; }
+    // A transaction finished and `h` can continue. Safe from any task.
+    void ready(std::coroutine_handle<> h);
+
+private:
+    AsyncTask<> roots[CORO_MAX_ROOTS];
+    size_t nroots;
+    size_t outstanding; // transactions handed out and not yet resumed
+
+    std::coroutine_handle<> wait(void);
+
+#ifdef ESP_PLATFORM
+    StaticQueue_t ready_buf;
+    uint8_t ready_storage[CORO_POOL_FRAMES * sizeof(void *)];
+    QueueHandle_t ready_queue;
+#else
+    std::mutex lock;
+    std::condition_variable cond;
+    void *ready_ring[CORO_POOL_FRAMES];
+    size_t ready_head, ready_count;
+#endif
+};
+
+inline AsyncScheduler::AsyncScheduler() {
+    nroots = 0;
+    outstanding = 0;
+#ifdef ESP_PLATFORM
+    ready_queue = xQueueCreateStatic(CORO_POOL_FRAMES, sizeof(void *), ready_storage, &ready_buf);
+#else
+    ready_head = 0;
+    ready_count = 0;
+#endif
+}
+
+inline bool AsyncScheduler::spawn(AsyncTask<> &&task) {
+    if (!task.valid() || nroots == CORO_MAX_ROOTS) {
+        return false;
+    }
+    roots[nroots] = std::move(task);
+    roots[nroots++].start();
+    return true;
+}
+
+inline void AsyncScheduler::run() {
+    // A transaction is outstanding for as long as some root is waiting,
+    // so once there are none every root has run to the end.
+    while (outstanding > 0) {
+        std::coroutine_handle<> h = wait();
+        outstanding--;
+        h.resume();
+    }
+    for (size_t i = 0; i < nroots; i++) {
+        roots[i].reset();
+    }
+    nroots = 0;
+}
+
+#ifdef ESP_PLATFORM
+inline void AsyncScheduler::ready(std::coroutine_handle<> h) {
+    void *address = h.address();
+    // Can't fill up: every suspended coroutine owns one frame.
+    xQueueSend(ready_queue, &address, portMAX_DELAY);
+}
+
+inline std::coroutine_handle<> AsyncScheduler::wait() {
+    void *address;
+    xQueueReceive(ready_queue, &address, portMAX_DELAY);
+    return std::coroutine_handle<>::from_address(address);
+}
+#else
+inline void AsyncScheduler::ready(std::coroutine_handle<> h) {
+    std::lock_guard<std::mutex> guard(lock);
+    ready_ring[(ready_head + ready_count++) % CORO_POOL_FRAMES] = h.address();
+    cond.notify_one();
+}
+
+inline std::coroutine_handle<> AsyncScheduler::wait() {
+    std::unique_lock<std::mutex> guard(lock);
+    cond.wait(guard, [this] { return ready_count > 0; });
+    void *address = ready_ring[ready_head];
+    ready_head = (ready_head + 1) % CORO_POOL_FRAMES;
+    ready_count--;
+    return std::coroutine_handle<>::from_address(address);
+}
+#endif
+
+// ### Transactions ###
+
+// One transaction queued on a bus worker. The worker calls `call`, stores
+// the result and passes `handle` to the scheduler.
+struct async_op_t {
+    int (*call)(async_op_t *op);
+    int result;
+    std::coroutine_handle<> handle;
+};
+
+// Awaitable for one blocking bus call `F` (returning an esp_err_t) run on
+// `Bus`'s worker. Lives in the awaiting coroutine's frame until resumed.
+// `Bus` needs `scheduler()` and `submit(async_op_t *)`.
+template <typename Bus, typename F>
+struct async_call_t : async_op_t {
+    Bus *bus;
+    F fn;
+
+    async_call_t(Bus *bus, F fn) : bus(bus), fn(std::move(fn)) {
+        call = [](async_op_t *op) { return static_cast<async_call_t *>(op)->fn(); };
+        result = 0;
+    }
+
+    bool await_ready() noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> h) {
+        handle = h;
+        bus->scheduler().submitted();
+        bus->submit(this);
+    }
+    int await_resume() noexcept { return result; }
+};
+
+#endif
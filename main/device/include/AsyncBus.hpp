@@ -0,0 +1,85 @@
+// AsyncBus.hpp
+// Worker task per bus for coroutine drivers (see Async.hpp).
+//
+// The esp-idf I2C and SPI calls the drivers use are blocking. Rather than
+// rewrite them, each bus gets a worker task that runs them one at a time
+// off a queue, so the acquisition task only waits when it has nothing
+// else to do. Transactions on the same bus still go out in order; the
+// overlap is with other buses and with work on the acquisition task.
+// 05/2023
+
+#ifndef ASYNCBUS_H
+#define ASYNCBUS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+
+#include "Async.hpp"
+#include "Registers.hpp"
+
+#define ASYNC_BUS_TASK_STACK 3072
+// Above the acquisition task, so a finished transaction is handed back
+// (and the next one started) as soon as the bus is free.
+#define ASYNC_BUS_TASK_PRIORITY 6
+// Acquisition's core (the main task's), leaving the other to storage.
+#define ASYNC_BUS_TASK_CORE 0
+
+class AsyncBus {
+public:
+    explicit AsyncBus(const char *name);
+
+    // Start the worker. Completed transactions are resumed by `sched`.
+    bool init(AsyncScheduler &sched);
+    bool started(void) const { return worker != nullptr; }
+
+    // Run `fn` (a blocking bus call returning an esp_err_t) on the worker.
+    // `co_await` the result to get the esp_err_t.
+    template <typename F>
+    async_call_t<AsyncBus, F> call(F fn) {
+        return async_call_t<AsyncBus, F>(this, std::move(fn));
+    }
+
+    // Awaitable versions of reg_read and reg_write, run through `dev`'s
+    // Device::transact on the worker (so retries happen there, and
+    // queueing time isn't counted as latency) under the caller's
+    // transaction deadline.
+    template <typename D>
+    auto read(D &dev, i2c_port_t port, uint8_t address, uint8_t reg, uint8_t *data, size_t len) {
+        return call([=, &dev, deadline = transaction_deadline_us] {
+            transaction_deadline_us = deadline;
+            return dev.transact(len, [=](TickType_t timeout) {
+                return reg_read(port, address, reg, data, len, timeout);
+            });
+        });
+    }
+    template <typename D>
+    auto write(D &dev, i2c_port_t port, uint8_t address, uint8_t reg, uint8_t value) {
+        return call([=, &dev, deadline = transaction_deadline_us] {
+            transaction_deadline_us = deadline;
+            return dev.transact(1, [=](TickType_t timeout) {
+                return reg_write(port, address, reg, value, timeout);
+            });
+        });
+    }
+
+    // For async_call_t.
+    AsyncScheduler &scheduler(void) { return *sched; }
+    void submit(async_op_t *op);
+
+private:
+    const char *name;
+    AsyncScheduler *sched;
+    TaskHandle_t worker;
+
+    StaticQueue_t queue_buf;
+    uint8_t queue_storage[CORO_POOL_FRAMES * sizeof(async_op_t *)];
+    QueueHandle_t queue;
+
+    static void run(void *param);
+};
+
+#endif
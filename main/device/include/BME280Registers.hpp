@@ -0,0 +1,93 @@
+// BME280Registers.hpp
+// Register map for the BME280 pressure sensor.
+// Register addresses and fields are from the BME280 datasheet
+// (BST-BME280-DS002), section 5.
+// 05/2023
+
+#ifndef BME280REGISTERS_H
+#define BME280REGISTERS_H
+
+#include "Registers.hpp"
+
+namespace bme280 {
+
+// Not banked. Over I2C the BME280 does not auto-increment on writes;
+// instead any number of register/value pairs can follow the address in
+// one transaction. Reads do auto-increment.
+inline constexpr reg_map_t MAP = {BURST_PAIRS, false, 0, 0, 0};
+
+inline constexpr uint8_t CHIP_ID = 0x60;
+inline constexpr uint8_t RESET_VALUE = 0xb6;
+// Time from reset (or power on) until the NVM has been copied out.
+inline constexpr int STARTUP_MS = 2;
+
+// Values for osrs_p, osrs_t and osrs_h fields.
+enum class Osrs : uint8_t { SKIP = 0, X1 = 1, X2 = 2, X4 = 3, X8 = 4, X16 = 5 };
+// Values for mode field of CTRL_MEAS register.
+enum class Mode : uint8_t { SLEEP = 0, FORCED = 1, NORMAL = 3 };
+// Values for t_sb field of CONFIG register.
+enum class Standby : uint8_t {
+    MS0_5 = 0, MS62_5 = 1, MS125 = 2, MS250 = 3,
+    MS500 = 4, MS1000 = 5, MS10 = 6, MS20 = 7,
+};
+// Values for filter field of CONFIG register.
+enum class Filter : uint8_t { OFF = 0, COEFF_2 = 1, COEFF_4 = 2, COEFF_8 = 3, COEFF_16 = 4 };
+
+// Calibration data, in two blocks. dig_T1 .. dig_H1 then dig_H2 .. dig_H6.
+struct CALIB00 : Reg<0x88> {};
+inline constexpr size_t CALIB00_SIZE = 26;
+struct CALIB26 : Reg<0xe1> {};
+inline constexpr size_t CALIB26_SIZE = 7;
+
+struct ID : Reg<0xd0> {};
+struct RESET : Reg<0xe0> {};
+
+struct CTRL_HUM : Reg<0xf2> {
+    static constexpr Field<0, 3, Osrs> OSRS_H{};
+};
+
+struct STATUS : Reg<0xf3> {
+    static constexpr Field<3, 1> MEASURING{};
+    static constexpr Field<0, 1> IM_UPDATE{};
+};
+
+struct CTRL_MEAS : Reg<0xf4> {
+    static constexpr Field<5, 3, Osrs> OSRS_T{};
+    static constexpr Field<2, 3, Osrs> OSRS_P{};
+    static constexpr Field<0, 2, Mode> MODE{};
+};
+
+struct CONFIG : Reg<0xf5> {
+    static constexpr Field<5, 3, Standby> T_SB{};
+    static constexpr Field<2, 3, Filter> FILTER{};
+    static constexpr Field<0, 1> SPI3W_EN{};
+};
+
+// It is recommended to read all the measurements in one go:
+// press_msb, press_lsb, press_xlsb, temp_msb, temp_lsb, temp_xlsb, hum_msb, hum_lsb
+struct PRESS_MSB : Reg<0xf7> {};
+inline constexpr size_t MEASUREMENT_SIZE = 8;
+
+// ### Configuration sequences ###
+
+// CONFIG writes are ignored in normal mode, and CTRL_HUM only takes effect
+// on the next CTRL_MEAS write, so every rate change drops to sleep first
+// and sets the mode last. All of it goes out as one transaction.
+template <Osrs P, Osrs T, Osrs H, Standby Sb, Filter F>
+inline constexpr auto RATE = reg_block(MAP, {
+    reg<CTRL_MEAS>(CTRL_MEAS::MODE(Mode::SLEEP), 0),
+    reg<CONFIG>(CONFIG::T_SB(Sb) | CONFIG::FILTER(F)),
+    reg<CTRL_HUM>(CTRL_HUM::OSRS_H(H)),
+    reg<CTRL_MEAS>(CTRL_MEAS::OSRS_T(T) | CTRL_MEAS::OSRS_P(P) | CTRL_MEAS::MODE(Mode::NORMAL)),
+});
+
+// ~60Hz: 15.6ms max conversion, 0.5ms standby.
+inline constexpr auto RATE_FULL_CFG =
+    RATE<Osrs::X4, Osrs::X1, Osrs::X1, Standby::MS0_5, Filter::COEFF_4>;
+// ~6Hz with heavy oversampling and filtering for the pad.
+inline constexpr auto RATE_LOW_CFG =
+    RATE<Osrs::X16, Osrs::X2, Osrs::X1, Standby::MS125, Filter::COEFF_16>;
+
+}
+
+#endif
@@ -0,0 +1,117 @@
+// Breaker.hpp
+// Retry limits and circuit breaking for device transactions.
+//
+// A failed transaction is retried straight away, a bounded number of
+// times and only while the current sample slot has room for another
+// attempt. Each device's breaker remembers the outcome of its last
+// BREAKER_WINDOW transactions and opens once too many of them failed, at
+// which point the driver is marked not alive and the HealthMonitor
+// quarantines it. While open, transactions fail without touching the bus.
+// The HealthMonitor's re-probes are the half-open state: a single check
+// is let through, and the circuit closes again if it succeeds.
+// 05/2023
+
+#ifndef BREAKER_H
+#define BREAKER_H
+
+#include <stdint.h>
+
+// Immediate retries per transaction.
+#define RETRY_MAX 2
+// Outcomes remembered per device.
+#define BREAKER_WINDOW 32
+// Outcomes needed before the error rate is judged.
+#define BREAKER_MIN_CALLS 8
+// Failures within the window that open the circuit (25%).
+#define BREAKER_OPEN_ERRORS 8
+
+static_assert(BREAKER_WINDOW <= 32, "breaker window is a 32 bit history");
+
+typedef struct {
+    uint8_t max_retries;
+    uint8_t min_calls;
+    uint8_t open_errors;
+} breaker_policy_t;
+
+inline constexpr breaker_policy_t BREAKER_DEFAULT = {
+    RETRY_MAX, BREAKER_MIN_CALLS, BREAKER_OPEN_ERRORS,
+};
+
+// Latest time a retry may finish, from esp_timer_get_time(). A retry is
+// only made if the attempt that just failed would fit again before it.
+// Each task has its own: acquisition sets it to the end of each slot,
+// storage to the end of its flash work, and AsyncBus carries the
+// submitting task's over to the bus worker with each transaction.
+inline thread_local int64_t transaction_deadline_us = INT64_MAX;
+
+enum breaker_state : uint8_t {
+    BREAKER_CLOSED,
+    BREAKER_OPEN,
+    BREAKER_HALF_OPEN,
+};
+
+class CircuitBreaker {
+public:
+    CircuitBreaker() : policy(BREAKER_DEFAULT) { reset(); }
+
+    void setPolicy(const breaker_policy_t &p) { policy = p; }
+    const breaker_policy_t &limits() const { return policy; }
+    breaker_state state() const { return current; }
+
+    // Whether a transaction may go out.
+    bool allow() const { return current != BREAKER_OPEN; }
+
+    /**
+     * Counts the outcome of a transaction (after its retries).
+     *
+     * @return true if this outcome opened the circuit.
+     */
+    bool record(bool ok) {
+        if (current == BREAKER_HALF_OPEN) {
+            if (ok) {
+                reset();
+                return false;
+            }
+            current = BREAKER_OPEN;
+            return true;
+        }
+
+        history = (history << 1) | (ok ? 0 : 1);
+        if (calls < BREAKER_WINDOW) {
+            calls++;
+        }
+        if (current == BREAKER_CLOSED && calls >= policy.min_calls &&
+            errors() >= policy.open_errors) {
+            current = BREAKER_OPEN;
+            return true;
+        }
+        return false;
+    }
+
+    // Failures among the remembered outcomes.
+    int errors() const {
+        uint32_t window = BREAKER_WINDOW == 32 ? history : history & ((1u << BREAKER_WINDOW) - 1);
+        return __builtin_popcount(calls < BREAKER_WINDOW ? window & ((1u << calls) - 1) : window);
+    }
+
+    // For the HealthMonitor: quarantine, re-probe and recovery.
+    void open() { current = BREAKER_OPEN; }
+    void halfOpen() {
+        if (current == BREAKER_OPEN) {
+            current = BREAKER_HALF_OPEN;
+        }
+    }
+    void reset() {
+        current = BREAKER_CLOSED;
+        history = 0;
+        calls = 0;
+    }
+
+private:
+    breaker_policy_t policy;
+    breaker_state current;
+    uint32_t history; // bit 0 is the latest outcome, set on failure
+    uint8_t calls;
+};
+
+#endif
@@ -8,28 +8,35 @@
 
 #include <sys/time.h>
 #include "Device.hpp"
+#include "Registers.hpp"
+#include "Async.hpp"
+#include "AsyncBus.hpp"
 #include "i2c_cxx.hpp"
 
 #define DS3231_I2C_ADDR 0x68
 
+// Seconds through year, BCD, from register 0x00. See the datasheet's
+// figure 1 (timekeeping registers).
+#define DS3231_REG_TIME 0x00
+#define DS3231_TIME_SIZE 7
+#define DS3231_REG_STATUS 0x0f
+#define DS3231_STATUS_OSF 0x80 // oscillator stopped: the time is not valid
+
 // Class prototype
-class DS3231 : public Device {
+class DS3231 : public Device<DS3231> {
 public:
-    DS3231();
+    explicit DS3231(const device_desc_t &desc);
 
     // Device methods
     struct timeval getTime();
-    status checkOK() override;
-    status init(idf::I2CMaster);
-
-    void stop() override;
-
-protected: 
-    void watchdog_task(void *parameters) override;
-    void watchdog_callback(TimerHandle_t xtimer) override;
+    AsyncTask<status> getTimeAsync(AsyncBus &bus, struct timeval *tv);
+    status checkOK();
+    status init();
 
 private:
-    std::shared_ptr<idf::I2CAddress> addr;
-    std::shared_ptr<idf::I2CMaster> i2c;
+    idf::I2CAddress addr;
+    i2c_port_t port;
+
+    static time_t decode(const uint8_t *regs);
 };
 #endif
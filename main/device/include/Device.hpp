@@ -1,6 +1,10 @@
 // device.hpp
 // Specifies the interface for devices. Device class is inherited
 // by all devices. All devices must implement the methods specified
+//
+// Devices are statically dispatched: each driver derives from
+// Device<Driver> (CRTP) rather than a virtual base, so there are no
+// vtables and calls from the System resolve at compile time.
 
 #ifndef DEVICE_H
 #define DEVICE_H
@@ -9,47 +13,190 @@
 #include <stdint.h>
 #include <vector>
 #include <iostream>
-#include <memory>
+#include <concepts>
 
 #include <i2c_cxx.hpp>
-#include <freertos/FreeRTOS.h>
-#include <freertos/timers.h>
-#include <freertos/task.h>
+#include "driver/gpio.h"
+#include "driver/spi_master.h"
+#include "freertos/FreeRTOS.h"
 
 #include "types.hpp"
+#include "DeviceStats.hpp"
+#include "Breaker.hpp"
 
 enum device_bus {
     BUS_I2C0,
     BUS_I2C1,
     BUS_SPI0,
     BUS_SPI1,
-    BUS_UART
+    BUS_UART,
+    BUS_ADC,
 };
 
+// Describes where a device lives. One of these per device makes up the
+// constexpr fleet table in System.hpp.
+typedef struct {
+    const char *name;
+    device_bus bus;
+    uint8_t address; // I2C address, or chip select GPIO for SPI devices
+    gpio_num_t irq;  // data ready interrupt line, or GPIO_NUM_NC
+} device_desc_t;
+
+// Whether two devices in `table` answer to the same address on one I2C
+// bus. Checked against the fleet table at compile time.
+template <size_t N>
+constexpr bool i2c_address_clash(const device_desc_t (&table)[N]) {
+    for (size_t i = 0; i < N; i++) {
+        for (size_t j = i + 1; j < N; j++) {
+            bool i2c = table[i].bus == BUS_I2C0 || table[i].bus == BUS_I2C1;
+            if (i2c && table[i].bus == table[j].bus && table[i].address == table[j].address) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// SPI peripheral for a device on one of the SPI buses.
+constexpr spi_host_device_t spi_host(device_bus bus) {
+    return bus == BUS_SPI1 ? SPI3_HOST : SPI2_HOST;
+}
+
+// Longest a single transaction attempt may block in the bus driver.
+#define ATTEMPT_TIMEOUT_MS 10
+
+// I2C clock on both buses (System::i2c_init).
+#define I2C_CLOCK_HZ 400000
+// Longest the I2C controller waits on a bus level (a slave stretching the
+// clock, or a stuck line) before giving up on the transaction, set with
+// i2c_set_timeout. This, not the driver's tick timeout, is what bounds a
+// hung attempt to within a slot.
+#define I2C_HW_TIMEOUT_US 500
+
+// Wire time of an I2C register access with `bytes` of data: the address,
+// register and repeated start address bytes, then the data, 9 clocks each.
+constexpr int64_t i2c_wire_us(size_t bytes) {
+    return (int64_t)(bytes + 3) * 9 * 1000000 / I2C_CLOCK_HZ;
+}
+
+// Bus driver timeout for an attempt starting at `now_us`: what's left
+// before transaction_deadline_us, but at least one tick (the driver can't
+// do less) and at most ATTEMPT_TIMEOUT_MS. A backstop only: at 100Hz a
+// tick is a whole 10 slots.
+inline TickType_t attempt_ticks(int64_t now_us) {
+    int64_t left_ms = (transaction_deadline_us - now_us) / 1000;
+    if (left_ms > ATTEMPT_TIMEOUT_MS) {
+        left_ms = ATTEMPT_TIMEOUT_MS;
+    }
+    TickType_t ticks = left_ms > 0 ? pdMS_TO_TICKS((uint32_t)left_ms) : 0;
+    return ticks > 0 ? ticks : 1;
+}
+
+// Failures worth trying again straight away: a NACK or a lost
+// arbitration/timeout, typically a glitch on the bus.
+inline bool retryable(esp_err_t err) {
+    return err == ESP_FAIL || err == ESP_ERR_TIMEOUT;
+}
+
+template <typename Derived>
 class Device {
 public:
-    // Runs some test to check the device is working.
-    // This might include checking it is accessible on the bus,
-    // seeing if measurements are in range or checking status registers.
-    virtual status checkOK() = 0;
-    
-    // Initialise device. Find device on the bus and set up registers, and finalise
-    // by running a sanity check (probably using Device::checkOK).
-    // Returns a `status`, same as checkOK.
-    // virtual status init(idf::I2CMaster) = 0;
-    
+    // Every device must provide:
+    //
+    // status checkOK();
+    //   Runs some test to check the device is working.
+    //   This might include checking it is accessible on the bus,
+    //   seeing if measurements are in range or checking status registers.
+    //   Must be a short bus transaction - it is scheduled by the HealthMonitor
+    //   into the idle time between samples.
+    //
+    // status init(...);
+    //   Initialise device. Find device on the bus and set up registers, and finalise
+    //   by running a sanity check (probably using checkOK).
+    //   Returns a `status`, same as checkOK.
+    //
+    // These are checked by the DeviceDriver concept below.
 
+    // Whether the last transaction with this device succeeded.
+    bool isAlive() const { return alive; }
 
-    // called to stop freeRTOS tasks
-    virtual void stop() = 0;
+    // Transaction and sample counters. Safe to read from any task.
+    DeviceStats &ioStats() { return io_stats; }
 
-    // FYI: ignore the "=0" after these methods. It just forced them to be purely virtual.
+    void setPolicy(const breaker_policy_t &policy) { breaker.setPolicy(policy); }
+
+    // Wire time of a transaction moving `bytes`, for transact's deadline
+    // check. I2C; drivers on other buses hide this with their own.
+    int64_t wireUs(size_t bytes) const { return i2c_wire_us(bytes); }
+    breaker_state circuit() const { return breaker.state(); }
+
+    /**
+     * Runs one bus transaction through this device's retry policy, circuit
+     * breaker and counters (see Breaker.hpp).
+     *
+     * `op` is called with the bus driver timeout for the attempt, in
+     * ticks, and returns an esp_err_t. Failed attempts are retried while
+     * the policy and the slot allow. No attempt is started unless its
+     * wire time (Derived::wireUs) fits before transaction_deadline_us.
+     * Drivers needn't clear `alive` on a failure: it is cleared here once
+     * the breaker opens.
+     *
+     * Only one transaction per device may be in flight at a time.
+     *
+     * @return ESP_OK, the last attempt's error, ESP_ERR_INVALID_STATE
+     *         without touching the bus if the circuit is open, or
+     *         ESP_ERR_TIMEOUT without touching the bus (or counting against
+     *         the device) if the slot has no room for even one attempt.
+     */
+    template <typename F>
+    esp_err_t transact(size_t bytes, F &&op) {
+        if (!breaker.allow()) {
+            return ESP_ERR_INVALID_STATE;
+        }
+        esp_err_t err = ESP_ERR_TIMEOUT;
+        for (int attempt = 0;; attempt++) {
+            int64_t start = esp_timer_get_time();
+            if (start + self().wireUs(bytes) > transaction_deadline_us) {
+                if (attempt == 0) {
+                    return ESP_ERR_TIMEOUT;
+                }
+                break;
+            }
+            TickType_t timeout = attempt_ticks(start);
+            err = io_stats.track(bytes, [&] { return op(timeout); });
+            if (err == ESP_OK || attempt >= breaker.limits().max_retries || !retryable(err)) {
+                break;
+            }
+            // Only try again if the same again still fits in the slot.
+            int64_t now = esp_timer_get_time();
+            if (now + (now - start) > transaction_deadline_us) {
+                break;
+            }
+            io_stats.retry();
+        }
+        if (breaker.record(err == ESP_OK)) {
+            alive = false;
+        }
+        return err;
+    }
 
 protected:
-    TimerHandle_t health_check_timer;
-    bool alive;
-    // freeRTOS task function for watchdog
-    virtual void watchdog_task(void *parameters) = 0;
-    virtual void watchdog_callback(TimerHandle_t xTimer) = 0;
+    // Cleared by drivers when a transaction fails. The HealthMonitor picks
+    // this up, quarantines the device and sets it again once it re-probes OK.
+    bool alive = true;
+
+    DeviceStats io_stats;
+    CircuitBreaker breaker;
+
+    Derived &self() { return static_cast<Derived &>(*this); }
+
+    template <typename> friend class HealthMonitor;
+};
+
+// Anything that can be placed in a Fleet.
+template <typename T>
+concept DeviceDriver = std::derived_from<T, Device<T>> && requires(T dev) {
+    { dev.checkOK() } -> std::same_as<status>;
 };
+
 #endif
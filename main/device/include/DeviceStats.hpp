@@ -0,0 +1,148 @@
+// DeviceStats.hpp
+// Per-device transaction and sample counters.
+//
+// Every driver has a DeviceStats (see Device.hpp). Bus transactions go
+// through `track`, which times them and sorts failures by kind, and
+// drivers report the samples they produce and lose. Updates are relaxed
+// atomics so that the acquisition task, a bus worker and whoever reads a
+// snapshot never need a lock. Each device has one transaction in flight
+// at a time, so the latency min/max/average are plain load-then-store.
+// 05/2023
+
+#ifndef DEVICESTATS_H
+#define DEVICESTATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+#include "esp_err.h"
+#include "esp_timer.h"
+
+enum device_error {
+    DEV_ERR_TIMEOUT,  // bus timed out (ESP_ERR_TIMEOUT)
+    DEV_ERR_NACK,     // device didn't answer (ESP_FAIL from the I2C driver)
+    DEV_ERR_BAD_DATA, // answered with something wrong: bad ID, CRC, readback
+    DEV_ERR_OTHER,
+    DEV_ERR_KINDS,
+};
+
+// Snapshot of a DeviceStats. This is what goes in REC_STATS log records
+// and on the live stream's stats channel, after the device index.
+typedef struct __attribute__((packed)) {
+    uint32_t transactions;
+    uint32_t bytes;
+    uint32_t errors[DEV_ERR_KINDS];
+    uint32_t retries;
+    uint32_t latency_min_us;
+    uint32_t latency_avg_us; // moving average over ~16 transactions
+    uint32_t latency_max_us;
+    uint32_t samples;
+    uint32_t dropped;
+    uint32_t last_good_ms;   // esp_timer time of the last good transaction
+} device_stats_t;
+
+class DeviceStats {
+public:
+    DeviceStats() { reset(); }
+
+    // Run `op` (a bus call returning an esp_err_t) and count it.
+    template <typename F>
+    esp_err_t track(size_t bytes, F &&op) {
+        int64_t start = esp_timer_get_time();
+        esp_err_t err = op();
+        int64_t end = esp_timer_get_time();
+        transaction(err, bytes, (uint32_t)(end - start), end);
+        return err;
+    }
+
+    void transaction(esp_err_t err, size_t bytes, uint32_t latency_us, int64_t now_us) {
+        transactions.fetch_add(1, std::memory_order_relaxed);
+        if (err != ESP_OK) {
+            errors[kind(err)].fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        this->bytes.fetch_add(bytes, std::memory_order_relaxed);
+        last_good_ms.store((uint32_t)(now_us / 1000), std::memory_order_relaxed);
+
+        if (latency_us < latency_min.load(std::memory_order_relaxed)) {
+            latency_min.store(latency_us, std::memory_order_relaxed);
+        }
+        if (latency_us > latency_max.load(std::memory_order_relaxed)) {
+            latency_max.store(latency_us, std::memory_order_relaxed);
+        }
+        // Average kept x16: avg += (latency - avg) / 16
+        uint32_t avg = latency_avg16.load(std::memory_order_relaxed);
+        avg = avg == 0 ? latency_us << 4 : avg - (avg >> 4) + latency_us;
+        latency_avg16.store(avg, std::memory_order_relaxed);
+    }
+
+    // A failure that was found without a bus error (e.g. wrong chip ID).
+    void error(device_error kind) { errors[kind].fetch_add(1, std::memory_order_relaxed); }
+    void retry(void) { retries.fetch_add(1, std::memory_order_relaxed); }
+    void produced(uint32_t n) { samples.fetch_add(n, std::memory_order_relaxed); }
+    void lost(uint32_t n) { dropped.fetch_add(n, std::memory_order_relaxed); }
+
+    device_stats_t snapshot(void) const {
+        device_stats_t s;
+        s.transactions = transactions.load(std::memory_order_relaxed);
+        s.bytes = bytes.load(std::memory_order_relaxed);
+        for (int i = 0; i < DEV_ERR_KINDS; i++) {
+            s.errors[i] = errors[i].load(std::memory_order_relaxed);
+        }
+        s.retries = retries.load(std::memory_order_relaxed);
+        s.latency_min_us = latency_min.load(std::memory_order_relaxed);
+        if (s.latency_min_us == UINT32_MAX) {
+            s.latency_min_us = 0;
+        }
+        s.latency_avg_us = latency_avg16.load(std::memory_order_relaxed) >> 4;
+        s.latency_max_us = latency_max.load(std::memory_order_relaxed);
+        s.samples = samples.load(std::memory_order_relaxed);
+        s.dropped = dropped.load(std::memory_order_relaxed);
+        s.last_good_ms = last_good_ms.load(std::memory_order_relaxed);
+        return s;
+    }
+
+    void reset(void) {
+        transactions.store(0, std::memory_order_relaxed);
+        bytes.store(0, std::memory_order_relaxed);
+        for (int i = 0; i < DEV_ERR_KINDS; i++) {
+            errors[i].store(0, std::memory_order_relaxed);
+        }
+        retries.store(0, std::memory_order_relaxed);
+        latency_min.store(UINT32_MAX, std::memory_order_relaxed);
+        latency_avg16.store(0, std::memory_order_relaxed);
+        latency_max.store(0, std::memory_order_relaxed);
+        samples.store(0, std::memory_order_relaxed);
+        dropped.store(0, std::memory_order_relaxed);
+        last_good_ms.store(0, std::memory_order_relaxed);
+    }
+
+    static device_error kind(esp_err_t err) {
+        switch (err) {
+        case ESP_ERR_TIMEOUT:
+            return DEV_ERR_TIMEOUT;
+        case ESP_FAIL:
+            return DEV_ERR_NACK;
+        case ESP_ERR_INVALID_RESPONSE:
+        case ESP_ERR_INVALID_CRC:
+            return DEV_ERR_BAD_DATA;
+        default:
+            return DEV_ERR_OTHER;
+        }
+    }
+
+private:
+    std::atomic<uint32_t> transactions;
+    std::atomic<uint32_t> bytes;
+    std::atomic<uint32_t> errors[DEV_ERR_KINDS];
+    std::atomic<uint32_t> retries;
+    std::atomic<uint32_t> latency_min;
+    std::atomic<uint32_t> latency_avg16;
+    std::atomic<uint32_t> latency_max;
+    std::atomic<uint32_t> samples;
+    std::atomic<uint32_t> dropped;
+    std::atomic<uint32_t> last_good_ms;
+};
+
+#endif
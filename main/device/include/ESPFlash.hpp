@@ -8,19 +8,13 @@
 
 #include "Device.hpp"
 
-class ESPFlash : public Device {
+class ESPFlash : public Device<ESPFlash> {
 public:
     ESPFlash();
 
     // Device methods
-    status checkOK() override;
+    status checkOK();
     status init();
-
-    void stop() override;
-
-protected: 
-    void watchdog_task(void *parameters) override;
-    void watchdog_callback(TimerHandle_t xtimer) override;
 };
 
 #endif
\ No newline at end of file
@@ -6,28 +6,96 @@
 #ifndef H3LIS100DLTR_H
 #define H3LIS100DLTR_H
 
+#include <atomic>
+#include <mutex>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
 #include "Device.hpp"
+#include "Registers.hpp"
+#include "Async.hpp"
+#include "AsyncBus.hpp"
 
 #define H3LIS100DLTR_I2C_ADDR 0x19
+#define H3LIS100DLTR_I2C_ADDR_ALT 0x18 // SA0 pulled low
+
+// Samples buffered between the reader and `read`. 64 samples is 64ms at
+// the full 1kHz rate.
+#define H3LIS100DLTR_BUFFER 64
+static_assert((H3LIS100DLTR_BUFFER & (H3LIS100DLTR_BUFFER - 1)) == 0,
+              "the sample counts wrap, so the buffer must divide 2^32");
+
+// The reader task bursts each sample out as INT1 flags it. The chip has
+// no FIFO, so it must get there before the next sample (1ms at the full
+// rate): above the bus workers, so it's next on the bus whatever the
+// acquisition loop has queued.
+#define H3LIS100DLTR_TASK_STACK 2560
+#define H3LIS100DLTR_TASK_PRIORITY (ASYNC_BUS_TASK_PRIORITY + 1)
+#define H3LIS100DLTR_TASK_CORE ASYNC_BUS_TASK_CORE
+// With no edge for this long the reader polls STATUS_REG anyway. At the
+// low rate edges aren't latched through light sleep, and one missed edge
+// would leave INT1 high for good.
+#define H3LIS100DLTR_POLL_TICKS 1
+// A burst and its retries must finish before the next sample is due.
+#define H3LIS100DLTR_READ_DEADLINE_US 900
 
-class H3LIS100DLTR : public Device {
+class H3LIS100DLTR : public Device<H3LIS100DLTR> {
 public:
-    H3LIS100DLTR();
+    explicit H3LIS100DLTR(const device_desc_t &desc);
 
     // Device methods
-    status checkOK() override;
-    status init(idf::I2CMaster);
-    std::vector<accel_reading_t> read();
+    status checkOK();
+    status init();
+    status setRate(sample_rate rate);
 
-    void stop() override;
+    // Start the reader task. Until it runs (or if it can't, or there is
+    // no INT1 line), update/updateAsync read from the acquisition loop.
+    bool startReader(void);
+    // Burst out the sample INT1 flagged, if any, or poll STATUS_REG if
+    // `poll`. What the reader does on each wake; public for host/h3lis_sim.
+    void service(bool poll);
 
-protected: 
-    void watchdog_task(void *parameters) override;
-    void watchdog_callback(TimerHandle_t xtimer) override;
+    // Without the reader: fetch a new sample if INT1 has flagged one since
+    // the last call. At the low rate STATUS_REG is polled instead (see
+    // setRate). Nothing to do once the reader runs.
+    void update(void);
+    AsyncTask<> updateAsync(AsyncBus &bus);
+    // Move up to `max` buffered samples into `out`, oldest first.
+    size_t read(accel_reading_t *out, size_t max);
+    // As above, into planar channels: x at ch[0], y at ch[stride], z at
+    // ch[2 * stride] (a SampleBlock's).
+    size_t read(int16_t *ch, size_t stride, size_t max);
+
+    // Samples lost since init, either overwritten on the chip before we
+    // got to them or not fitting in the buffer.
+    uint32_t dropped() const { return dropped_count.load(std::memory_order_relaxed); }
 
 private:
-    std::shared_ptr<idf::I2CAddress> addr;
-    std::shared_ptr<idf::I2CMaster> i2c;
+    const char *name;
+    idf::I2CAddress addr;
+    i2c_port_t port;
+    gpio_num_t irq;
+
+    // Data ready edges seen by the ISR and not yet serviced.
+    std::atomic<uint32_t> pending;
+    // Read every update whether or not an edge was seen.
+    std::atomic<bool> polled;
+    TaskHandle_t reader;
+    // One transaction at a time between the reader and the acquisition
+    // task's health checks and rate changes.
+    std::mutex lock;
+
+    // Single producer (whoever services INT1), single consumer (`read`).
+    // Free running counts; a sample's slot is its count mod the size.
+    accel_reading_t samples[H3LIS100DLTR_BUFFER];
+    std::atomic<uint32_t> head; // samples written
+    std::atomic<uint32_t> tail; // samples read
+    std::atomic<uint32_t> dropped_count;
+
+    void accept(const uint8_t *frame, uint32_t edges);
+    static void drdy_isr(void *param);
+    static void reader_run(void *param);
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,78 @@
+// H3LIS100DLTRRegisters.hpp
+// Register map for the H3LIS100DL ±100g accelerometer.
+// Register addresses and fields are from the H3LIS100DL datasheet
+// (DocID022040), section 7/8.
+// 05/2023
+
+#ifndef H3LIS100DLTRREGISTERS_H
+#define H3LIS100DLTRREGISTERS_H
+
+#include "Registers.hpp"
+
+namespace h3lis100dl {
+
+// Not banked. Multi-byte accesses only auto-increment if the MSB of the
+// register address is set.
+inline constexpr reg_map_t MAP = {BURST_AUTO_INCREMENT, false, 0, 0, 0x80};
+
+inline constexpr uint8_t WHO_AM_I_VALUE = 0x32;
+
+enum class PowerMode : uint8_t { DOWN = 0, NORMAL = 1 };
+enum class DataRate : uint8_t { HZ50 = 0, HZ100 = 1, HZ400 = 2, HZ1000 = 3 };
+enum class Int1Cfg : uint8_t { INT1_SRC = 0, INT1_OR_INT2 = 1, DATA_READY = 2, BOOT = 3 };
+
+struct WHO_AM_I : Reg<0x0f> {};
+
+struct CTRL_REG1 : Reg<0x20> {
+    static constexpr Field<5, 3, PowerMode> PM{};
+    static constexpr Field<3, 2, DataRate> DR{};
+    static constexpr Field<2, 1> ZEN{};
+    static constexpr Field<1, 1> YEN{};
+    static constexpr Field<0, 1> XEN{};
+};
+
+struct CTRL_REG2 : Reg<0x21> {
+    static constexpr Field<7, 1> BOOT{}; // self-clearing
+};
+
+struct CTRL_REG3 : Reg<0x22> {
+    static constexpr Field<7, 1> IHL{};
+    static constexpr Field<6, 1> PP_OD{};
+    static constexpr Field<2, 1> LIR1{};
+    static constexpr Field<0, 2, Int1Cfg> I1_CFG{};
+};
+
+struct STATUS_REG : Reg<0x27> {
+    static constexpr Field<7, 1> ZYXOR{}; // a new sample overwrote an unread one
+    static constexpr Field<3, 1> ZYXDA{}; // new sample available
+};
+
+// STATUS_REG through OUT_Z in one auto-increment read. The outputs are
+// single signed bytes at odd addresses:
+//   STATUS, -, OUT_X, -, OUT_Y, -, OUT_Z
+struct OUT_X : Reg<0x29> {};
+struct OUT_Z : Reg<0x2d> {};
+inline constexpr size_t FRAME_SIZE = OUT_Z::address - STATUS_REG::address + 1;
+
+// ### Configuration sequences ###
+
+// Data ready on INT1, active high push-pull, no high pass filter.
+// The chip is left powered down until a rate is set.
+inline constexpr auto INIT = reg_block(MAP, {
+    reg<CTRL_REG1>(CTRL_REG1::PM(PowerMode::DOWN)),
+    reg<CTRL_REG2>(0),
+    reg<CTRL_REG3>(CTRL_REG3::I1_CFG(Int1Cfg::DATA_READY)),
+});
+
+template <DataRate Dr>
+inline constexpr auto RATE = reg_block(MAP, {
+    reg<CTRL_REG1>(CTRL_REG1::PM(PowerMode::NORMAL) | CTRL_REG1::DR(Dr) |
+                   CTRL_REG1::ZEN(1) | CTRL_REG1::YEN(1) | CTRL_REG1::XEN(1)),
+});
+
+inline constexpr auto RATE_FULL_CFG = RATE<DataRate::HZ1000>; // chip maximum
+inline constexpr auto RATE_LOW_CFG = RATE<DataRate::HZ50>;
+
+}
+
+#endif
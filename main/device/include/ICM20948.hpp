@@ -8,33 +8,47 @@
 
 
 #include "Device.hpp"
+#include "Registers.hpp"
+#include "Async.hpp"
+#include "AsyncBus.hpp"
+#include "Pool.hpp"
 #include <i2c_cxx.hpp>
 
-class ICM20948 : public Device {
-public:
-    ICM20948();
+#define ICM20948_I2C_ADDR 0x69
+// AD0 pulled low. TODO: this clashes with the DS3231 if both share a bus.
+#define ICM20948_I2C_ADDR_ALT 0x68
 
-    static const uint8_t BASE_ADDRESS = 0x69;
+// Time to wait after a DEVICE_RESET before the chip responds.
+#define ICM20948_RESET_MS 100
+// Status polls (one tick apart) to wait for an auxiliary slave 4 transfer.
+#define ICM20948_SLV4_TRIES 5
 
-    std::vector<imu_reading_t> read();
-    status init(std::shared_ptr<idf::I2CMaster>, bool alt_address);
+class ICM20948 : public Device<ICM20948> {
+public:
+    explicit ICM20948(const device_desc_t &desc);
 
-    // Device methods
-    status checkOK() override;
+    const sample_batch<imu_reading_t> &read();
+    status init();
+    status setRate(sample_rate rate);
 
-    void stop() override;
+    // Device methods
+    status checkOK();
 
     void update(void);
-
-protected: 
-    void watchdog_task(void *parameters) override;
-    void watchdog_callback(TimerHandle_t xtimer) override;
+    AsyncTask<> updateAsync(AsyncBus &bus);
 
 private:
-    std::unique_ptr<idf::I2CAddress> addr;
-    std::shared_ptr<idf::I2CMaster> i2c;
+    idf::I2CAddress addr;
+    i2c_port_t port;
+
+    status magInit(void);
+    esp_err_t magTransfer(bool read, uint8_t reg, uint8_t out, uint8_t *in);
+    void accept(const uint8_t *frame);
 
-    std::vector<imu_reading_t> measurements;
+    // Up to SAMPLE_BATCH_MAX, in one sample pool block.
+    sample_batch<imu_reading_t> measurements;
+    // What the last `read` handed out, in the other block.
+    sample_batch<imu_reading_t> taken;
 };
 
 #endif
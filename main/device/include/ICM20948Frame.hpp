@@ -0,0 +1,80 @@
+// ICM20948Frame.hpp
+// Decoding of raw ICM20948 sensor frames into imu_reading_t.
+// Kept free of any esp-idf dependencies so it builds anywhere.
+// 05/2023
+
+#ifndef ICM20948FRAME_H
+#define ICM20948FRAME_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "types.hpp"
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+              "frame decoding assumes a little endian CPU");
+
+// The first ten words of a frame (accel, gyro, temp, mag) map one to one
+// onto imu_reading_t. The last word (AK09916 ST2/TMPS) is dropped.
+#define ICM20948_FRAME_WORDS 10
+static_assert(sizeof(imu_reading_t) == ICM20948_FRAME_WORDS * sizeof(int16_t),
+              "imu_reading_t must match the frame layout");
+
+/**
+ * Swaps the bytes of both 16 bit halves of a 32 bit word, turning two
+ * big endian samples into two native ones with one load and store.
+ */
+static inline uint32_t swap16x2(uint32_t w) {
+    return ((w & 0x00ff00ffu) << 8) | ((w >> 8) & 0x00ff00ffu);
+}
+
+/**
+ * Decodes a batch of raw frames (a single burst, or a run of FIFO
+ * records) into readings.
+ *
+ * Frames are big endian two's complement words in imu_reading_t field
+ * order. Each frame is converted two samples at a time; the result is
+ * signed, so widening a field afterwards sign-extends correctly.
+ *
+ * @param src First byte of the first frame. No alignment needed.
+ * @param count Number of frames.
+ * @param stride Bytes from the start of one frame to the next (at least
+ *               ICM20948_FRAME_WORDS * 2).
+ * @param dst Output, `count` readings.
+ */
+static inline void icm20948_decode(const uint8_t *src, size_t count, size_t stride,
+                                   imu_reading_t *dst) {
+    for (size_t i = 0; i < count; i++) {
+        uint32_t w[ICM20948_FRAME_WORDS / 2];
+        // memcpy rather than casts so unaligned frames are fine; the
+        // compiler turns these into plain word loads/stores.
+        memcpy(w, src, sizeof(w));
+        for (size_t j = 0; j < ICM20948_FRAME_WORDS / 2; j++) {
+            w[j] = swap16x2(w[j]);
+        }
+        memcpy(&dst[i], w, sizeof(w));
+        src += stride;
+    }
+}
+
+/**
+ * As `icm20948_decode`, straight into planar channels (a SampleBlock's):
+ * field c of frame i goes to ch[c * ch_stride + i], in imu_channel order.
+ * Saves decoding into readings and transposing them afterwards.
+ */
+static inline void icm20948_decode_planar(const uint8_t *src, size_t count, size_t stride,
+                                          int16_t *ch, size_t ch_stride) {
+    for (size_t i = 0; i < count; i++) {
+        uint32_t w[ICM20948_FRAME_WORDS / 2];
+        memcpy(w, src, sizeof(w));
+        for (size_t j = 0; j < ICM20948_FRAME_WORDS / 2; j++) {
+            uint32_t v = swap16x2(w[j]);
+            ch[(2 * j) * ch_stride + i] = (int16_t)(v & 0xffff);
+            ch[(2 * j + 1) * ch_stride + i] = (int16_t)(v >> 16);
+        }
+        src += stride;
+    }
+}
+
+#endif
@@ -0,0 +1,231 @@
+// ICM20948Registers.hpp
+// Register map for the ICM20948 9-axis IMU.
+// Only the registers we actually use are described. Register addresses
+// and fields are from the ICM-20948 datasheet (DS-000189), section 7/8.
+// 05/2023
+
+#ifndef ICM20948REGISTERS_H
+#define ICM20948REGISTERS_H
+
+#include "Registers.hpp"
+
+namespace icm20948 {
+
+// Registers are split across four banks selected by REG_BANK_SEL, which
+// is present at 0x7F in every bank. Writes auto-increment.
+inline constexpr reg_map_t MAP = {BURST_AUTO_INCREMENT, true, 0x7f, 4, 0};
+
+inline constexpr uint8_t WHO_AM_I_VALUE = 0xea;
+
+enum class ClkSel : uint8_t { INTERNAL = 0, AUTO = 1 };
+enum class GyroFs : uint8_t { DPS250 = 0, DPS500 = 1, DPS1000 = 2, DPS2000 = 3 };
+enum class AccelFs : uint8_t { G2 = 0, G4 = 1, G8 = 2, G16 = 3 };
+
+// ### Bank 0 ###
+
+struct WHO_AM_I : Reg<0x00, 0> {};
+
+struct USER_CTRL : Reg<0x03, 0> {
+    static constexpr Field<7, 1> DMP_EN{};
+    static constexpr Field<6, 1> FIFO_EN{};
+    static constexpr Field<5, 1> I2C_MST_EN{};
+    static constexpr Field<4, 1> I2C_IF_DIS{};
+    static constexpr Field<1, 1> I2C_MST_RST{}; // self-clearing
+};
+
+struct LP_CONFIG : Reg<0x05, 0> {
+    static constexpr Field<6, 1> I2C_MST_CYCLE{};
+    static constexpr Field<5, 1> ACCEL_CYCLE{};
+    static constexpr Field<4, 1> GYRO_CYCLE{};
+};
+
+struct PWR_MGMT_1 : Reg<0x06, 0> {
+    static constexpr Field<7, 1> DEVICE_RESET{}; // self-clearing
+    static constexpr Field<6, 1> SLEEP{};
+    static constexpr Field<5, 1> LP_EN{};
+    static constexpr Field<3, 1> TEMP_DIS{};
+    static constexpr Field<0, 3, ClkSel> CLKSEL{};
+};
+
+struct PWR_MGMT_2 : Reg<0x07, 0> {
+    static constexpr Field<3, 3> DISABLE_ACCEL{};
+    static constexpr Field<0, 3> DISABLE_GYRO{};
+};
+
+struct INT_PIN_CFG : Reg<0x0f, 0> {
+    static constexpr Field<7, 1> INT1_ACTL{};
+    static constexpr Field<6, 1> INT1_OPEN{};
+    static constexpr Field<5, 1> INT1_LATCH_EN{};
+    static constexpr Field<4, 1> INT_ANYRD_2CLEAR{};
+    static constexpr Field<1, 1> BYPASS_EN{};
+};
+
+struct INT_ENABLE : Reg<0x10, 0> {};
+
+struct INT_ENABLE_1 : Reg<0x11, 0> {
+    static constexpr Field<0, 1> RAW_DATA_0_RDY_EN{};
+};
+
+struct I2C_MST_STATUS : Reg<0x17, 0> {
+    static constexpr Field<6, 1> I2C_SLV4_DONE{};
+    static constexpr Field<4, 1> I2C_SLV4_NACK{};
+};
+
+struct ACCEL_XOUT_H : Reg<0x2d, 0> {};
+struct EXT_SLV_SENS_DATA_00 : Reg<0x3b, 0> {};
+
+// ### Bank 2 ###
+
+struct GYRO_SMPLRT_DIV : Reg<0x00, 2> {};
+
+struct GYRO_CONFIG_1 : Reg<0x01, 2> {
+    static constexpr Field<3, 3> GYRO_DLPFCFG{};
+    static constexpr Field<1, 2, GyroFs> GYRO_FS_SEL{};
+    static constexpr Field<0, 1> GYRO_FCHOICE{};
+};
+
+struct ODR_ALIGN_EN : Reg<0x09, 2> {
+    static constexpr Field<0, 1> ALIGN_EN{};
+};
+
+struct ACCEL_SMPLRT_DIV_1 : Reg<0x10, 2> {}; // bits [11:8]
+struct ACCEL_SMPLRT_DIV_2 : Reg<0x11, 2> {}; // bits [7:0]
+
+struct ACCEL_CONFIG : Reg<0x14, 2> {
+    static constexpr Field<3, 3> ACCEL_DLPFCFG{};
+    static constexpr Field<1, 2, AccelFs> ACCEL_FS_SEL{};
+    static constexpr Field<0, 1> ACCEL_FCHOICE{};
+};
+
+// ### Bank 3 ###
+
+struct I2C_MST_CTRL : Reg<0x01, 3> {
+    static constexpr Field<7, 1> MULT_MST_EN{};
+    static constexpr Field<4, 1> I2C_MST_P_NSR{};
+    static constexpr Field<0, 4> I2C_MST_CLK{};
+};
+
+// Fields shared by the I2C_SLVx_ADDR registers.
+struct SlvAddr {
+    static constexpr Field<7, 1> I2C_SLV_RNW{};
+    static constexpr Field<0, 7> I2C_ID{};
+};
+
+// Fields shared by the I2C_SLVx_CTRL registers. I2C_SLV4_CTRL only has EN.
+struct SlvCtrl {
+    static constexpr Field<7, 1> I2C_SLV_EN{};
+    static constexpr Field<6, 1> I2C_SLV_BYTE_SW{};
+    static constexpr Field<5, 1> I2C_SLV_REG_DIS{};
+    static constexpr Field<4, 1> I2C_SLV_GRP{};
+    static constexpr Field<0, 4> I2C_SLV_LENG{};
+};
+
+struct I2C_SLV0_ADDR : Reg<0x03, 3>, SlvAddr {};
+struct I2C_SLV0_REG : Reg<0x04, 3> {};
+struct I2C_SLV0_CTRL : Reg<0x05, 3>, SlvCtrl {};
+
+struct I2C_SLV4_ADDR : Reg<0x13, 3>, SlvAddr {};
+struct I2C_SLV4_REG : Reg<0x14, 3> {};
+struct I2C_SLV4_CTRL : Reg<0x15, 3>, SlvCtrl {};
+struct I2C_SLV4_DO : Reg<0x16, 3> {};
+struct I2C_SLV4_DI : Reg<0x17, 3> {};
+
+}
+
+// The AK09916 magnetometer inside the package. It is only reachable
+// through the ICM20948's auxiliary I2C master (or in bypass mode).
+// Registers are from the AK09916 datasheet, section 9.
+namespace ak09916 {
+
+inline constexpr uint8_t I2C_ADDR = 0x0c;
+inline constexpr uint8_t WIA2_VALUE = 0x09;
+// Time for a soft reset to complete.
+inline constexpr int RESET_MS = 1;
+
+enum class Mode : uint8_t {
+    POWER_DOWN = 0x00, SINGLE = 0x01,
+    CONT_10HZ = 0x02, CONT_20HZ = 0x04, CONT_50HZ = 0x06, CONT_100HZ = 0x08,
+};
+
+struct WIA2 : Reg<0x01> {};
+struct HXL : Reg<0x11> {}; // HXL HXH HYL HYH HZL HZH TMPS ST2 - little endian
+struct ST2 : Reg<0x18> {}; // must be read to release the data registers
+
+struct CNTL2 : Reg<0x31> {
+    static constexpr Field<0, 5, Mode> MODE{};
+};
+
+struct CNTL3 : Reg<0x32> {
+    static constexpr Field<0, 1> SRST{};
+};
+
+// HXL through ST2.
+inline constexpr uint8_t READOUT_SIZE = ST2::address - HXL::address + 1;
+
+}
+
+namespace icm20948 {
+
+// ### Sensor frame ###
+
+// One burst from ACCEL_XOUT_H covers accel, gyro and temperature followed
+// directly by the slave 0 data in EXT_SLV_SENS_DATA_00.. - so once the
+// magnetometer readout below is running, one transaction gets all nine
+// axes. Everything in the frame is big endian 16 bit words:
+//   ACCEL X Y Z, GYRO X Y Z, TEMP, MAG X Y Z, ST2/TMPS
+// (slave 0 byte-swaps the AK09916's little endian pairs for us).
+static_assert(EXT_SLV_SENS_DATA_00::address - ACCEL_XOUT_H::address == 14,
+              "sensor registers and slave data must be contiguous");
+inline constexpr size_t FRAME_SIZE = 14 + ak09916::READOUT_SIZE;
+
+// ### Configuration sequences ###
+
+// Written once after reset. Wakes the chip on the auto-selected clock,
+// sets full-scale ranges for flight (±16g, ±2000dps) with the DLPF on so
+// the sample rate dividers take effect, and routes raw data ready to INT1.
+inline constexpr auto INIT = reg_block(MAP, {
+    reg<USER_CTRL>(USER_CTRL::I2C_MST_EN(1)),
+    reg<LP_CONFIG>(0),
+    reg<PWR_MGMT_1>(PWR_MGMT_1::CLKSEL(ClkSel::AUTO)),
+    reg<PWR_MGMT_2>(0),
+    reg<INT_PIN_CFG>(INT_PIN_CFG::INT_ANYRD_2CLEAR(1)),
+    reg<INT_ENABLE>(0),
+    reg<INT_ENABLE_1>(INT_ENABLE_1::RAW_DATA_0_RDY_EN(1)),
+    reg<GYRO_CONFIG_1>(GYRO_CONFIG_1::GYRO_DLPFCFG(1) |
+                       GYRO_CONFIG_1::GYRO_FS_SEL(GyroFs::DPS2000) |
+                       GYRO_CONFIG_1::GYRO_FCHOICE(1)),
+    reg<ODR_ALIGN_EN>(ODR_ALIGN_EN::ALIGN_EN(1)),
+    reg<ACCEL_CONFIG>(ACCEL_CONFIG::ACCEL_DLPFCFG(1) |
+                      ACCEL_CONFIG::ACCEL_FS_SEL(AccelFs::G16) |
+                      ACCEL_CONFIG::ACCEL_FCHOICE(1)),
+    reg<I2C_MST_CTRL>(I2C_MST_CTRL::I2C_MST_P_NSR(1) |
+                      I2C_MST_CTRL::I2C_MST_CLK(7)), // 345.6kHz
+});
+
+// Has the auxiliary I2C master read the magnetometer into
+// EXT_SLV_SENS_DATA on every sample, byte swapped into big endian.
+// Reading from HXL (odd address) means pairs start at odd addresses, hence
+// GRP. Written once the AK09916 has been put in continuous mode.
+inline constexpr auto MAG_READOUT = reg_block(MAP, {
+    reg<I2C_SLV0_ADDR>(I2C_SLV0_ADDR::I2C_SLV_RNW(1) | I2C_SLV0_ADDR::I2C_ID(ak09916::I2C_ADDR)),
+    reg<I2C_SLV0_REG>(ak09916::HXL::address),
+    reg<I2C_SLV0_CTRL>(I2C_SLV0_CTRL::I2C_SLV_EN(1) |
+                       I2C_SLV0_CTRL::I2C_SLV_BYTE_SW(1) |
+                       I2C_SLV0_CTRL::I2C_SLV_GRP(1) |
+                       I2C_SLV0_CTRL::I2C_SLV_LENG(ak09916::READOUT_SIZE)),
+});
+
+// Output data rate is 1.125kHz / (1 + div) for both gyro and accel.
+template <uint16_t Div>
+inline constexpr auto RATE = reg_block(MAP, {
+    reg<GYRO_SMPLRT_DIV>((uint8_t)Div),
+    reg<ACCEL_SMPLRT_DIV_1>((uint8_t)(Div >> 8) & 0x0f),
+    reg<ACCEL_SMPLRT_DIV_2>((uint8_t)Div),
+});
+
+inline constexpr auto RATE_FULL_CFG = RATE<0>; // 1125Hz
+inline constexpr auto RATE_LOW_CFG = RATE<10>; // ~102Hz
+
+}
+
+#endif
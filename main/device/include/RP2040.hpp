@@ -0,0 +1,149 @@
+// RP2040.hpp
+// Header file for the SPI link to the payload's RP2040.
+// 05/2023
+
+#ifndef RP2040_H
+#define RP2040_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "driver/spi_master.h"
+
+#include "Device.hpp"
+
+// TODO: check these
+#define PIN_PAYLOAD_MOSI 13
+#define PIN_PAYLOAD_MISO 12
+#define PIN_PAYLOAD_SCLK 14
+#define PIN_PAYLOAD_CS   15
+
+#define PAYLOAD_CLOCK_HZ (8 * 1000 * 1000)
+
+// Set to 1 to route MISO to the MOSI pin through the GPIO matrix, so every
+// frame we send comes straight back. Stands in for the RP2040 when
+// benchmarking the link on its own.
+#define PAYLOAD_LOOPBACK 0
+
+// ### Framing ###
+//
+// Both sides clock out one fixed size frame per transaction (the RP2040
+// is the SPI slave, so we keep clocking idle frames to let it talk).
+// Every frame carries a sequence number, the sequence number of the last
+// command frame received, and a CRC32 over everything before it.
+//
+// Command frames are sent stop-and-wait: the same frame is resent until
+// the other side's `ack` reaches its sequence number. Telemetry frames
+// are fire-and-forget and never delay a command.
+
+#define PAYLOAD_FRAME_SIZE 128
+#define PAYLOAD_FRAME_DATA (PAYLOAD_FRAME_SIZE - 12)
+#define PAYLOAD_MAGIC 0xa5
+
+// Transactions kept queued with the SPI driver (double buffering).
+#define PAYLOAD_INFLIGHT 2
+// Frames queued per lane, each way.
+#define PAYLOAD_COMMAND_SLOTS 4
+#define PAYLOAD_TELEMETRY_SLOTS 16
+// Exchanges to wait for a command ack before resending.
+#define PAYLOAD_RESEND_EXCHANGES 4
+// The link is considered down if no valid frame arrives for this long.
+#define PAYLOAD_TIMEOUT_US (500 * 1000)
+
+enum payload_lane : uint8_t {
+    LANE_IDLE,
+    LANE_COMMAND,
+    LANE_TELEMETRY,
+};
+
+typedef struct __attribute__((packed)) {
+    uint8_t magic;
+    uint8_t lane;
+    uint16_t seq;
+    uint16_t ack;  // seq of the last command frame received
+    uint16_t len;  // bytes of `data` in use
+    uint8_t data[PAYLOAD_FRAME_DATA];
+    uint32_t crc;  // CRC32 of all the above
+} payload_frame_t;
+
+static_assert(sizeof(payload_frame_t) == PAYLOAD_FRAME_SIZE, "payload frame must be packed");
+
+typedef struct {
+    uint32_t tx_frames;    // non-idle frames sent, including resends
+    uint32_t rx_frames;    // non-idle frames accepted
+    uint32_t resends;
+    uint32_t crc_errors;
+    uint32_t seq_gaps;     // frames from the RP2040 we never saw
+    uint32_t dropped;      // frames we had to discard for lack of space
+    uint32_t rtt_last_us;  // command queued -> ack received
+    uint32_t rtt_max_us;
+} payload_stats_t;
+
+class RP2040 : public Device<RP2040> {
+public:
+    explicit RP2040(const device_desc_t &desc);
+
+    // Device methods
+    status checkOK();
+    status init(void);
+
+    // Run the link: collect finished transactions and keep PAYLOAD_INFLIGHT
+    // queued. Never blocks, so it's safe from any non-ISR context, but
+    // must always be called from the same task.
+    void poll(void);
+
+    // Queue a message. Returns false if the lane is full or it's too long.
+    bool send(payload_lane lane, const uint8_t *data, size_t len);
+    // Take the oldest message from the RP2040. Returns its length, 0 if
+    // there is nothing waiting.
+    size_t receive(payload_lane *lane, uint8_t *data, size_t max);
+
+    // Whether every queued command has been acknowledged.
+    bool commandsIdle() const { return cmd_count == 0; }
+    const payload_stats_t &stats() const { return counters; }
+
+private:
+    typedef struct {
+        int64_t queued_us;
+        uint16_t len;
+        uint8_t lane;
+        uint8_t data[PAYLOAD_FRAME_DATA];
+    } message_t;
+
+    spi_host_device_t host;
+    gpio_num_t cs;
+    spi_device_handle_t spi;
+
+    // DMA buffers and transactions, one per in-flight slot. These live in
+    // the object (internal RAM, word aligned) so no DMA heap is needed.
+    payload_frame_t tx_frames[PAYLOAD_INFLIGHT] __attribute__((aligned(4)));
+    payload_frame_t rx_frames[PAYLOAD_INFLIGHT] __attribute__((aligned(4)));
+    spi_transaction_t trans[PAYLOAD_INFLIGHT];
+    int64_t queued_at[PAYLOAD_INFLIGHT];
+    int inflight;
+    int next_slot;
+
+    message_t cmd_queue[PAYLOAD_COMMAND_SLOTS];
+    int cmd_head, cmd_count;
+    message_t tel_queue[PAYLOAD_TELEMETRY_SLOTS];
+    int tel_head, tel_count;
+    message_t rx_queue[PAYLOAD_TELEMETRY_SLOTS];
+    int rx_head, rx_count;
+
+    uint16_t tx_seq;
+    uint16_t cmd_seq;        // seq the head command went out with
+    bool cmd_sent;
+    int cmd_wait;            // exchanges since the head command went out
+    uint16_t rx_seq;         // newest seq received
+    uint16_t rx_cmd_seq;     // last command seq received, echoed as `ack`
+    bool rx_cmd_seen;
+    bool rx_seen;
+    int64_t last_rx_us;
+
+    payload_stats_t counters;
+
+    void fill(payload_frame_t *frame);
+    void accept(const payload_frame_t *frame);
+};
+
+#endif
@@ -0,0 +1,188 @@
+// Registers.hpp
+// Compile-time register map descriptions and configuration blocks.
+//
+// Chips describe their registers as types with typed bitfields (see
+// ICM20948Registers.hpp, BME280Registers.hpp). A configuration sequence is
+// a constexpr list of register writes which `reg_block` turns, at compile
+// time, into the minimum number of bus transactions: contiguous registers
+// are merged into one auto-increment burst, bank switches are inserted only
+// where the bank changes, and chips which take register/value pairs get the
+// whole sequence in a single transaction.
+// 05/2023
+
+#ifndef REGISTERS_H
+#define REGISTERS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <array>
+
+#include "driver/i2c.h"
+#include "esp_err.h"
+
+#include "Device.hpp"
+
+// Timeout for a single register transaction.
+#define REG_TIMEOUT_MS 10
+
+/**
+ * A bitfield within an 8-bit register. `T` is the type accepted for the
+ * field's value, usually a scoped enum listing the legal settings.
+ */
+template <uint8_t Shift, uint8_t Width, typename T = uint8_t>
+struct Field {
+    static constexpr uint8_t mask = (uint8_t)(((1u << Width) - 1) << Shift);
+
+    constexpr uint8_t operator()(T value) const {
+        return (uint8_t)(((uint8_t)value << Shift) & mask);
+    }
+};
+
+/**
+ * Base for register descriptions. Derive one struct per register and add
+ * its Fields as static constexpr members.
+ */
+template <uint8_t Address, uint8_t Bank = 0>
+struct Reg {
+    static constexpr uint8_t address = Address;
+    static constexpr uint8_t bank = Bank;
+};
+
+// One register write within a configuration sequence.
+typedef struct {
+    uint8_t bank;
+    uint8_t reg;
+    uint8_t value;
+    uint8_t verify_mask; // bits to compare on read-back, 0 to skip
+} reg_write_t;
+
+// Build a write for register R. Self-clearing or write-only bits should be
+// left out of `verify_mask`.
+template <typename R>
+constexpr reg_write_t reg(uint8_t value, uint8_t verify_mask = 0xff) {
+    return reg_write_t{R::bank, R::address, value, verify_mask};
+}
+
+enum reg_burst_mode {
+    BURST_AUTO_INCREMENT, // [reg, v0, v1, ...] writes reg, reg+1, ...
+    BURST_PAIRS,          // [reg0, v0, reg1, v1, ...] in any order
+};
+
+// How a chip expects its registers to be written.
+typedef struct {
+    reg_burst_mode mode;
+    bool banked;
+    uint8_t bank_reg;   // register selecting the bank, if banked
+    uint8_t bank_shift; // position of the bank number within bank_reg
+    uint8_t increment;  // OR'd into the register address of multi-byte
+                        // accesses, for chips that only auto-increment on request
+} reg_map_t;
+
+// Runtime view of a RegBlock, so the bus code need not be a template.
+typedef struct {
+    const uint8_t *bytes;       // all transactions, back to back
+    const uint8_t *lengths;     // length of each transaction
+    size_t count;               // number of transactions
+    const reg_write_t *writes;  // original sequence, for verification
+    size_t nwrites;
+} reg_block_view_t;
+
+/**
+ * A configuration sequence compiled down to bus transactions.
+ * Only ever built by `reg_block`, in a constexpr context.
+ */
+template <size_t N>
+struct RegBlock {
+    // Worst case every write is its own transaction with a bank switch
+    // before it, plus the switch back to bank 0 at the end.
+    std::array<uint8_t, 4 * N + 2> bytes{};
+    std::array<uint8_t, 2 * N + 1> lengths{};
+    size_t count = 0;
+    std::array<reg_write_t, N> writes{};
+
+    constexpr operator reg_block_view_t() const {
+        return reg_block_view_t{bytes.data(), lengths.data(), count, writes.data(), N};
+    }
+};
+
+/**
+ * Compiles a configuration sequence for a chip.
+ *
+ * Writes are issued in the order given. Banked chips are always left in
+ * bank 0 afterwards.
+ */
+template <size_t N>
+constexpr RegBlock<N> reg_block(const reg_map_t &map, const reg_write_t (&writes)[N]) {
+    RegBlock<N> block;
+    size_t pos = 0;
+
+    for (size_t i = 0; i < N; i++) {
+        block.writes[i] = writes[i];
+    }
+
+    if (map.mode == BURST_PAIRS) {
+        for (size_t i = 0; i < N; i++) {
+            block.bytes[pos++] = writes[i].reg;
+            block.bytes[pos++] = writes[i].value;
+        }
+        block.lengths[block.count++] = (uint8_t)pos;
+        return block;
+    }
+
+    int bank = -1;
+    size_t i = 0;
+    while (i < N) {
+        if (map.banked && writes[i].bank != bank) {
+            bank = writes[i].bank;
+            block.bytes[pos++] = map.bank_reg;
+            block.bytes[pos++] = (uint8_t)(bank << map.bank_shift);
+            block.lengths[block.count++] = 2;
+        }
+
+        size_t start = pos;
+        block.bytes[pos++] = writes[i].reg;
+        block.bytes[pos++] = writes[i].value;
+        size_t j = i + 1;
+        while (j < N && writes[j].bank == writes[i].bank &&
+               writes[j].reg == writes[j - 1].reg + 1) {
+            block.bytes[pos++] = writes[j].value;
+            j++;
+        }
+        if (j - i > 1) {
+            block.bytes[start] |= map.increment;
+        }
+        block.lengths[block.count++] = (uint8_t)(pos - start);
+        i = j;
+    }
+
+    if (map.banked && bank != 0) {
+        block.bytes[pos++] = map.bank_reg;
+        block.bytes[pos++] = 0;
+        block.lengths[block.count++] = 2;
+    }
+    return block;
+}
+
+// Bus port for a device on one of the I2C buses.
+constexpr i2c_port_t i2c_port(device_bus bus) {
+    return bus == BUS_I2C1 ? I2C_NUM_1 : I2C_NUM_0;
+}
+
+// Burst read of `len` registers starting at `reg`.
+esp_err_t reg_read(i2c_port_t port, uint8_t address, uint8_t reg,
+                   uint8_t *data, size_t len,
+                   TickType_t timeout = pdMS_TO_TICKS(REG_TIMEOUT_MS));
+
+// Single register write.
+esp_err_t reg_write(i2c_port_t port, uint8_t address, uint8_t reg, uint8_t value,
+                    TickType_t timeout = pdMS_TO_TICKS(REG_TIMEOUT_MS));
+
+// Issue every transaction of a configuration block.
+esp_err_t reg_write_block(i2c_port_t port, uint8_t address, const reg_block_view_t &block);
+
+// Read back every register of a configuration block and compare the bits
+// in each write's verify mask. Returns ESP_ERR_INVALID_RESPONSE on mismatch.
+esp_err_t reg_verify_block(i2c_port_t port, uint8_t address, const reg_map_t &map,
+                           const reg_block_view_t &block);
+
+#endif
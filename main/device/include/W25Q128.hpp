@@ -6,21 +6,71 @@
 #ifndef W25Q128_H
 #define W25Q128_H
 
+#include <stdint.h>
+#include <stddef.h>
+
+#include "driver/spi_master.h"
+
 #include "Device.hpp"
 
-class W25Q128 : public Device {
+// Both flash chips share one SPI bus. TODO: check these
+#define PIN_FLASH_MOSI 23
+#define PIN_FLASH_MISO 19
+#define PIN_FLASH_SCLK 18
+#define PIN_FLASH0_CS  5
+#define PIN_FLASH1_CS  4
+
+#define W25Q128_CLOCK_HZ (20 * 1000 * 1000)
+
+// Winbond, W25Q series, 128Mbit
+#define W25Q128_JEDEC_ID 0xef4018
+
+#define W25Q128_PAGE_SIZE 256
+#define W25Q128_SECTOR_SIZE 4096
+#define W25Q128_BLOCK_SIZE (64 * 1024)
+#define W25Q128_CAPACITY (16 * 1024 * 1024)
+#define W25Q128_PAGES (W25Q128_CAPACITY / W25Q128_PAGE_SIZE)
+#define W25Q128_PAGES_PER_SECTOR (W25Q128_SECTOR_SIZE / W25Q128_PAGE_SIZE)
+#define W25Q128_PAGES_PER_BLOCK (W25Q128_BLOCK_SIZE / W25Q128_PAGE_SIZE)
+
+/**
+ * Driver for one W25Q128 NOR flash chip.
+ *
+ * Programs and erases are only started here, never waited on: the chip
+ * goes busy for up to 3ms (page program) or 400ms (sector erase), and
+ * callers check `busy` before issuing the next operation. While the chip
+ * is busy it only answers status reads.
+ */
+class W25Q128 : public Device<W25Q128> {
 public:
-    W25Q128();
+    explicit W25Q128(const device_desc_t &desc);
 
     // Device methods
-    status checkOK() override;
+    status checkOK();
     status init();
+    int64_t wireUs(size_t bytes) const { return (int64_t)bytes * 8 * 1000000 / W25Q128_CLOCK_HZ; }
+
+    // Whether a program or erase is still running. Only touches the bus
+    // if one was started.
+    bool busy(void);
+
+    // Read `len` bytes from `address`. The chip must not be busy.
+    status read(uint32_t address, void *data, size_t len);
+    // Start programming up to one page. Must not cross a page boundary.
+    status program(uint32_t address, const void *data, size_t len);
+    // Start erasing the 4KB sector / 64KB block containing `address`.
+    status eraseSector(uint32_t address);
+    status eraseBlock(uint32_t address);
 
-    void stop() override;
+private:
+    spi_host_device_t host;
+    gpio_num_t cs;
+    spi_device_handle_t spi;
+    bool in_progress;
 
-protected: 
-    void watchdog_task(void *parameters) override;
-    void watchdog_callback(TimerHandle_t xtimer) override;
+    esp_err_t command(uint8_t cmd, int addr_bits, uint32_t address,
+                      const void *tx, void *rx, size_t len);
+    status start(uint8_t cmd, uint32_t address, const void *data, size_t len);
 };
 
-#endif
\ No newline at end of file
+#endif
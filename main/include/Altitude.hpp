@@ -0,0 +1,104 @@
+// Altitude.hpp
+// Height above the pad and vertical velocity, from the barometers and the
+// IMU's accelerometer, to confirm apogee and the microgravity window.
+// Fixed point throughout, with gains solved at compile time, and no
+// esp-idf dependencies beyond the cycle counter.
+// 05/2023
+
+#ifndef ALTITUDE_H
+#define ALTITUDE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "types.hpp"
+#include "CycleStats.hpp"
+#include "Attitude.hpp"
+
+// Time between BME280 measurements for each rate (RATE_FULL_CFG and
+// RATE_LOW_CFG in BME280Registers.hpp): conversion time plus standby.
+#define BARO_INTERVAL_FULL_US 16700
+#define BARO_INTERVAL_LOW_US 171000
+
+// Noise the gains are designed for. Accelerometer white noise, including
+// what attitude error leaks in from gravity and thrust (m/s^2/sqrt(Hz));
+// accelerometer bias drift (m/s^3/sqrt(Hz)); barometric altitude noise,
+// including the airframe's static port errors (m).
+#define ALTITUDE_ACCEL_NOISE 0.3
+#define ALTITUDE_BIAS_NOISE 0.005
+#define ALTITUDE_BARO_NOISE 0.5
+
+static inline uint32_t baro_interval_us(sample_rate rate) {
+    return rate == RATE_FULL ? BARO_INTERVAL_FULL_US : BARO_INTERVAL_LOW_US;
+}
+
+// Steady state Kalman gains for one barometer update, Q24: altitude,
+// velocity (1/s) and accelerometer bias (1/s^2).
+typedef struct {
+    int32_t k[3];
+} altitude_gains_t;
+
+// Filter state carried across a warm boot, Q16 metres and seconds, plus
+// the last vertical acceleration to carry it forward with.
+typedef struct {
+    int32_t h, v, b, ground;
+    int32_t accel;
+    uint8_t initialised;
+    uint8_t reserved[3];
+} altitude_state_t;
+
+/**
+ * Three state Kalman filter: altitude, vertical velocity and the
+ * accelerometer's bias along the vertical.
+ *
+ * Every IMU reading is rotated into the vertical by the attitude estimate
+ * and integrated; every barometer reading corrects the result. Gains are
+ * the filter's steady state for the barometer rate, so each step is a
+ * fixed handful of integer multiplies. State is Q32 in metres and seconds.
+ *
+ * While tracking the ground (on the pad) the pad's altitude follows the
+ * estimate, so altitude reads 0 until launch.
+ */
+class AltitudeEstimator {
+public:
+    AltitudeEstimator();
+
+    // Forget everything, including the ground level, and clear the stats.
+    void reset(void);
+    // Match the barometers' rate.
+    void setRate(sample_rate rate);
+    void trackGround(bool on) { tracking = on; }
+
+    // Integrates a block of consecutive readings, `dt_us` apart, taken
+    // with the IMU at orientation `q`. Ignored until the first barometer
+    // reading.
+    void update(const imu_reading_t *readings, size_t n, uint32_t dt_us, const quat_t &q);
+    // Corrects with one barometer's pressure, in Pa Q24.8.
+    void baro(uint32_t pressure);
+
+    void save(altitude_state_t *state) const;
+    // Carries on from `state`, moved on `elapsed_us` at its last
+    // acceleration to cover the time nothing was integrated.
+    void restore(const altitude_state_t &state, uint32_t elapsed_us);
+
+    bool ready() const { return initialised; }
+    int32_t altitudeMm() const;
+    int32_t velocityMmS() const;
+    int32_t biasMmS2() const;
+    const cycle_stats_t &stats() const { return cycles.stats(); }
+
+private:
+    int64_t h, v, b; // altitude (m), velocity (m/s), accel bias (m/s^2), Q32
+    int64_t ground;  // pad altitude, Q32 m
+    int32_t accel;   // last vertical acceleration, m/s^2 Q16
+    const altitude_gains_t *gains;
+    bool initialised;
+    bool tracking;
+    CycleStats cycles;
+};
+
+// Standard atmosphere altitude for a pressure in Pa Q24.8, as Q16 metres.
+// Good for 20 to 110kPa (about -700m to 11.8km).
+int32_t baro_altitude(uint32_t pressure);
+
+#endif
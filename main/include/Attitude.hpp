@@ -0,0 +1,80 @@
+// Attitude.hpp
+// Orientation estimate from the IMU stream (Mahony filter), so the payload
+// can check its print axis during microgravity. Single precision, no
+// esp-idf dependencies beyond the cycle counter.
+// 05/2023
+
+#ifndef ATTITUDE_H
+#define ATTITUDE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "types.hpp"
+#include "CycleStats.hpp"
+
+// ICM20948 output data rates (RATE_FULL_CFG / RATE_LOW_CFG in
+// ICM20948Registers.hpp): 1.125kHz / (1 + div).
+#define IMU_RATE_FULL_HZ 1125.0f
+#define IMU_RATE_LOW_HZ (1125.0f / 11)
+
+// Full scales set by ICM20948 INIT: +-16g and +-2000dps.
+#define IMU_ACCEL_LSB_PER_G 2048.0f
+#define IMU_GYRO_LSB_PER_DPS 16.4f
+
+// Proportional gain, as 2 * Kp. Pulls the estimate towards the measured
+// gravity and magnetic field with a time constant of about 1 / Kp.
+#define ATTITUDE_TWO_KP 1.0f
+// Integral gain, as 2 * Ki, for gyro bias. Off: flights are short.
+#define ATTITUDE_TWO_KI 0.0f
+// Accelerometer corrections are only applied while the measured specific
+// force is within this much of 1g, i.e. while the rocket isn't under
+// thrust, drag or in free fall. Otherwise the gyros carry the estimate
+// alone, including all of microgravity.
+#define ATTITUDE_ACCEL_GATE 0.15f
+
+// Unit quaternion, body to world. World is z up with x along magnetic
+// north's horizontal component; body is the IMU's accel/gyro axes.
+typedef struct {
+    float w, x, y, z;
+} quat_t;
+
+// Filter state carried across a warm boot: the orientation, and the last
+// body rate (rad/s) to carry it forward with.
+typedef struct {
+    quat_t q;
+    float rate[3];
+} attitude_state_t;
+
+class AttitudeEstimator {
+public:
+    AttitudeEstimator();
+
+    // Back to level, facing magnetic north, with the stats cleared.
+    void reset(void);
+
+    // Runs the filter over a block of consecutive readings, `dt_us` apart.
+    void update(const imu_reading_t *readings, size_t n, uint32_t dt_us);
+
+    void save(attitude_state_t *state) const;
+    // Carries on from `state`, turned on `elapsed_us` at its last body
+    // rate to cover the time nothing was integrated. The stats are kept.
+    void restore(const attitude_state_t &state, uint32_t elapsed_us);
+
+    const quat_t &attitude() const { return q; }
+    const cycle_stats_t &stats() const { return cycles.stats(); }
+
+private:
+    quat_t q;
+    float half_dt;
+    float ix, iy, iz; // integral feedback, rad/s
+    float rate[3];    // last gyro reading, rad/s
+    CycleStats cycles;
+
+    void step(const imu_reading_t &r);
+};
+
+// Angle in radians between the two orientations.
+float quat_angle(const quat_t &a, const quat_t &b);
+
+#endif
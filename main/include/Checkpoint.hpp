@@ -0,0 +1,67 @@
+// Checkpoint.hpp
+// Flight state kept in RTC memory, so a reset mid-flight (a panic, a
+// watchdog, a brownout) comes back logging where it left off instead of
+// starting over on the pad.
+// 05/2023
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdint.h>
+
+#include "FlashLog.hpp"
+#include "Pipeline.hpp"
+
+#define CHECKPOINT_MAGIC 0x54504b43 // "CKPT"
+// Bump whenever checkpoint_t (or anything in it) changes, so a new image
+// never trusts an old layout.
+#define CHECKPOINT_VERSION 1
+// How often the pipeline's state is saved. The log position is saved
+// every slot it moves.
+#define CHECKPOINT_INTERVAL_US (10 * 1000)
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint8_t mode;              // system_mode it was saved in
+    uint8_t logging;           // 1 if `log` holds a flight log's position
+    uint32_t boots;            // warm boots so far this flight
+    uint32_t sequence;         // which copy is newer
+    // Log time (esp_timer plus the offset carried across warm boots) and
+    // RTC time at the last pipeline save. The RTC keeps counting through
+    // a reset, so the two give the log time on the way back up.
+    int64_t rtc_us;
+    int64_t log_us;
+    int64_t saved_us;          // log time of the latest save
+    log_position_t log;
+    pipeline_checkpoint_t pipeline;
+    uint32_t crc;              // CRC32 of everything above
+} checkpoint_t;
+
+/**
+ * Two copies of a checkpoint_t in RTC slow memory, written alternately so
+ * a reset part way through a save leaves the other one whole. RTC memory
+ * keeps its contents through every reset but power loss, and costs no
+ * more to write than a memcpy and a CRC, where NVS would take an erase
+ * cycle on the internal flash.
+ *
+ * The caller fills in `state()` and calls `save`.
+ */
+class Checkpoint {
+public:
+    Checkpoint();
+
+    // The newest intact copy, if it is from this image's layout.
+    bool load(checkpoint_t *out) const;
+    // Forget both copies, so the next reset starts a new flight.
+    void clear(void);
+
+    // What the next save writes. Starts from the loaded copy if any.
+    checkpoint_t &state() { return current; }
+    void save(void);
+
+private:
+    checkpoint_t current;
+};
+
+#endif
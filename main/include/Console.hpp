@@ -0,0 +1,34 @@
+// Console.hpp
+// Non-blocking console output. Messages are copied into a RAM ring and
+// written to the UART by a low priority task, so logging never holds up
+// the acquisition loop.
+// 05/2023
+
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// RAM ring between writers and the drain task. ~350ms of output at
+// 115200 baud.
+#define CONSOLE_BUFFER 4096
+// Longest single formatted message; longer ones are truncated.
+#define CONSOLE_LINE_MAX 160
+#define CONSOLE_TASK_STACK 2048
+// Just above idle: runs whenever nothing else has work.
+#define CONSOLE_TASK_PRIORITY 1
+
+// Creates the ring and starts the drain task. Safe to call more than once.
+bool console_init(void);
+
+// Queue a message. Never blocks: if the ring can't take all of it, the
+// whole message is dropped and counted. Before console_init (or if it
+// failed) messages go straight to stdout.
+void console_write(const char *msg, size_t len);
+void console_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+// Messages dropped since boot.
+uint32_t console_dropped(void);
+
+#endif
@@ -0,0 +1,75 @@
+// Crc32.hpp
+// CRC32 with the zlib polynomial (reflected 0xedb88320, inverted in and
+// out), so `crc32_update(0, ...)` matches Python's zlib.crc32. Chaining
+// calls with the previous result continues the same CRC.
+//
+// On target this is the ESP32 ROM routine. Elsewhere (host tools, replay)
+// it's slice-by-8: eight bytes per step through eight 1KB tables built at
+// compile time.
+// 05/2023
+
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef ESP_PLATFORM
+#include "esp_rom_crc.h"
+
+inline uint32_t crc32_update(uint32_t crc, const void *data, size_t len) {
+    return esp_rom_crc32_le(crc, (const uint8_t *)data, (uint32_t)len);
+}
+
+#else
+#include <string.h>
+#include <array>
+
+namespace crc32_detail {
+
+typedef std::array<std::array<uint32_t, 256>, 8> tables_t;
+
+constexpr tables_t make_tables() {
+    tables_t t{};
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = c & 1 ? (c >> 1) ^ 0xedb88320u : c >> 1;
+        }
+        t[0][i] = c;
+    }
+    for (int s = 1; s < 8; s++) {
+        for (int i = 0; i < 256; i++) {
+            t[s][i] = (t[s - 1][i] >> 8) ^ t[0][t[s - 1][i] & 0xff];
+        }
+    }
+    return t;
+}
+
+inline constexpr tables_t TABLES = make_tables();
+
+}
+
+inline uint32_t crc32_update(uint32_t crc, const void *data, size_t len) {
+    const auto &t = crc32_detail::TABLES;
+    const uint8_t *p = (const uint8_t *)data;
+    crc = ~crc;
+    while (len >= 8) {
+        // Little endian hosts only, like the rest of the log format.
+        uint32_t a, b;
+        memcpy(&a, p, 4);
+        memcpy(&b, p + 4, 4);
+        a ^= crc;
+        crc = t[7][a & 0xff] ^ t[6][(a >> 8) & 0xff] ^ t[5][(a >> 16) & 0xff] ^ t[4][a >> 24] ^
+              t[3][b & 0xff] ^ t[2][(b >> 8) & 0xff] ^ t[1][(b >> 16) & 0xff] ^ t[0][b >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = t[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+#endif
+
+#endif
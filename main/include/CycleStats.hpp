@@ -0,0 +1,64 @@
+// CycleStats.hpp
+// CPU cycle counts for the on-board estimators (Attitude.hpp, Altitude.hpp),
+// so their cost per reading is measured on target and logged alongside
+// their output.
+// 05/2023
+
+#ifndef CYCLESTATS_H
+#define CYCLESTATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef ESP_PLATFORM
+#include "esp_cpu.h"
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// CPU cycle counter. 0 where there isn't one.
+static inline uint32_t cpu_cycles(void) {
+#ifdef ESP_PLATFORM
+    return esp_cpu_get_cycle_count();
+#elif defined(__x86_64__) || defined(__i386__)
+    return (uint32_t)__rdtsc();
+#else
+    return 0;
+#endif
+}
+
+typedef struct {
+    uint32_t updates;
+    uint32_t cycles_avg;  // per update, moving average over ~16 blocks
+    uint32_t cycles_max;  // per update, worst block
+} cycle_stats_t;
+
+class CycleStats {
+public:
+    CycleStats() { reset(); }
+
+    void reset(void) {
+        counters = {};
+        avg16 = 0;
+    }
+
+    // A block of `n` updates that started at cpu_cycles() `start`.
+    void add(uint32_t start, size_t n) {
+        uint32_t per = (cpu_cycles() - start) / n;
+        counters.updates += n;
+        if (per > counters.cycles_max) {
+            counters.cycles_max = per;
+        }
+        // Average kept x16, as in DeviceStats.
+        avg16 = avg16 == 0 ? per << 4 : avg16 - (avg16 >> 4) + per;
+        counters.cycles_avg = avg16 >> 4;
+    }
+
+    const cycle_stats_t &stats() const { return counters; }
+
+private:
+    cycle_stats_t counters;
+    uint32_t avg16;
+};
+
+#endif
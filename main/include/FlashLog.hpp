@@ -0,0 +1,129 @@
+// FlashLog.hpp
+// Page-structured flight log on the W25Q128s, with optional write-behind
+// staging on the second (buffer) chip.
+// 05/2023
+
+#ifndef FLASHLOG_H
+#define FLASHLOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "W25Q128.hpp"
+#include "LogFormat.hpp"
+
+static_assert(LOG_PAGE_SIZE == W25Q128_PAGE_SIZE, "log page must fill a flash page");
+
+// ### Buffering ###
+
+// Closed pages held in RAM waiting for a free chip.
+#define LOG_PAGE_BUFFERS 8
+// Size of the staging ring at the start of the buffer chip, in whole
+// blocks. The rest of the chip is left to the RP2040.
+#define LOG_STAGING_PAGES (4 * W25Q128_PAGES_PER_BLOCK) // 256KB
+
+// Where the log stood, for picking it up again after a warm boot without
+// searching the chip. Only erases that have finished count.
+typedef struct {
+    uint32_t head;
+    uint32_t staging_tail;
+    uint32_t staging_head;
+    uint32_t staging_erased;
+    uint8_t erased[W25Q128_PAGES / W25Q128_PAGES_PER_BLOCK / 8];
+} log_position_t;
+
+typedef struct {
+    uint32_t pages_written;  // straight to the primary
+    uint32_t pages_staged;   // via the buffer chip
+    uint32_t pages_migrated;
+    uint32_t records_dropped;
+} log_stats_t;
+
+/**
+ * Record encoder and page scheduler for the flight log.
+ *
+ * `append` packs records into RAM pages. `poll`, called once per sample
+ * slot, never waits on a chip: each closed page goes to the primary if it
+ * is free, otherwise to the staging ring on the buffer chip if that is
+ * free, otherwise it waits in RAM. Either way the page's index is fixed
+ * when it leaves RAM, so staging a page leaves an erased hole at that
+ * index in the primary.
+ *
+ * Both chips erase in 64KB blocks, which cost about a fifth as much per
+ * page as 4KB sectors. The primary only erases the block under its own
+ * head while pages are queued - pages staged during that erase become
+ * holes in the block being erased, so nothing is wasted. Once nothing is
+ * waiting, the next block is erased ahead of time and staged pages are
+ * migrated into their holes, compacting the primary back into one
+ * contiguous log.
+ */
+class FlashLog {
+public:
+    // `staging` may be null to log to the primary alone.
+    FlashLog(W25Q128 &primary, W25Q128 *staging);
+
+    // Finds the end of the log, migrating anything left on the staging
+    // chip by a reset. Blocks.
+    status mount(void);
+    // Carries on from `pos`, saved by `position` before a reset, checking
+    // it against the chips. Only reads page headers, so it is quick; on
+    // STATUS_FAILED fall back to `mount`.
+    status resume(const log_position_t &pos);
+    void position(log_position_t *pos) const;
+    // Bumped whenever `position` would report something new.
+    uint32_t moves(void) const { return moved; }
+
+    // Encode one record. Returns false (and counts a drop) if every page
+    // buffer is full or `len` exceeds LOG_RECORD_MAX.
+    bool append(uint8_t type, uint32_t time_us, const void *data, size_t len);
+    // Close the partly filled page so the next `poll` can write it out.
+    void flush(void);
+    // Move pages along. Never waits on a chip.
+    void poll(void);
+
+    // Whether every closed page has left RAM.
+    bool drained(void) const { return buf_count == 0; }
+    // Pages in the log, including any still staged.
+    uint32_t pages(void) const { return head; }
+    // Merged read view: page `index` from the primary, or from the
+    // staging chip if it hasn't been migrated yet.
+    status readPage(uint32_t index, log_page_t *page);
+    // Check every page and record CRC in the log. Blocks.
+    status verify(log_verify_t *result);
+
+    const log_stats_t &stats() const { return counters; }
+
+private:
+    W25Q128 &primary;
+    W25Q128 *staging;
+
+    log_page_t bufs[LOG_PAGE_BUFFERS];
+    int buf_head, buf_count;
+
+    uint32_t head;            // next log index to hand out
+    // Primary blocks erased since mount. A block's bit is set once every
+    // page in it at or past the head at the time is erased.
+    uint8_t erased[W25Q128_PAGES / W25Q128_PAGES_PER_BLOCK / 8];
+
+    // Staging ring positions are free-running; slot = position % LOG_STAGING_PAGES.
+    uint32_t staging_tail;    // oldest page not yet migrated
+    uint32_t staging_head;
+    uint32_t staging_erased;
+    uint32_t targets[LOG_STAGING_PAGES]; // log index held in each slot
+
+    uint32_t erasing;         // primary page whose block is being erased
+    bool staging_erasing;
+    uint32_t moved;
+
+    log_page_t migrate_buf;
+    log_stats_t counters;
+
+    log_page_t *openPage(void);
+    bool blockErased(uint32_t index);
+    bool eraseFor(uint32_t index);
+    bool stagingUsable(void);
+    void recoverStaging(void);
+    void waitIdle(W25Q128 &chip);
+};
+
+#endif
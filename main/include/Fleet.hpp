@@ -0,0 +1,66 @@
+// Fleet.hpp
+// Compile-time registry of every device on the system.
+// 05/2023
+
+#ifndef FLEET_H
+#define FLEET_H
+
+#include <stddef.h>
+#include <tuple>
+#include <utility>
+
+#include "Device.hpp"
+
+/**
+ * Holds one of each device type in `Ts`, in declaration order, constructed
+ * from a matching constexpr table of device_desc_t.
+ *
+ * Devices live inside the Fleet itself (so in static storage when the
+ * Fleet is a member of a global), and every call made through the Fleet is
+ * resolved at compile time - `visit` with a runtime index expands to a
+ * chain of direct calls rather than an indirect one.
+ */
+template <DeviceDriver... Ts>
+class Fleet {
+public:
+    static constexpr int size = sizeof...(Ts);
+
+    explicit Fleet(const device_desc_t (&table)[sizeof...(Ts)])
+        : Fleet(table, std::index_sequence_for<Ts...>{}) {}
+
+    // Device at index I, by its concrete type.
+    template <int I>
+    auto &get() { return std::get<I>(devices); }
+
+    const device_desc_t &desc(int index) const { return table[index]; }
+
+    // Call f(device) for every device in order.
+    template <typename F>
+    void forEach(F &&f) {
+        std::apply([&](auto &...dev) { (f(dev), ...); }, devices);
+    }
+
+    // Call f(device) on the device at a runtime index. Returns
+    // STATUS_FAILED for an out of range index.
+    template <typename F>
+    status visit(int index, F &&f) {
+        status result = STATUS_FAILED;
+        visit_impl(index, f, result, std::index_sequence_for<Ts...>{});
+        return result;
+    }
+
+private:
+    const device_desc_t *table;
+    std::tuple<Ts...> devices;
+
+    template <size_t... Is>
+    Fleet(const device_desc_t (&t)[sizeof...(Ts)], std::index_sequence<Is...>)
+        : table(t), devices(t[Is]...) {}
+
+    template <typename F, size_t... Is>
+    void visit_impl(int index, F &f, status &result, std::index_sequence<Is...>) {
+        ((index == (int)Is ? (void)(result = f(std::get<Is>(devices))) : (void)0), ...);
+    }
+};
+
+#endif
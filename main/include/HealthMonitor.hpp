@@ -0,0 +1,235 @@
+// HealthMonitor.hpp
+// Central health scheduler for all devices on the system.
+// Staggered health checks, quarantine and re-probing for every device in a
+// Fleet. Runs inside the acquisition loop's idle time, so it never needs
+// its own task, timer or stack.
+// 05/2023
+
+#ifndef HEALTHMONITOR_H
+#define HEALTHMONITOR_H
+
+#include <stdint.h>
+#include <array>
+
+#include "esp_timer.h"
+
+#include "Fleet.hpp"
+#include "Console.hpp"
+
+// Nominal interval between checks of a healthy device.
+#define HEALTH_PERIOD_US (1000 * 1000)
+// Longest interval between re-probes of a quarantined device.
+#define HEALTH_MAX_BACKOFF 5 // 2^5 * HEALTH_PERIOD_US = 32s
+// Consecutive STATUS_MISBEHAVING results before a device is quarantined.
+#define HEALTH_MISBEHAVE_LIMIT 3
+// Assumed cost of a check before the first one has been timed. Must fit
+// in a slot's idle time or no check would ever run.
+#define HEALTH_DEFAULT_COST_US 200
+// Most a check's estimated cost can reach, however long one has taken.
+// Kept well inside a full-rate slot (see System.hpp).
+#define HEALTH_MAX_COST_US 400
+// Every device in the fleet, for a monitor that owns them all.
+#define HEALTH_ALL_DEVICES 0xffffffffu
+
+/**
+ * Runs `checkOK` for every device in a Fleet on a staggered schedule,
+ * using only the bus time left over at the end of a sample slot.
+ *
+ * This replaces the per-device FreeRTOS timers/tasks. Nothing here runs
+ * on its own: the acquisition loop calls `poll` after it has finished
+ * reading, telling us when the next slot starts, and at most one check is
+ * run if it is expected to finish before then.
+ *
+ * Devices which fail a check, or whose circuit breaker opens (see
+ * Breaker.hpp), are quarantined (see `usable`) and re-probed with
+ * exponential backoff until they come back.
+ *
+ * A monitor only looks after the devices it owns, so that each device is
+ * checked from the task that otherwise talks to it. Those it doesn't own
+ * are left alone and always read as usable.
+ */
+template <typename FleetT>
+class HealthMonitor {
+public:
+    /**
+     * First checks are spread evenly across one HEALTH_PERIOD_US so that
+     * no two devices fall due in the same slot.
+     *
+     * @param fleet Devices to monitor. Must outlive the monitor.
+     * @param owned Bit N set to look after the fleet's device N.
+     */
+    explicit HealthMonitor(FleetT &fleet, uint32_t owned = HEALTH_ALL_DEVICES)
+        : fleet(fleet), owned(owned) {
+        static_assert(FleetT::size <= 32, "owned is a 32 bit device mask");
+        for (int i = 0; i < FleetT::size; i++) {
+            entry_t &e = devices[i];
+            e.next_check_us = ((int64_t)i * HEALTH_PERIOD_US) / FleetT::size;
+            e.cost_us = HEALTH_DEFAULT_COST_US;
+            e.misbehaving = 0;
+            e.backoff = 0;
+            e.quarantined = false;
+        }
+    }
+
+    /**
+     * Gives the monitor a chance to use the rest of the current sample slot.
+     *
+     * Devices whose drivers have flagged a failed transaction are quarantined
+     * straight away (no bus access needed). Then the next due device, in
+     * round-robin order, is checked - but only if its estimated check time
+     * fits before `deadline_us`. A check that doesn't fit is left for a
+     * later slot rather than delaying the next sample, and its estimate
+     * eases back towards HEALTH_DEFAULT_COST_US, so one slow check can't
+     * keep a device from being checked again.
+     *
+     * @param now_us Current time from esp_timer_get_time().
+     * @param deadline_us Time at which the next sample slot starts.
+     * @return true if a check was run.
+     */
+    bool poll(int64_t now_us, int64_t deadline_us) {
+        int index = 0;
+        fleet.forEach([&](auto &dev) {
+            entry_t &e = devices[index];
+            if (owns(index++) && !e.quarantined && !dev.alive) {
+                record(e, dev, STATUS_FAILED, now_us);
+            }
+        });
+
+        for (int n = 0; n < FleetT::size; n++) {
+            int i = (cursor + n) % FleetT::size;
+            entry_t &e = devices[i];
+            if (!owns(i) || e.next_check_us > now_us) {
+                continue;
+            }
+            if (now_us + e.cost_us > deadline_us) {
+                if (e.cost_us > HEALTH_DEFAULT_COST_US) {
+                    e.cost_us -= (e.cost_us - HEALTH_DEFAULT_COST_US + 15) / 16;
+                }
+                continue;
+            }
+
+            fleet.visit(i, [&](auto &dev) {
+                // A quarantined device's circuit is open; let this one
+                // check through (half-open).
+                if (e.quarantined) {
+                    dev.breaker.halfOpen();
+                }
+                int64_t start = esp_timer_get_time();
+                status result = dev.checkOK();
+                int64_t end = esp_timer_get_time();
+
+                // Only checks that got an answer say how long a check
+                // takes; a timed out one would keep the device from ever
+                // being re-probed.
+                int32_t took = (int32_t)(end - start);
+                if (result != STATUS_FAILED) {
+                    e.cost_us = estimate(e.cost_us, took);
+                }
+                bus_time_us += took;
+                checks_run++;
+
+                record(e, dev, result, end);
+                return result;
+            });
+            cursor = (i + 1) % FleetT::size;
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * Whether the acquisition loop should talk to this device.
+     *
+     * @param index Index of the device in the fleet.
+     */
+    bool usable(int index) const {
+        if (index < 0 || index >= FleetT::size) {
+            return false;
+        }
+        return !devices[index].quarantined;
+    }
+
+    // Total bus time spent on health checks since boot.
+    int64_t busTimeUs() const { return bus_time_us; }
+    uint32_t checksRun() const { return checks_run; }
+
+private:
+    struct entry_t {
+        int64_t next_check_us;
+        int32_t cost_us;        // expected duration of a checkOK (see estimate)
+        uint8_t misbehaving;    // consecutive STATUS_MISBEHAVING results
+        uint8_t backoff;        // re-probe interval is HEALTH_PERIOD_US << backoff
+        bool quarantined;
+    };
+
+    FleetT &fleet;
+    uint32_t owned;
+    std::array<entry_t, FleetT::size> devices;
+    int cursor = 0;
+
+    int64_t bus_time_us = 0;
+    uint32_t checks_run = 0;
+
+    bool owns(int index) const { return (owned >> index) & 1; }
+
+    /**
+     * Moves a check's expected duration towards the latest one: halfway up
+     * if it took longer, a quarter of the way down if it was quicker, and
+     * never past HEALTH_MAX_COST_US. A check that starts to run slow is
+     * soon given more room, without one outlier setting the estimate.
+     */
+    static int32_t estimate(int32_t cost_us, int32_t took_us) {
+        cost_us = took_us > cost_us ? cost_us + (took_us - cost_us + 1) / 2
+                                    : cost_us - (cost_us - took_us) / 4;
+        return cost_us < HEALTH_MAX_COST_US ? cost_us : HEALTH_MAX_COST_US;
+    }
+
+    /**
+     * Applies the result of a check to a device's schedule.
+     *
+     * Healthy devices are checked again after HEALTH_PERIOD_US. Failed devices
+     * (or ones misbehaving HEALTH_MISBEHAVE_LIMIT times in a row) are
+     * quarantined, and the re-probe interval doubles on every further failure
+     * up to 2^HEALTH_MAX_BACKOFF periods.
+     */
+    template <typename D>
+    void record(entry_t &e, D &dev, status result, int64_t now_us) {
+        const char *name = fleet.desc(&e - devices.data()).name;
+
+        if (result == STATUS_MISBEHAVING) {
+            if (e.misbehaving < HEALTH_MISBEHAVE_LIMIT) {
+                e.misbehaving++;
+            }
+            if (e.misbehaving >= HEALTH_MISBEHAVE_LIMIT) {
+                result = STATUS_FAILED;
+            }
+        } else {
+            e.misbehaving = 0;
+        }
+
+        if (result == STATUS_FAILED) {
+            if (e.quarantined && e.backoff < HEALTH_MAX_BACKOFF) {
+                e.backoff++;
+            }
+            if (!e.quarantined) {
+                console_printf("Health: %s failed, quarantining.\n", name);
+            }
+            e.quarantined = true;
+            dev.alive = false;
+            dev.breaker.open();
+            e.next_check_us = now_us + ((int64_t)HEALTH_PERIOD_US << e.backoff);
+            return;
+        }
+
+        if (e.quarantined) {
+            console_printf("Health: %s recovered.\n", name);
+        }
+        e.quarantined = false;
+        e.backoff = 0;
+        dev.alive = true;
+        dev.breaker.reset();
+        e.next_check_us = now_us + HEALTH_PERIOD_US;
+    }
+};
+
+#endif
@@ -0,0 +1,79 @@
+// LiveStream.hpp
+// Framed binary stream of live sensor readings for diagnostic mode.
+// 05/2023
+
+#ifndef LIVESTREAM_H
+#define LIVESTREAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "driver/uart.h"
+#include "esp_pm.h"
+
+// Takes over the console UART (the one on the USB bridge). Text written
+// to the console afterwards is interleaved with frames; the decoder skips
+// it by resyncing on the sync word and CRC.
+#define LIVE_UART UART_NUM_0
+// TODO: check the USB bridge on the board manages this.
+#define LIVE_BAUD 2000000
+// Frames queued in the UART driver. ~40ms at LIVE_BAUD.
+#define LIVE_TX_BUFFER 8192
+#define LIVE_RX_BUFFER 256
+
+// ### Framing ###
+//
+//   sync (0x5aa5) | channel | len | time_us | payload[len] | crc32
+//
+// Little endian. `channel` is the source's device_id (see types.hpp) and
+// the payload is a run of that device's readings, exactly as in memory.
+// The CRC32 (zlib polynomial) covers everything from `sync` to the end
+// of the payload. tools/live.py decodes this.
+
+#define LIVE_SYNC 0x5aa5
+#define LIVE_MAX_PAYLOAD 240
+
+typedef struct __attribute__((packed)) {
+    uint16_t sync;
+    uint8_t channel;
+    uint8_t len;
+    uint32_t time_us;
+} live_header_t;
+
+// Device counters go out on their own channel: each frame is one device's
+// index followed by its device_stats_t (see DeviceStats.hpp).
+#define LIVE_CHANNEL_STATS 31
+
+// The host selects channels by sending LIVE_CMD_MASK then a little endian
+// uint32 mask with bit N set for device_id N.
+#define LIVE_CMD_MASK 'M'
+
+class LiveStream {
+public:
+    explicit LiveStream(uint32_t mask);
+
+    // Switch the console UART to LIVE_BAUD with a driver-owned TX buffer.
+    // Keeps the APB clock (the UART's) at 80MHz from then on.
+    bool init(void);
+
+    bool enabled(uint8_t channel) const { return mask & (1u << channel); }
+
+    // Queue one frame. Never blocks: if the TX buffer can't take the
+    // whole frame it is dropped and counted.
+    bool send(uint8_t channel, uint32_t time_us, const void *data, size_t len);
+    // Pick up mask changes from the host. Never blocks.
+    void poll(void);
+
+    uint32_t dropped() const { return dropped_count; }
+
+private:
+    uint32_t mask;
+    uint32_t dropped_count;
+    bool ready;
+    esp_pm_lock_handle_t pm_lock;
+
+    uint8_t cmd[5];
+    size_t cmd_len;
+};
+
+#endif
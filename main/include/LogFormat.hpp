@@ -0,0 +1,130 @@
+// LogFormat.hpp
+// On-flash format of the flight log, and checks on it. No esp-idf
+// dependencies beyond the CRC, so host tools can share it.
+// 05/2023
+
+#ifndef LOGFORMAT_H
+#define LOGFORMAT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "Crc32.hpp"
+
+// ### On-flash format ###
+//
+// The log is a sequence of 256 byte pages from address 0 of the primary
+// chip. Page N always lives at N * LOG_PAGE_SIZE and carries its own
+// index, so a page can be written out of order (or sit on the staging
+// chip for a while) without changing where it ends up. Each page holds
+// whole records packed from the start of `data`; the unused tail is left
+// erased (0xff).
+//
+// Every page carries a CRC32 over all of its 256 bytes but the `crc`
+// field, set as it leaves RAM, so a torn program or bit rot anywhere in
+// it shows up. Every record carries its own CRC32 over its header (bar
+// `crc`) and payload, so the good records in a damaged page can still be
+// recovered. tools/flashlog.py checks both with Python's zlib.crc32.
+
+#define LOG_PAGE_SIZE 256
+#define LOG_PAGE_MAGIC 0x4c47 // "GL"
+#define LOG_PAGE_ERASED 0xffff
+#define LOG_PAGE_HEADER 12
+#define LOG_PAGE_DATA (LOG_PAGE_SIZE - LOG_PAGE_HEADER)
+
+typedef struct __attribute__((packed)) {
+    uint16_t magic;
+    uint16_t used;   // bytes of `data` holding records
+    uint32_t index;  // page number in the log
+    uint32_t crc;    // CRC32 of the rest of the page
+    uint8_t data[LOG_PAGE_DATA];
+} log_page_t;
+
+static_assert(sizeof(log_page_t) == LOG_PAGE_SIZE, "log page must be packed");
+
+typedef struct __attribute__((packed)) {
+    uint8_t type;     // log_record_type
+    uint8_t len;      // bytes of payload following this header
+    uint32_t time_us; // low 32 bits of esp_timer_get_time()
+    uint32_t crc;     // CRC32 of the above, then the payload
+} log_record_t;
+
+#define LOG_RECORD_MAX (LOG_PAGE_DATA - sizeof(log_record_t))
+
+enum log_record_type : uint8_t {
+    REC_ACCEL,
+    REC_IMU,
+    REC_BARO,
+    REC_RTC,
+    REC_MESSAGE,
+    REC_ANALOG,
+    REC_PHASE,
+    REC_STATS, // device index, then its device_stats_t
+    REC_ATTITUDE, // IMU device index, then an attitude_sample_t
+    REC_ALTITUDE, // IMU device index, then an altitude_sample_t
+    REC_POWER, // power_stats_t (see Power.hpp)
+    REC_CHECKPOINT, // cycle_stats_t: checkpoint saves and their cost
+    REC_STAGES, // stage_stats_t (see System.hpp)
+    REC_HEAP, // heap_stats_t (see System.hpp)
+};
+
+// ### Checks ###
+
+typedef struct {
+    uint32_t pages_ok;
+    uint32_t pages_erased;    // never written, or a hole left by a reset
+    uint32_t pages_corrupt;   // bad header, wrong index or failed CRC
+    uint32_t records_ok;      // including good records in corrupt pages
+    uint32_t records_corrupt;
+    uint32_t end;             // one past the last page that isn't erased
+} log_verify_t;
+
+inline uint32_t log_page_crc(const log_page_t *page) {
+    uint32_t crc = crc32_update(0, page, offsetof(log_page_t, crc));
+    return crc32_update(crc, page->data, LOG_PAGE_DATA);
+}
+
+inline uint32_t log_record_crc(const log_record_t *rec, const void *payload) {
+    uint32_t crc = crc32_update(0, rec, offsetof(log_record_t, crc));
+    return crc32_update(crc, payload, rec->len);
+}
+
+// Check one page, expected to be log page `index`, adding to `result`.
+void log_verify_page(const log_page_t *page, uint32_t index, log_verify_t *result);
+// Check an image of `count` pages from log page `first` on.
+void log_verify_pages(const log_page_t *pages, uint32_t first, uint32_t count,
+                      log_verify_t *result);
+
+// ### Reading ###
+
+/**
+ * Calls `f(const log_record_t &rec, const uint8_t *payload)` for every
+ * intact record in a page expected to be log page `index`: all of them if
+ * the page checks out, otherwise those whose own CRC matches.
+ */
+template <typename F>
+void log_page_records(const log_page_t *page, uint32_t index, F &&f) {
+    if (page->magic != LOG_PAGE_MAGIC) {
+        return;
+    }
+    bool good = page->index == index && page->used <= LOG_PAGE_DATA &&
+                log_page_crc(page) == page->crc;
+    size_t used = page->used < LOG_PAGE_DATA ? page->used : LOG_PAGE_DATA;
+    size_t pos = 0;
+
+    while (pos + sizeof(log_record_t) <= used) {
+        log_record_t rec;
+        memcpy(&rec, &page->data[pos], sizeof(rec));
+        const uint8_t *payload = &page->data[pos + sizeof(rec)];
+        if (pos + sizeof(rec) + rec.len > used) {
+            return;
+        }
+        if (good || log_record_crc(&rec, payload) == rec.crc) {
+            f(rec, payload);
+        }
+        pos += sizeof(rec) + rec.len;
+    }
+}
+
+#endif
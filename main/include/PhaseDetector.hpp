@@ -0,0 +1,79 @@
+// PhaseDetector.hpp
+// Works out the flight phase from the accelerometers, on the acquisition
+// task, so System can switch sensor and stored rates as the flight goes
+// on. Integer only, no esp-idf dependencies.
+// 05/2023
+
+#ifndef PHASEDETECTOR_H
+#define PHASEDETECTOR_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "types.hpp"
+#include "Pipeline.hpp"
+
+// Each transition needs its condition to hold, on every reading, for a
+// while. First guesses, to be tuned against replays of real flights.
+
+// Pad -> boost: specific force above this.
+#define PHASE_LAUNCH_MG 2500
+#define PHASE_LAUNCH_HOLD_US (100 * 1000)
+// Boost -> coast: specific force against the direction it had at launch,
+// once drag is all that's left.
+#define PHASE_BURNOUT_HOLD_US (50 * 1000)
+// Coast -> microgravity: specific force below this.
+#define PHASE_ZERO_G_MG 100
+#define PHASE_ZERO_G_HOLD_US (200 * 1000)
+// Microgravity -> descent: drag building up again.
+#define PHASE_DESCENT_MG 300
+#define PHASE_DESCENT_HOLD_US (200 * 1000)
+// Descent -> landed: 1g within this and no rotation, for a good while.
+// Under the drogue the rocket swings and spins.
+#define PHASE_STILL_MG 50
+#define PHASE_STILL_DPS 5
+#define PHASE_LANDED_HOLD_US (5 * 1000 * 1000)
+
+// H3LIS100DLTR: 780mg per count.
+#define PHASE_ACCEL_MG_PER_LSB 780
+// Go on the accelerometers once the IMU has said nothing for this long.
+// At the low rate it reads every ~10ms, so many slots have nothing from it.
+#define PHASE_IMU_STALE_US (100 * 1000)
+
+/**
+ * Phase detection from each slot's readings (a pipeline_block_t, as
+ * acquisition builds it). Uses IMU0's accelerometer and gyro, IMU1's if
+ * IMU0 has nothing this slot, and acc0 or acc1 if the IMU is clipping or
+ * has gone quiet. The accelerometers' counts are too coarse to tell lying
+ * still from swinging under the drogue, so landing waits for the IMU.
+ * Only ever moves forward, one phase at a time.
+ */
+class PhaseDetector {
+public:
+    PhaseDetector();
+
+    // Carry on from `phase` (a warm boot), with nothing held yet.
+    void reset(flight_phase phase);
+
+    // Look at a slot's readings. Returns the phase afterwards.
+    flight_phase update(const pipeline_block_t &block);
+    flight_phase currentPhase() const { return phase; }
+
+private:
+    flight_phase phase;
+    // When the next transition's condition started holding, if it is.
+    bool holding;
+    uint32_t since_us;
+    // Sum of the specific force while launch held: the thrust axis in the
+    // sensor's frame.
+    int64_t axis[3];
+    // Last IMU reading, for PHASE_IMU_STALE_US.
+    bool imu_seen;
+    uint32_t imu_us;
+
+    // `dps` < 0: no gyro, from the accelerometers.
+    void reading(uint32_t time_us, const int32_t mg[3], int32_t dps);
+    bool hold(bool condition, uint32_t time_us, uint32_t hold_us);
+};
+
+#endif
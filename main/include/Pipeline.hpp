@@ -0,0 +1,195 @@
+// Pipeline.hpp
+// On-board processing of sensor readings, between the drivers and the
+// flight log.
+//
+// System feeds this from the drivers every slot. It has no esp-idf
+// dependencies, so the replay harness (host/replay.cpp) can run recorded
+// or synthetic flights through exactly the same code on Linux. Anything
+// that works on readings (decimation, and later detection and fusion)
+// belongs here rather than in System.
+// 05/2023
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "types.hpp"
+#include "LogFormat.hpp"
+#include "Decimator.hpp"
+#include "SampleBlock.hpp"
+#include "Attitude.hpp"
+#include "Altitude.hpp"
+
+// Decimated readings per log record. Each record is one device's block.
+#define ACCEL_LOG_BLOCK 16 // 97 byte records
+#define IMU_LOG_BLOCK 8    // 161 byte records
+
+// How often each IMU's attitude and altitude estimates are logged.
+#define ATTITUDE_LOG_US (20 * 1000)
+#define ALTITUDE_LOG_US (20 * 1000)
+
+// Longest gap between IMU blocks that's taken as the readings' spacing.
+// Past this (a quarantined IMU, or the first block) the output data rate
+// stands in for it.
+#define IMU_INTERVAL_MAX_US (20 * 1000)
+
+// Streams of each kind: one per device.
+#define PIPELINE_ACCELS 2
+#define PIPELINE_IMUS 2
+#define PIPELINE_BAROS 2
+
+// What each flight phase stores. Sensors run at `rate`, and the stored
+// streams are then CIC decimated by 1 << log2.
+typedef struct {
+    sample_rate rate;
+    uint8_t accel_log2;
+    uint8_t imu_log2;
+} phase_config_t;
+
+inline constexpr phase_config_t PHASE_CONFIG[] = {
+    /* PHASE_PAD */          {RATE_LOW,  0, 0}, // sensors already slow
+    /* PHASE_BOOST */        {RATE_FULL, 0, 0}, // everything
+    /* PHASE_COAST */        {RATE_FULL, 1, 1}, // 500Hz
+    /* PHASE_MICROGRAVITY */ {RATE_FULL, 3, 3}, // 125Hz
+    /* PHASE_DESCENT */      {RATE_FULL, 3, 3},
+    /* PHASE_LANDED */       {RATE_LOW,  0, 0},
+};
+
+static_assert(sizeof(PHASE_CONFIG) / sizeof(PHASE_CONFIG[0]) == PHASE_COUNT,
+              "PHASE_CONFIG needs an entry per flight phase");
+
+// A logged attitude estimate: the quaternion in Q14, and the filter's
+// average cost per reading in CPU cycles (saturating).
+typedef struct __attribute__((packed)) {
+    int16_t q[4]; // w, x, y, z
+    int16_t cycles;
+} attitude_sample_t;
+
+attitude_sample_t attitude_sample(const AttitudeEstimator &est);
+
+// A logged altitude estimate: height above the pad, vertical velocity and
+// accelerometer bias, and the filter's average cost per reading in CPU
+// cycles.
+typedef struct __attribute__((packed)) {
+    int32_t altitude_mm;
+    int32_t velocity_mm_s;
+    int32_t bias_mm_s2;
+    int32_t cycles;
+} altitude_sample_t;
+
+altitude_sample_t altitude_sample(const AltitudeEstimator &est);
+
+// What a warm boot needs to carry on from: the phase and each IMU's
+// estimates. Decimation blocks in progress are lost with the reset.
+typedef struct {
+    uint8_t phase;
+    uint8_t reserved[3];
+    attitude_state_t attitude[PIPELINE_IMUS];
+    altitude_state_t altitude[PIPELINE_IMUS];
+} pipeline_checkpoint_t;
+
+// One slot's worth of readings, as handed from the acquisition task to
+// the one running the pipeline (see Spsc.hpp). Sized for what a slot
+// produces with some slack; the accelerometers keep anything beyond
+// that buffered for the next slot.
+#define PIPELINE_BLOCK_ACCEL 8
+#define PIPELINE_BLOCK_IMU 4
+#define PIPELINE_BLOCK_BARO 2
+// Other records logged in the slot (analog, stats): each a log_record_t
+// (CRC left to FlashLog) then its payload.
+#define PIPELINE_BLOCK_RECORDS 256
+
+// One device's readings in a slot, a channel to an array.
+typedef SampleBlock<int16_t, ACC_CHANNELS, PIPELINE_BLOCK_ACCEL> accel_block_t;
+typedef SampleBlock<int16_t, IMU_CHANNELS, PIPELINE_BLOCK_IMU> imu_block_t;
+typedef SampleBlock<int32_t, BARO_CHANNELS, PIPELINE_BLOCK_BARO> baro_block_t;
+
+typedef struct {
+    uint32_t time_us;
+    uint8_t phase;
+    uint16_t records_len;
+    accel_block_t accel[PIPELINE_ACCELS];
+    imu_block_t imu[PIPELINE_IMUS];
+    baro_block_t baro[PIPELINE_BAROS];
+    uint8_t records[PIPELINE_BLOCK_RECORDS];
+} pipeline_block_t;
+
+// Empties `block` for a slot at `time_us` in `phase`.
+void pipeline_block_clear(pipeline_block_t *block, uint32_t time_us, flight_phase phase);
+// Adds a record to `block`. False if it doesn't fit.
+bool pipeline_block_record(pipeline_block_t *block, log_record_type type, uint32_t time_us,
+                           const void *data, size_t len);
+
+// Where the pipeline's log records go: the flight log on board, a digest
+// in the replay harness. Returns false if the record was dropped.
+typedef bool (*pipeline_sink_t)(void *ctx, log_record_type type, uint32_t time_us,
+                                const void *data, size_t len);
+
+class Pipeline {
+public:
+    Pipeline(pipeline_sink_t sink, void *ctx);
+
+    // Readings one device produced since the last call, the newest taken
+    // at `time_us`. `index` picks the device among its kind, 0 or 1.
+    void accel(int index, uint32_t time_us, const accel_reading_t *readings, size_t n);
+    void imu(int index, uint32_t time_us, const imu_reading_t *readings, size_t n);
+    void baro(int index, uint32_t time_us, const baro_reading_t &reading);
+    // As above, a block at a time, the newest reading's time standing in
+    // for `time_us`. Empty blocks are skipped.
+    void accel(int index, const accel_block_t &block);
+    void imu(int index, const imu_block_t &block);
+    void baro(int index, const baro_block_t &block);
+    // A whole slot: its phase (if it changed), records, then every
+    // device's block as above.
+    void process(const pipeline_block_t &block);
+
+    // Orientation from one IMU's readings so far.
+    const AttitudeEstimator &attitude(int index) const { return attitude_est[index]; }
+    // Altitude and vertical velocity from one IMU and both barometers,
+    // updated with every IMU reading.
+    const AltitudeEstimator &altitude(int index) const { return altitude_est[index]; }
+
+    /**
+     * Switches stored rates for a new flight phase.
+     *
+     * Blocks already collected at the old rate are written out first, and
+     * the phase change itself is logged so the decoder knows the new rates.
+     * Sensor output rates are up to the caller (PHASE_CONFIG[].rate).
+     */
+    void setPhase(flight_phase next, uint32_t time_us);
+    flight_phase currentPhase() const { return phase; }
+
+    // Writes out any partly filled decimation blocks.
+    void flush(uint32_t time_us);
+
+    void checkpoint(pipeline_checkpoint_t *cp) const;
+    /**
+     * Carries on from a checkpoint taken `elapsed_us` ago, in place of
+     * starting on the pad. The phase is logged again at `time_us`, which
+     * marks the resume in the log.
+     */
+    void restore(const pipeline_checkpoint_t &cp, uint32_t elapsed_us, uint32_t time_us);
+
+private:
+    pipeline_sink_t sink;
+    void *ctx;
+    flight_phase phase;
+
+    DecimatedStream<accel_reading_t, ACCEL_LOG_BLOCK> acc_streams[PIPELINE_ACCELS];
+    DecimatedStream<imu_reading_t, IMU_LOG_BLOCK> imu_streams[PIPELINE_IMUS];
+    AttitudeEstimator attitude_est[PIPELINE_IMUS];
+    AltitudeEstimator altitude_est[PIPELINE_IMUS];
+    uint32_t attitude_logged_us[PIPELINE_IMUS];
+    uint32_t altitude_logged_us[PIPELINE_IMUS];
+    uint32_t imu_time_us[PIPELINE_IMUS];
+    bool imu_timed[PIPELINE_IMUS];
+
+    void record_block(log_record_type type, uint8_t source, uint32_t time_us,
+                      const void *readings, size_t len);
+    uint32_t imu_interval(int index, uint32_t time_us, size_t n);
+    void imu_estimate(int index, uint32_t time_us, const imu_reading_t *readings, size_t n);
+};
+
+#endif
@@ -0,0 +1,152 @@
+// Pool.hpp
+// Fixed-size block pools, and an allocator that lets the standard
+// containers take their storage from one instead of the heap. The heap
+// on the ESP32 is shared with esp-idf and fragments under steady churn,
+// so nothing that runs every slot allocates from it.
+//
+// No esp-idf dependencies. Safe to allocate and free from any task.
+// 05/2023
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <atomic>
+#include <new>
+#include <vector>
+
+#include "types.hpp"
+
+// Reading batches (IMU and barometer queues, and what they hand over).
+// Each holds SAMPLE_BATCH_MAX readings of the largest kind; a driver drops
+// (and counts) any more until the batch is taken. Two per device (the
+// queue, and the batch last read out), held for good, plus a few for
+// anything else.
+#define SAMPLE_BATCH_MAX 8
+#define SAMPLE_POOL_BLOCKS 16
+
+typedef struct {
+    uint32_t in_use;     // blocks allocated right now
+    uint32_t high_water;
+    uint32_t failures;   // allocations refused (pool full or block too big)
+    uint32_t fallbacks;  // of those, ones PoolAllocator took from the heap
+} pool_stats_t;
+
+/**
+ * `Count` blocks of `Size` bytes, handed out one at a time. Allocation
+ * claims the lowest free bit of a bitmap with a compare and swap, so it
+ * is constant time, never blocks, and can't fragment.
+ */
+template <size_t Size, size_t Count>
+class BlockPool {
+    static_assert(Count > 0 && Count <= 32, "pool bitmap is 32 bits");
+
+public:
+    static constexpr size_t block_size = Size;
+
+    constexpr BlockPool() : bits(0), in_use(0), high_water(0), failures(0), fallbacks(0) {}
+
+    // nullptr (and counts a failure) if `size` doesn't fit or none are free.
+    void *alloc(size_t size) noexcept {
+        uint32_t used = bits.load(std::memory_order_relaxed);
+        do {
+            if (size > Size || used == FULL) {
+                failures.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            }
+        } while (!bits.compare_exchange_weak(used, used | ((used + 1) & ~used),
+                                             std::memory_order_acquire, std::memory_order_relaxed));
+        uint32_t n = in_use.fetch_add(1, std::memory_order_relaxed) + 1;
+        uint32_t high = high_water.load(std::memory_order_relaxed);
+        while (n > high && !high_water.compare_exchange_weak(high, n, std::memory_order_relaxed)) {
+        }
+        return blocks[__builtin_ctz(~used)];
+    }
+
+    // False if `p` isn't one of this pool's blocks.
+    bool free(void *p) noexcept {
+        if (!owns(p)) {
+            return false;
+        }
+        size_t i = ((uint8_t *)p - &blocks[0][0]) / Size;
+        bits.fetch_and(~(1u << i), std::memory_order_release);
+        in_use.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Counts an allocation that went to the heap after this pool refused it.
+    void fell_back() noexcept { fallbacks.fetch_add(1, std::memory_order_relaxed); }
+
+    bool owns(const void *p) const noexcept {
+        const uint8_t *b = (const uint8_t *)p;
+        return b >= &blocks[0][0] && b < &blocks[0][0] + sizeof(blocks);
+    }
+
+    pool_stats_t stats() const {
+        return {in_use.load(std::memory_order_relaxed), high_water.load(std::memory_order_relaxed),
+                failures.load(std::memory_order_relaxed), fallbacks.load(std::memory_order_relaxed)};
+    }
+
+private:
+    static constexpr uint32_t FULL = (uint32_t)((1ull << Count) - 1);
+
+    alignas(max_align_t) uint8_t blocks[Count][Size];
+    std::atomic<uint32_t> bits; // bit N set if blocks[N] is allocated
+    std::atomic<uint32_t> in_use;
+    std::atomic<uint32_t> high_water;
+    std::atomic<uint32_t> failures;
+    std::atomic<uint32_t> fallbacks;
+};
+
+/**
+ * Standard allocator drawing from `Pool`. Anything the pool refuses goes
+ * to the heap instead, so a container never fails outright; each time it
+ * does is counted in the pool's fallbacks, which System logs and reports
+ * on the console.
+ */
+template <typename T, auto &Pool>
+struct PoolAllocator {
+    typedef T value_type;
+
+    template <typename U>
+    struct rebind {
+        typedef PoolAllocator<U, Pool> other;
+    };
+
+    PoolAllocator() noexcept = default;
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U, Pool> &) noexcept {}
+
+    T *allocate(size_t n) {
+        void *p = Pool.alloc(n * sizeof(T));
+        if (p == nullptr) {
+            Pool.fell_back();
+            p = ::operator new(n * sizeof(T));
+        }
+        return (T *)p;
+    }
+    void deallocate(T *p, size_t) noexcept {
+        if (!Pool.free(p)) {
+            ::operator delete(p);
+        }
+    }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U, Pool> &) const noexcept { return true; }
+};
+
+inline constexpr size_t SAMPLE_BLOCK_BYTES =
+    SAMPLE_BATCH_MAX * (sizeof(imu_reading_t) > sizeof(baro_reading_t) ? sizeof(imu_reading_t)
+                                                                       : sizeof(baro_reading_t));
+
+inline BlockPool<SAMPLE_BLOCK_BYTES, SAMPLE_POOL_BLOCKS> sample_pool;
+
+// A batch of readings in one sample pool block. Reserve SAMPLE_BATCH_MAX
+// up front so it never reallocates, and keep it: clear() and swap() keep
+// the block, so a batch reused slot after slot never allocates again.
+template <typename T>
+using sample_batch = std::vector<T, PoolAllocator<T, sample_pool>>;
+
+#endif
@@ -0,0 +1,87 @@
+// Power.hpp
+// CPU frequency scaling and light sleep between sample slots.
+// 05/2023
+
+#ifndef POWER_H
+#define POWER_H
+
+#include <stdint.h>
+
+#include "esp_pm.h"
+
+// The CPU runs at the top frequency while a slot's work is being done and
+// drops to the bottom one otherwise. 40MHz is the crystal, so the APB
+// clock comes down with it; drivers that need it at 80MHz (the ADC, SPI
+// and I2C masters, LiveStream) hold their own locks.
+#define POWER_CPU_MAX_MHZ 160
+#define POWER_CPU_MIN_MHZ 40
+
+// Logged as a REC_POWER record every STATS_INTERVAL_US.
+typedef struct __attribute__((packed)) {
+    uint32_t slots;         // slots started in the interval
+    uint32_t period_us;     // slot length
+    uint32_t duty_permille; // share of the interval spent at full speed
+    uint32_t sleep;         // 1 if light sleep was allowed between slots
+    uint32_t wake_avg_us;   // from a slot falling due to its work starting
+    uint32_t wake_max_us;
+} power_stats_t;
+
+/**
+ * Owns the power management configuration and the locks the acquisition
+ * and storage tasks need: one each keeping the CPU at full speed while a
+ * slot (or a flush, or a block of the slot's output) is being worked on,
+ * and one keeping it out of light sleep in phases where slots are too
+ * short to sleep through.
+ *
+ * Between slots the acquisition task is blocked on the sample clock, so
+ * with tickless idle the idle task drops the clock or light sleeps until
+ * the next esp_timer alarm. What that costs each slot shows up as the
+ * wake-up latency: how long after the slot fell due its work started.
+ *
+ * Without CONFIG_PM_ENABLE nothing is scaled, but the stats still work.
+ */
+class PowerManager {
+public:
+    PowerManager();
+
+    // Applies the frequency range. Light sleep stays off until setSlot
+    // allows it.
+    bool init(void);
+    // Slot length from now on, and whether the CPU may light sleep between
+    // slots.
+    void setSlot(uint32_t period_us, bool sleep);
+
+    // Full speed until the matching release. Nests.
+    void hold(void);
+    void release(void);
+
+    // A slot due at `due_us` (esp_timer time) is starting: hold, and
+    // count how late it got going.
+    void slotBegin(int64_t due_us);
+    void slotEnd(void) { release(); }
+
+    // Full speed for the storage task, on the other core. Separate from
+    // hold, which is the acquisition task's, and not in the duty cycle.
+    void storeBegin(void);
+    void storeEnd(void);
+
+    // Counters since the last snapshot, which starts a new interval.
+    power_stats_t snapshot(int64_t now);
+
+private:
+    esp_pm_lock_handle_t cpu_lock;
+    esp_pm_lock_handle_t awake_lock;
+    esp_pm_lock_handle_t store_lock;
+    bool sleep_allowed;
+    uint32_t period_us;
+
+    uint32_t depth;
+    int64_t held_since;
+    int64_t busy_us;
+    int64_t interval_start;
+    uint32_t slots;
+    int64_t wake_sum_us;
+    uint32_t wake_max_us;
+};
+
+#endif
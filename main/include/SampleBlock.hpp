@@ -0,0 +1,86 @@
+// SampleBlock.hpp
+// Readings as structure-of-arrays blocks: each channel (field) of a block
+// of readings contiguous, with one shared timestamp per reading. Decimation
+// and anything else that works a channel at a time runs down one array
+// instead of striding across interleaved structs. No esp-idf dependencies.
+// 05/2023
+
+#ifndef SAMPLEBLOCK_H
+#define SAMPLEBLOCK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/**
+ * Up to `N` readings of `Channels` channels of type `S`. Channel `c` of
+ * reading `i` is `ch[c][i]`, taken at `time_us[i]`. Channels are in the
+ * reading struct's field order (accel_channel, imu_channel, baro_channel
+ * in types.hpp), and each starts 16 byte aligned when N * sizeof(S) is a
+ * multiple of 16.
+ */
+template <typename S, int Channels, size_t N>
+struct SampleBlock {
+    typedef S sample_type;
+    static constexpr int channels = Channels;
+    static constexpr size_t capacity = N;
+
+    uint32_t n;
+    uint32_t time_us[N];
+    alignas(16) S ch[Channels][N];
+};
+
+template <typename B>
+inline void sample_block_clear(B *block) {
+    block->n = 0;
+}
+
+/**
+ * Takes in `n` readings already written to the channels just past the
+ * last one, the newest taken at `time_us` and the others `dt_us` apart
+ * before it.
+ */
+template <typename B>
+void sample_block_commit(B *block, size_t n, uint32_t time_us, uint32_t dt_us) {
+    for (size_t i = 0; i < n; i++) {
+        block->time_us[block->n + i] = time_us - (uint32_t)(n - 1 - i) * dt_us;
+    }
+    block->n += n;
+}
+
+/**
+ * Appends readings (`T` a plain struct of `Channels` fields of type `S`,
+ * like imu_reading_t) to `block`, transposing them into its channels. The
+ * last is stamped `time_us`, and the ones before it `dt_us` apart.
+ *
+ * @return How many fit.
+ */
+template <typename T, typename B>
+size_t sample_block_append(B *block, const T *readings, size_t n, uint32_t time_us,
+                           uint32_t dt_us) {
+    typedef typename B::sample_type S;
+    static_assert(sizeof(T) == B::channels * sizeof(S), "reading doesn't match the block");
+    size_t room = B::capacity - block->n;
+    size_t take = n < room ? n : room;
+    const S *in = (const S *)readings;
+    for (size_t i = 0; i < take; i++, in += B::channels) {
+        for (int c = 0; c < B::channels; c++) {
+            block->ch[c][block->n + i] = in[c];
+        }
+    }
+    sample_block_commit(block, take, time_us, dt_us);
+    return take;
+}
+
+// Reading `i` of `block`, back as a struct.
+template <typename T, typename B>
+void sample_block_get(const B &block, size_t i, T *out) {
+    typedef typename B::sample_type S;
+    static_assert(sizeof(T) == B::channels * sizeof(S), "reading doesn't match the block");
+    S *o = (S *)out;
+    for (int c = 0; c < B::channels; c++) {
+        o[c] = block.ch[c][i];
+    }
+}
+
+#endif
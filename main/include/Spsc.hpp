@@ -0,0 +1,102 @@
+// Spsc.hpp
+// Lock-free single producer, single consumer queue, and a pool of blocks
+// passed between two tasks on it. No esp-idf dependencies, so the replay
+// harness runs the same hand-off between threads.
+// 05/2023
+
+#ifndef SPSC_H
+#define SPSC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <atomic>
+
+/**
+ * Bounded ring of `N` entries (a power of two). One task pushes and one
+ * pops; neither ever waits on the other. Each side only writes its own
+ * index, and the release/acquire pair on it publishes the entry.
+ */
+template <typename T, size_t N>
+class SpscQueue {
+    static_assert(N > 0 && (N & (N - 1)) == 0, "queue length must be a power of two");
+
+public:
+    SpscQueue() : head(0), tail(0) {}
+
+    // Producer side. False if full.
+    bool push(const T &item) {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == N) {
+            return false;
+        }
+        items[h % N] = item;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. False if empty.
+    bool pop(T *item) {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        if (head.load(std::memory_order_acquire) == t) {
+            return false;
+        }
+        *item = items[t % N];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Entries waiting. Exact from either side for its own end.
+    size_t size(void) const {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+private:
+    T items[N];
+    std::atomic<uint32_t> head; // free-running
+    std::atomic<uint32_t> tail;
+};
+
+/**
+ * `N` blocks handed from a producer task to a consumer task and back. The
+ * producer takes a free block, fills it and commits it; the consumer
+ * takes committed blocks in order and releases them when done. Nothing is
+ * copied and nothing allocated.
+ *
+ * When every block is committed and unreleased, `take` fails: the
+ * producer decides what to drop rather than wait.
+ */
+template <typename T, size_t N>
+class BlockChannel {
+public:
+    BlockChannel() {
+        for (size_t i = 0; i < N; i++) {
+            free_blocks.push(&blocks[i]);
+        }
+    }
+
+    // Producer side.
+    T *take(void) {
+        T *block;
+        return free_blocks.pop(&block) ? block : nullptr;
+    }
+    void commit(T *block) { full_blocks.push(block); }
+
+    // Consumer side.
+    T *next(void) {
+        T *block;
+        return full_blocks.pop(&block) ? block : nullptr;
+    }
+    void release(T *block) { free_blocks.push(block); }
+
+    // Blocks committed and not yet taken by the consumer.
+    size_t pending(void) const { return full_blocks.size(); }
+
+private:
+    T blocks[N];
+    // Both hold every block at most once, so neither can overflow.
+    SpscQueue<T *, N> free_blocks;
+    SpscQueue<T *, N> full_blocks;
+};
+
+#endif
@@ -11,13 +11,15 @@
 #include <iostream>
 #include <vector>
 #include <sys/time.h>
-#include <memory>
+#include <optional>
+#include <atomic>
 
 // esp-idf dependencies
 #include "driver/gpio.h"
 #include <system_cxx.hpp>
-
-#include <semaphore>
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 
 // Our dependencies
 #include "types.hpp"
@@ -26,6 +28,22 @@
 #include "H3LIS100DLTR.hpp"
 #include "BME280.hpp"
 #include "ICM20948.hpp"
+#include "RP2040.hpp"
+#include "Analog.hpp"
+#include "Fleet.hpp"
+#include "HealthMonitor.hpp"
+#include "FlashLog.hpp"
+#include "Pipeline.hpp"
+#include "PhaseDetector.hpp"
+#include "LiveStream.hpp"
+#include "Console.hpp"
+#include "Async.hpp"
+#include "AsyncBus.hpp"
+#include "Power.hpp"
+#include "Checkpoint.hpp"
+#include "CycleStats.hpp"
+#include "Spsc.hpp"
+#include "Pool.hpp"
 
 // ### Pins for system control ###
 
@@ -35,6 +53,104 @@
 // TODO: check these
 #define PIN_SCL idf::SCL_GPIO(22)
 #define PIN_SDA idf::SDA_GPIO(21)
+// Second I2C bus, for imu1: both its address straps (0x68, 0x69) are
+// taken on the first by the RTC and imu0. TODO: check these
+#define PIN_SCL1 idf::SCL_GPIO(26)
+#define PIN_SDA1 idf::SDA_GPIO(25)
+
+// Data ready lines. TODO: check these
+#define PIN_ACC0_INT1 (gpio_num_t) 34
+#define PIN_ACC1_INT1 (gpio_num_t) 35
+
+// ### Timing ###
+
+// Length of one full-rate sample slot.
+#define SAMPLE_PERIOD_US 1000
+// Slot length in the low rate phases (pad, landed). Long enough for the
+// CPU to light sleep between slots, short enough to poll the accelerometers
+// at twice their low output data rate.
+#define SAMPLE_PERIOD_LOW_US 10000
+// Set to 0 to read sensors one after another on the acquisition task
+// instead of as coroutines on the I2C worker (see Async.hpp).
+#define SENSOR_ASYNC 1
+// Bus time kept free at the end of every slot, on top of the health
+// monitor's own estimate of how long a check takes.
+#define SLOT_GUARD_US 100
+static_assert(HEALTH_MAX_COST_US + SLOT_GUARD_US < SAMPLE_PERIOD_US,
+              "a health check must be able to fit in a full-rate slot");
+// How long the startup check waits for the payload to acknowledge a ping.
+#define PAYLOAD_PING_TIMEOUT_US (100 * 1000)
+// Lowest battery voltage check_power will accept. TODO: check against the pack
+#define POWER_MIN_MV 7000
+// How long check_power waits for the first analog block.
+#define POWER_CHECK_TIMEOUT_US (100 * 1000)
+// Longest flash_flush will wait for the flight log to drain.
+#define FLASH_FLUSH_TIMEOUT_US (1000 * 1000)
+
+// Channels streamed in diagnostic mode until the host picks others.
+#define LIVE_DEFAULT_MASK ((1u << DEV_ACC0) | (1u << DEV_ACC1) | \
+                           (1u << DEV_IMU0) | (1u << DEV_IMU1) | (1u << DEV_ANALOG) | \
+                           (1u << LIVE_CHANNEL_STATS))
+// How often every device's counters are logged (and streamed).
+#define STATS_INTERVAL_US (1000 * 1000)
+// During microgravity the payload is sent the attitude estimate this
+// often, to check its print axis against: PAYLOAD_MSG_ATTITUDE then an
+// attitude_sample_t, on the telemetry lane.
+#define ATTITUDE_PAYLOAD_US (100 * 1000)
+#define PAYLOAD_MSG_ATTITUDE 'Q'
+
+// ### Stages ###
+
+// Sampling runs on the main task (core 0), which hands each slot's
+// readings to the storage task (core 1) in a pooled block. The pipeline,
+// log page encoding and flash I/O all happen there, so nothing they do
+// delays a sample. 64 blocks ride out 64ms of storage falling behind at
+// full rate, 640ms at low rate.
+#define STORAGE_BLOCKS 64
+#define STORAGE_TASK_STACK 4096
+#define STORAGE_TASK_PRIORITY 5
+#define STORAGE_TASK_CORE 1
+// How long storage's flash I/O may go on retrying in one pass, so a
+// failing chip can't hold up blocks acquisition is waiting to reuse.
+#define STORAGE_IO_DEADLINE_US (10 * 1000)
+// The devices storage talks to, and so checks the health of itself.
+#define STORAGE_DEVICES ((1u << DEV_FLASH) | (1u << DEV_FLASH_BUFFER))
+
+// Logged as a REC_STAGES record every STATS_INTERVAL_US.
+typedef struct __attribute__((packed)) {
+    uint32_t blocks;           // slot blocks through the pipeline
+    uint32_t blocks_dropped;   // slots with no free block
+    uint32_t readings_dropped; // IMU and barometer readings lost with them
+    uint32_t records_dropped;  // other records with no block to go in
+    uint32_t queue_max;        // most blocks waiting at once
+    uint32_t acquire_permille; // share of the interval each stage was busy
+    uint32_t encode_permille;
+    uint32_t flash_permille;
+    uint32_t slots_missed;     // sample clock ticks a slot overran
+} stage_stats_t;
+
+// Logged as a REC_HEAP record every STATS_INTERVAL_US. Heap figures are
+// for internal RAM; allocs and frees are since the last record, and read
+// 0 in steady state.
+typedef struct __attribute__((packed)) {
+    uint32_t free_bytes;
+    uint32_t min_free_bytes;         // lowest since boot
+    uint32_t largest_block;
+    uint32_t fragmentation_permille; // free RAM outside the largest block
+    uint32_t allocs;
+    uint32_t frees;
+    pool_stats_t samples;            // sample batch pool
+    coro_pool_stats_t coro;          // coroutine frame pool
+} heap_stats_t;
+
+// Both IMUs' attitude, from storage for acquisition to send the payload.
+typedef struct {
+    attitude_sample_t imu[PIPELINE_IMUS];
+} attitude_msg_t;
+
+static inline uint32_t slot_period_us(sample_rate rate) {
+    return rate == RATE_FULL ? SAMPLE_PERIOD_US : SAMPLE_PERIOD_LOW_US;
+}
 
 // ### enums ###
 
@@ -45,6 +161,32 @@ enum system_mode {
     MODE_DIAGNOSTIC,
 };
 
+// ### Device fleet ###
+
+inline constexpr device_desc_t FLEET[] = {
+    {"rtc",   BUS_I2C0, DS3231_I2C_ADDR,           GPIO_NUM_NC},
+    {"flash", BUS_SPI0, PIN_FLASH0_CS,             GPIO_NUM_NC},
+    {"flashbuf", BUS_SPI0, PIN_FLASH1_CS,          GPIO_NUM_NC},
+    {"acc0",  BUS_I2C0, H3LIS100DLTR_I2C_ADDR,     PIN_ACC0_INT1},
+    {"acc1",  BUS_I2C0, H3LIS100DLTR_I2C_ADDR_ALT, PIN_ACC1_INT1},
+    {"baro0", BUS_I2C0, BME280_I2C_ADDRESS1,       GPIO_NUM_NC},
+    {"baro1", BUS_I2C0, BME280_I2C_ADDRESS2,       GPIO_NUM_NC},
+    {"imu0",  BUS_I2C0, ICM20948_I2C_ADDR,         GPIO_NUM_NC},
+    {"imu1",  BUS_I2C1, ICM20948_I2C_ADDR_ALT,     GPIO_NUM_NC},
+    {"payload", BUS_SPI1, PIN_PAYLOAD_CS,          GPIO_NUM_NC},
+    {"analog", BUS_ADC,   0,                       GPIO_NUM_NC},
+};
+
+typedef Fleet<DS3231, W25Q128, W25Q128,
+              H3LIS100DLTR, H3LIS100DLTR,
+              BME280, BME280,
+              ICM20948, ICM20948,
+              RP2040, Analog> fleet_t;
+
+static_assert(fleet_t::size == sizeof(FLEET) / sizeof(FLEET[0]),
+              "FLEET and fleet_t are out of sync");
+static_assert(!i2c_address_clash(FLEET), "two devices share an address on one I2C bus");
+
 
 // ### Class prototype ### 
 class System {
@@ -53,49 +195,168 @@ public:
 
     // Default constructor
     System();
+    // Power, mode, checkpoint, flash and logging. Call first, from a task.
+    void core_init(void);
 
-    // Readings
-    std::vector<accel_reading_t> accelread(void);
-    std::vector<imu_reading_t> imuread(void);
-    std::vector<baro_reading_t> baroread(void);
+    // Readings. Append what device `index` of a kind has buffered to
+    // `block`, stamped a slot apart up to now, and return how many went
+    // in. Accelerometer readings that don't fit stay buffered; IMU and
+    // barometer ones are dropped and counted.
+    size_t accelread(int index, accel_block_t *block);
+    size_t imuread(int index, imu_block_t *block);
+    size_t baroread(int index, baro_block_t *block);
+    analog_reading_t analogread(void);
     rtc_reading_t rtcread(void);
 
     // ioctl
+    bool record(log_record_type type, const void *data, size_t len);
     int flash_flush(void);
+    bool verify_log(void);
     void log_init(void);
-    void log_msg(std::string msg, log_type type);
+    void log_msg(const char *msg, log_type type);
     void offload(void);
     void i2c_init(void);
     void sensor_init(void);
     void sensor_update(void); // block until all sensors have data
+    void set_phase(flight_phase phase);
+    void live_init(uint32_t mask);
+
+    // Whether this boot carried on a flight from a checkpoint.
+    bool warmBoot(void) const { return warm; }
+    // Worst slot start delay seen against the sample clock.
+    int64_t slotLateMaxUs(void) const { return slot_late_max_us; }
 
 private:
     // Private variables
     flash_mode flashmode;
 
-    // Devices
-    DS3231 rtc;
-    W25Q128 flash;
-    H3LIS100DLTR acc0;
-    H3LIS100DLTR acc1;
-    BME280 baro0;
-    BME280 baro1;
-    ICM20948 imu0;
-    ICM20948 imu1;
+    // Devices. Constructed in place from FLEET, no heap involved.
+    fleet_t devices;
+    DS3231 &rtc() { return devices.get<DEV_RTC>(); }
+    W25Q128 &flash() { return devices.get<DEV_FLASH>(); }
+    W25Q128 &flashbuf() { return devices.get<DEV_FLASH_BUFFER>(); }
+    H3LIS100DLTR &acc0() { return devices.get<DEV_ACC0>(); }
+    H3LIS100DLTR &acc1() { return devices.get<DEV_ACC1>(); }
+    BME280 &baro0() { return devices.get<DEV_BARO0>(); }
+    BME280 &baro1() { return devices.get<DEV_BARO1>(); }
+    ICM20948 &imu0() { return devices.get<DEV_IMU0>(); }
+    ICM20948 &imu1() { return devices.get<DEV_IMU1>(); }
+    RP2040 &payload() { return devices.get<DEV_PAYLOAD>(); }
+    Analog &analog() { return devices.get<DEV_ANALOG>(); }
+
+    // Everything between the drivers and the flight log. Only the storage
+    // task touches it (or the flight log) once that has started.
+    Pipeline pipeline;
+    // Acquisition's view of the phase, which each block carries over, and
+    // what moves it on.
+    flight_phase phase;
+    PhaseDetector detector;
+
+    // Slot blocks, and the one being filled this slot.
+    BlockChannel<pipeline_block_t, STORAGE_BLOCKS> blocks;
+    pipeline_block_t *open_block;
+    SpscQueue<attitude_msg_t, 4> attitude_out;
+    TaskHandle_t storage_task;
+    // Kept by acquisition, taken by storage's stats snapshot.
+    std::atomic<uint32_t> acquire_busy_us;
+    std::atomic<uint32_t> blocks_dropped;
+    std::atomic<uint32_t> readings_dropped;
+    std::atomic<uint32_t> records_dropped;
+    std::atomic<uint32_t> queue_max;
+    std::atomic<uint32_t> slots_missed;
+    std::atomic<bool> flush_requested;
+    std::atomic<bool> flush_done;
+    // Storage's own.
+    int64_t encode_us;
+    int64_t flash_us;
+    uint32_t blocks_done;
+    int64_t stages_logged_us;
+    uint32_t attitude_sent_us;
+    bool flushing;
+
+    // Binary stream of raw readings, diagnostic mode only.
+    std::optional<LiveStream> live;
+
+    // Most recent analog block, kept for check_power and diagnostics.
+    analog_reading_t analog_latest;
+
+    // Install and own the two I2C drivers. Devices reach theirs through
+    // the port their fleet table entry names, not through these.
+    std::optional<idf::I2CMaster> i2c;
+    std::optional<idf::I2CMaster> i2c1;
+
+    // Flight log. Only present in FLASH_EXTERNAL and FLASH_TIERED modes.
+    std::optional<FlashLog> flashlog;
+
+    // Clock scaling and light sleep between slots
+    PowerManager power;
+
+    // Flight state kept across resets, what saving it costs, and when the
+    // log position last moved
+    Checkpoint checkpoint;
+    CycleStats checkpoint_cycles;
+    uint32_t checkpoint_moves;
+    bool warm;
+
+    // Health checks for all of the above, each device's from the task
+    // that uses it: the flash chips' on storage, the rest on acquisition.
+    HealthMonitor<fleet_t> health;
+    HealthMonitor<fleet_t> storage_health;
 
-    std::shared_ptr<idf::I2CMaster> i2c;
+    // Coroutine reads, with a worker per I2C bus. imu1 is alone on I2C1,
+    // so its reads overlap everything else's.
+    AsyncScheduler sched;
+    AsyncBus i2c_bus;
+    AsyncBus i2c1_bus;
 
     // Private methods
-    void log_internal(std::string msg, log_type type);
+    void log_internal(const char *msg, log_type type);
+    void log_samples(void);
+    pipeline_block_t *begin_block(void);
+    void commit_block(void);
+    static void storage_run(void *param);
+    void storage_poll(void);
+    void snapshot_stages(int64_t now);
+    void stream(uint8_t channel, uint32_t time_us, const void *readings, size_t len, size_t size);
+    template <typename T, typename B>
+    void stream_block(uint8_t channel, const B &block, size_t from);
+    void service_io(void);
+    void snapshot_stats(int64_t now);
+    bool baro_due(int index, int64_t now);
+    void set_slot(sample_rate rate);
+    void set_rates(sample_rate rate);
+    bool resume_checkpoint(void);
+    void save_checkpoint(void);
+    // esp_timer time, carried on across warm boots. Timestamps everything
+    // in the log.
+    int64_t log_time(void) const { return esp_timer_get_time() + time_offset_us; }
+    static bool pipeline_sink(void *ctx, log_record_type type, uint32_t time_us,
+                              const void *data, size_t len);
 
     // Startup checks
     bool check_uart(void);
     bool check_power(void);
     bool check_payload(void);
 
-    // Interrupt handler for I2C devices
+    // Sample clock callback: wakes acquisition for the next slot.
     static void interrupt_handler(void *param);
-    static std::binary_semaphore data_ready;
+    // The task sensor_update runs on, which the sample clock notifies.
+    // Ticks that land while a slot is still running add up in its
+    // notification count rather than being lost.
+    TaskHandle_t acquire_task;
+    esp_timer_handle_t sample_timer;
+    uint32_t slot_us;
+    // When the sample clock first fired after it was last (re)started.
+    int64_t slot_origin_us;
+    int64_t last_slot_us;
+    int64_t slot_late_max_us;
+    int64_t last_stats_us;
+    // Sample pool heap fallbacks already reported.
+    uint32_t pool_fallbacks;
+    int64_t time_offset_us;
+    // When each barometer next has a new measurement. Staggered by half an
+    // interval, so the altitude filter gets corrections evenly spaced.
+    int64_t baro_due_us[PIPELINE_BAROS];
 };
 
 #endif
@@ -9,41 +9,125 @@
 #include <vector>
 #include <stdint.h>
 
+// Raw H3LIS100DLTR sample, signed. 780mg per count.
 typedef struct {
-    uint16_t acc_x;
-    uint16_t acc_y;
-    uint16_t acc_z;
+    int16_t acc_x;
+    int16_t acc_y;
+    int16_t acc_z;
 } accel_reading_t;
 
+// Fields of each reading type, in order, as channels of a SampleBlock
+// (see SampleBlock.hpp).
+enum accel_channel {
+    ACC_X,
+    ACC_Y,
+    ACC_Z,
+    ACC_CHANNELS,
+};
+
+// Raw ICM20948 sample. Signed, and in the same order as the registers
+// so a frame decodes straight into it (see ICM20948Frame.hpp).
 typedef struct {
-    uint16_t acc_x;
-    uint16_t acc_y;
-    uint16_t acc_z;
-    uint16_t gyr_x;
-    uint16_t gyr_y;
-    uint16_t gyr_z;
-    uint16_t mag_x;
-    uint16_t mag_y;
-    uint16_t mag_z;
-    uint16_t temp;
+    int16_t acc_x;
+    int16_t acc_y;
+    int16_t acc_z;
+    int16_t gyr_x;
+    int16_t gyr_y;
+    int16_t gyr_z;
+    int16_t temp;
+    int16_t mag_x;
+    int16_t mag_y;
+    int16_t mag_z;
 } imu_reading_t;
 
+enum imu_channel {
+    IMU_ACC_X,
+    IMU_ACC_Y,
+    IMU_ACC_Z,
+    IMU_GYR_X,
+    IMU_GYR_Y,
+    IMU_GYR_Z,
+    IMU_TEMP,
+    IMU_MAG_X,
+    IMU_MAG_Y,
+    IMU_MAG_Z,
+    IMU_CHANNELS,
+};
+
 typedef uint32_t rtc_reading_t;
 
+// Compensated BME280 sample, in the units of the datasheet's integer
+// formulas. Pressure is 0 if the reading couldn't be compensated.
 typedef struct {
-    uint16_t humidity;
-    uint16_t temp;
-    uint16_t pressure;
+    uint32_t humidity; // %RH, Q22.10
+    int32_t temp;      // 0.01 degC
+    uint32_t pressure; // Pa, Q24.8
 } baro_reading_t;
 
+enum baro_channel {
+    BARO_HUMIDITY,
+    BARO_TEMP,
+    BARO_PRESSURE,
+    BARO_CHANNELS,
+};
+
+// Analog inputs, in the order they appear in analog_reading_t.
+enum analog_channel {
+    AN_TC0,   // resin thermocouple amplifier
+    AN_TC1,   // spare thermocouple amplifier
+    AN_VBAT,  // battery, through a divider
+    AN_RESIN, // resin pressure transducer
+    AN_CHANNELS,
+};
+
+// One decimated, calibrated block. Millivolts at each ADC pin.
+typedef struct {
+    uint16_t mv[AN_CHANNELS];
+} analog_reading_t;
+
 enum status {
     STATUS_OK,
     STATUS_MISBEHAVING,
     STATUS_FAILED,
 };
+// Output data rate a sensor is configured for.
+enum sample_rate {
+    RATE_LOW,
+    RATE_FULL,
+};
+
+// Phases of the flight, in order.
+enum flight_phase {
+    PHASE_PAD,
+    PHASE_BOOST,
+    PHASE_COAST,         // burnout until zero G
+    PHASE_MICROGRAVITY,  // payload printing
+    PHASE_DESCENT,
+    PHASE_LANDED,
+    PHASE_COUNT,
+};
+
+// Index of each device in the fleet. Must match the order of FLEET and
+// fleet_t in System.hpp. Flight log records and live stream channels
+// name their source by this.
+enum device_id {
+    DEV_RTC,
+    DEV_FLASH,
+    DEV_FLASH_BUFFER,
+    DEV_ACC0,
+    DEV_ACC1,
+    DEV_BARO0,
+    DEV_BARO1,
+    DEV_IMU0,
+    DEV_IMU1,
+    DEV_PAYLOAD,
+    DEV_ANALOG,
+};
+
 enum flash_mode {
     FLASH_INTERNAL,
-    FLASH_EXTERNAL
+    FLASH_EXTERNAL,
+    FLASH_TIERED, // external, with write-behind through the buffer chip
 };
 
 enum log_type {
@@ -10,8 +10,8 @@
 // if you get compile errors on these check your esp-idf install.
 // Your IDE will almost definitely be confused by these, but don't worry.
 // #include "sdkconfig.h"
-// #include "freertos/FreeRTOS.h"
-// #include "freertos/task.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 // #include "esp_chip_info.h"
 // #include "esp_flash.h"
 
@@ -25,14 +25,17 @@ System dm;
 // idf entrypoint
 extern "C" void app_main()
 {
-    printf("Initialising Bluesat Rocket Telemetry system...\n");
+    console_printf("Initialising Bluesat Rocket Telemetry system...\n");
     obc_main();
 }
 
 // Main function
 void obc_main(void) {
+    // Now that the scheduler is running. Reads the mode jumpers.
+    dm.core_init();
+
     // Switch to appropriate mode
-    printf("WE ARE IN OBC MAIN\n ");
+    console_printf("WE ARE IN OBC MAIN\n ");
     bool mission_mode = false;
     switch (dm.mode) {
         case MODE_NORMAL:
@@ -69,10 +72,10 @@ void obc_main(void) {
  *             all logging output will be outputted on serial.
 */
 void mission(bool test) {
-    
-    
+    // Blocks on the sample clock between slots, so the idle task can
+    // scale the clock down or light sleep.
     for (;;) {
-        // Placeholder
+        dm.sensor_update();
     }
 }
 
@@ -83,51 +86,26 @@ void mission(bool test) {
  * accessing the data stored on the flash chip.
 */
 void offload(void) {
-    for (;;) {
-        // Placeholder
-    }
+    // Check the log before anything reads it off.
+    dm.verify_log();
+
+    // Placeholder: nothing else to do yet, so leave the CPU to the idle task.
+    vTaskSuspend(nullptr);
 }
 
 /**
  * Diagnostic loop.
  * 
- * Outputs all sensor output on serial for sanity checking.
+ * Streams raw sensor readings as binary frames on the console UART for
+ * sanity checking. Decode on the host with tools/live.py.
 */
 void diagnostic(void) {
-    for (int j = 0;j < 10;j++) {
-        // Diagnostic mode ignores the flash chip. Just read all sensors and print.
-        printf("WE ARE IN DIAGNOSTIC FOR LOOP\n ");
-        // Accelerometer
-        // std::vector<accel_reading_t> accel_readings = dm.accelread();
-
-        // IMU
-        // std::vector<imu_reading_t> imu_readings = dm.imuread();
-
-        // Barometer
-        std::vector<baro_reading_t> baro_readings = dm.baroread();
-
-        // Grab curr_time
-        time_t curr_time = time(NULL);
-
-        // Print all values in one line
-        // FIXME: Uncomment this below 
-        printf("%" PRIu64 " ", curr_time);
-        // for (int i = 0; i < accel_readings.size(); i++) {
-        //     printf("| acc%d    x=[%8u] y=[%8u] z=[%8u] |\n",i, accel_readings[i].acc_x, accel_readings[i].acc_y, accel_readings[i].acc_z);
-        // }
-        // for (int i = 0; i < imu_readings.size(); i++) {
-        //     printf("| imu%d_ac x=[%8u] y=[%8u] z=[%8u] |\n", i, (unsigned)imu_readings[i].acc_x, (unsigned)imu_readings[i].acc_y, (unsigned)imu_readings[i].acc_z);
-        //     printf("| imu%d_gy x=[%8u] y=[%8u] z=[%8u] |\n", i, (unsigned)imu_readings[i].gyr_x, (unsigned)imu_readings[i].gyr_y, (unsigned)imu_readings[i].gyr_z);
-        //     printf("| imu%d_mg x=[%8u] y=[%8u] z=[%8u] |\n", i, (unsigned)imu_readings[i].mag_x, (unsigned)imu_readings[i].mag_y, (unsigned)imu_readings[i].mag_z);
-        // }
-        
-        //DEBUG STUFF: IZY 
-        dm.baroread();
-        
-        for (int i = 0; i < baro_readings.size(); i++) {
-            printf("| baro%d  h=[%8u] t=[%8u] p=[%8u] ", i, (unsigned)baro_readings[i].temp, (unsigned)baro_readings[i].pressure, (unsigned)baro_readings[i].humidity);
-        }
-        // TODO: add logic from drivers to convert raw bytes to actual readout
+    // Diagnostic mode ignores the flash chip.
+    dm.i2c_init();
+    dm.sensor_init();
+    dm.live_init(LIVE_DEFAULT_MASK);
 
+    for (;;) {
+        dm.sensor_update();
     }
 }
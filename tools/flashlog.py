@@ -0,0 +1,365 @@
+#!/usr/bin/env python3
+"""Flight log image tools (see main/include/LogFormat.hpp).
+
+Works on a raw dump of the primary W25Q128 (16MB, or any whole number of
+256 byte pages).
+
+    tools/flashlog.py verify flash.bin          # check every page and record CRC
+    tools/flashlog.py decode flash.bin out/     # one column file per field
+    tools/flashlog.py decode flash.bin out/ --csv
+
+`verify` exits non-zero if anything is damaged. `decode` splits the image
+into segments of pages and decodes them in parallel, then writes each
+sensor's fields as raw little endian column files, `<sensor>.<field>`
+plus `<sensor>.time_us` (int64), described by out/columns.json. Records
+that fail their CRC are skipped. No dependencies beyond the standard
+library; with numpy, `np.fromfile(path, dtype)` loads a column.
+"""
+
+import argparse
+import csv
+import json
+import mmap
+import multiprocessing
+import os
+import struct
+import sys
+import time
+import zlib
+from array import array
+
+PAGE_SIZE = 256          # LOG_PAGE_SIZE
+PAGE_MAGIC = 0x4C47      # LOG_PAGE_MAGIC
+PAGE_ERASED = 0xFFFF     # LOG_PAGE_ERASED
+PAGE_HEADER = struct.Struct("<HHII")  # magic, used, index, crc
+PAGE_DATA = PAGE_SIZE - PAGE_HEADER.size
+RECORD = struct.Struct("<BBII")       # type, len, time_us, crc
+CRC_AT = 8                            # offsetof(log_page_t, crc)
+RECORD_CRC_AT = 6                     # offsetof(log_record_t, crc)
+
+
+def page_crc(page):
+    return zlib.crc32(page[PAGE_HEADER.size:], zlib.crc32(page[:CRC_AT]))
+
+
+def record_crc(header, payload):
+    return zlib.crc32(payload, zlib.crc32(header[:RECORD_CRC_AT]))
+
+
+def walk_records(data, used, check, result):
+    """Counts the records in one page's data, checking their CRCs if asked."""
+    pos = 0
+    used = min(used, PAGE_DATA)
+    while pos + RECORD.size <= used:
+        _, length, _, crc = RECORD.unpack_from(data, pos)
+        end = pos + RECORD.size + length
+        if end > used:
+            result["records_corrupt"] += 1
+            return
+        if not check or record_crc(data[pos:pos + RECORD.size], data[pos + RECORD.size:end]) == crc:
+            result["records_ok"] += 1
+        else:
+            result["records_corrupt"] += 1
+        pos = end
+
+
+def verify(image):
+    """Checks every page of `image` (bytes-like), as log_verify_pages does."""
+    result = dict(pages_ok=0, pages_erased=0, pages_corrupt=0,
+                  records_ok=0, records_corrupt=0, end=0)
+    view = memoryview(image)
+    for index in range(len(image) // PAGE_SIZE):
+        page = view[index * PAGE_SIZE:(index + 1) * PAGE_SIZE]
+        magic, used, page_index, crc = PAGE_HEADER.unpack_from(page)
+        if magic == PAGE_ERASED:
+            result["pages_erased"] += 1
+            continue
+        result["end"] = index + 1
+        good = (magic == PAGE_MAGIC and page_index == index and used <= PAGE_DATA
+                and page_crc(page) == crc)
+        result["pages_ok" if good else "pages_corrupt"] += 1
+        if magic == PAGE_MAGIC:
+            walk_records(page[PAGE_HEADER.size:], used, not good, result)
+    return result
+
+
+# ### Decoding ###
+
+# FLEET order in main/include/System.hpp.
+DEVICES = ("rtc", "flash", "flashbuf", "acc0", "acc1", "baro0", "baro1",
+           "imu0", "imu1", "payload", "analog")
+
+ACCEL = ("acc_x", "acc_y", "acc_z")
+IMU = ("acc_x", "acc_y", "acc_z", "gyr_x", "gyr_y", "gyr_z", "temp", "mag_x", "mag_y", "mag_z")
+BARO = ("humidity", "temp", "pressure")  # %RH Q22.10, 0.01 degC, Pa Q24.8
+ANALOG = ("tc0_mv", "tc1_mv", "vbat_mv", "resin_mv")
+ATTITUDE = ("q_w", "q_x", "q_y", "q_z", "cycles")  # Q14, then CPU cycles per update
+ALTITUDE = ("altitude_mm", "velocity_mm_s", "bias_mm_s2", "cycles")
+CHECKPOINT = ("saves", "cycles_avg", "cycles_max")  # CPU cycles per save
+STAGES = ("blocks", "blocks_dropped", "readings_dropped", "records_dropped", "queue_max",
+          "acquire_permille", "encode_permille", "flash_permille", "slots_missed")
+HEAP = ("free", "min_free", "largest_block", "frag_permille", "allocs", "frees",
+        "samples_in_use", "samples_high_water", "samples_failures", "samples_fallbacks",
+        "coro_in_use", "coro_high_water", "coro_failures")
+POWER = ("slots", "period_us", "duty_permille", "sleep", "wake_avg_us", "wake_max_us")
+STATS = ("transactions", "bytes", "err_timeout", "err_nack", "err_bad_data", "err_other",
+         "retries", "lat_min_us", "lat_avg_us", "lat_max_us", "samples", "dropped",
+         "last_good_ms")
+
+# log_record_type: (name, sourced, array typecode, fields)
+#   name     - sensor name, or None to take it from the source byte
+#   sourced  - payload starts with the device's index in FLEET
+# Sourced sensor records are blocks of decimated readings; the others
+# hold a single reading.
+RECORDS = {
+    0: (None, True, "h", ACCEL),        # REC_ACCEL
+    1: (None, True, "h", IMU),          # REC_IMU
+    2: (None, True, "i", BARO),         # REC_BARO
+    3: ("rtc", False, "I", ("time",)),  # REC_RTC
+    5: ("analog", False, "H", ANALOG),  # REC_ANALOG
+    6: ("phase", False, "B", ("phase",)),  # REC_PHASE
+    7: ("stats", True, "I", STATS),     # REC_STATS
+    8: ("attitude", True, "h", ATTITUDE),  # REC_ATTITUDE
+    9: ("altitude", True, "i", ALTITUDE),  # REC_ALTITUDE
+    10: ("power", False, "I", POWER),   # REC_POWER
+    11: ("checkpoint", False, "I", CHECKPOINT),  # REC_CHECKPOINT
+    12: ("stages", False, "I", STAGES),  # REC_STAGES
+    13: ("heap", False, "I", HEAP),     # REC_HEAP
+}
+REC_MESSAGE = 4
+BLOCK_TYPES = (0, 1, 2)
+
+
+def decode_segment(job):
+    """Decodes pages [first, first + count) of the image at `path`.
+
+    Returns ({sensor: (record times, readings per record, payload bytes)},
+    [(time, message)], counters). Sensor payloads are left packed; the
+    caller turns them into columns.
+    """
+    path, first, count = job
+    image = open_image(path)
+    view = memoryview(image)
+    streams = {}
+    messages = []
+    counters = dict(records=0, skipped=0, pages=0, first=None)
+    unpack_page = PAGE_HEADER.unpack_from
+    unpack_record = RECORD.unpack_from
+
+    for index in range(first, first + count):
+        page = view[index * PAGE_SIZE:(index + 1) * PAGE_SIZE]
+        magic, used, page_index, crc = unpack_page(page)
+        if magic != PAGE_MAGIC:
+            continue
+        counters["pages"] += 1
+        used = min(used, PAGE_DATA)
+        trusted = page_index == index and page_crc(page) == crc
+        data = page[PAGE_HEADER.size:]
+        pos = 0
+        while pos + RECORD.size <= used:
+            rtype, length, time_us, rcrc = unpack_record(data, pos)
+            start = pos + RECORD.size
+            end = start + length
+            if end > used:
+                counters["skipped"] += 1
+                break
+            pos = end
+            if not trusted and record_crc(data[start - RECORD.size:start], data[start:end]) != rcrc:
+                counters["skipped"] += 1
+                continue
+            counters["records"] += 1
+            if counters["first"] is None:
+                counters["first"] = time_us
+
+            if rtype == REC_MESSAGE:
+                messages.append((time_us, bytes(data[start:end]).decode("utf-8", "replace")))
+                continue
+            spec = RECORDS.get(rtype)
+            if spec is None:
+                continue
+            name, sourced, code, fields = spec
+            if sourced:
+                source = data[start]
+                dev = DEVICES[source] if source < len(DEVICES) else "dev%d" % source
+                name = dev if name is None else "%s_%s" % (name, dev)
+                start += 1
+            size = array(code).itemsize * len(fields)
+            n = (end - start) // size
+            stream = streams.get(name)
+            if stream is None:
+                stream = streams[name] = (array("I"), array("H"), bytearray(), rtype)
+            stream[0].append(time_us)
+            stream[1].append(n)
+            stream[2].extend(data[start:start + n * size])
+    return streams, messages, counters
+
+
+def unwrap(times, first):
+    """Widens 32 bit microsecond stamps to int64, assuming they're in order
+    and the log started at `first`."""
+    out = array("q")
+    base = 0
+    last = first
+    for t in times:
+        if t < last and last - t > 1 << 31:
+            base += 1 << 32
+        last = t
+        out.append(t + base)
+    return out
+
+
+def reading_times(stamps, counts):
+    """Per-reading times for blocks of decimated readings.
+
+    A record is stamped when its block completes, so its readings are
+    spread evenly back to the previous block of the same sensor. Gaps
+    (a quarantined sensor, a phase change) are bridged with the previous
+    spacing instead.
+    """
+    out = array("q")
+    step = 0
+    for k, (t, n) in enumerate(zip(stamps, counts)):
+        if n == 0:
+            continue
+        if k > 0:
+            gap = (t - stamps[k - 1]) // n
+            step = gap if step == 0 or gap <= 4 * step else step
+        elif len(stamps) > 1 and counts[1]:
+            step = max(0, (stamps[1] - t) // counts[1])
+        if step > 0:
+            out.extend(range(t - step * (n - 1), t + 1, step))
+        else:
+            out.extend([t] * n)
+    return out
+
+
+def columns(first, stamps, counts, payload, rtype):
+    name, _, code, fields = RECORDS[rtype]
+    values = array(code)
+    values.frombytes(bytes(payload))
+    stamps = unwrap(stamps, first)
+    if rtype in BLOCK_TYPES:
+        times = reading_times(stamps, counts)
+    else:
+        times = stamps
+    cols = {"time_us": times}
+    for i, field in enumerate(fields):
+        cols[field] = values[i::len(fields)]
+    return cols
+
+
+def decode(path, jobs):
+    pages = os.path.getsize(path) // PAGE_SIZE
+    jobs = max(1, jobs)
+    per = -(-pages // jobs)
+    segments = [(path, first, min(per, pages - first)) for first in range(0, pages, per)]
+    if jobs == 1:
+        results = [decode_segment(seg) for seg in segments]
+    else:
+        with multiprocessing.Pool(jobs) as pool:
+            results = pool.map(decode_segment, segments)
+
+    merged = {}
+    messages = []
+    counters = dict(records=0, skipped=0, pages=0)
+    first = None
+    for streams, msgs, seg_counters in results:
+        for name, (stamps, counts, payload, rtype) in streams.items():
+            if name not in merged:
+                merged[name] = (array("I"), array("H"), bytearray(), rtype)
+            m = merged[name]
+            m[0].extend(stamps)
+            m[1].extend(counts)
+            m[2].extend(payload)
+        messages.extend(msgs)
+        for key in ("records", "skipped", "pages"):
+            counters[key] += seg_counters[key]
+        if first is None:
+            first = seg_counters["first"]
+    sensors = {name: columns(first, *stream) for name, stream in merged.items()}
+    stamps = unwrap(array("I", (t for t, _ in messages)), first)
+    messages = [(t, text) for t, (_, text) in zip(stamps, messages)]
+    return sensors, messages, counters
+
+
+def write_columns(out_dir, sensors, messages, with_csv):
+    os.makedirs(out_dir, exist_ok=True)
+    manifest = {}
+    for name, cols in sorted(sensors.items()):
+        manifest[name] = {"rows": len(cols["time_us"]), "columns": {}}
+        for field, values in cols.items():
+            if sys.byteorder != "little":
+                values = array(values.typecode, values)
+                values.byteswap()
+            with open(os.path.join(out_dir, "%s.%s" % (name, field)), "wb") as f:
+                values.tofile(f)
+            manifest[name]["columns"][field] = "<" + {"h": "i2", "H": "u2", "i": "i4",
+                                                      "I": "u4", "B": "u1", "q": "i8"}[values.typecode]
+        if with_csv:
+            with open(os.path.join(out_dir, name + ".csv"), "w", newline="") as f:
+                writer = csv.writer(f)
+                writer.writerow(cols.keys())
+                writer.writerows(zip(*cols.values()))
+    with open(os.path.join(out_dir, "columns.json"), "w") as f:
+        json.dump(manifest, f, indent=1)
+    if messages:
+        with open(os.path.join(out_dir, "messages.txt"), "w") as f:
+            for t, text in messages:
+                f.write("%d %s\n" % (t, text.rstrip("\n")))
+
+
+def cmd_decode(args):
+    size = os.path.getsize(args.image)
+    start = time.perf_counter()
+    sensors, messages, counters = decode(args.image, args.jobs)
+    decoded = time.perf_counter()
+    write_columns(args.out, sensors, messages, args.csv)
+    done = time.perf_counter()
+
+    readings = sum(len(cols["time_us"]) for cols in sensors.values())
+    print("%d pages, %d records (%d skipped), %d readings from %d sensors" %
+          (counters["pages"], counters["records"], counters["skipped"], readings, len(sensors)))
+    print("decode %.2fs (%.0f MB/s, %d jobs), write %.2fs" %
+          (decoded - start, size / (decoded - start) / 1e6, args.jobs, done - decoded),
+          file=sys.stderr)
+    return 0
+
+
+def open_image(path):
+    f = open(path, "rb")
+    return mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+
+
+def cmd_verify(args):
+    image = open_image(args.image)
+    start = time.perf_counter()
+    result = verify(image)
+    took = time.perf_counter() - start
+    # Erased pages past the end are just unused flash.
+    holes = result["pages_erased"] - (len(image) // PAGE_SIZE - result["end"])
+    print("%d pages: %d ok, %d corrupt, %d holes" %
+          (result["end"], result["pages_ok"], result["pages_corrupt"], holes))
+    print("records: %d ok, %d corrupt" % (result["records_ok"], result["records_corrupt"]))
+    print("%.2fs, %.0f MB/s" % (took, len(image) / took / 1e6), file=sys.stderr)
+    return 1 if result["pages_corrupt"] or result["records_corrupt"] else 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    sub = parser.add_subparsers(dest="command", required=True)
+    p = sub.add_parser("verify", help="check page and record CRCs")
+    p.add_argument("image", help="raw dump of the primary flash")
+    p.set_defaults(func=cmd_verify)
+    p = sub.add_parser("decode", help="decode to column files")
+    p.add_argument("image", help="raw dump of the primary flash")
+    p.add_argument("out", help="output directory")
+    p.add_argument("--csv", action="store_true", help="also write a CSV per sensor")
+    p.add_argument("--jobs", type=int, default=os.cpu_count() or 1,
+                   help="worker processes (default: one per core)")
+    p.set_defaults(func=cmd_decode)
+    args = parser.parse_args()
+    sys.exit(args.func(args))
+
+
+if __name__ == "__main__":
+    main()
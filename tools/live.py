@@ -0,0 +1,179 @@
+#!/usr/bin/env python3
+"""Decoder for the diagnostic mode live stream (see main/include/LiveStream.hpp).
+
+Reads frames from the OBC's console UART (or a capture file), checks them,
+and either prints a running summary of every channel or dumps the readings
+to CSV.
+
+    tools/live.py /dev/ttyUSB0                      # summary once a second
+    tools/live.py /dev/ttyUSB0 --csv imu.csv        # every reading
+    tools/live.py /dev/ttyUSB0 --mask imu0,imu1     # only stream the IMUs
+    tools/live.py capture.bin --csv out.csv         # decode a capture
+
+Needs pyserial for live ports.
+"""
+
+import argparse
+import csv
+import struct
+import sys
+import time
+import zlib
+
+BAUD = 2000000  # LIVE_BAUD
+SYNC = b"\xa5\x5a"  # LIVE_SYNC, little endian
+HEADER = struct.Struct("<HBBI")  # sync, channel, len, time_us
+CRC = struct.Struct("<I")
+CMD_MASK = b"M"  # LIVE_CMD_MASK
+
+# Channel numbers are device_id in types.hpp - keep these in step.
+# name: (device_id, reading format, field names)
+CHANNELS = {
+    "acc0": (3, "<3h", ("acc_x", "acc_y", "acc_z")),
+    "acc1": (4, "<3h", ("acc_x", "acc_y", "acc_z")),
+    "baro0": (5, "<IiI", ("humidity", "temp", "pressure")),
+    "baro1": (6, "<IiI", ("humidity", "temp", "pressure")),
+    "imu0": (7, "<10h", ("acc_x", "acc_y", "acc_z", "gyr_x", "gyr_y", "gyr_z",
+                         "temp", "mag_x", "mag_y", "mag_z")),
+    "imu1": (8, "<10h", ("acc_x", "acc_y", "acc_z", "gyr_x", "gyr_y", "gyr_z",
+                         "temp", "mag_x", "mag_y", "mag_z")),
+    "analog": (10, "<4H", ("tc0_mv", "tc1_mv", "vbat_mv", "resin_mv")),
+    # LIVE_CHANNEL_STATS: device index, then its device_stats_t
+    "stats": (31, "<B13I", ("device", "transactions", "bytes", "err_timeout", "err_nack",
+                            "err_bad_data", "err_other", "retries", "lat_min_us",
+                            "lat_avg_us", "lat_max_us", "samples", "dropped",
+                            "last_good_ms")),
+}
+# FLEET order in System.hpp, for naming stats frames.
+DEVICES = ("rtc", "flash", "flashbuf", "acc0", "acc1", "baro0", "baro1",
+           "imu0", "imu1", "payload", "analog")
+BY_ID = {dev: (name, struct.Struct(fmt), fields)
+         for name, (dev, fmt, fields) in CHANNELS.items()}
+
+
+def frames(read):
+    """Yields (channel, time_us, payload, stats) for every valid frame.
+
+    `read` returns the next bytes, b"" if none are ready yet, or None at
+    the end of the stream. Resyncs on the sync word after garbage (console
+    text, dropped bytes) and skips frames that fail their CRC, counting
+    them in stats["crc_errors"].
+    """
+    buf = bytearray()
+    stats = {"crc_errors": 0}
+    while True:
+        chunk = read()
+        if chunk is None:
+            return
+        buf += chunk
+        while True:
+            start = buf.find(SYNC)
+            if start < 0:
+                del buf[:-1]
+                break
+            del buf[:start]
+            if len(buf) < HEADER.size:
+                break
+            _, channel, length, time_us = HEADER.unpack_from(buf)
+            end = HEADER.size + length
+            if len(buf) < end + CRC.size:
+                break
+            (crc,) = CRC.unpack_from(buf, end)
+            if zlib.crc32(bytes(buf[:end])) != crc:
+                stats["crc_errors"] += 1
+                del buf[:1]
+                continue
+            yield channel, time_us, bytes(buf[HEADER.size:end]), stats
+            del buf[:end + CRC.size]
+
+
+def readings(payload, fmt):
+    usable = len(payload) - len(payload) % fmt.size
+    return [fmt.unpack_from(payload, off) for off in range(0, usable, fmt.size)]
+
+
+def open_source(path, mask):
+    if path == "-":
+        return None, lambda: sys.stdin.buffer.read1(4096) or None
+    try:
+        import serial
+    except ImportError:
+        serial = None
+    if serial is not None and not path.endswith(".bin"):
+        port = serial.Serial(path, BAUD, timeout=0.1)
+        if mask is not None:
+            port.write(CMD_MASK + struct.pack("<I", mask))
+        # An empty read is just a timeout; the port never ends.
+        return port, lambda: port.read(4096)
+    f = open(path, "rb")
+    return f, lambda: f.read(65536) or None
+
+
+def parse_mask(names):
+    mask = 0
+    for name in names.split(","):
+        if name not in CHANNELS:
+            raise argparse.ArgumentTypeError(
+                "unknown channel %r (have %s)" % (name, ", ".join(CHANNELS)))
+        mask |= 1 << CHANNELS[name][0]
+    return mask
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("source", help="serial port, capture file, or - for stdin")
+    parser.add_argument("--mask", type=parse_mask,
+                        help="comma separated channels to stream (%s)" % ",".join(CHANNELS))
+    parser.add_argument("--csv", help="write every reading to this file")
+    args = parser.parse_args()
+
+    _, read = open_source(args.source, args.mask)
+
+    writer = None
+    if args.csv:
+        out = open(args.csv, "w", newline="")
+        writer = csv.writer(out)
+        writer.writerow(["time_us", "channel", "index"] + ["v%d" % i for i in range(14)])
+
+    counts = {}
+    latest = {}
+    last_print = time.monotonic()
+    stats = {"crc_errors": 0}
+    try:
+        for channel, time_us, payload, stats in frames(read):
+            if channel not in BY_ID:
+                continue
+            name, fmt, fields = BY_ID[channel]
+            rows = readings(payload, fmt)
+            if name == "stats" and rows:
+                dev = rows[0][0]
+                name = "stats:" + (DEVICES[dev] if dev < len(DEVICES) else str(dev))
+            counts[name] = counts.get(name, 0) + len(rows)
+            if rows:
+                latest[name] = dict(zip(fields, rows[-1]))
+            if writer:
+                for i, row in enumerate(rows):
+                    writer.writerow([time_us, name, i] + list(row))
+
+            now = time.monotonic()
+            if not writer and now - last_print >= 1.0:
+                elapsed = now - last_print
+                for key in sorted(latest):
+                    rate = counts.get(key, 0) / elapsed
+                    values = " ".join("%s=%d" % kv for kv in latest[key].items())
+                    if key.startswith("stats:"):
+                        print("%-14s %s" % (key, values))
+                    else:
+                        print("%-6s %7.1f/s  %s" % (key, rate, values))
+                print("crc errors: %d\n" % stats["crc_errors"])
+                counts.clear()
+                last_print = now
+    except KeyboardInterrupt:
+        pass
+    if writer:
+        out.close()
+    print("crc errors: %d" % stats["crc_errors"], file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()